@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <numbers>
+#include <vector>
+
+// 库内部的 DSP 链（前级增益、参数均衡器、前瞻限幅器）
+#include "dsp_chain.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DSP_TEST_SSE2 1
+#endif
+
+// spdlog 用于日志记录
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/spdlog.h"
+
+namespace {
+
+    using namespace MusicEngine;
+
+    constexpr int SAMPLE_RATE = 48000;
+    // 与音频回调的块大小相当
+    constexpr size_t BLOCK_FRAMES = 512;
+
+    // 各声道相同的正弦波，交错存放
+    std::vector<float> sine(double frequency, float amplitude, size_t frames, uint32_t channels) {
+        std::vector<float> samples(frames * channels);
+        for (size_t f = 0; f < frames; ++f) {
+            const auto value = static_cast<float>(
+                    amplitude * std::sin(2.0 * std::numbers::pi * frequency * static_cast<double>(f) / SAMPLE_RATE));
+            std::fill_n(samples.begin() + static_cast<std::ptrdiff_t>(f * channels), channels, value);
+        }
+        return samples;
+    }
+
+    // 按回调大小分块处理整段信号
+    std::vector<float> run(const DspChain::Params &params, std::vector<float> samples, uint32_t channels) {
+        DspChain chain;
+        chain.publish(params);
+        chain.prepare(SAMPLE_RATE, channels);
+        const size_t frames = samples.size() / channels;
+        for (size_t offset = 0; offset < frames; offset += BLOCK_FRAMES) {
+            chain.process(samples.data() + offset * channels, std::min(BLOCK_FRAMES, frames - offset));
+        }
+        return samples;
+    }
+
+    // 第一声道在 [first, frames) 区间内的电平（dB），相对满幅正弦
+    double level_db(const std::vector<float> &samples, uint32_t channels, size_t first) {
+        double sum = 0.0;
+        const size_t frames = samples.size() / channels;
+        for (size_t f = first; f < frames; ++f) {
+            sum += static_cast<double>(samples[f * channels]) * samples[f * channels];
+        }
+        const double rms = std::sqrt(sum / static_cast<double>(frames - first));
+        return 20.0 * std::log10(rms * std::numbers::sqrt2);
+    }
+
+    float peak(const std::vector<float> &samples, size_t first_sample) {
+        float result = 0.0f;
+        for (size_t i = first_sample; i < samples.size(); ++i) {
+            result = std::max(result, std::fabs(samples[i]));
+        }
+        return result;
+    }
+
+    DspChain::Params eq_params(EqFilterType type, double frequency, double gain_db, double q) {
+        DspChain::Params params;
+        params.enabled = true;
+        params.bands[0] = {type, frequency, gain_db, q};
+        params.band_count = 1;
+        return params;
+    }
+
+    class Checker {
+    public:
+        explicit Checker(std::shared_ptr<spdlog::logger> logger) : logger_(std::move(logger)) {}
+
+        void expect(bool ok, const char *what, double value) {
+            ++checks_;
+            if (ok) {
+                logger_->info("{}: {:.4f}", what, value);
+            } else {
+                logger_->error("{}: {:.4f}", what, value);
+                ++failures_;
+            }
+        }
+
+        int checks() const { return checks_; }
+        int failures() const { return failures_; }
+
+    private:
+        std::shared_ptr<spdlog::logger> logger_;
+        int checks_ = 0;
+        int failures_ = 0;
+    };
+
+} // namespace
+
+// 不需要音频文件和声卡：用合成的正弦波检查均衡器的频率响应、限幅器的输出上限与延迟，
+// 以及 process() 返回后调用方的浮点控制寄存器保持不变。作为 CTest 测试运行，发现问题时返回 1
+int main() {
+    spdlog::set_pattern("[%n] [%^%l%$] %v");
+    auto logger = spdlog::stdout_color_mt("DspTest");
+    logger->set_level(spdlog::level::info);
+
+    logger->info("--- MusicEngine DSP Chain Test Starting ---");
+    Checker check(logger);
+    const size_t frames = SAMPLE_RATE; // 1 秒
+    const size_t settled = SAMPLE_RATE / 2; // 只测量滤波器和平滑稳定之后的后半段
+
+    // --- 步骤 1: 峰值均衡，中心频率处 +6 dB，远离中心处基本不变 ---
+    {
+        const auto params = eq_params(EqFilterType::Peaking, 1000.0, 6.0, 1.0);
+        const double at_center = level_db(run(params, sine(1000.0, 0.25f, frames, 2), 2), 2, settled) -
+                                 level_db(sine(1000.0, 0.25f, frames, 2), 2, settled);
+        check.expect(std::fabs(at_center - 6.0) < 0.1, "Peaking +6 dB at 1 kHz, gain at 1 kHz (dB)", at_center);
+        const double far = level_db(run(params, sine(100.0, 0.25f, frames, 2), 2), 2, settled) -
+                           level_db(sine(100.0, 0.25f, frames, 2), 2, settled);
+        check.expect(std::fabs(far) < 0.3, "Peaking +6 dB at 1 kHz, gain at 100 Hz (dB)", far);
+    }
+
+    // --- 步骤 2: 低通与高通 ---
+    {
+        const double stop = level_db(run(eq_params(EqFilterType::LowPass, 1000.0, 0.0, 0.7071),
+                                         sine(10000.0, 0.5f, frames, 2), 2), 2, settled) -
+                            level_db(sine(10000.0, 0.5f, frames, 2), 2, settled);
+        check.expect(stop < -30.0, "Low-pass at 1 kHz, gain at 10 kHz (dB)", stop);
+        const double pass = level_db(run(eq_params(EqFilterType::HighPass, 1000.0, 0.0, 0.7071),
+                                         sine(10000.0, 0.5f, frames, 2), 2), 2, settled) -
+                            level_db(sine(10000.0, 0.5f, frames, 2), 2, settled);
+        check.expect(std::fabs(pass) < 0.2, "High-pass at 1 kHz, gain at 10 kHz (dB)", pass);
+    }
+
+    // --- 步骤 3: 向量路径（1/2/4 声道）与标量路径（其他声道数）结果一致 ---
+    {
+        DspChain::Params params = eq_params(EqFilterType::LowShelf, 120.0, 5.0, 0.8);
+        params.bands[1] = {EqFilterType::Peaking, 2500.0, -4.0, 1.4};
+        params.bands[2] = {EqFilterType::HighShelf, 8000.0, 3.0, 0.7};
+        params.band_count = 3;
+        const auto input = sine(440.0, 0.5f, frames, 1);
+        const auto vector_out = run(params, input, 1);
+        std::vector<float> wide(frames * 3);
+        for (size_t f = 0; f < frames; ++f) {
+            std::fill_n(wide.begin() + static_cast<std::ptrdiff_t>(f * 3), 3, input[f]);
+        }
+        const auto scalar_out = run(params, wide, 3);
+        double worst = 0.0;
+        for (size_t f = 0; f < frames; ++f) {
+            worst = std::max(worst, static_cast<double>(std::fabs(vector_out[f] - scalar_out[f * 3 + 2])));
+        }
+        check.expect(worst < 1e-5, "EQ vector vs scalar path, largest difference", worst);
+    }
+
+    // --- 步骤 4: 限幅器，输出不超过阈值；低于阈值的信号只延迟不改变 ---
+    {
+        DspChain::Params params;
+        params.enabled = true;
+        params.limiter_enabled = true;
+        params.limiter_threshold_db = -6.0f;
+        const float threshold = std::pow(10.0f, -6.0f / 20.0f);
+
+        const auto loud = run(params, sine(997.0, 1.0f, frames, 2), 2);
+        const float loud_peak = peak(loud, 0);
+        check.expect(loud_peak <= threshold * 1.001f, "Limiter at -6 dB, output peak of a 0 dBFS sine", loud_peak);
+        const double loud_level = level_db(loud, 2, settled);
+        check.expect(loud_level > -6.5, "Limiter at -6 dB, output level of a 0 dBFS sine (dB)", loud_level);
+
+        const auto quiet_in = sine(997.0, 0.25f, frames, 2);
+        const auto quiet = run(params, quiet_in, 2);
+        const size_t delay = static_cast<size_t>(SAMPLE_RATE) * DspChain::LIMITER_LOOKAHEAD_MS / 1000;
+        double worst = 0.0;
+        for (size_t i = delay * 2; i < quiet.size(); ++i) {
+            worst = std::max(worst, static_cast<double>(std::fabs(quiet[i] - quiet_in[i - delay * 2])));
+        }
+        check.expect(worst < 1e-6, "Limiter below threshold, largest difference to the delayed input", worst);
+    }
+
+#if defined(DSP_TEST_SSE2)
+    // --- 步骤 5: process() 只在自身执行期间开启 FTZ/DAZ ---
+    {
+        const unsigned int before = _mm_getcsr() & ~0x8040u;
+        _mm_setcsr(before);
+        run(eq_params(EqFilterType::Peaking, 1000.0, 6.0, 1.0), sine(1000.0, 0.25f, BLOCK_FRAMES * 4, 2), 2);
+        const unsigned int after = _mm_getcsr();
+        check.expect(after == before, "MXCSR after process(), changed bits", static_cast<double>(after ^ before));
+    }
+#endif
+
+    // --- 步骤 6: 报告 ---
+    if (check.failures() > 0) {
+        logger->error("{} of {} DSP checks failed.", check.failures(), check.checks());
+        return 1;
+    }
+    logger->info("All {} DSP checks passed.", check.checks());
+    logger->info("--- MusicEngine DSP Chain Test Finished ---");
+    return 0;
+}
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+// 库内部的向量化内核（SSE2/NEON），与下面的标量参考实现逐样本比较
+#include "convert_kernels.hpp"
+#include "mix_kernels.hpp"
+
+// spdlog 用于日志记录
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/spdlog.h"
+
+namespace {
+
+    using namespace MusicEngine;
+
+    // -3 dB，单声道上混与 5.1 下混使用的电平
+    constexpr float LEVEL_3DB = 0.70710678f;
+
+    std::mt19937 rng(20240611);
+
+    std::vector<float> random_samples(size_t count) {
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        std::vector<float> samples(count);
+        for (auto &s : samples) {
+            s = dist(rng);
+        }
+        return samples;
+    }
+
+    // 整数格式覆盖完整取值范围
+    template<typename T>
+    std::vector<T> random_input(size_t count) {
+        if constexpr (std::is_same_v<T, float>) {
+            return random_samples(count);
+        } else {
+            std::uniform_int_distribution<int64_t> dist(std::numeric_limits<T>::min(), std::numeric_limits<T>::max());
+            std::vector<T> samples(count);
+            for (auto &s : samples) {
+                s = static_cast<T>(dist(rng));
+            }
+            return samples;
+        }
+    }
+
+    template<typename T>
+    float to_float(T sample) {
+        if constexpr (std::is_same_v<T, int16_t>) {
+            return static_cast<float>(sample) / 32768.0f;
+        } else if constexpr (std::is_same_v<T, int32_t>) {
+            return static_cast<float>(static_cast<double>(sample) / 2147483648.0);
+        } else {
+            return sample;
+        }
+    }
+
+    float gain_at(mix::GainRamp ramp, size_t frame) { return ramp.start + static_cast<float>(frame) * ramp.step; }
+
+    class Checker {
+    public:
+        explicit Checker(std::shared_ptr<spdlog::logger> logger) : logger_(std::move(logger)) {}
+
+        // 比较一段输出与参考值，记录第一个超出容差的样本
+        void expect_near(const char *what, const std::vector<float> &actual, const std::vector<float> &expected,
+                         size_t frames, uint32_t channels, float tolerance) {
+            ++checks_;
+            for (size_t i = 0; i < expected.size(); ++i) {
+                if (!(std::fabs(actual[i] - expected[i]) <= tolerance)) {
+                    logger_->error("{}: {} frames x {} ch, sample {} is {:.7f}, expected {:.7f}", what, frames,
+                                   channels, i, actual[i], expected[i]);
+                    ++failures_;
+                    return;
+                }
+            }
+        }
+
+        void expect(const char *what, bool ok) {
+            ++checks_;
+            if (!ok) {
+                logger_->error("{}", what);
+                ++failures_;
+            }
+        }
+
+        int checks() const { return checks_; }
+        int failures() const { return failures_; }
+
+    private:
+        std::shared_ptr<spdlog::logger> logger_;
+        int checks_ = 0;
+        int failures_ = 0;
+    };
+
+    // 帧数覆盖空输入、不足一个向量、向量尾部，以及增益需要累加很多步的长块
+    const size_t FRAME_COUNTS[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 64, 1023, 4096};
+
+    // 长块中向量路径逐步累加增益，与标量的 start + n * step 有舍入误差
+    constexpr float RAMP_TOLERANCE = 1e-4f;
+
+    void test_mix_kernels(Checker &check) {
+        const mix::GainRamp fade_out{1.0f, -1.0f / 4096.0f};
+        const mix::GainRamp fade_in{0.0f, 1.0f / 4096.0f};
+
+        for (uint32_t channels = 1; channels <= 6; ++channels) {
+            for (size_t frames : FRAME_COUNTS) {
+                const size_t count = frames * channels;
+                const auto a = random_samples(count);
+                const auto b = random_samples(count);
+
+                std::vector<float> expected(count);
+                for (size_t i = 0; i < count; ++i) {
+                    expected[i] = a[i] * gain_at(fade_out, i / channels) + b[i] * gain_at(fade_in, i / channels);
+                }
+                std::vector<float> out(count);
+                mix::crossfade(out.data(), a.data(), b.data(), frames, channels, fade_out, fade_in);
+                check.expect_near("crossfade", out, expected, frames, channels, RAMP_TOLERANCE);
+
+                // dst 与输入重叠
+                out = a;
+                mix::crossfade(out.data(), out.data(), b.data(), frames, channels, fade_out, fade_in);
+                check.expect_near("crossfade in place", out, expected, frames, channels, RAMP_TOLERANCE);
+
+                for (size_t i = 0; i < count; ++i) {
+                    expected[i] = a[i] * 0.5f;
+                }
+                out = a;
+                mix::apply_gain(out.data(), count, 0.5f);
+                check.expect_near("apply_gain", out, expected, frames, channels, 0.0f);
+
+                for (size_t i = 0; i < count; ++i) {
+                    expected[i] = a[i] * gain_at(fade_in, i / channels);
+                }
+                out = a;
+                mix::apply_gain(out.data(), frames, channels, fade_in);
+                check.expect_near("apply_gain ramp", out, expected, frames, channels, RAMP_TOLERANCE);
+
+                for (size_t i = 0; i < count; ++i) {
+                    expected[i] = b[i] + a[i] * gain_at(fade_out, i / channels);
+                }
+                out = b;
+                mix::mix_into(out.data(), a.data(), frames, channels, fade_out);
+                check.expect_near("mix_into", out, expected, frames, channels, RAMP_TOLERANCE);
+            }
+        }
+
+        for (size_t count : FRAME_COUNTS) {
+            const auto samples = random_samples(count);
+            const mix::PeakStats stats = mix::reduce_peaks(samples.data(), count);
+            float lo = count ? samples[0] : 0.0f, hi = lo;
+            double sum_squares = 0.0;
+            for (float s : samples) {
+                lo = std::min(lo, s);
+                hi = std::max(hi, s);
+                sum_squares += static_cast<double>(s) * s;
+            }
+            check.expect("reduce_peaks: min/max differ from the scalar reference", stats.min == lo && stats.max == hi);
+            check.expect("reduce_peaks: sum of squares differs from the scalar reference",
+                         std::fabs(stats.sum_squares - sum_squares) <= 1e-4 * std::max(1.0, sum_squares));
+        }
+    }
+
+    // 按声道布局生成参考输出：planar 时每个声道一个平面，否则交错存放
+    template<typename T>
+    void test_conversion(Checker &check, const char *name, convert::SampleType type) {
+        using convert::Route;
+        for (size_t frames : FRAME_COUNTS) {
+            for (bool planar : {false, true}) {
+                for (int channels : {1, 2, 6}) {
+                    const std::vector<T> source = random_input<T>(frames * channels);
+                    // 交错样本 (frame, channel) 的值
+                    const auto sample = [&](size_t frame, int channel) {
+                        return to_float(source[frame * channels + channel]);
+                    };
+
+                    // planar 输入按声道拆开
+                    std::vector<std::vector<T>> plane_data(channels, std::vector<T>(frames));
+                    std::vector<const uint8_t *> planes(channels);
+                    for (int ch = 0; ch < channels; ++ch) {
+                        for (size_t f = 0; f < frames; ++f) {
+                            plane_data[ch][f] = source[f * channels + ch];
+                        }
+                        planes[ch] = reinterpret_cast<const uint8_t *>(plane_data[ch].data());
+                    }
+                    const uint8_t *interleaved[1] = {reinterpret_cast<const uint8_t *>(source.data())};
+                    const uint8_t *const *in = planar ? planes.data() : interleaved;
+
+                    const Route route = channels == 6 ? Route::Surround51ToStereo : Route::Copy;
+                    const uint32_t out_channels = channels == 6 ? 2 : static_cast<uint32_t>(channels);
+                    std::vector<float> expected(frames * out_channels);
+                    for (size_t f = 0; f < frames; ++f) {
+                        if (channels == 6) {
+                            const float center = sample(f, 2);
+                            expected[2 * f] = sample(f, 0) + (center + sample(f, 4)) * LEVEL_3DB;
+                            expected[2 * f + 1] = sample(f, 1) + (center + sample(f, 5)) * LEVEL_3DB;
+                        } else {
+                            for (int ch = 0; ch < channels; ++ch) {
+                                expected[f * channels + ch] = sample(f, ch);
+                            }
+                        }
+                    }
+
+                    const convert::Kernel kernel = convert::find_kernel(type, planar, channels, route);
+                    check.expect(name, kernel != nullptr);
+                    if (kernel) {
+                        std::vector<float> out(expected.size());
+                        kernel(out.data(), in, frames);
+                        check.expect_near(name, out, expected, frames, out_channels, 1e-6f);
+                    }
+
+                    // 单声道上混到立体声，两侧均为 -3 dB
+                    if (channels == 1) {
+                        std::vector<float> upmix(frames * 2);
+                        for (size_t f = 0; f < frames; ++f) {
+                            upmix[2 * f] = upmix[2 * f + 1] = sample(f, 0) * LEVEL_3DB;
+                        }
+                        const convert::Kernel mono = convert::find_kernel(type, planar, 1, Route::MonoToStereo);
+                        check.expect(name, mono != nullptr);
+                        if (mono) {
+                            std::vector<float> out(upmix.size());
+                            mono(out.data(), in, frames);
+                            check.expect_near(name, out, upmix, frames, 2, 1e-6f);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+} // namespace
+
+// 不需要音频文件和声卡：用随机数据比较向量化内核与标量参考实现，覆盖各种声道数和向量尾部。
+// 作为 CTest 测试运行，发现差异时返回 1
+int main() {
+    spdlog::set_pattern("[%n] [%^%l%$] %v");
+    auto logger = spdlog::stdout_color_mt("KernelTest");
+    logger->set_level(spdlog::level::info);
+
+    logger->info("--- MusicEngine Kernel Test Starting ({} mix kernels) ---", mix::instruction_set());
+    Checker check(logger);
+
+    // --- 步骤 1: 混音内核 ---
+    test_mix_kernels(check);
+
+    // --- 步骤 2: 采样格式转换内核 ---
+    test_conversion<int16_t>(check, "S16 conversion", convert::SampleType::S16);
+    test_conversion<int32_t>(check, "S32 conversion", convert::SampleType::S32);
+    test_conversion<float>(check, "F32 conversion", convert::SampleType::F32);
+
+    // --- 步骤 3: 报告 ---
+    if (check.failures() > 0) {
+        logger->error("{} of {} kernel checks failed.", check.failures(), check.checks());
+        return 1;
+    }
+    logger->info("All {} kernel checks match the scalar reference.", check.checks());
+    logger->info("--- MusicEngine Kernel Test Finished ---");
+    return 0;
+}
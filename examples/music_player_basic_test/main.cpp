@@ -117,28 +117,28 @@ int main() {
 
     // 测试 Play
     logger->info("[Action] Calling play()...");
-    player.play(music_to_play);
+    player.play(music_to_play).wait(); // play() 只是投递命令，等待曲目真正开始
     print_player_state(player, logger);
     logger->info("Playing for 10 seconds...");
     std::this_thread::sleep_for(std::chrono::seconds(10));
 
     // 测试 Pause
     logger->info("[Action] Calling pause()...");
-    player.pause();
+    player.pause().wait();
     print_player_state(player, logger);
     logger->info("Paused for 3 seconds...");
     std::this_thread::sleep_for(std::chrono::seconds(3));
 
     // 测试 Resume
     logger->info("[Action] Calling resume()...");
-    player.resume();
+    player.resume().wait();
     print_player_state(player, logger);
     logger->info("Resuming playback for 10 seconds...");
     std::this_thread::sleep_for(std::chrono::seconds(10));
 
     // 测试 Stop
     logger->info("[Action] Calling stop()...");
-    player.stop();
+    player.stop().wait();
     print_player_state(player, logger);
     logger->info("--- Playback Sequence Finished ---");
 
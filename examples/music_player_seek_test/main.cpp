@@ -75,12 +75,12 @@ int main() {
 
         // --- [Test 1] 播放与进度 ---
         logger->info("\n--- [Test 1] Playback & Progress Reporting ---");
-        player.play(music_to_play);
+        player.play(music_to_play).wait(); // 等待曲目打开，之后才能读取时长
         monitor_progress(player, logger, 5);
 
         // --- [Test 2] 百分比跳转 ---
         logger->info("\n--- [Test 2] seek_percent() ---");
-        player.seek_percent(50);
+        logger->info("[Result] Seek {}", player.seek_percent(50).get() ? "landed" : "failed");
         monitor_progress(player, logger, 5);
 
         // --- [Test 3] 秒数跳转 ---
@@ -94,13 +94,13 @@ int main() {
         // --- [Test 4] 边界情况 ---
         logger->info("\n--- [Test 4] Edge Cases ---");
         logger->info("[Action] Testing clamping with seek_percent(150)...");
-        if (auto clamped = player.seek_percent(150))
-            logger->info("[Result] Clamped to {}%", *clamped);
+        if (player.seek_percent(150).get())
+            logger->info("[Result] Clamped to 100%");
         std::this_thread::sleep_for(std::chrono::seconds(2));
 
         logger->info("[Action] Testing seek on a stopped player...");
-        player.stop(); // stop() 被调用，player 实例的生命周期即将结束
-        if (!player.seek_percent(30))
+        player.stop().wait(); // stop() 被调用，player 实例的生命周期即将结束
+        if (!player.seek_percent(30).get())
             logger->info("[Result] PASSED: Seek correctly ignored.");
     } // --- 第一个 player 实例在这里被销毁 ---
 
@@ -119,7 +119,7 @@ int main() {
     });
 
     logger->info("[Action] Playing and seeking to 3 seconds before end...");
-    player_for_callback_test.play(music_to_play);
+    player_for_callback_test.play(music_to_play).wait();
     if (player_for_callback_test.get_duration() > 4.0) {
         player_for_callback_test.seek(player_for_callback_test.get_duration() - 3.0);
     }
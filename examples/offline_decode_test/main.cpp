@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+// 核心 MusicEngine 头文件
+#include "decoder.h"
+
+// spdlog 用于日志记录
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/spdlog.h"
+
+// 在没有声卡的机器上（例如 CI）也能运行：不打开任何音频设备，以 CPU 允许的最快速度解码
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[%n] [%^%l%$] %v");
+    auto logger = spdlog::stdout_color_mt("DecodeTest");
+    logger->set_level(spdlog::level::info);
+
+    if (argc < 2) {
+        logger->error("Usage: {} <music file> [sample rate]", argv[0]);
+        return 1;
+    }
+    const std::filesystem::path file_path = argv[1];
+    const int sample_rate = argc > 2 ? std::atoi(argv[2]) : 0;
+
+    logger->info("--- MusicEngine Offline Decode Test Starting ---");
+
+    // --- 步骤 1: 打开文件 ---
+    MusicEngine::Decoder decoder;
+    if (!decoder.open(file_path, {sample_rate, 2})) {
+        logger->error("Failed to open {}", file_path.string());
+        return 1;
+    }
+    const MusicEngine::AudioFormat format = decoder.format();
+    logger->info("Opened {}: {} Hz source, decoding to {} Hz / {} ch, duration {:.2f}s", file_path.string(),
+                 decoder.source_sample_rate(), format.sample_rate, format.channels, decoder.duration());
+
+    // --- 步骤 2: 解码整个文件并统计 ---
+    std::vector<float> buffer(4096 * format.channels);
+    size_t total_frames = 0;
+    float peak = 0.0f;
+    const auto start = std::chrono::steady_clock::now();
+    while (size_t frames = decoder.read(buffer)) {
+        for (size_t i = 0; i < frames * format.channels; ++i) {
+            peak = std::max(peak, std::fabs(buffer[i]));
+        }
+        total_frames += frames;
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double decoded_secs = static_cast<double>(total_frames) / format.sample_rate;
+    logger->info("Decoded {} frames ({:.2f}s) in {:.3f}s: {:.1f}x realtime, peak {:.3f}", total_frames, decoded_secs,
+                 elapsed, elapsed > 0.0 ? decoded_secs / elapsed : 0.0, peak);
+
+    // --- 步骤 3: 精确跳转 ---
+    const double seek_target = decoder.duration() / 2.0;
+    if (!decoder.seek(seek_target) || decoder.read(buffer) == 0) {
+        logger->error("Seek to {:.2f}s failed", seek_target);
+        return 1;
+    }
+    logger->info("Seek to {:.2f}s succeeded", seek_target);
+
+    if (total_frames == 0) {
+        logger->error("No audio was decoded.");
+        return 1;
+    }
+    logger->info("--- Test finished successfully! ---");
+    return 0;
+}
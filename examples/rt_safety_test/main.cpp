@@ -0,0 +1,145 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// 核心 MusicEngine 头文件
+#include "music_player.h"
+#include "rt_safety.h"
+
+// spdlog 用于日志记录
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/spdlog.h"
+
+namespace {
+
+    // 写入一个 16 位立体声 PCM WAV 正弦波文件。采样率选 32 kHz，使任何输出设备下都会经过重采样器
+    bool write_test_tone(const std::filesystem::path &path, int sample_rate, int seconds) {
+        std::ofstream out(path, std::ios::binary);
+        if (!out) {
+            return false;
+        }
+        const auto put = [&out](uint32_t value, int bytes) {
+            for (int i = 0; i < bytes; ++i) {
+                out.put(static_cast<char>((value >> (8 * i)) & 0xff));
+            }
+        };
+        const uint32_t frames = static_cast<uint32_t>(sample_rate * seconds);
+        const uint32_t data_size = frames * 2 * 2;
+        out.write("RIFF", 4);
+        put(36 + data_size, 4);
+        out.write("WAVEfmt ", 8);
+        put(16, 4);
+        put(1, 2); // PCM
+        put(2, 2);
+        put(static_cast<uint32_t>(sample_rate), 4);
+        put(static_cast<uint32_t>(sample_rate) * 4, 4);
+        put(4, 2);
+        put(16, 2);
+        out.write("data", 4);
+        put(data_size, 4);
+        for (uint32_t i = 0; i < frames; ++i) {
+            const double phase = 2.0 * 3.14159265358979323846 * 440.0 * i / sample_rate;
+            const auto sample = static_cast<int16_t>(std::lround(std::sin(phase) * 8000.0));
+            put(static_cast<uint16_t>(sample), 2);
+            put(static_cast<uint16_t>(sample), 2);
+        }
+        return static_cast<bool>(out);
+    }
+
+} // namespace
+
+// 需以 -DMUSICENGINE_RT_CHECKS=ON 构建。播放到空设备（无需声卡），操作播放器的各项功能，
+// 并确认音频回调中没有发生内存分配、加锁或阻塞调用，解码线程的稳态解码步骤（FFmpeg 内部除外）中没有内存分配；
+// 发现违规时返回 1。不指定文件时使用临时生成的测试音，作为 CTest 测试运行
+int main(int argc, char *argv[]) {
+    spdlog::set_pattern("[%n] [%^%l%$] %v");
+    auto logger = spdlog::stdout_color_mt("RtSafetyTest");
+    logger->set_level(spdlog::level::info);
+
+    bool abort_on_violation = false;
+    std::filesystem::path file_path;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string_view(argv[i]) == "--abort") {
+            abort_on_violation = true;
+        } else {
+            file_path = argv[i];
+        }
+    }
+    if (!MusicEngine::rt::checks_enabled()) {
+        logger->warn("MusicEngine was built without MUSICENGINE_RT_CHECKS; nothing will be checked.");
+        return 0;
+    }
+    MusicEngine::rt::set_abort_on_violation(abort_on_violation);
+
+    const bool generated = file_path.empty();
+    if (generated) {
+        file_path = std::filesystem::temp_directory_path() / "musicengine_rt_safety_tone.wav";
+        if (!write_test_tone(file_path, 32000, 12)) {
+            logger->error("Cannot write the test tone to {}", file_path.string());
+            return 1;
+        }
+    }
+
+    MusicEngine::Music music;
+    music.file_path = file_path;
+
+    logger->info("--- MusicEngine Real-Time Safety Test Starting ---");
+    MusicEngine::MusicPlayer::set_null_output(true);
+    {
+        MusicEngine::MusicPlayer player;
+        if (!player.play(music).get()) {
+            logger->error("Failed to play {}", music.file_path.string());
+            return 1;
+        }
+
+        // --- 步骤 1: 稳态播放 ---
+        std::this_thread::sleep_for(std::chrono::seconds(2));
+
+        // --- 步骤 2: 在回调运行期间修改各项参数 ---
+        const auto pause = [] { std::this_thread::sleep_for(std::chrono::milliseconds(500)); };
+        player.set_volume(0.5);
+        pause();
+        const std::vector<MusicEngine::EqBand> bands = {{MusicEngine::EqFilterType::LowShelf, 100.0, 4.0},
+                                                         {MusicEngine::EqFilterType::Peaking, 2500.0, -3.0, 1.4}};
+        player.set_eq_bands(bands);
+        pause();
+        player.set_analysis_enabled(true);
+        pause();
+
+        // --- 步骤 3: 跳转（精确与关键帧两种模式） ---
+        player.seek(player.get_duration() / 2).wait();
+        pause();
+        player.set_seek_mode(MusicEngine::SeekMode::Keyframe);
+        player.seek(5.0).wait();
+        pause();
+
+        // --- 步骤 4: 暂停、恢复与无缝衔接 ---
+        player.pause().wait();
+        player.resume().wait();
+        player.queue_next(music).wait();
+        std::this_thread::sleep_for(std::chrono::seconds(2));
+        player.stop().wait();
+    }
+    MusicEngine::MusicPlayer::set_null_output(false);
+    if (generated) {
+        std::filesystem::remove(file_path);
+    }
+
+    // --- 步骤 5: 报告 ---
+    const uint64_t count = MusicEngine::rt::violation_count();
+    for (const auto &violation : MusicEngine::rt::violations()) {
+        logger->error("{}", MusicEngine::rt::describe(violation));
+    }
+    if (count > 0) {
+        logger->error("{} real-time violation(s) in the audio callback or the decoder step.", count);
+        return 1;
+    }
+    logger->info("No real-time violations in the audio callback or the decoder step.");
+    logger->info("--- MusicEngine Real-Time Safety Test Finished ---");
+    return 0;
+}
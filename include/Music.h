@@ -2,17 +2,30 @@
 
 #include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace MusicEngine {
 
+    class InputSource;
+
+    // EBU R128 loudness of a track, measured by MusicManager::start_loudness_analysis()
+    struct LoudnessInfo {
+        bool analyzed = false; // The fields below are valid
+        double integrated_lufs = 0.0; // Integrated (gated) loudness in LUFS
+        double true_peak_dbtp = 0.0; // Highest inter-sample peak in dBTP
+        double track_gain_db = 0.0; // Gain that brings the track to the reference loudness
+        double album_gain_db = 0.0; // Gain that brings the track's album to the reference loudness
+    };
+
     // Structure to hold music information
     struct Music {
         // Basic metadata
         std::string title; // Music title
         std::string artist; // Artist name
         std::string album; // Album name
+        std::string album_artist; // Album artist, empty if the file has no such tag
         std::string genre; // Genre
         int32_t year = 0; // Release year
         int32_t duration = 0; // Duration in seconds
@@ -20,8 +33,14 @@ namespace MusicEngine {
         // Filesystem path to the music file
         std::filesystem::path file_path;
 
+        // Where to read the track from instead of file_path, if set (memory, pipe, remote storage; see input_source.h)
+        std::shared_ptr<InputSource> source;
+
         // Flag indicating if cover art is available
         bool has_cover_art = false; 
+
+        // Loudness measurements, used for ReplayGain during playback
+        LoudnessInfo loudness;
     };
 
 } // namespace MusicEngine
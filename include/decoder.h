@@ -0,0 +1,112 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <span>
+
+namespace MusicEngine {
+
+    class InputSource;
+
+    /**
+     * @struct AudioFormat
+     * @brief Describes interleaved 32-bit float PCM.
+     */
+    struct AudioFormat {
+        int sample_rate = 0; ///< Samples per second per channel; 0 when opening means "keep the source rate"
+        int channels = 2; ///< Number of interleaved channels
+    };
+
+    /**
+     * @class Decoder
+     * @brief Decodes a music file to interleaved float PCM without an audio device.
+     *
+     * Uses the same FFmpeg demux/decode/resample pipeline as MusicPlayer, including encoder delay and padding
+     * removal and sample-accurate seeking, but is driven entirely by the caller: read() returns as soon as the
+     * data is decoded, so a file decodes as fast as the CPU allows. Useful for analysis, offline rendering and
+     * tests on machines without a sound card.
+     * A Decoder is not thread-safe; use one instance per thread. This class uses the Pimpl idiom.
+     */
+    class Decoder {
+    public:
+        Decoder();
+        ~Decoder();
+
+        Decoder(const Decoder &) = delete;
+        Decoder &operator=(const Decoder &) = delete;
+        Decoder(Decoder &&) noexcept;
+        Decoder &operator=(Decoder &&) noexcept;
+
+        /**
+         * @brief Opens a file for decoding. Any previously opened file is closed first.
+         * @param file_path The music file to decode.
+         * @param target_format The PCM format read() produces. A sample rate of 0 keeps the file's own rate.
+         * @return true on success; on failure the reason is logged and the decoder stays closed.
+         */
+        bool open(const std::filesystem::path &file_path, const AudioFormat &target_format = {});
+
+        /**
+         * @brief Opens a track read from @p source (see input_source.h), otherwise like the overload above.
+         */
+        bool open(std::shared_ptr<InputSource> source, const AudioFormat &target_format = {});
+
+        /**
+         * @brief Multi-threaded decoding, applied from the next open(). See MusicPlayer::set_decoder_threads() and
+         * MusicPlayer::set_parallel_decoding() for what each option does.
+         * @param codec_threads Threads inside the codec; 0 picks one per core, 1 (the default) turns it off.
+         * @param segment_workers Workers decoding segments of the file in parallel; 0 or 1 (the default) turns
+         * it off.
+         * @param min_duration_secs Only files at least this long are split into segments.
+         */
+        void set_threading(int codec_threads, int segment_workers = 0, double min_duration_secs = 0.0);
+
+        /**
+         * @brief Closes the file and releases the decoder. Safe to call on a closed decoder.
+         */
+        void close();
+
+        bool is_open() const;
+
+        /**
+         * @brief Decodes into @p buffer.
+         *
+         * Fills the buffer completely unless the end of the file is reached. Any buffer size works; a partial
+         * frame at the end of @p buffer is left untouched.
+         *
+         * @param buffer Destination for interleaved samples in the format returned by format().
+         * @return The number of frames (not samples) written; 0 at the end of the file or on error.
+         */
+        size_t read(std::span<float> buffer);
+
+        /**
+         * @brief Seeks to an exact position. The next read() starts at @p position_secs.
+         * @return true on success.
+         */
+        bool seek(double position_secs);
+
+        /**
+         * @brief Returns true once everything has been read.
+         */
+        bool eof() const;
+
+        /**
+         * @brief Duration of the open file in seconds as reported by the container, or 0.0.
+         */
+        double duration() const;
+
+        /**
+         * @brief The format read() produces (the resolved sample rate if 0 was requested).
+         */
+        AudioFormat format() const;
+
+        /**
+         * @brief Sample rate of the file itself, or 0 if nothing is open.
+         */
+        int source_sample_rate() const;
+
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> pimpl_;
+    };
+
+} // namespace MusicEngine
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace MusicEngine {
+
+    /**
+     * @class InputSource
+     * @brief Where the bytes of a track come from, when it isn't a local file.
+     *
+     * Set Music::source to play or parse a track from memory, a file descriptor or pipe, or any byte-range
+     * reader (e.g. HTTP Range requests against a blob store). Readers don't call read() on the demuxer's thread:
+     * a prefetcher fetches large blocks on its own thread and keeps a configurable amount of data ahead of the
+     * demuxer (see MusicPlayer::set_prefetch_size()), so a slow source doesn't stall decoding.
+     *
+     * Every player or parser that opens a source gets its own prefetcher, and read() may be called from several
+     * of them at once; the built-in sources handle that, except pipes, which can only be read once.
+     */
+    class InputSource {
+    public:
+        virtual ~InputSource() = default;
+
+        /**
+         * @brief Reads up to @p size bytes starting at byte @p offset.
+         *
+         * Short reads are allowed; the caller asks again for the rest. Sources that aren't seekable only see
+         * increasing offsets.
+         *
+         * @return The number of bytes read, 0 at the end of the input, or -1 on error.
+         */
+        virtual std::ptrdiff_t read(uint64_t offset, void *buffer, size_t size) = 0;
+
+        /**
+         * @brief Total size in bytes, or std::nullopt if it isn't known (pipes, live streams).
+         */
+        virtual std::optional<uint64_t> size() const = 0;
+
+        /**
+         * @brief false if the input can only be read front to back. Seeking in such tracks is not possible.
+         */
+        virtual bool seekable() const { return true; }
+
+        /**
+         * @brief Name for log messages, also used to guess the container from its extension (e.g. "track.flac").
+         */
+        virtual std::string name() const = 0;
+
+        /**
+         * @brief The whole input, if it is already in memory; readers then use it directly, without prefetching.
+         */
+        virtual std::span<const char> contiguous_bytes() const { return {}; }
+
+        /**
+         * @brief A track held in memory. @p owner keeps @p bytes alive for as long as the source exists.
+         */
+        static std::shared_ptr<InputSource> from_memory(std::span<const char> bytes, std::shared_ptr<const void> owner,
+                                                        std::string name);
+
+        /**
+         * @brief A track held in memory, taking ownership of @p bytes.
+         */
+        static std::shared_ptr<InputSource> from_memory(std::vector<char> bytes, std::string name);
+
+        /**
+         * @brief An open file descriptor: a regular file (read with pread, seekable) or a pipe or socket (read
+         * sequentially, not seekable).
+         * @param owns_fd true to close @p fd when the source is destroyed.
+         */
+        static std::shared_ptr<InputSource> from_fd(int fd, std::string name, bool owns_fd = false);
+
+        /**
+         * @brief Reads a byte range: (offset, buffer, size) -> bytes read, 0 at the end, -1 on error.
+         */
+        using RangeReader = std::function<std::ptrdiff_t(uint64_t offset, void *buffer, size_t size)>;
+
+        /**
+         * @brief A source backed by a byte-range reader, such as an HTTP client issuing Range requests.
+         * @param size Total size if known (e.g. from Content-Length); without it the track can't be seeked from
+         * its end, which some containers need to read their index.
+         */
+        static std::shared_ptr<InputSource> from_range_reader(RangeReader reader, std::optional<uint64_t> size,
+                                                              std::string name);
+    };
+
+} // namespace MusicEngine
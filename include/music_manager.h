@@ -4,9 +4,12 @@
 #include <functional>
 #include <initializer_list>
 #include <memory>
+#include <optional>
+#include <span>
 #include <string>
 #include <vector>
 #include "Music.h"
+#include "waveform.h"
 
 namespace MusicEngine {
     
@@ -81,6 +84,18 @@ namespace MusicEngine {
          */
         std::vector<std::string> get_music_filenames() const;
 
+        /**
+         * @brief Reads the metadata of a track that isn't a local file, e.g. one held in memory or fetched from
+         * remote storage (see input_source.h).
+         *
+         * The track is not added to the database. The returned Music keeps the source, so it can be passed to
+         * MusicPlayer::play() directly.
+         *
+         * @param source Where to read the track from.
+         * @return The music information, or std::nullopt if the source can't be parsed.
+         */
+        std::optional<Music> create_music_from_source(std::shared_ptr<InputSource> source) const;
+
         /**
          * @brief Sets a single music library directory path.
          *
@@ -144,6 +159,96 @@ namespace MusicEngine {
          */
         std::shared_ptr<const std::vector<char>> get_cover_art(const Music& music) const;
 
+        /**
+         * @brief Gets the cover art as a view into the memory-mapped music file, without copying it.
+         *
+         * The image is located directly in the file's ID3 APIC frame, FLAC PICTURE block or MP4 covr atom,
+         * so only the pages holding it are read. The returned handle keeps the mapping alive; the span it
+         * points to stays valid as long as the handle is held.
+         *
+         * @param music The music object to get the cover art for.
+         * @return A shared_ptr to the image bytes, or nullptr if no cover art exists.
+         */
+        std::shared_ptr<const std::span<const char>> get_cover_art_view(const Music &music) const;
+
+        /**
+         * @brief Enables or disables sharing cover art across an album.
+         *
+         * Cover art with identical bytes is always stored once and shared between tracks. With the album hint
+         * enabled, tracks with the same album artist and album are additionally served the first extracted cover
+         * without reading their files. Disabled by default, since tracks of one album may carry different artwork;
+         * enable it for libraries where they don't.
+         *
+         * @param enabled true to enable the album hint.
+         */
+        void set_cover_art_album_hint(bool enabled);
+
+        /**
+         * @brief Gets the waveform overview of a track, generating it in the background if needed.
+         *
+         * Overviews are computed once per file and kept on disk (see set_waveform_cache_directory()), so later
+         * requests for an unchanged file return immediately. Generation runs on a background thread, newest
+         * request first. For long tracks a coarse preview (WaveformSummary::complete == false) is delivered
+         * before the full pass finishes.
+         *
+         * @param music The music object to get the overview for.
+         * @param on_ready Invoked with the overview; right away on the calling thread if it is cached, otherwise
+         * from the background thread (possibly twice: preview, then complete). Receives nullptr if the file can't
+         * be decoded.
+         */
+        void request_waveform(const Music &music,
+                              const std::function<void(std::shared_ptr<const WaveformSummary>)> &on_ready) const;
+
+        /**
+         * @brief Gets the complete waveform overview of a track if it has already been generated.
+         * @return The overview, or nullptr. Never decodes.
+         */
+        std::shared_ptr<const WaveformSummary> get_cached_waveform(const Music &music) const;
+
+        /**
+         * @brief Sets the directory for cached waveform overviews (default: a folder in the system temp
+         * directory). An empty path keeps overviews in memory only.
+         */
+        void set_waveform_cache_directory(const std::filesystem::path &directory);
+
+        /**
+         * @brief Measures the loudness of the tracks in the database in the background (EBU R128).
+         *
+         * Tracks are decoded in parallel on a pool of worker threads. For each one the integrated loudness, the
+         * true peak and the gain to a reference loudness of -18 LUFS (ReplayGain 2.0) are stored in
+         * Music::loudness; album gain is computed over all analyzed tracks with the same album artist and album.
+         * Tracks whose results are already known (and whose file is unchanged) are skipped, so the analysis can
+         * be interrupted with cancel_loudness_analysis() and simply started again later, and rerunning it after a
+         * rescan only decodes new or modified files. Use set_loudness_store() to keep results across runs.
+         *
+         * @param on_finished (Optional) Invoked from a background thread when the job ends, with the number of
+         * tracks analyzed by this run.
+         * @param threads Number of worker threads; 0 uses one per hardware thread.
+         * @return false if an analysis is already running or the database is empty.
+         */
+        bool start_loudness_analysis(const std::function<void(size_t)> &on_finished = nullptr, unsigned threads = 0);
+
+        /**
+         * @brief Checks if a loudness analysis is currently in progress.
+         */
+        bool is_analyzing_loudness() const;
+
+        /**
+         * @brief Stops a running loudness analysis and waits for it. Results measured so far are kept.
+         */
+        void cancel_loudness_analysis();
+
+        /**
+         * @brief Keeps loudness results in a file, so they survive restarts.
+         *
+         * Results already in the file are loaded and applied to the database (also after future scans), and
+         * every newly measured track is appended to it right away.
+         *
+         * @param store_path The file to use; it is created if it doesn't exist.
+         * @return false if the file cannot be read or written.
+         */
+        bool set_loudness_store(const std::filesystem::path &store_path);
+
     private:
         struct Impl;
         std::unique_ptr<Impl> pimpl_;
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
+#include <future>
 #include <memory>
 #include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
 #include "Music.h"
 
 namespace MusicEngine {
@@ -13,6 +19,144 @@ namespace MusicEngine {
      */
     enum class PlayerState { Stopped, Playing, Paused };
 
+    /**
+     * @enum LatencyProfile
+     * @brief Trade-off between output latency and power use.
+     */
+    enum class LatencyProfile {
+        LowLatency, ///< ~10 ms device buffer, 40 ms decoded ahead; for interactive and UI sounds
+        Balanced, ///< ~30 ms device buffer, 1 s decoded ahead (default)
+        PowerSaving ///< ~300 ms device buffer, 4 s decoded ahead, decoder wakes rarely; for battery devices
+    };
+
+    /**
+     * @enum SeekMode
+     * @brief How precisely seek() positions playback.
+     */
+    enum class SeekMode {
+        Accurate, ///< Decodes and discards up to the exact target sample (default)
+        Keyframe ///< Resumes at the packet before the target; cheaper, but may start slightly early
+    };
+
+    /**
+     * @enum CrossfadeCurve
+     * @brief Gain curve used when crossfading into a queued track.
+     */
+    enum class CrossfadeCurve {
+        Linear, ///< Gains sum to 1; dips in loudness for uncorrelated material
+        EqualPower, ///< Sine/cosine law; keeps perceived loudness constant for uncorrelated material
+        SCurve ///< Smoothstep; slow start and end, fast middle
+    };
+
+    /**
+     * @enum ReplayGainMode
+     * @brief Which stored loudness gain is applied during playback.
+     */
+    enum class ReplayGainMode {
+        Off, ///< Play tracks as they are (default)
+        Track, ///< Bring every track to the reference loudness
+        Album ///< Bring every album to the reference loudness, keeping level differences within it
+    };
+
+    /**
+     * @enum EqFilterType
+     * @brief Response of one parametric EQ band.
+     */
+    enum class EqFilterType { Peaking, LowShelf, HighShelf, LowPass, HighPass };
+
+    /**
+     * @struct EqBand
+     * @brief One band of the parametric equalizer.
+     */
+    struct EqBand {
+        EqFilterType type = EqFilterType::Peaking;
+        double frequency_hz = 1000.0; ///< Centre frequency (peaking) or corner frequency (shelves, pass filters)
+        double gain_db = 0.0; ///< Boost or cut; ignored by the pass filters
+        double q = 0.7071; ///< Bandwidth of a peaking band, slope of shelves, resonance of pass filters
+        bool enabled = true;
+    };
+
+    /**
+     * @struct DspStats
+     * @brief Cost of the DSP chain in the audio callback.
+     */
+    struct DspStats {
+        uint64_t blocks = 0; ///< Callback blocks processed
+        double average_us = 0.0; ///< Mean processing time per block
+        double peak_us = 0.0; ///< Longest processing time of a block
+        double load = 0.0; ///< Processing time as a fraction of the duration of the audio processed
+    };
+
+    /**
+     * @struct AnalysisSettings
+     * @brief Cost controls of the output analysis (level meters and spectrum).
+     *
+     * The analysis thread computes at most @p update_hz results per second, each with one FFT of @p fft_size
+     * points, so its cost is bounded by update_hz * fft_size * log2(fft_size) regardless of the sample rate.
+     */
+    struct AnalysisSettings {
+        size_t fft_size = 2048; ///< FFT length, rounded to a power of two between 64 and 16384
+        double update_hz = 30.0; ///< Results per second, between 1 and 120
+    };
+
+    /**
+     * @struct AudioAnalysis
+     * @brief Levels and spectrum of the audio that was just output.
+     */
+    struct AudioAnalysis {
+        uint64_t sequence = 0; ///< Increases by one with every result
+        int sample_rate = 0;
+        size_t fft_size = 0;
+        std::vector<float> rms; ///< Per channel RMS since the previous result (linear, 1.0 = full scale)
+        std::vector<float> peak; ///< Per channel sample peak since the previous result (linear)
+        /// Magnitudes of the last fft_size samples (channels averaged, Hann window) in dB relative to a full-scale
+        /// sine; fft_size / 2 + 1 bins, bin i centred on i * sample_rate / fft_size Hz
+        std::vector<float> spectrum_db;
+    };
+
+    /**
+     * @struct TimingStats
+     * @brief Distribution of one measured duration, kept as a histogram with power-of-two buckets.
+     */
+    struct TimingStats {
+        uint64_t count = 0; ///< Measurements taken
+        double total_us = 0.0; ///< Sum of all measurements
+        double mean_us = 0.0;
+        double max_us = 0.0;
+        double p50_us = 0.0; ///< Upper bound of the bucket holding the median
+        double p99_us = 0.0; ///< Upper bound of the bucket holding the 99th percentile
+        std::vector<double> bucket_bounds_us; ///< Upper bound of each bucket: 1 µs, 2 µs, 4 µs, ...
+        std::vector<uint64_t> cumulative_counts; ///< Measurements at most as long as the matching bound
+    };
+
+    /**
+     * @struct PlaybackStats
+     * @brief Health of a player's playback pipeline, counted since the player was created or last reset.
+     */
+    struct PlaybackStats {
+        uint64_t underruns = 0; ///< Callbacks that ran out of decoded audio mid-track
+        double underrun_secs = 0.0; ///< Silence output in their place
+        double buffered_secs = 0.0; ///< Decoded audio waiting in the buffer right now
+        double buffer_target_secs = 0.0; ///< How far ahead the decoder currently fills
+        TimingStats read; ///< Demuxing one packet (file or source I/O included)
+        TimingStats decode; ///< Sending one packet to the codec, or receiving one decoded frame from it
+        TimingStats resample; ///< Converting one chunk of a frame to the output format
+        TimingStats enqueue; ///< Committing decoded audio to the buffer (a copy only when staged)
+        TimingStats callback; ///< This player's share of each audio callback
+        TimingStats callback_jitter; ///< Deviation of the time between callbacks from the device period
+        TimingStats seek_latency; ///< From seek() to the first callback playing the new position
+        TimingStats time_to_first_audio; ///< From play() to the first callback playing the track
+    };
+
+    /**
+     * @enum StatsFormat
+     * @brief Text format of MusicPlayer::export_playback_stats().
+     */
+    enum class StatsFormat {
+        Prometheus, ///< Prometheus text exposition format, durations in seconds
+        Json ///< One JSON object, durations in microseconds as in PlaybackStats
+    };
+
     /**
      * @class MusicPlayer
      * @brief Manages the playback of a single music track.
@@ -21,6 +165,10 @@ namespace MusicEngine {
      * including play, pause, stop, resume, and seek operations. It encapsulates
      * the complexity of audio decoding and device handling in a simple-to-use class.
      * This class uses the Pimpl (Pointer to implementation) idiom.
+     *
+     * All players in a process share one output device: each playing instance is a voice of a common mixer
+     * with its own decoder, buffer and DSP chain, so e.g. a music player and an announcement player can run at
+     * the same time (see set_volume() and set_ducking()).
      */
     class MusicPlayer {
     public:
@@ -44,29 +192,64 @@ namespace MusicEngine {
         /**
          * @brief Starts playback of a new music track.
          * If another track is already playing, it will be stopped before the new one begins.
+         *
+         * Like every control call (stop(), pause(), resume(), seek(), queue_next()), play() only posts a command to
+         * the player's decoder thread and returns immediately; opening the file, probing it and joining the output
+         * happen there. get_state() and get_duration() reflect the new track once the returned future is ready.
+         * A command that is still waiting when a newer one supersedes it is dropped: when play() is called again
+         * before a track has opened, e.g. while skipping quickly, only the newest track is opened.
+         *
          * @param music The Music object to be played.
+         * @return Becomes true once the track is playing; false if it could not be opened or was superseded.
+         * The future may be discarded; waiting on it from a player callback deadlocks.
          */
-        void play(const MusicEngine::Music &music);
+        std::future<bool> play(const MusicEngine::Music &music);
 
         /**
          * @brief Stops the current playback completely.
          * The player state transitions to Stopped, and the current playback position is lost.
+         * Output falls silent right away; closing the track happens on the decoder thread.
+         * @return Becomes true once the track has been closed.
          */
-        void stop();
+        std::future<bool> stop();
+
+        /**
+         * @brief Sets the format of the output device.
+         *
+         * The device is opened on the first play() and then kept open across tracks; each track is resampled
+         * and remixed to this format. A changed format is applied by reopening the device on the next play().
+         * As the device is shared, it is only reopened while no other player is playing; otherwise the track is
+         * converted to the format the device already has.
+         *
+         * @param sample_rate Output sample rate in Hz, or 0 (the default) for the device's native rate.
+         * @param channels Number of output channels (default 2).
+         */
+        void set_output_format(int sample_rate, int channels = 2);
+
+        /**
+         * @brief Plays every player into a null device instead of the sound card, for tests and headless machines.
+         *
+         * The device callback still runs in real time, driven by a timer thread, and its output is discarded.
+         * Process-wide, as the device is shared; applied when the device is next opened, under the same conditions
+         * as set_output_format().
+         */
+        static void set_null_output(bool enabled);
 
         /**
          * @brief Pauses the current playback.
          * The player state transitions to Paused. Playback can be resumed from the same
          * position using resume(). Has no effect if the player is not in the Playing state.
+         * @return Becomes true once paused, false if there was nothing to pause.
          */
-        void pause();
+        std::future<bool> pause();
 
         /**
          * @brief Resumes playback from the paused state.
          * The player state transitions back to Playing. Has no effect if the player is
          * not in the Paused state.
+         * @return Becomes true once playing again, false if there was nothing to resume.
          */
-        void resume();
+        std::future<bool> resume();
 
         /**
          * @brief Gets the current state of the player.
@@ -94,30 +277,272 @@ namespace MusicEngine {
 
         /**
          * @brief Seeks to a specific time position in the currently playing track.
-         * The seek operation is performed asynchronously by the playback thread.
+         * The seek operation is performed asynchronously by the playback thread. A newer seek supersedes one that
+         * hasn't been carried out yet, and a seek right after play() applies to the new track.
          * @param position_secs The target time in seconds from the beginning of the track.
-         * @return std::optional<double> containing the actual requested position if the seek
-         * request is accepted, or std::nullopt if the request is ignored (e.g., player is stopped).
+         * @return Becomes true once playback continues from the target (served from the buffer, or the decoder
+         * has seeked); false if the player is stopped, the seek failed or a newer one replaced it.
          */
-        std::optional<double> seek(double position_secs);
+        std::future<bool> seek(double position_secs);
 
         /**
          * @brief Seeks to a specific position using a percentage.
          * Values outside the 0-100 range will be automatically clamped.
          * The seek operation is performed asynchronously.
          * @param percentage The target position as an integer percentage (0-100).
-         * @return std::optional<int> containing the actual (clamped) percentage if the seek
-         * request is accepted, or std::nullopt if ignored.
+         * @return As for seek(); false right away if the player is stopped or the track is still opening, as its
+         * duration isn't known yet.
+         */
+        std::future<bool> seek_percent(int percentage);
+
+        /**
+         * @brief Selects the device period and buffer depth.
+         *
+         * Each profile sets the device period in milliseconds, how far the decoder works ahead and how long it
+         * sleeps while the buffer is full. If the output runs dry mid-track, the decoder increases its depth
+         * (up to a per-profile limit) for the rest of the track. Applies from the next play(); a changed
+         * profile reopens the (shared) output device under the same conditions as set_output_format().
+         *
+         * @param profile The profile to use (LatencyProfile::Balanced by default).
+         */
+        void set_latency_profile(LatencyProfile profile);
+
+        /**
+         * @brief Sets how much decoded audio is kept around the play head.
+         *
+         * Seeks that land inside this window are served by moving the read position within the buffer,
+         * without touching the decoder, and take effect within one audio callback period. Applies from the
+         * next play(). Memory use is (back + ahead) seconds of float PCM, rounded up to a power of two.
+         *
+         * @param back_secs Seconds of already played audio to keep (default 0).
+         * @param ahead_secs Seconds to decode ahead of the play head, or 0 (the default) to use the depth of the
+         * latency profile.
+         */
+        void set_buffer_window(double back_secs, double ahead_secs);
+
+        /**
+         * @brief Sets how precisely seek() and seek_percent() position playback.
+         *
+         * Either way, files whose container doesn't index its own packets (e.g. VBR MP3 without a TOC) get a
+         * packet index built in the background after they are opened, so seeks don't depend on the container's
+         * estimate or a linear scan once it is available.
+         *
+         * @param mode SeekMode::Accurate (the default) or SeekMode::Keyframe.
+         */
+        void set_seek_mode(SeekMode mode);
+
+        /**
+         * @brief Queues a track to follow the current one without a gap.
+         *
+         * The track is opened, probed and pre-decoded in the background right away. When the current track
+         * ends, its samples are spliced into the same output stream, sample-accurately and with encoder
+         * delay/padding (LAME, iTunSMPB) removed. Queuing again replaces the previously queued track.
+         * If nothing is playing, this behaves like play().
+         *
+         * @param music The Music object to play next.
+         * @return Becomes true once the decoder thread has taken the track and started preparing it; when nothing
+         * is playing, the future play() returns.
+         */
+        std::future<bool> queue_next(const MusicEngine::Music &music);
+
+        /**
+         * @brief Configures crossfading into tracks queued with queue_next().
+         *
+         * The last @p duration_secs of the current track are mixed with the start of the queued one. The mix is
+         * done by the decoder thread ahead of the output buffer, so the audio callback is unaffected. If the
+         * queued track is not ready in time, or the current track is shorter than expected, playback falls back
+         * to a gapless transition. Takes effect from the next transition.
+         *
+         * @param duration_secs Crossfade length in seconds; 0 (the default) disables crossfading.
+         * @param curve The gain curve applied to both tracks.
+         */
+        void set_crossfade(double duration_secs, CrossfadeCurve curve = CrossfadeCurve::EqualPower);
+
+        /**
+         * @brief Applies the loudness gain stored with each track (see MusicManager::start_loudness_analysis()).
+         *
+         * The gain is taken from Music::loudness and multiplied into the decoded samples by the decoder thread,
+         * so nothing is measured at playback time. It is lowered where needed so the track's true peak stays
+         * below full scale. Tracks without loudness data play unchanged. Takes effect from the next track.
+         *
+         * @param mode Track or album gain, or Off (the default).
+         * @param preamp_db Extra gain added on top of the stored one, in dB.
+         */
+        void set_replay_gain(ReplayGainMode mode, double preamp_db = 0.0);
+
+        /**
+         * @brief Sets how much data is fetched ahead of the decoder for tracks read from an InputSource
+         * (Music::source) and for files on network filesystems. Takes effect from the next track.
+         *
+         * Larger values ride out slower or burstier sources (e.g. HTTP range requests) at the cost of memory.
+         * The default is 4 MiB; in-memory sources and local files are not prefetched.
+         *
+         * @param bytes Size of the prefetch window, rounded up to whole 256 KiB blocks.
+         */
+        void set_prefetch_size(size_t bytes);
+
+        /**
+         * @brief Lets the codec decode on several threads, for codecs that support frame or slice threading
+         * (e.g. FLAC, ALAC). Helps high-resolution files on slow cores. Takes effect from the next track.
+         *
+         * @param threads Number of decoding threads; 0 picks one per core, 1 (the default) turns threading off.
+         */
+        void set_decoder_threads(int threads);
+
+        /**
+         * @brief Decodes long tracks, such as hour-long DJ mixes, on several threads ahead of the play head.
+         *
+         * The track is split into consecutive segments of a few seconds. Each worker opens the track on its own,
+         * seeks to the next segment sample-accurately and decodes it, and the segments are joined seamlessly into
+         * the playback buffer. This works with every codec, but costs one decoder and one segment buffer per
+         * worker. Only seekable tracks are split. Takes effect from the next track.
+         *
+         * @param workers Number of worker threads; 0 or 1 (the default) turns segment decoding off.
+         * @param min_duration_secs Only tracks at least this long are split.
          */
-        std::optional<int> seek_percent(int percentage);
+        void set_parallel_decoding(int workers, double min_duration_secs = 600.0);
+
+        /**
+         * @brief Sets up the intro cache, shared by all players: the first seconds of tracks passed to
+         * preload_intro(), kept decoded in memory.
+         *
+         * play() of a cached track starts output from its intro at once, without waiting for the file to be
+         * opened and probed; the decoder opens behind it and continues sample-accurately where the intro ends.
+         * When the budget is exceeded, the intros played least recently are dropped first.
+         *
+         * @param budget_bytes Memory for all intros together; 0 (the default) turns the cache off and empties it.
+         * @param intro_secs Length of each intro.
+         * @param compact Keep intros as 16-bit samples, which halves their size.
+         */
+        void set_intro_cache(size_t budget_bytes, double intro_secs = 5.0, bool compact = false);
+
+        /**
+         * @brief Decodes the intro of @p music into the intro cache in the background, e.g. for the tracks in a
+         * play queue or the most played ones. Does nothing while the cache is off or for unseekable tracks.
+         *
+         * The intro is decoded to the format of the shared output device. Tracks requested before any player has
+         * opened the device wait until one does.
+         */
+        void preload_intro(const MusicEngine::Music &music);
+
+        /**
+         * @brief Sets this player's level in the shared output mix. Changes are ramped over one device period.
+         * @param gain Linear gain (1.0, the default, leaves the level unchanged).
+         */
+        void set_volume(double gain);
+
+        /**
+         * @brief Makes this player lower all other players while it is audible, e.g. for announcements.
+         *
+         * The other players fade down within about 50 ms once this one outputs sound, and back up over about
+         * 400 ms after it falls silent, is paused or stopped. Players that duck are never ducked themselves.
+         *
+         * @param ducks_others true to duck the other players.
+         * @param depth_db How far the others are lowered, in dB.
+         */
+        void set_ducking(bool ducks_others, double depth_db = -12.0);
+
+        /**
+         * @brief Switches the DSP chain (preamp, parametric EQ, look-ahead limiter) on or off.
+         *
+         * The chain runs in the audio callback on the PCM taken from the playback buffer, so parameter changes
+         * are heard immediately. While it is on, output is delayed by the limiter's 5 ms look-ahead; while off
+         * (the default) samples pass through untouched at no cost. The settings below are kept either way.
+         */
+        void set_dsp_enabled(bool enabled);
+
+        /**
+         * @brief Sets a gain applied before the equalizer. Changes are ramped, so they don't click.
+         */
+        void set_preamp(double gain_db);
+
+        /**
+         * @brief Replaces the equalizer bands (at most 10; extra bands are ignored).
+         *
+         * Bands are biquad filters applied in order. Frequency, gain and Q changes glide to their new values over
+         * about 20 ms; changing a band's type or toggling a pass filter takes effect at once.
+         */
+        void set_eq_bands(std::span<const EqBand> bands);
+
+        /**
+         * @brief Configures the look-ahead limiter at the end of the chain.
+         *
+         * Peaks above @p threshold_db are caught 5 ms in advance and the gain is lowered smoothly before they
+         * arrive, so the output never exceeds the threshold.
+         *
+         * @param enabled true to limit.
+         * @param threshold_db Ceiling in dBFS.
+         * @param release_ms Time for the gain to recover after a peak.
+         */
+        void set_limiter(bool enabled, double threshold_db = -1.0, double release_ms = 50.0);
+
+        /**
+         * @brief Returns the per-block processing cost of the DSP chain since the last play().
+         */
+        DspStats get_dsp_stats() const;
+
+        /**
+         * @brief Returns the playback pipeline's counters and timing histograms.
+         *
+         * Everything is recorded with relaxed atomic adds and two clock reads per measured step, so the
+         * instrumentation stays on in production; the audio callback never locks, allocates or waits for it.
+         * Counters accumulate across tracks until reset_playback_stats().
+         */
+        PlaybackStats get_playback_stats() const;
+
+        /**
+         * @brief Formats get_playback_stats() for a metrics scraper or a log.
+         * @param format Prometheus text or JSON.
+         * @param player_label Added as a `player` label to every Prometheus sample (and as a field in JSON), to
+         * tell several players apart; empty to leave it out.
+         */
+        std::string export_playback_stats(StatsFormat format, std::string_view player_label = {}) const;
+
+        /**
+         * @brief Sets all playback counters and histograms back to zero.
+         */
+        void reset_playback_stats();
+
+        /**
+         * @brief Sets a callback invoked when playback moves on to a track queued with queue_next().
+         * @param callback The function to call with the track that has just started. It is invoked from a
+         * background thread once the first sample of the new track is being output. Like a control call, takes
+         * effect on that thread, in order with the calls made before it.
+         */
+        void set_on_track_changed_callback(const std::function<void(const MusicEngine::Music &)> &callback);
 
         /**
          * @brief Sets a callback function to be invoked when playback of a track finishes naturally.
+         * Not invoked when playback continues with a track queued via queue_next().
          * @param callback The function to call. It will be invoked from a background thread,
-         * so any operations within the callback should be thread-safe.
+         * so any operations within the callback should be thread-safe. Takes effect on that thread, in order
+         * with the control calls made before it.
          */
         void set_on_playback_finished_callback(const std::function<void()>& callback);
 
+        /**
+         * @brief Turns the output analysis for level meters and spectrum displays on or off.
+         *
+         * The audio callback copies each output block into a lock-free ring (dropping blocks if analysis falls
+         * behind, never waiting); a separate thread computes RMS, peak and a windowed FFT from it. Results can be
+         * polled with get_latest_analysis() or received through set_on_analysis_callback(). Off by default.
+         *
+         * @param enabled true to analyze.
+         * @param settings FFT size and update rate, which bound the analysis thread's cost.
+         */
+        void set_analysis_enabled(bool enabled, const AnalysisSettings &settings = {});
+
+        /**
+         * @brief Returns the most recent analysis result, or nullptr if there is none yet. Never blocks on audio.
+         */
+        std::shared_ptr<const AudioAnalysis> get_latest_analysis() const;
+
+        /**
+         * @brief Sets a callback invoked with every analysis result.
+         * @param callback Called from the analysis thread; keep it short, or results are computed less often.
+         */
+        void set_on_analysis_callback(const std::function<void(const AudioAnalysis &)> &callback);
+
     private:
         struct Impl;
         std::unique_ptr<Impl> pimpl_;
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace MusicEngine::rt {
+
+    /**
+     * @enum ViolationKind
+     * @brief What a real-time scope did that it must not do.
+     */
+    enum class ViolationKind {
+        Allocation, ///< malloc, calloc, realloc, aligned allocation or operator new
+        Deallocation, ///< free or operator delete
+        Lock, ///< Locking a mutex or read-write lock (condition variable waits lock one first)
+        BlockingCall ///< Sleeping, waiting on a semaphore, joining a thread or file I/O
+    };
+
+    /**
+     * @struct Violation
+     * @brief One forbidden call made inside a RealtimeScope.
+     */
+    struct Violation {
+        static constexpr size_t MAX_FRAMES = 32;
+
+        ViolationKind kind = ViolationKind::Allocation;
+        const char *call = ""; ///< The intercepted function, e.g. "malloc" or "pthread_mutex_lock"
+        const char *scope = ""; ///< Name of the innermost RealtimeScope
+        std::array<void *, MAX_FRAMES> frames{}; ///< Return addresses, innermost first
+        size_t frame_count = 0;
+    };
+
+    /**
+     * @brief What a RealtimeScope records; a combination of these bits.
+     */
+    enum Checks : unsigned {
+        CHECK_NONE = 0, ///< Records nothing: exempts a call into code the library doesn't control
+        CHECK_ALLOCATIONS = 1u << 0, ///< Allocation and Deallocation
+        CHECK_LOCKS = 1u << 1, ///< Lock
+        CHECK_BLOCKING_CALLS = 1u << 2, ///< BlockingCall
+        CHECK_ALL = CHECK_ALLOCATIONS | CHECK_LOCKS | CHECK_BLOCKING_CALLS
+    };
+
+    /**
+     * @brief Whether the library was built with MUSICENGINE_RT_CHECKS. Without it, RealtimeScope does nothing
+     * and no violation is ever recorded.
+     */
+    bool checks_enabled();
+
+    /**
+     * @class RealtimeScope
+     * @brief Marks the current thread as real-time until the scope ends; scopes nest, the innermost one decides.
+     *
+     * With MUSICENGINE_RT_CHECKS, allocations, lock acquisitions and blocking calls made on the thread meanwhile are
+     * recorded with a stack trace into a fixed-size lock-free log, and the call then goes ahead as usual. The
+     * library opens one around the output device callback, so everything MusicPlayer runs there is covered, and
+     * an allocation-only one around each step of the decoder thread, minus the calls into FFmpeg.
+     * Use the MUSICENGINE_REALTIME_SCOPE() family of macros to compile the scopes away in other builds.
+     */
+    class RealtimeScope {
+    public:
+        explicit RealtimeScope(const char *name, unsigned checks = CHECK_ALL);
+        ~RealtimeScope();
+
+        RealtimeScope(const RealtimeScope &) = delete;
+        RealtimeScope &operator=(const RealtimeScope &) = delete;
+
+    private:
+        const char *outer_name_;
+        unsigned outer_checks_;
+    };
+
+    /**
+     * @brief Number of violations since the last reset_violations(), including any the log had no room for.
+     */
+    uint64_t violation_count();
+
+    /**
+     * @brief The logged violations, oldest first (the log keeps the first 256). Never blocks a real-time thread.
+     */
+    std::vector<Violation> violations();
+
+    /**
+     * @brief Empties the log. Must not race with a real-time scope: call it while the output device is stopped.
+     */
+    void reset_violations();
+
+    /**
+     * @brief Aborts the process at the first violation, after logging it; off by default. For CI runs, where a
+     * core dump points straight at the culprit.
+     */
+    void set_abort_on_violation(bool abort);
+
+    /**
+     * @brief Formats @p violation with a symbolized stack trace, one frame per line.
+     */
+    std::string describe(const Violation &violation);
+
+} // namespace MusicEngine::rt
+
+// Everything the scope runs must be real-time safe
+#define MUSICENGINE_REALTIME_SCOPE(name) MUSICENGINE_RT_SCOPE_(realtime, name, ::MusicEngine::rt::CHECK_ALL)
+// Only allocations are checked, e.g. on a producer thread that may wait for room
+#define MUSICENGINE_ALLOCATION_FREE_SCOPE(name)                                                                        \
+    MUSICENGINE_RT_SCOPE_(allocation_free, name, ::MusicEngine::rt::CHECK_ALLOCATIONS)
+// Suspends the checks of the enclosing scope, e.g. for a call into FFmpeg
+#define MUSICENGINE_REALTIME_EXEMPT(name) MUSICENGINE_RT_SCOPE_(exempt, name, ::MusicEngine::rt::CHECK_NONE)
+
+#if defined(MUSICENGINE_RT_CHECKS)
+#define MUSICENGINE_RT_SCOPE_(kind, name, checks)                                                                      \
+    const ::MusicEngine::rt::RealtimeScope musicengine_##kind##_scope_(name, checks)
+#else
+#define MUSICENGINE_RT_SCOPE_(kind, name, checks) ((void) 0)
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace MusicEngine {
+
+    /**
+     * @struct WaveformPeak
+     * @brief Range and loudness of one slice of a track, all channels combined (1.0 = full scale).
+     */
+    struct WaveformPeak {
+        float min = 0.0f;
+        float max = 0.0f;
+        float rms = 0.0f;
+    };
+
+    /**
+     * @struct WaveformLevel
+     * @brief One resolution of a waveform overview: a peak for every frames_per_peak frames of the track.
+     */
+    struct WaveformLevel {
+        uint32_t frames_per_peak = 0;
+        std::vector<WaveformPeak> peaks;
+    };
+
+    /**
+     * @struct WaveformSummary
+     * @brief Multi-resolution min/max/RMS overview of a track, e.g. for drawing a seek bar.
+     */
+    struct WaveformSummary {
+        int sample_rate = 0; ///< Rate the frame counts refer to (the file's own rate)
+        uint64_t frames = 0; ///< Length of the track in frames
+        /// Finest level first; each following level combines 4 peaks of the previous one
+        std::vector<WaveformLevel> levels;
+        /// false for the quick preview delivered while the full pass is running: a single coarse level built
+        /// from short excerpts spread over the track
+        bool complete = false;
+
+        /**
+         * @brief Picks the coarsest level that still has at least @p width peaks (e.g. one per pixel), or the
+         * finest level if none has that many. Returns nullptr if there are no levels.
+         */
+        const WaveformLevel *level_for_width(size_t width) const {
+            const WaveformLevel *best = levels.empty() ? nullptr : &levels.front();
+            for (const auto &level: levels) {
+                if (level.peaks.size() >= width) {
+                    best = &level;
+                }
+            }
+            return best;
+        }
+    };
+
+} // namespace MusicEngine
@@ -0,0 +1,156 @@
+#include "input_source.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace MusicEngine {
+
+    namespace {
+
+        class MemorySource final : public InputSource {
+        public:
+            MemorySource(std::span<const char> bytes, std::shared_ptr<const void> owner, std::string name) :
+                bytes_(bytes), owner_(std::move(owner)), name_(std::move(name)) {}
+
+            std::ptrdiff_t read(uint64_t offset, void *buffer, size_t size) override {
+                if (offset >= bytes_.size()) {
+                    return 0;
+                }
+                const size_t count = std::min(size, bytes_.size() - static_cast<size_t>(offset));
+                std::memcpy(buffer, bytes_.data() + offset, count);
+                return static_cast<std::ptrdiff_t>(count);
+            }
+
+            std::optional<uint64_t> size() const override { return bytes_.size(); }
+            std::string name() const override { return name_; }
+            std::span<const char> contiguous_bytes() const override { return bytes_; }
+
+        private:
+            std::span<const char> bytes_;
+            std::shared_ptr<const void> owner_;
+            std::string name_;
+        };
+
+        class FdSource final : public InputSource {
+        public:
+            FdSource(int fd, std::string name, bool owns_fd) : fd_(fd), name_(std::move(name)), owns_fd_(owns_fd) {
+                struct stat st {};
+                if (fstat(fd_, &st) == 0 && S_ISREG(st.st_mode)) {
+                    seekable_ = true;
+                    size_ = static_cast<uint64_t>(st.st_size);
+                    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+                }
+            }
+
+            ~FdSource() override {
+                if (owns_fd_) {
+                    ::close(fd_);
+                }
+            }
+
+            std::ptrdiff_t read(uint64_t offset, void *buffer, size_t size) override {
+                if (seekable_) {
+                    ssize_t result;
+                    do {
+                        result = pread(fd_, buffer, size, static_cast<off_t>(offset));
+                    } while (result < 0 && errno == EINTR);
+                    return result < 0 ? -1 : static_cast<std::ptrdiff_t>(result);
+                }
+
+                // A pipe can only move forward: skip up to the offset by reading into the caller's buffer
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (offset < position_) {
+                    return -1;
+                }
+                while (position_ < offset) {
+                    const ssize_t skipped = read_some(buffer, std::min<uint64_t>(size, offset - position_));
+                    if (skipped <= 0) {
+                        return skipped;
+                    }
+                    position_ += static_cast<uint64_t>(skipped);
+                }
+                const ssize_t result = read_some(buffer, size);
+                if (result > 0) {
+                    position_ += static_cast<uint64_t>(result);
+                }
+                return result;
+            }
+
+            std::optional<uint64_t> size() const override { return size_; }
+            bool seekable() const override { return seekable_; }
+            std::string name() const override { return name_; }
+
+        private:
+            ssize_t read_some(void *buffer, size_t size) const {
+                ssize_t result;
+                do {
+                    result = ::read(fd_, buffer, size);
+                } while (result < 0 && errno == EINTR);
+                return result < 0 ? -1 : result;
+            }
+
+            int fd_;
+            std::string name_;
+            bool owns_fd_;
+            bool seekable_ = false;
+            std::optional<uint64_t> size_;
+            std::mutex mutex_; // Pipes only: serializes reads, which share position_
+            uint64_t position_ = 0;
+        };
+
+        class RangeSource final : public InputSource {
+        public:
+            RangeSource(RangeReader reader, std::optional<uint64_t> size, std::string name) :
+                reader_(std::move(reader)), size_(size), name_(std::move(name)) {}
+
+            std::ptrdiff_t read(uint64_t offset, void *buffer, size_t size) override {
+                if (size_ && offset >= *size_) {
+                    return 0;
+                }
+                return reader_(offset, buffer, size);
+            }
+
+            std::optional<uint64_t> size() const override { return size_; }
+            std::string name() const override { return name_; }
+
+        private:
+            RangeReader reader_;
+            std::optional<uint64_t> size_;
+            std::string name_;
+        };
+
+    } // namespace
+
+    std::shared_ptr<InputSource> InputSource::from_memory(std::span<const char> bytes,
+                                                          std::shared_ptr<const void> owner, std::string name) {
+        return std::make_shared<MemorySource>(bytes, std::move(owner), std::move(name));
+    }
+
+    std::shared_ptr<InputSource> InputSource::from_memory(std::vector<char> bytes, std::string name) {
+        auto owner = std::make_shared<const std::vector<char>>(std::move(bytes));
+        const std::span<const char> view(*owner);
+        return std::make_shared<MemorySource>(view, std::move(owner), std::move(name));
+    }
+
+    std::shared_ptr<InputSource> InputSource::from_fd(int fd, std::string name, bool owns_fd) {
+        if (fd < 0) {
+            return nullptr;
+        }
+        return std::make_shared<FdSource>(fd, std::move(name), owns_fd);
+    }
+
+    std::shared_ptr<InputSource> InputSource::from_range_reader(RangeReader reader, std::optional<uint64_t> size,
+                                                                std::string name) {
+        if (!reader) {
+            return nullptr;
+        }
+        return std::make_shared<RangeSource>(std::move(reader), size, std::move(name));
+    }
+
+} // namespace MusicEngine
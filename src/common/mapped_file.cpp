@@ -0,0 +1,113 @@
+#include "mapped_file.hpp"
+
+#include <csetjmp>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace MusicEngine {
+
+    namespace {
+
+        // Where a guarded read on this thread resumes if it faults; null outside of one. Volatile, because only the
+        // signal handler reads it, so the compiler would otherwise drop the stores around the read
+        thread_local sigjmp_buf *volatile t_fault_resume = nullptr;
+        struct sigaction g_previous_bus_action {};
+
+        void on_bus_error(int signal, siginfo_t *info, void *context) {
+            if (sigjmp_buf *resume = t_fault_resume) {
+                siglongjmp(*resume, 1);
+            }
+            // Not ours: chain to the previous handler, or let the default action kill the process as it would have
+            if (g_previous_bus_action.sa_flags & SA_SIGINFO) {
+                g_previous_bus_action.sa_sigaction(signal, info, context);
+            } else if (g_previous_bus_action.sa_handler != SIG_DFL && g_previous_bus_action.sa_handler != SIG_IGN) {
+                g_previous_bus_action.sa_handler(signal);
+            } else {
+                std::signal(SIGBUS, SIG_DFL); // The faulting access runs again on return and now terminates
+            }
+        }
+
+        void install_bus_handler() {
+            static std::once_flag once;
+            std::call_once(once, [] {
+                struct sigaction action {};
+                action.sa_sigaction = on_bus_error;
+                // SA_NODEFER: SIGBUS stays unblocked after the jump, so sigsetjmp() needn't save the signal mask
+                action.sa_flags = SA_SIGINFO | SA_NODEFER;
+                sigemptyset(&action.sa_mask);
+                sigaction(SIGBUS, &action, &g_previous_bus_action);
+            });
+        }
+
+    } // namespace
+
+    std::shared_ptr<const MappedFile> MappedFile::open(const std::filesystem::path &file_path) {
+        int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        struct stat st {};
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return nullptr;
+        }
+
+        size_t size = static_cast<size_t>(st.st_size);
+        void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping stays valid after the descriptor is closed
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            return nullptr;
+        }
+
+        // Callers jump straight to the bytes they need; don't let the kernel read ahead the whole file
+        madvise(addr, size, MADV_RANDOM);
+
+        return std::shared_ptr<const MappedFile>(new MappedFile(static_cast<const char *>(addr), size));
+    }
+
+    MappedFile::~MappedFile() {
+        if (data_) {
+            munmap(const_cast<char *>(data_), size_);
+        }
+    }
+
+    bool MappedFile::copy(std::span<const char> range, void *dst) const {
+        return guard([&] { std::memcpy(dst, range.data(), range.size()); });
+    }
+
+    bool MappedFile::run_guarded(void (*fn)(void *), void *context) const {
+        install_bus_handler();
+        sigjmp_buf *outer = t_fault_resume;
+        sigjmp_buf resume;
+        if (sigsetjmp(resume, 0) != 0) {
+            t_fault_resume = outer;
+            return false; // The file shrank under the mapping
+        }
+        t_fault_resume = &resume;
+        fn(context);
+        t_fault_resume = outer;
+        return true;
+    }
+
+    void MappedFile::will_need(std::span<const char> range) const {
+        if (range.empty()) {
+            return;
+        }
+        // madvise needs a page-aligned start address
+        const auto page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        auto begin = reinterpret_cast<uintptr_t>(range.data()) & ~(page_size - 1);
+        auto end = reinterpret_cast<uintptr_t>(range.data() + range.size());
+        madvise(reinterpret_cast<void *>(begin), end - begin, MADV_WILLNEED);
+    }
+
+    void MappedFile::sequential() const { madvise(const_cast<char *>(data_), size_, MADV_SEQUENTIAL); }
+
+} // namespace MusicEngine
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <type_traits>
+
+namespace MusicEngine {
+
+    /**
+     * @class MappedFile
+     * @brief Read-only memory mapping of a whole file.
+     *
+     * The mapping is created lazily by the kernel: only the pages that are actually touched are read from disk.
+     * Instances are handed out as shared pointers so that views into the mapping (e.g. cover art) can keep it
+     * alive for as long as they are in use.
+     */
+    class MappedFile {
+    public:
+        /**
+         * @brief Maps a file into memory.
+         * @param file_path The file to map.
+         * @return The mapping, or nullptr if the file cannot be opened, is empty, or mmap fails.
+         */
+        static std::shared_ptr<const MappedFile> open(const std::filesystem::path &file_path);
+
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        std::span<const char> bytes() const { return {data_, size_}; }
+        size_t size() const { return size_; }
+
+        /**
+         * @brief Copies @p range, which must lie within the mapping, to @p dst.
+         *
+         * Unlike reading bytes() directly, survives the file being truncated or rewritten in place while it is
+         * mapped: the SIGBUS the kernel raises for pages past the new end is caught and reported as a failed copy.
+         * SIGBUS from anywhere else goes to the handler that was installed before.
+         *
+         * @return false if part of @p range is no longer backed by the file.
+         */
+        bool copy(std::span<const char> range, void *dst) const;
+
+        /**
+         * @brief Runs @p fn, which reads bytes(), under the same SIGBUS guard as copy().
+         *
+         * Meant for parsers that walk the mapping in place. A fault abandons @p fn with siglongjmp, so it must not
+         * hold anything with a non-trivial destructor (strings, vectors, locks) while it reads the mapping.
+         * Guards may nest; a fault resumes at the innermost one.
+         *
+         * @return false if @p fn was cut short by a read past the end of the file.
+         */
+        template<typename Fn>
+        bool guard(Fn &&fn) const {
+            using Callable = std::remove_reference_t<Fn>;
+            return run_guarded([](void *context) { (*static_cast<Callable *>(context))(); },
+                               const_cast<void *>(static_cast<const void *>(std::addressof(fn))));
+        }
+
+        /**
+         * @brief Hints the kernel that a range is about to be read, so it is paged in with one request.
+         */
+        void will_need(std::span<const char> range) const;
+
+        /**
+         * @brief Hints the kernel that the whole mapping will be read front to back.
+         */
+        void sequential() const;
+
+    private:
+        MappedFile(const char *data, size_t size) : data_(data), size_(size) {}
+
+        bool run_guarded(void (*fn)(void *), void *context) const;
+
+        const char *data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+} // namespace MusicEngine
@@ -0,0 +1,432 @@
+#include "media_input.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "mapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/vfs.h>
+#endif
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/mem.h>
+}
+
+namespace MusicEngine {
+
+    namespace {
+
+        // Size of the AVIOContext buffer, i.e. of the reads FFmpeg issues against us
+        constexpr int IO_BUFFER_SIZE = 64 * 1024;
+        // Read-ahead: the input is fetched in blocks of this size
+        constexpr size_t READ_AHEAD_BLOCK_SIZE = 256 * 1024;
+        // Mapped files: after a seek, page in this much from the new position in one request
+        constexpr size_t SEEK_PREFETCH_BYTES = 256 * 1024;
+
+        // Filesystems where small synchronous reads are round trips, and where a server going away would make every
+        // mapped read fail
+        bool is_remote_filesystem(int fd) {
+#if defined(__linux__)
+            struct statfs fs {};
+            if (fstatfs(fd, &fs) != 0) {
+                return false;
+            }
+            switch (static_cast<uint32_t>(fs.f_type)) {
+                case 0x6969: // NFS
+                case 0x517B: // SMB
+                case 0xFF534D42: // CIFS
+                case 0xFE534D42: // SMB2
+                case 0x00C36400: // Ceph
+                case 0x01021997: // 9P
+                case 0x65735546: // FUSE (sshfs, rclone, ...)
+                case 0x5346414F: // AFS
+                    return true;
+                default:
+                    break;
+            }
+#endif
+            return false;
+        }
+
+        // New absolute position for a seek callback, or a negative AVERROR
+        int64_t seek_target(int64_t position, int64_t size, int64_t offset, int whence) {
+            switch (whence) {
+                case SEEK_SET:
+                    break;
+                case SEEK_CUR:
+                    offset += position;
+                    break;
+                case SEEK_END:
+                    offset += size;
+                    break;
+                default:
+                    return AVERROR(EINVAL);
+            }
+            return offset >= 0 ? offset : AVERROR(EINVAL);
+        }
+
+        // Serves reads straight from bytes that are already in memory: a memory mapping or a memory source
+        class MemoryInput final : public MediaInput {
+        public:
+            // @p mapping, if not null, is the mapping behind @p bytes and receives paging hints
+            MemoryInput(std::span<const char> bytes, std::shared_ptr<const void> owner, const MappedFile *mapping,
+                        Access access) :
+                MediaInput(mapping ? Backend::Mapped : Backend::Memory), bytes_(bytes), owner_(std::move(owner)),
+                mapping_(mapping), access_(access) {
+                if (!mapping_) {
+                    return;
+                }
+                if (access_ == Access::Playback) {
+                    // Let the kernel read ahead aggressively and drop pages behind us
+                    mapping_->sequential();
+                } else {
+                    // Headers: one request for the first pages instead of a fault per page
+                    mapping_->will_need(bytes_.first(std::min(bytes_.size(), SEEK_PREFETCH_BYTES)));
+                }
+            }
+
+        protected:
+            int read(uint8_t *buffer, int size) override {
+                if (position_ >= static_cast<int64_t>(bytes_.size())) {
+                    return AVERROR_EOF;
+                }
+                const size_t count =
+                        std::min(static_cast<size_t>(size), bytes_.size() - static_cast<size_t>(position_));
+                const auto range = bytes_.subspan(static_cast<size_t>(position_), count);
+                if (!mapping_) {
+                    std::memcpy(buffer, range.data(), count);
+                } else if (!mapping_->copy(range, buffer)) {
+                    return AVERROR(EIO); // Truncated or rewritten while playing: a read error, as from read(2)
+                }
+                position_ += static_cast<int64_t>(count);
+                return static_cast<int>(count);
+            }
+
+            int64_t seek(int64_t offset, int whence) override {
+                const int64_t size = static_cast<int64_t>(bytes_.size());
+                if (whence == AVSEEK_SIZE) {
+                    return size;
+                }
+                const int64_t target = seek_target(position_, size, offset, whence);
+                if (target < 0) {
+                    return target;
+                }
+                position_ = target;
+                if (mapping_ && access_ == Access::Playback && position_ < size) {
+                    // Sequential read-ahead restarts at the new position only once it has faulted a few times
+                    const size_t begin = static_cast<size_t>(position_);
+                    mapping_->will_need(bytes_.subspan(begin, std::min(bytes_.size() - begin, SEEK_PREFETCH_BYTES)));
+                }
+                return position_;
+            }
+
+        private:
+            std::span<const char> bytes_;
+            std::shared_ptr<const void> owner_; // Keeps bytes_ alive
+            const MappedFile *mapping_;
+            Access access_;
+            int64_t position_ = 0;
+        };
+
+        // Fetches an InputSource in large blocks on its own thread, keeping a window of blocks ahead of the reader
+        class ReadAheadInput final : public MediaInput {
+        public:
+            ReadAheadInput(std::shared_ptr<InputSource> source, size_t block_count) :
+                MediaInput(Backend::ReadAhead), source_(std::move(source)), blocks_(std::max<size_t>(block_count, 1)) {
+                if (const auto size = source_->size()) {
+                    const int64_t block_size = static_cast<int64_t>(READ_AHEAD_BLOCK_SIZE);
+                    size_ = static_cast<int64_t>(*size);
+                    end_block_ = (size_ + block_size - 1) / block_size;
+                }
+                for (auto &block: blocks_) {
+                    block.data.resize(READ_AHEAD_BLOCK_SIZE);
+                }
+                thread_ = std::thread(&ReadAheadInput::run, this);
+            }
+
+            ~ReadAheadInput() override {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stop_requested_ = true;
+                }
+                cond_var_.notify_all();
+                thread_.join();
+            }
+
+        protected:
+            int read(uint8_t *buffer, int size) override {
+                std::unique_lock<std::mutex> lock(mutex_);
+                const int64_t index = position_ / static_cast<int64_t>(READ_AHEAD_BLOCK_SIZE);
+                if ((size_ >= 0 && position_ >= size_) || index >= end_block_) {
+                    return AVERROR_EOF;
+                }
+                const Block *block = nullptr;
+                cond_var_.wait(lock, [&] {
+                    block = find(index);
+                    return (block && block->ready) || stop_requested_;
+                });
+                if (!block || !block->ready) {
+                    return AVERROR_EXIT;
+                }
+                if (block->failed) {
+                    return AVERROR(EIO);
+                }
+
+                const int64_t offset = position_ - index * static_cast<int64_t>(READ_AHEAD_BLOCK_SIZE);
+                if (offset >= static_cast<int64_t>(block->length)) {
+                    return AVERROR_EOF; // The input ended before its stated size, or this is the end of a pipe
+                }
+                const size_t count =
+                        std::min(static_cast<size_t>(size), block->length - static_cast<size_t>(offset));
+                std::memcpy(buffer, block->data.data() + offset, count);
+                position_ += static_cast<int64_t>(count);
+                if (position_ / static_cast<int64_t>(READ_AHEAD_BLOCK_SIZE) != index) {
+                    // The window has moved on: a block behind us can be reused for the next one ahead
+                    cond_var_.notify_all();
+                }
+                return static_cast<int>(count);
+            }
+
+            int64_t seek(int64_t offset, int whence) override {
+                if (size_ < 0 && (whence == AVSEEK_SIZE || whence == SEEK_END)) {
+                    return AVERROR(ENOSYS);
+                }
+                if (whence == AVSEEK_SIZE) {
+                    return size_;
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                const int64_t target = seek_target(position_, size_, offset, whence);
+                if (target < 0) {
+                    return target;
+                }
+                position_ = target;
+                cond_var_.notify_all();
+                return position_;
+            }
+
+        private:
+            struct Block {
+                int64_t index = -1; // Block number in the input, -1 if unused
+                bool ready = false; // false while the read-ahead thread is filling it
+                bool failed = false;
+                size_t length = 0;
+                std::vector<uint8_t> data;
+            };
+
+            const Block *find(int64_t index) const {
+                for (const auto &block: blocks_) {
+                    if (block.index == index) {
+                        return &block;
+                    }
+                }
+                return nullptr;
+            }
+
+            // [Read-ahead Thread] Fills the first missing block of the window [reader's block, + block count),
+            // reusing one that has fallen out of it
+            void run() {
+                const int64_t block_size = static_cast<int64_t>(READ_AHEAD_BLOCK_SIZE);
+                const int64_t window = static_cast<int64_t>(blocks_.size());
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (!stop_requested_) {
+                    const int64_t first = position_ / block_size;
+                    const int64_t last = std::min(first + window, end_block_);
+                    int64_t wanted = -1;
+                    for (int64_t i = first; i < last && wanted < 0; ++i) {
+                        if (!find(i)) {
+                            wanted = i;
+                        }
+                    }
+                    if (wanted < 0) {
+                        cond_var_.wait(lock);
+                        continue;
+                    }
+                    // The window is exactly as long as the block list, so a missing block means one is outside it
+                    auto victim = std::find_if(blocks_.begin(), blocks_.end(), [&](const Block &block) {
+                        return block.index < first || block.index >= first + window;
+                    });
+                    victim->index = wanted;
+                    victim->ready = false;
+
+                    lock.unlock();
+                    bool failed = false;
+                    const size_t length = read_block(wanted * block_size, victim->data, failed);
+                    lock.lock();
+
+                    victim->length = length;
+                    victim->failed = failed;
+                    victim->ready = true;
+                    if (!failed && length < READ_AHEAD_BLOCK_SIZE) {
+                        // A short block is the last one, whether or not the size was known up front
+                        end_block_ = std::min(end_block_, length > 0 ? wanted + 1 : wanted);
+                    }
+                    cond_var_.notify_all();
+                }
+            }
+
+            size_t read_block(int64_t offset, std::vector<uint8_t> &data, bool &failed) const {
+                size_t length = 0;
+                while (length < data.size()) {
+                    const std::ptrdiff_t result = source_->read(static_cast<uint64_t>(offset) + length,
+                                                                data.data() + length, data.size() - length);
+                    if (result < 0) {
+                        failed = true;
+                        break;
+                    }
+                    if (result == 0) {
+                        break;
+                    }
+                    length += static_cast<size_t>(result);
+                }
+                return length;
+            }
+
+            std::shared_ptr<InputSource> source_;
+            int64_t size_ = -1; // -1 if unknown
+            int64_t end_block_ = std::numeric_limits<int64_t>::max(); // One past the last block, once known
+            std::vector<Block> blocks_;
+            std::mutex mutex_;
+            std::condition_variable cond_var_;
+            int64_t position_ = 0; // Reader's position in the input
+            bool stop_requested_ = false;
+            std::thread thread_;
+        };
+
+        // Number of read-ahead blocks that hold @p prefetch_bytes; probing only ever needs one
+        size_t read_ahead_blocks(MediaInput::Access access, size_t prefetch_bytes) {
+            if (access == MediaInput::Access::Probe) {
+                return 1;
+            }
+            return std::max<size_t>((prefetch_bytes + READ_AHEAD_BLOCK_SIZE - 1) / READ_AHEAD_BLOCK_SIZE, 1);
+        }
+
+        // avformat_open_input() through @p input, or by @p url alone if there is none
+        int open_with_input(AVFormatContext **format_ctx, const std::string &url, std::unique_ptr<MediaInput> &input) {
+            if (!input) {
+                return avformat_open_input(format_ctx, url.c_str(), nullptr, nullptr);
+            }
+
+            *format_ctx = avformat_alloc_context();
+            if (!*format_ctx) {
+                input.reset();
+                return AVERROR(ENOMEM);
+            }
+            (*format_ctx)->pb = input->io_context();
+            (*format_ctx)->flags |= AVFMT_FLAG_CUSTOM_IO;
+            // The name is still passed so the container can be guessed from the extension as well as the content.
+            // On failure FFmpeg frees the context but leaves our I/O context alone.
+            const int result = avformat_open_input(format_ctx, url.c_str(), nullptr, nullptr);
+            if (result < 0) {
+                input.reset();
+            }
+            return result;
+        }
+
+    } // namespace
+
+    std::unique_ptr<MediaInput> MediaInput::open(const std::filesystem::path &file_path, Access access,
+                                                 size_t prefetch_bytes) {
+        int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st {};
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+            ::close(fd);
+            return nullptr;
+        }
+
+        if (is_remote_filesystem(fd)) {
+            return open(InputSource::from_fd(fd, file_path.filename().string(), true), access, prefetch_bytes);
+        }
+        ::close(fd);
+        auto file = MappedFile::open(file_path);
+        if (!file) {
+            return nullptr;
+        }
+        const auto bytes = file->bytes();
+        const MappedFile *mapping = file.get();
+        std::unique_ptr<MediaInput> input = std::make_unique<MemoryInput>(bytes, std::move(file), mapping, access);
+        if (!input->create_io_context(IO_BUFFER_SIZE, true)) {
+            return nullptr;
+        }
+        return input;
+    }
+
+    std::unique_ptr<MediaInput> MediaInput::open(std::shared_ptr<InputSource> source, Access access,
+                                                 size_t prefetch_bytes) {
+        if (!source) {
+            return nullptr;
+        }
+        const bool seekable = source->seekable();
+        std::unique_ptr<MediaInput> input;
+        if (const auto bytes = source->contiguous_bytes(); !bytes.empty()) {
+            input = std::make_unique<MemoryInput>(bytes, source, nullptr, access);
+        } else {
+            input = std::make_unique<ReadAheadInput>(std::move(source), read_ahead_blocks(access, prefetch_bytes));
+        }
+        if (!input->create_io_context(IO_BUFFER_SIZE, seekable)) {
+            return nullptr;
+        }
+        return input;
+    }
+
+    int MediaInput::read_callback(void *opaque, uint8_t *buffer, int size) {
+        return static_cast<MediaInput *>(opaque)->read(buffer, size);
+    }
+
+    int64_t MediaInput::seek_callback(void *opaque, int64_t offset, int whence) {
+        return static_cast<MediaInput *>(opaque)->seek(offset, whence & ~AVSEEK_FORCE);
+    }
+
+    MediaInput::~MediaInput() {
+        if (io_context_) {
+            // FFmpeg may have replaced the buffer it was given, so free whichever one it holds now
+            av_freep(&io_context_->buffer);
+            avio_context_free(&io_context_);
+        }
+    }
+
+    bool MediaInput::create_io_context(int buffer_size, bool seekable) {
+        auto *buffer = static_cast<unsigned char *>(av_malloc(static_cast<size_t>(buffer_size)));
+        if (!buffer) {
+            return false;
+        }
+        io_context_ = avio_alloc_context(buffer, buffer_size, 0, this, read_callback, nullptr, seek_callback);
+        if (!io_context_) {
+            av_free(buffer);
+            return false;
+        }
+        if (!seekable) {
+            // Keeps demuxers from seeking around, e.g. to the end for tags; short skips forward still work
+            io_context_->seekable = 0;
+        }
+        return true;
+    }
+
+    int open_format_input(AVFormatContext **format_ctx, const std::filesystem::path &file_path,
+                          MediaInput::Access access, std::unique_ptr<MediaInput> &input, size_t prefetch_bytes) {
+        input = MediaInput::open(file_path, access, prefetch_bytes);
+        return open_with_input(format_ctx, file_path.string(), input);
+    }
+
+    int open_format_input(AVFormatContext **format_ctx, const std::shared_ptr<InputSource> &source,
+                          MediaInput::Access access, std::unique_ptr<MediaInput> &input, size_t prefetch_bytes) {
+        input = MediaInput::open(source, access, prefetch_bytes);
+        if (!input) {
+            return AVERROR(EINVAL);
+        }
+        return open_with_input(format_ctx, source->name(), input);
+    }
+
+} // namespace MusicEngine
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include "input_source.h"
+
+struct AVFormatContext;
+struct AVIOContext;
+
+namespace MusicEngine {
+
+    /**
+     * @class MediaInput
+     * @brief FFmpeg I/O for a local file or an InputSource that avoids FFmpeg's small synchronous read() calls.
+     *
+     * Files on local filesystems are memory-mapped and copied out of the mapping, and in-memory sources are
+     * read directly. Files on network and FUSE filesystems (NFS, SMB/CIFS, Ceph, FUSE mounts), where each small
+     * read is a round trip and a mapping can fault on a network error, and all other sources are read in large
+     * blocks by a read-ahead thread that keeps a prefetch window ahead of the demuxer.
+     */
+    class MediaInput {
+    public:
+        /**
+         * @enum Access
+         * @brief How the file is going to be read.
+         */
+        enum class Access {
+            Playback, ///< Front to back with occasional seeks: read ahead aggressively
+            Probe ///< Headers and tags only: large reads, but nothing fetched beyond what is asked for
+        };
+
+        /**
+         * @enum Backend
+         * @brief Where the bytes come from.
+         */
+        enum class Backend { Mapped, Memory, ReadAhead };
+
+        /// Default amount of data the read-ahead thread keeps ahead of playback
+        static constexpr size_t DEFAULT_PREFETCH_BYTES = 4 * 1024 * 1024;
+
+        /**
+         * @brief Opens @p file_path, choosing the backend from the filesystem it lives on.
+         * @param prefetch_bytes Read-ahead window for playback from network filesystems.
+         * @return The input, or nullptr if the file can't be opened (callers then let FFmpeg open the path).
+         */
+        static std::unique_ptr<MediaInput> open(const std::filesystem::path &file_path, Access access,
+                                                size_t prefetch_bytes = DEFAULT_PREFETCH_BYTES);
+
+        /**
+         * @brief Opens @p source: directly if its bytes are in memory, otherwise through the read-ahead thread.
+         * @param prefetch_bytes Read-ahead window for playback.
+         * @return The input, or nullptr if @p source is null.
+         */
+        static std::unique_ptr<MediaInput> open(std::shared_ptr<InputSource> source, Access access,
+                                                size_t prefetch_bytes = DEFAULT_PREFETCH_BYTES);
+
+        virtual ~MediaInput();
+
+        MediaInput(const MediaInput &) = delete;
+        MediaInput &operator=(const MediaInput &) = delete;
+
+        AVIOContext *io_context() const { return io_context_; }
+        Backend backend() const { return backend_; }
+
+    protected:
+        explicit MediaInput(Backend backend) : backend_(backend) {}
+
+        // Creates io_context_ with a buffer of @p buffer_size bytes around the virtual functions below
+        bool create_io_context(int buffer_size, bool seekable);
+
+        // Same contracts as the read_packet and seek callbacks of avio_alloc_context()
+        virtual int read(uint8_t *buffer, int size) = 0;
+        virtual int64_t seek(int64_t offset, int whence) = 0;
+
+    private:
+        static int read_callback(void *opaque, uint8_t *buffer, int size);
+        static int64_t seek_callback(void *opaque, int64_t offset, int whence);
+
+        AVIOContext *io_context_ = nullptr;
+        Backend backend_;
+    };
+
+    /**
+     * @brief avformat_open_input() reading through a MediaInput for @p file_path.
+     *
+     * On success @p input holds the MediaInput, which must outlive the format context: destroy it only after
+     * avformat_close_input(). If no MediaInput can be created, FFmpeg opens the path itself and @p input stays
+     * empty.
+     *
+     * @return 0 on success, or a negative AVERROR code like avformat_open_input().
+     */
+    int open_format_input(AVFormatContext **format_ctx, const std::filesystem::path &file_path,
+                          MediaInput::Access access, std::unique_ptr<MediaInput> &input,
+                          size_t prefetch_bytes = MediaInput::DEFAULT_PREFETCH_BYTES);
+
+    /**
+     * @brief avformat_open_input() reading @p source, named by InputSource::name().
+     *
+     * As above, @p input must outlive the format context.
+     *
+     * @return 0 on success, or a negative AVERROR code like avformat_open_input().
+     */
+    int open_format_input(AVFormatContext **format_ctx, const std::shared_ptr<InputSource> &source,
+                          MediaInput::Access access, std::unique_ptr<MediaInput> &input,
+                          size_t prefetch_bytes = MediaInput::DEFAULT_PREFETCH_BYTES);
+
+} // namespace MusicEngine
@@ -0,0 +1,323 @@
+#include "rt_safety.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define MUSICENGINE_RT_BACKTRACE 1
+#endif
+
+// Interception replaces the C library's allocator entry points and resolves the real lock and blocking calls with
+// dlsym(RTLD_NEXT), which needs glibc. Elsewhere scopes still work, but nothing is recorded.
+#if defined(MUSICENGINE_RT_CHECKS) && defined(__GLIBC__)
+#define MUSICENGINE_RT_INTERCEPT 1
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace MusicEngine::rt {
+
+    namespace {
+
+        constexpr size_t LOG_CAPACITY = 256;
+
+        // Write-once slots: a recording thread claims an index, fills the slot and then marks it ready
+        struct Slot {
+            Violation violation;
+            std::atomic<bool> ready{false};
+        };
+
+        std::array<Slot, LOG_CAPACITY> g_log;
+        std::atomic<uint64_t> g_count{0};
+        std::atomic<bool> g_abort{false};
+
+        // Trivial thread-locals: no constructor runs and, linked statically, no TLS block is allocated on first use
+        thread_local unsigned t_checks = CHECK_NONE;
+        thread_local const char *t_scope = nullptr;
+
+        const char *kind_name(ViolationKind kind) {
+            switch (kind) {
+                case ViolationKind::Allocation:
+                    return "allocation";
+                case ViolationKind::Deallocation:
+                    return "deallocation";
+                case ViolationKind::Lock:
+                    return "lock";
+                case ViolationKind::BlockingCall:
+                    return "blocking call";
+            }
+            return "violation";
+        }
+
+#if defined(MUSICENGINE_RT_INTERCEPT)
+        thread_local bool t_reporting = false; // Set while recording, so the calls recording makes pass through
+
+#if defined(MUSICENGINE_RT_BACKTRACE)
+        // glibc loads the unwinder (and allocates) on the first backtrace(); do that before any real-time scope
+        [[maybe_unused]] const bool g_unwinder_loaded = [] {
+            void *frame = nullptr;
+            return backtrace(&frame, 1) >= 0;
+        }();
+#endif
+
+        unsigned check_for(ViolationKind kind) {
+            switch (kind) {
+                case ViolationKind::Allocation:
+                case ViolationKind::Deallocation:
+                    return CHECK_ALLOCATIONS;
+                case ViolationKind::Lock:
+                    return CHECK_LOCKS;
+                case ViolationKind::BlockingCall:
+                    return CHECK_BLOCKING_CALLS;
+            }
+            return CHECK_NONE;
+        }
+
+        // [Any Thread] Records @p call if the innermost scope checks for it; the call then proceeds as usual
+        void note(ViolationKind kind, const char *call) {
+            if ((t_checks & check_for(kind)) == 0 || t_reporting) {
+                return;
+            }
+            t_reporting = true;
+            const uint64_t index = g_count.fetch_add(1, std::memory_order_relaxed);
+            Violation *logged = nullptr;
+            if (index < LOG_CAPACITY) {
+                logged = &g_log[index].violation;
+                logged->kind = kind;
+                logged->call = call;
+                logged->scope = t_scope ? t_scope : "";
+#if defined(MUSICENGINE_RT_BACKTRACE)
+                // Leaves out this function's own frame
+                void *frames[Violation::MAX_FRAMES + 1];
+                const int depth = backtrace(frames, static_cast<int>(Violation::MAX_FRAMES + 1));
+                logged->frame_count = depth > 1 ? static_cast<size_t>(depth - 1) : 0;
+                std::copy_n(frames + 1, logged->frame_count, logged->frames.begin());
+#endif
+                g_log[index].ready.store(true, std::memory_order_release);
+            }
+
+            if (g_abort.load(std::memory_order_relaxed)) {
+                char message[256];
+                const int length = std::snprintf(message, sizeof(message), "Real-time violation: %s (%s) in %s\n",
+                                                 call, kind_name(kind), t_scope ? t_scope : "");
+                if (length > 0) {
+                    ::write(STDERR_FILENO, message, std::min(static_cast<size_t>(length), sizeof(message) - 1));
+                }
+#if defined(MUSICENGINE_RT_BACKTRACE)
+                if (logged) {
+                    backtrace_symbols_fd(logged->frames.data(), static_cast<int>(logged->frame_count),
+                                         STDERR_FILENO);
+                }
+#endif
+                std::abort();
+            }
+            t_reporting = false;
+        }
+
+        // The definition that ours hides, looked up once
+        template<typename Fn>
+        Fn next(std::atomic<void *> &cache, const char *name) {
+            void *fn = cache.load(std::memory_order_relaxed);
+            if (!fn) {
+                fn = dlsym(RTLD_NEXT, name);
+                cache.store(fn, std::memory_order_relaxed);
+            }
+            return reinterpret_cast<Fn>(fn);
+        }
+#endif
+
+    } // namespace
+
+    bool checks_enabled() {
+#if defined(MUSICENGINE_RT_INTERCEPT)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    RealtimeScope::RealtimeScope(const char *name, unsigned checks) : outer_name_(t_scope), outer_checks_(t_checks) {
+        t_checks = checks;
+        t_scope = name;
+    }
+
+    RealtimeScope::~RealtimeScope() {
+        t_scope = outer_name_;
+        t_checks = outer_checks_;
+    }
+
+    uint64_t violation_count() { return g_count.load(std::memory_order_relaxed); }
+
+    std::vector<Violation> violations() {
+        std::vector<Violation> result;
+        const uint64_t count = std::min<uint64_t>(g_count.load(std::memory_order_relaxed), LOG_CAPACITY);
+        result.reserve(static_cast<size_t>(count));
+        for (size_t i = 0; i < count; ++i) {
+            // A slot still being filled is left out; it shows up in the next call
+            if (g_log[i].ready.load(std::memory_order_acquire)) {
+                result.push_back(g_log[i].violation);
+            }
+        }
+        return result;
+    }
+
+    void reset_violations() {
+        for (Slot &slot : g_log) {
+            slot.ready.store(false, std::memory_order_relaxed);
+        }
+        g_count.store(0, std::memory_order_release);
+    }
+
+    void set_abort_on_violation(bool abort) { g_abort = abort; }
+
+    std::string describe(const Violation &violation) {
+        std::string text = std::string(kind_name(violation.kind)) + ": " + violation.call + " in " + violation.scope;
+#if defined(MUSICENGINE_RT_BACKTRACE)
+        char **symbols = backtrace_symbols(violation.frames.data(), static_cast<int>(violation.frame_count));
+        for (size_t i = 0; i < violation.frame_count; ++i) {
+            text += "\n    #" + std::to_string(i) + " ";
+            text += symbols ? symbols[i] : "?";
+        }
+        std::free(symbols);
+#endif
+        return text;
+    }
+
+} // namespace MusicEngine::rt
+
+#if defined(MUSICENGINE_RT_INTERCEPT)
+
+using MusicEngine::rt::ViolationKind;
+using MusicEngine::rt::note;
+
+// ------------------- Allocation -------------------
+// glibc's allocator stays reachable under its __libc_ names, so no lookup is needed (dlsym itself allocates)
+
+extern "C" {
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void *ptr);
+
+    void *malloc(size_t size) noexcept {
+        note(ViolationKind::Allocation, "malloc");
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size) noexcept {
+        note(ViolationKind::Allocation, "calloc");
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *ptr, size_t size) noexcept {
+        note(ViolationKind::Allocation, "realloc");
+        return __libc_realloc(ptr, size);
+    }
+
+    void *memalign(size_t alignment, size_t size) noexcept {
+        note(ViolationKind::Allocation, "memalign");
+        return __libc_memalign(alignment, size);
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size) noexcept {
+        note(ViolationKind::Allocation, "aligned_alloc");
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void **out, size_t alignment, size_t size) noexcept {
+        note(ViolationKind::Allocation, "posix_memalign");
+        if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+            return EINVAL;
+        }
+        void *ptr = __libc_memalign(alignment, size);
+        if (!ptr) {
+            return ENOMEM;
+        }
+        *out = ptr;
+        return 0;
+    }
+
+    void free(void *ptr) noexcept {
+        if (ptr) {
+            note(ViolationKind::Deallocation, "free");
+        }
+        __libc_free(ptr);
+    }
+}
+
+// ------------------- Locks and blocking calls -------------------
+// std::mutex, std::shared_mutex and std::condition_variable (which waits with its mutex locked) end up here
+
+#define MUSICENGINE_RT_FORWARD(name, ...)                                                                              \
+    static std::atomic<void *> next_fn{nullptr};                                                                       \
+    return MusicEngine::rt::next<decltype(&::name)>(next_fn, #name)(__VA_ARGS__)
+
+extern "C" {
+    int pthread_mutex_lock(pthread_mutex_t *mutex) noexcept {
+        note(ViolationKind::Lock, "pthread_mutex_lock");
+        MUSICENGINE_RT_FORWARD(pthread_mutex_lock, mutex);
+    }
+
+    int pthread_rwlock_rdlock(pthread_rwlock_t *lock) noexcept {
+        note(ViolationKind::Lock, "pthread_rwlock_rdlock");
+        MUSICENGINE_RT_FORWARD(pthread_rwlock_rdlock, lock);
+    }
+
+    int pthread_rwlock_wrlock(pthread_rwlock_t *lock) noexcept {
+        note(ViolationKind::Lock, "pthread_rwlock_wrlock");
+        MUSICENGINE_RT_FORWARD(pthread_rwlock_wrlock, lock);
+    }
+
+    int pthread_join(pthread_t thread, void **result) {
+        note(ViolationKind::BlockingCall, "pthread_join");
+        MUSICENGINE_RT_FORWARD(pthread_join, thread, result);
+    }
+
+    int sem_wait(sem_t *sem) {
+        note(ViolationKind::BlockingCall, "sem_wait");
+        MUSICENGINE_RT_FORWARD(sem_wait, sem);
+    }
+
+    int sem_timedwait(sem_t *sem, const struct timespec *deadline) {
+        note(ViolationKind::BlockingCall, "sem_timedwait");
+        MUSICENGINE_RT_FORWARD(sem_timedwait, sem, deadline);
+    }
+
+    int nanosleep(const struct timespec *duration, struct timespec *remaining) {
+        note(ViolationKind::BlockingCall, "nanosleep");
+        MUSICENGINE_RT_FORWARD(nanosleep, duration, remaining);
+    }
+
+    int clock_nanosleep(clockid_t clock, int flags, const struct timespec *duration, struct timespec *remaining) {
+        note(ViolationKind::BlockingCall, "clock_nanosleep");
+        MUSICENGINE_RT_FORWARD(clock_nanosleep, clock, flags, duration, remaining);
+    }
+
+    int usleep(useconds_t microseconds) {
+        note(ViolationKind::BlockingCall, "usleep");
+        MUSICENGINE_RT_FORWARD(usleep, microseconds);
+    }
+
+    ssize_t read(int fd, void *buffer, size_t size) {
+        note(ViolationKind::BlockingCall, "read");
+        MUSICENGINE_RT_FORWARD(read, fd, buffer, size);
+    }
+
+    ssize_t write(int fd, const void *buffer, size_t size) {
+        note(ViolationKind::BlockingCall, "write");
+        MUSICENGINE_RT_FORWARD(write, fd, buffer, size);
+    }
+}
+
+#undef MUSICENGINE_RT_FORWARD
+
+#endif
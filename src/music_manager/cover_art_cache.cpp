@@ -1,14 +1,167 @@
 #include "cover_art_cache.hpp"
+#include <cstring>
+#include <mutex>
+#include <span>
 #include <unordered_map>
 #include "music_parser.hpp"
 
 namespace MusicEngine {
 
+    namespace {
+
+        std::span<const char> as_bytes(const std::vector<char> &blob) { return {blob.data(), blob.size()}; }
+        std::span<const char> as_bytes(const MusicParser::CoverArtView &blob) { return blob.data; }
+
+        // Runs `read` over the blob's bytes. A view into a mapping is read under its SIGBUS guard, so a file truncated
+        // since it was mapped fails the read instead of crashing; `read` must not own anything with a destructor.
+        template<typename Fn>
+        bool read_bytes(const std::vector<char> &blob, Fn &&read) {
+            read(as_bytes(blob));
+            return true;
+        }
+
+        template<typename Fn>
+        bool read_bytes(const MusicParser::CoverArtView &blob, Fn &&read) {
+            if (!blob.mapping) {
+                read(blob.data);
+                return true;
+            }
+            return blob.mapping->guard([&] { read(blob.data); });
+        }
+
+        // 64-bit FNV-1a over the image bytes. Cheap enough to run once per extraction and
+        // good enough as a bucket key; equality is always confirmed with a full compare.
+        uint64_t hash_bytes(std::span<const char> data) {
+            uint64_t hash = 14695981039346656037ULL;
+            for (char c: data) {
+                hash ^= static_cast<unsigned char>(c);
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        // Album key used by the fast path. Falls back to the track artist when the file has no album artist tag.
+        std::string make_album_key(const Music &music) {
+            const std::string &artist = music.album_artist.empty() ? music.artist : music.album_artist;
+            if (music.album.empty() || artist.empty()) {
+                return {};
+            }
+            return artist + '\x1f' + music.album;
+        }
+
+        // Lookup tables for one kind of cover art blob (owned vector or view into a mapping)
+        template<typename Blob>
+        struct BlobIndex {
+            using Ptr = std::shared_ptr<const Blob>;
+            using WeakPtr = std::weak_ptr<const Blob>;
+
+            // Memory cache: Key is the file path, Value is a shared pointer to the cover data
+            // Using weak_ptr avoids circular references and allows the system to reclaim memory automatically when under pressure
+            std::unordered_map<std::string, WeakPtr> by_path;
+
+            // Content index: Key is the hash of the image bytes. Several tracks with identical art resolve to one buffer.
+            // A bucket holds more than one entry only on a hash collision.
+            std::unordered_map<uint64_t, std::vector<WeakPtr>> by_content;
+
+            // Album hint: Key is (album artist, album). Lets the first extracted track serve the rest of the album.
+            std::unordered_map<std::string, WeakPtr> by_album;
+
+            // Size of by_content after the last prune_if_grown() sweep
+            size_t swept_size = 0;
+
+            Ptr find(const std::string &key, const std::string &album_key) {
+                // 1. Check memory cache
+                if (auto it = by_path.find(key); it != by_path.end()) {
+                    if (auto shared_ptr = it->second.lock()) {
+                        // Cache hit and data is valid
+                        return shared_ptr;
+                    }
+                }
+
+                // 2. Album fast path: another track of the same album has already been extracted
+                if (!album_key.empty()) {
+                    if (auto it = by_album.find(album_key); it != by_album.end()) {
+                        if (auto shared_ptr = it->second.lock()) {
+                            by_path[key] = shared_ptr;
+                            return shared_ptr;
+                        }
+                    }
+                }
+                return nullptr;
+            }
+
+            // Returns the already cached blob with the same content, or stores and returns `blob`.
+            // Returns nullptr if the bytes of `blob` can no longer be read.
+            Ptr intern(Ptr blob) {
+                const auto bytes = as_bytes(*blob);
+                uint64_t hash = 0;
+                if (!read_bytes(*blob, [&](std::span<const char> data) { hash = hash_bytes(data); })) {
+                    return nullptr;
+                }
+                prune_if_grown();
+                auto &bucket = by_content[hash];
+
+                // Drop entries whose buffers have been released while we are here
+                std::erase_if(bucket, [](const WeakPtr &weak) { return weak.expired(); });
+
+                for (const auto &weak: bucket) {
+                    auto existing = weak.lock();
+                    if (!existing || as_bytes(*existing).size() != bytes.size()) {
+                        continue;
+                    }
+                    bool same = false;
+                    const bool readable = read_bytes(*blob, [&](std::span<const char> data) {
+                        read_bytes(*existing, [&](std::span<const char> existing_data) {
+                            same = std::memcmp(existing_data.data(), data.data(), data.size()) == 0;
+                        });
+                    });
+                    if (!readable) {
+                        return nullptr;
+                    }
+                    if (same) {
+                        return existing;
+                    }
+                }
+
+                bucket.push_back(blob);
+                return blob;
+            }
+
+            // Drops released entries and the content buckets they leave empty. Runs whenever the content index has
+            // doubled since the last sweep, so the cost stays amortised over the inserts that grew it.
+            void prune_if_grown() {
+                if (by_content.size() < 2 * swept_size + 16) {
+                    return;
+                }
+                for (auto it = by_content.begin(); it != by_content.end();) {
+                    std::erase_if(it->second, [](const WeakPtr &weak) { return weak.expired(); });
+                    it = it->second.empty() ? by_content.erase(it) : std::next(it);
+                }
+                std::erase_if(by_path, [](const auto &entry) { return entry.second.expired(); });
+                std::erase_if(by_album, [](const auto &entry) { return entry.second.expired(); });
+                swept_size = by_content.size();
+            }
+
+            void remember(const std::string &key, const std::string &album_key, const Ptr &blob) {
+                by_path[key] = blob;
+                if (!album_key.empty()) {
+                    by_album[album_key] = blob;
+                }
+            }
+        };
+
+    } // namespace
+
     struct CoverArtCache::Impl {
-        // Memory cache: Key is the file path, Value is a shared pointer to the cover data
-        // Using weak_ptr avoids circular references and allows the system to reclaim memory automatically when under pressure
-        std::unordered_map<std::string, std::weak_ptr<const std::vector<char>>> memory_cache_;
+        BlobIndex<std::vector<char>> buffers_;
+        BlobIndex<MusicParser::CoverArtView> views_;
+        bool album_hint_enabled_ = false;
+
         std::mutex cache_mutex_;
+
+        std::string album_key(const Music &music) const {
+            return album_hint_enabled_ ? make_album_key(music) : std::string{};
+        }
     };
 
     // Singleton accessor
@@ -28,24 +181,60 @@ namespace MusicEngine {
 
         std::lock_guard<std::mutex> lock(pimpl_->cache_mutex_);
         const std::string key = music.file_path.string();
+        const std::string album_key = pimpl_->album_key(music);
 
-        // 1. Check memory cache
-        if (auto it = pimpl_->memory_cache_.find(key); it != pimpl_->memory_cache_.end()) {
-            if (auto shared_ptr = it->second.lock()) {
-                // Cache hit and data is valid
-                return shared_ptr;
-            }
+        if (auto cached = pimpl_->buffers_.find(key, album_key)) {
+            return cached;
         }
 
-        // 2. Cache miss, load from file
+        // Cache miss, load from file and share the buffer with any track that has identical art
         if (auto data_opt = MusicParser::extract_cover_art_data(music.file_path)) {
-            auto shared_ptr = std::make_shared<const std::vector<char>>(std::move(*data_opt));
-            // Store in cache
-            pimpl_->memory_cache_[key] = shared_ptr;
+            auto shared_ptr = pimpl_->buffers_.intern(std::make_shared<const std::vector<char>>(std::move(*data_opt)));
+            pimpl_->buffers_.remember(key, album_key, shared_ptr);
             return shared_ptr;
         }
 
         return nullptr; // Extraction failed
     }
 
+    std::shared_ptr<const std::span<const char>> CoverArtCache::get_cover_art_view(const Music &music) {
+        if (!music.has_cover_art) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(pimpl_->cache_mutex_);
+        const std::string key = music.file_path.string();
+        const std::string album_key = pimpl_->album_key(music);
+
+        // The returned span shares ownership with the mapping, so the mapping lives as long as any handle does
+        auto as_span = [](const std::shared_ptr<const MusicParser::CoverArtView> &view) {
+            return std::shared_ptr<const std::span<const char>>(view, &view->data);
+        };
+
+        if (auto cached = pimpl_->views_.find(key, album_key)) {
+            return as_span(cached);
+        }
+
+        if (auto view = MusicParser::map_cover_art(music.file_path)) {
+            auto holder = std::make_shared<const MusicParser::CoverArtView>(std::move(*view));
+            auto shared_ptr = pimpl_->views_.intern(std::move(holder));
+            if (!shared_ptr) {
+                return nullptr; // The file was truncated after its tags were parsed
+            }
+            pimpl_->views_.remember(key, album_key, shared_ptr);
+            return as_span(shared_ptr);
+        }
+
+        return nullptr; // Extraction failed
+    }
+
+    void CoverArtCache::set_album_hint_enabled(bool enabled) {
+        std::lock_guard<std::mutex> lock(pimpl_->cache_mutex_);
+        pimpl_->album_hint_enabled_ = enabled;
+        if (!enabled) {
+            pimpl_->buffers_.by_album.clear();
+            pimpl_->views_.by_album.clear();
+        }
+    }
+
 } // namespace MusicEngine
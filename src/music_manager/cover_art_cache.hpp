@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <span>
 #include <string>
 #include <vector>
 #include "Music.h"
@@ -26,6 +27,28 @@ namespace MusicEngine {
          */
         std::shared_ptr<const std::vector<char>> get_cover_art(const Music& music);
 
+        /**
+         * @brief Retrieves the cover art as a zero-copy view into the memory-mapped music file.
+         *
+         * The returned handle keeps the mapping alive. Views are deduplicated the same way as buffers:
+         * identical art resolves to a single view (backed by the first file it was found in).
+         *
+         * @param music The Music object for which to retrieve the cover art.
+         * @return A shared pointer to the image bytes, or nullptr if no cover art exists.
+         */
+        std::shared_ptr<const std::span<const char>> get_cover_art_view(const Music& music);
+
+        /**
+         * @brief Enables or disables the album fast path.
+         *
+         * When enabled, tracks that share (album artist, album) are served the cover art of the first
+         * extracted track without opening their files. Identical art is always shared by content hash,
+         * regardless of this setting. Disabled by default.
+         *
+         * @param enabled true to use the album fast path.
+         */
+        void set_album_hint_enabled(bool enabled);
+
     private:
         CoverArtCache();
         ~CoverArtCache();
@@ -0,0 +1,313 @@
+#include "cover_art_locator.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace MusicParser {
+
+    namespace {
+
+        using Bytes = std::span<const char>;
+
+        // ID3v2 picture type of the front cover
+        constexpr uint8_t FRONT_COVER = 3;
+
+        uint32_t read_be32(const char *p) {
+            const auto *u = reinterpret_cast<const uint8_t *>(p);
+            return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) | (uint32_t(u[2]) << 8) | uint32_t(u[3]);
+        }
+
+        uint32_t read_be24(const char *p) {
+            const auto *u = reinterpret_cast<const uint8_t *>(p);
+            return (uint32_t(u[0]) << 16) | (uint32_t(u[1]) << 8) | uint32_t(u[2]);
+        }
+
+        uint64_t read_be64(const char *p) { return (uint64_t(read_be32(p)) << 32) | read_be32(p + 4); }
+
+        // ID3v2 sizes store 7 bits per byte
+        uint32_t read_synchsafe32(const char *p) {
+            const auto *u = reinterpret_cast<const uint8_t *>(p);
+            return (uint32_t(u[0] & 0x7f) << 21) | (uint32_t(u[1] & 0x7f) << 14) | (uint32_t(u[2] & 0x7f) << 7) |
+                   uint32_t(u[3] & 0x7f);
+        }
+
+        bool starts_with(Bytes bytes, std::string_view magic) {
+            return bytes.size() >= magic.size() && std::memcmp(bytes.data(), magic.data(), magic.size()) == 0;
+        }
+
+        // Skips a text string terminated according to the ID3 text encoding. Returns the offset past the terminator.
+        std::optional<size_t> skip_id3_string(Bytes body, size_t offset, uint8_t encoding) {
+            const bool wide = encoding == 1 || encoding == 2; // UTF-16 with or without BOM
+            if (wide) {
+                for (size_t i = offset; i + 1 < body.size(); i += 2) {
+                    if (body[i] == 0 && body[i + 1] == 0) {
+                        return i + 2;
+                    }
+                }
+            } else {
+                for (size_t i = offset; i < body.size(); ++i) {
+                    if (body[i] == 0) {
+                        return i + 1;
+                    }
+                }
+            }
+            return std::nullopt;
+        }
+
+        struct Picture {
+            Bytes data;
+            uint8_t type = 0;
+        };
+
+        // Keeps the front cover if there is one, otherwise the first picture seen
+        void consider(std::optional<Picture> &best, const Picture &candidate) {
+            if (candidate.data.empty()) {
+                return;
+            }
+            if (!best || (best->type != FRONT_COVER && candidate.type == FRONT_COVER)) {
+                best = candidate;
+            }
+        }
+
+        // APIC (v2.3/v2.4): encoding, MIME\0, picture type, description\0, data
+        std::optional<Picture> parse_apic(Bytes body) {
+            if (body.size() < 4) {
+                return std::nullopt;
+            }
+            const auto encoding = static_cast<uint8_t>(body[0]);
+            auto mime_end = skip_id3_string(body, 1, 0); // MIME type is always Latin-1
+            if (!mime_end || *mime_end >= body.size()) {
+                return std::nullopt;
+            }
+            const auto type = static_cast<uint8_t>(body[*mime_end]);
+            auto desc_end = skip_id3_string(body, *mime_end + 1, encoding);
+            if (!desc_end) {
+                return std::nullopt;
+            }
+            return Picture{body.subspan(*desc_end), type};
+        }
+
+        // PIC (v2.2): encoding, 3-byte image format, picture type, description\0, data
+        std::optional<Picture> parse_pic(Bytes body) {
+            if (body.size() < 6) {
+                return std::nullopt;
+            }
+            const auto encoding = static_cast<uint8_t>(body[0]);
+            const auto type = static_cast<uint8_t>(body[4]);
+            auto desc_end = skip_id3_string(body, 5, encoding);
+            if (!desc_end) {
+                return std::nullopt;
+            }
+            return Picture{body.subspan(*desc_end), type};
+        }
+
+        // Returns the total size of the ID3v2 tag at the start of `file`, or 0 if there is none
+        size_t id3_tag_size(Bytes file) {
+            if (file.size() < 10 || !starts_with(file, "ID3")) {
+                return 0;
+            }
+            const auto flags = static_cast<uint8_t>(file[5]);
+            size_t size = 10 + read_synchsafe32(file.data() + 6);
+            if (flags & 0x10) {
+                size += 10; // Footer present
+            }
+            return size;
+        }
+
+        std::optional<Picture> find_in_id3(Bytes file) {
+            const size_t tag_size = id3_tag_size(file);
+            if (tag_size == 0 || tag_size > file.size()) {
+                return std::nullopt;
+            }
+
+            const int version = static_cast<uint8_t>(file[3]);
+            const auto tag_flags = static_cast<uint8_t>(file[5]);
+            // Whole-tag unsynchronisation in v2.2/v2.3 rewrites the image bytes; they cannot be served in place
+            if (version < 4 && (tag_flags & 0x80)) {
+                return std::nullopt;
+            }
+
+            Bytes tag = file.subspan(0, 10 + read_synchsafe32(file.data() + 6));
+            size_t pos = 10;
+
+            if (version >= 3 && (tag_flags & 0x40)) {
+                // Extended header: v2.3 size excludes its own 4 bytes, v2.4 size is synchsafe and inclusive
+                if (pos + 4 > tag.size()) {
+                    return std::nullopt;
+                }
+                pos += version == 3 ? 4 + read_be32(tag.data() + pos) : read_synchsafe32(tag.data() + pos);
+            }
+
+            const size_t header_size = version == 2 ? 6 : 10;
+            std::optional<Picture> best;
+
+            while (pos + header_size <= tag.size()) {
+                const char *header = tag.data() + pos;
+                if (header[0] == 0) {
+                    break; // Padding
+                }
+
+                size_t frame_size;
+                uint16_t frame_flags = 0;
+                if (version == 2) {
+                    frame_size = read_be24(header + 3);
+                } else {
+                    frame_size = version == 4 ? read_synchsafe32(header + 4) : read_be32(header + 4);
+                    frame_flags = static_cast<uint16_t>((uint8_t(header[8]) << 8) | uint8_t(header[9]));
+                }
+
+                if (pos + header_size + frame_size > tag.size()) {
+                    break;
+                }
+                Bytes body = tag.subspan(pos + header_size, frame_size);
+
+                if (version == 2 && std::memcmp(header, "PIC", 3) == 0) {
+                    if (auto pic = parse_pic(body)) {
+                        consider(best, *pic);
+                    }
+                } else if (version >= 3 && std::memcmp(header, "APIC", 4) == 0) {
+                    // v2.3: 0x0080 compression, 0x0040 encryption, 0x0020 grouping identity. v2.4: 0x0040 grouping
+                    // identity, 0x0008 compression, 0x0004 encryption, 0x0002 unsynchronisation, 0x0001 data length
+                    // indicator. The grouping byte and the data length indicator precede the frame data in that order
+                    const bool transformed = version == 3 ? (frame_flags & 0x00c0) != 0 : (frame_flags & 0x000e) != 0;
+                    if (!transformed) {
+                        const bool grouped = version == 3 ? (frame_flags & 0x0020) != 0 : (frame_flags & 0x0040) != 0;
+                        const size_t prefix = (grouped ? 1 : 0) + (version == 4 && (frame_flags & 0x0001) ? 4 : 0);
+                        body = body.subspan(std::min(prefix, body.size()));
+                        if (auto pic = parse_apic(body)) {
+                            consider(best, *pic);
+                        }
+                    }
+                }
+
+                pos += header_size + frame_size;
+            }
+
+            return best;
+        }
+
+        std::optional<Picture> find_in_flac(Bytes file) {
+            // FLAC files occasionally carry an ID3v2 tag in front of the stream marker
+            Bytes stream = file.subspan(std::min(id3_tag_size(file), file.size()));
+            if (!starts_with(stream, "fLaC")) {
+                return std::nullopt;
+            }
+
+            std::optional<Picture> best;
+            size_t pos = 4;
+            bool last = false;
+            while (!last && pos + 4 <= stream.size()) {
+                const auto header = static_cast<uint8_t>(stream[pos]);
+                last = header & 0x80;
+                const int block_type = header & 0x7f;
+                const size_t length = read_be24(stream.data() + pos + 1);
+                pos += 4;
+                if (pos + length > stream.size()) {
+                    break;
+                }
+
+                if (block_type == 6) {
+                    // METADATA_BLOCK_PICTURE: type, MIME, description, 4 x dimension fields, data
+                    Bytes block = stream.subspan(pos, length);
+                    size_t p = 0;
+                    auto field = [&](size_t n) -> std::optional<uint32_t> {
+                        if (p + n > block.size())
+                            return std::nullopt;
+                        uint32_t v = read_be32(block.data() + p);
+                        p += n;
+                        return v;
+                    };
+                    auto type = field(4);
+                    auto mime_len = field(4);
+                    if (type && mime_len && (p += *mime_len) <= block.size()) {
+                        auto desc_len = field(4);
+                        if (desc_len && (p += *desc_len) + 16 <= block.size()) {
+                            p += 16;
+                            auto data_len = field(4);
+                            if (data_len && p + *data_len <= block.size()) {
+                                consider(best, Picture{block.subspan(p, *data_len), static_cast<uint8_t>(*type)});
+                            }
+                        }
+                    }
+                }
+
+                pos += length;
+            }
+            return best;
+        }
+
+        // Walks the children of an MP4 container and returns the payload of the first child of the given type
+        std::optional<Bytes> find_atom(Bytes container, std::string_view type) {
+            size_t pos = 0;
+            while (pos + 8 <= container.size()) {
+                uint64_t size = read_be32(container.data() + pos);
+                size_t header = 8;
+                if (size == 1) {
+                    if (pos + 16 > container.size())
+                        break;
+                    size = read_be64(container.data() + pos + 8);
+                    header = 16;
+                } else if (size == 0) {
+                    size = container.size() - pos; // Extends to the end of the container
+                }
+                if (size < header || size > container.size() - pos) { // Written so a 64-bit size can't wrap around
+                    break;
+                }
+                if (std::memcmp(container.data() + pos + 4, type.data(), 4) == 0) {
+                    return container.subspan(pos + header, size - header);
+                }
+                pos += size;
+            }
+            return std::nullopt;
+        }
+
+        std::optional<Picture> find_in_mp4(Bytes file) {
+            if (file.size() < 8 || std::memcmp(file.data() + 4, "ftyp", 4) != 0) {
+                return std::nullopt;
+            }
+
+            auto moov = find_atom(file, "moov");
+            auto udta = moov ? find_atom(*moov, "udta") : std::nullopt;
+            auto meta = udta ? find_atom(*udta, "meta") : std::nullopt;
+            if (!meta) {
+                return std::nullopt;
+            }
+            // ISO 'meta' is a full box with 4 bytes of version/flags; some QuickTime writers omit them
+            if (meta->size() >= 8 && std::memcmp(meta->data() + 4, "hdlr", 4) != 0) {
+                *meta = meta->subspan(4);
+            }
+
+            auto ilst = find_atom(*meta, "ilst");
+            auto covr = ilst ? find_atom(*ilst, "covr") : std::nullopt;
+            auto data = covr ? find_atom(*covr, "data") : std::nullopt;
+            // 'data' payload: 4 bytes type indicator, 4 bytes locale, then the image
+            if (!data || data->size() <= 8) {
+                return std::nullopt;
+            }
+            return Picture{data->subspan(8), FRONT_COVER};
+        }
+
+    } // namespace
+
+    std::optional<std::span<const char>> locate_cover_art(std::span<const char> file) {
+        std::optional<Picture> picture;
+        if (starts_with(file, "ID3")) {
+            picture = find_in_id3(file);
+            if (!picture) {
+                picture = find_in_flac(file);
+            }
+        } else if (starts_with(file, "fLaC")) {
+            picture = find_in_flac(file);
+        } else {
+            picture = find_in_mp4(file);
+        }
+
+        if (picture) {
+            return picture->data;
+        }
+        return std::nullopt;
+    }
+
+} // namespace MusicParser
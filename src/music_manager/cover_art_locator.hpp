@@ -0,0 +1,21 @@
+#pragma once
+
+#include <optional>
+#include <span>
+
+namespace MusicParser {
+
+    /**
+     * @brief Finds the embedded cover image inside the raw bytes of a music file without demuxing it.
+     *
+     * Understands ID3v2 APIC/PIC frames (MP3, and ID3-prefixed FLAC), FLAC METADATA_BLOCK_PICTURE and the
+     * MP4/M4A `moov.udta.meta.ilst.covr` atom. A front cover is preferred when several pictures are present.
+     * Frames that are unsynchronised, compressed or encrypted cannot be served in place and are reported as
+     * not found, so the caller can fall back to FFmpeg.
+     *
+     * @param file The complete file contents (typically a memory mapping).
+     * @return A sub-span of @p file holding the image bytes, or std::nullopt.
+     */
+    std::optional<std::span<const char>> locate_cover_art(std::span<const char> file);
+
+} // namespace MusicParser
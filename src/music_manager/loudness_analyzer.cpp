@@ -0,0 +1,350 @@
+#include "loudness_analyzer.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <numbers>
+#include "decoder.h"
+
+namespace MusicEngine {
+
+    namespace {
+
+        // ITU-R BS.1770-4 Annex 2: 48-tap interpolation filter for 4x oversampling, split into its four phases
+        constexpr float OVERSAMPLING_PHASES[4][12] = {
+                {0.0017089843750f, 0.0109863281250f, -0.0196533203125f, 0.0332031250000f, -0.0594482421875f,
+                 0.1373291015625f, 0.9721679687500f, -0.1022949218750f, 0.0476074218750f, -0.0266113281250f,
+                 0.0148925781250f, -0.0083007812500f},
+                {-0.0291748046875f, 0.0292968750000f, -0.0517578125000f, 0.0891113281250f, -0.1665039062500f,
+                 0.4650878906250f, 0.7797851562500f, -0.2003173828125f, 0.1015625000000f, -0.0582275390625f,
+                 0.0330810546875f, -0.0189208984375f},
+                {-0.0189208984375f, 0.0330810546875f, -0.0582275390625f, 0.1015625000000f, -0.2003173828125f,
+                 0.7797851562500f, 0.4650878906250f, -0.1665039062500f, 0.0891113281250f, -0.0517578125000f,
+                 0.0292968750000f, -0.0291748046875f},
+                {-0.0083007812500f, 0.0148925781250f, -0.0266113281250f, 0.0476074218750f, -0.1022949218750f,
+                 0.9721679687500f, 0.1373291015625f, -0.0594482421875f, 0.0332031250000f, -0.0196533203125f,
+                 0.0109863281250f, 0.0017089843750f},
+        };
+
+        constexpr double RELATIVE_GATE_LU = -10.0;
+        constexpr size_t ANALYSIS_BLOCK_FRAMES = 4096;
+        constexpr const char *STORE_HEADER = "# MusicEngine loudness v1";
+
+        double block_loudness(double mean_square) { return -0.691 + 10.0 * std::log10(mean_square); }
+
+        // Mean square of the blocks in a histogram bin, taken at the centre of the bin
+        double bin_energy(size_t bin) {
+            const double lufs = LoudnessMeter::ABSOLUTE_GATE_LUFS + (static_cast<double>(bin) + 0.5) / 10.0;
+            return std::pow(10.0, (lufs + 0.691) / 10.0);
+        }
+
+        template<typename T>
+        bool parse_field(std::string_view &line, T &value) {
+            const size_t tab = line.find('\t');
+            if (tab == std::string_view::npos) {
+                return false;
+            }
+            const auto result = std::from_chars(line.data(), line.data() + tab, value);
+            line.remove_prefix(tab + 1);
+            return result.ec == std::errc{};
+        }
+
+    } // namespace
+
+    // ------------------- LoudnessMeter -------------------
+
+    LoudnessMeter::LoudnessMeter(int sample_rate, int channels)
+        : channels_(channels), hop_frames_(std::max<size_t>(static_cast<size_t>(sample_rate) / 10, 1)),
+          states_(static_cast<size_t>(channels)), bins_(HISTOGRAM_BINS, 0) {
+        // K-weighting for an arbitrary sample rate: the BS.1770 high shelf and high-pass, designed from their
+        // analog prototypes (the standard only tabulates the coefficients for 48 kHz)
+        const double rate = static_cast<double>(sample_rate);
+        {
+            const double f0 = 1681.974450955533;
+            const double gain_db = 3.999843853973347;
+            const double q = 0.7071752369554196;
+            const double k = std::tan(std::numbers::pi * f0 / rate);
+            const double vh = std::pow(10.0, gain_db / 20.0);
+            const double vb = std::pow(vh, 0.4996667741545416);
+            const double a0 = 1.0 + k / q + k * k;
+            shelf_ = {(vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+                      2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+        }
+        {
+            const double f0 = 38.13547087602444;
+            const double q = 0.5003270373238773;
+            const double k = std::tan(std::numbers::pi * f0 / rate);
+            const double a0 = 1.0 + k / q + k * k;
+            highpass_ = {1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+        }
+
+        // Channel weights for a 5.1 layout (L R C LFE Ls Rs): the LFE is ignored, surrounds count +1.5 dB
+        if (channels >= 6) {
+            states_[3].weight = 0.0;
+            states_[4].weight = 1.41;
+            states_[5].weight = 1.41;
+        }
+    }
+
+    void LoudnessMeter::add_frames(const float *samples, size_t frames) {
+        for (size_t f = 0; f < frames; ++f) {
+            for (int ch = 0; ch < channels_; ++ch) {
+                ChannelState &state = states_[static_cast<size_t>(ch)];
+                const float x = samples[f * static_cast<size_t>(channels_) + static_cast<size_t>(ch)];
+
+                // True peak: run the oversampling filter over the last 12 input samples
+                std::copy_backward(state.history, state.history + 11, state.history + 12);
+                state.history[0] = x;
+                double peak = std::fabs(x);
+                for (const auto &phase: OVERSAMPLING_PHASES) {
+                    float y = 0.0f;
+                    for (int k = 0; k < 12; ++k) {
+                        y += phase[k] * state.history[k];
+                    }
+                    peak = std::max(peak, static_cast<double>(std::fabs(y)));
+                }
+                true_peak_ = std::max(true_peak_, peak);
+
+                // K-weighting: high shelf followed by high-pass
+                const double s = shelf_.b0 * x + state.z[0];
+                state.z[0] = shelf_.b1 * x - shelf_.a1 * s + state.z[1];
+                state.z[1] = shelf_.b2 * x - shelf_.a2 * s;
+                const double h = highpass_.b0 * s + state.z[2];
+                state.z[2] = highpass_.b1 * s - highpass_.a1 * h + state.z[3];
+                state.z[3] = highpass_.b2 * s - highpass_.a2 * h;
+                hop_energy_ += state.weight * h * h;
+            }
+
+            if (++hop_position_ < hop_frames_) {
+                continue;
+            }
+
+            // A 100 ms step is complete; the last four make up the next 400 ms gating block
+            hop_energies_[hops_ % 4] = hop_energy_;
+            hop_energy_ = 0.0;
+            hop_position_ = 0;
+            if (++hops_ < 4) {
+                continue;
+            }
+            const double mean_square =
+                    (hop_energies_[0] + hop_energies_[1] + hop_energies_[2] + hop_energies_[3]) / (4.0 * hop_frames_);
+            const double lufs = mean_square > 0.0 ? block_loudness(mean_square) : ABSOLUTE_GATE_LUFS - 1.0;
+            if (lufs > ABSOLUTE_GATE_LUFS) {
+                const auto bin = static_cast<size_t>((lufs - ABSOLUTE_GATE_LUFS) * 10.0);
+                ++bins_[std::min<size_t>(bin, HISTOGRAM_BINS - 1)];
+            }
+        }
+    }
+
+    LoudnessMeter::BlockHistogram LoudnessMeter::histogram() const {
+        BlockHistogram histogram;
+        for (size_t bin = 0; bin < bins_.size(); ++bin) {
+            if (bins_[bin] != 0) {
+                histogram.emplace_back(static_cast<uint16_t>(bin), bins_[bin]);
+            }
+        }
+        return histogram;
+    }
+
+    double LoudnessMeter::integrated_lufs(std::span<const BlockHistogram *const> histograms) {
+        std::vector<double> counts(HISTOGRAM_BINS, 0.0);
+        for (const BlockHistogram *histogram: histograms) {
+            for (const auto &[bin, count]: *histogram) {
+                if (bin < HISTOGRAM_BINS) {
+                    counts[bin] += count;
+                }
+            }
+        }
+
+        // Absolute gate: every block in the histogram is already louder than -70 LUFS
+        double blocks = 0.0;
+        double energy = 0.0;
+        for (size_t bin = 0; bin < counts.size(); ++bin) {
+            blocks += counts[bin];
+            energy += counts[bin] * bin_energy(bin);
+        }
+        if (blocks == 0.0) {
+            return ABSOLUTE_GATE_LUFS;
+        }
+
+        // Relative gate: drop blocks more than 10 LU below the loudness of the blocks that passed the first gate
+        const double gate = block_loudness(energy / blocks) + RELATIVE_GATE_LU;
+        const double first = std::ceil((gate - ABSOLUTE_GATE_LUFS) * 10.0 - 0.5);
+        blocks = 0.0;
+        energy = 0.0;
+        for (size_t bin = static_cast<size_t>(std::max(first, 0.0)); bin < counts.size(); ++bin) {
+            blocks += counts[bin];
+            energy += counts[bin] * bin_energy(bin);
+        }
+        return blocks > 0.0 ? block_loudness(energy / blocks) : ABSOLUTE_GATE_LUFS;
+    }
+
+    // ------------------- Analysis -------------------
+
+    bool stat_for_loudness(const std::filesystem::path &file_path, int64_t &modified, uintmax_t &size) {
+        std::error_code ec;
+        const auto time = std::filesystem::last_write_time(file_path, ec);
+        if (ec) {
+            return false;
+        }
+        size = std::filesystem::file_size(file_path, ec);
+        modified = static_cast<int64_t>(time.time_since_epoch().count());
+        return !ec;
+    }
+
+    std::optional<LoudnessRecord> analyze_loudness(const std::filesystem::path &file_path,
+                                                   const std::atomic<bool> &cancel,
+                                                   const std::shared_ptr<spdlog::logger> &logger) {
+        LoudnessRecord record;
+        if (!stat_for_loudness(file_path, record.modified, record.size)) {
+            logger->warn("Loudness analysis: cannot stat {}", file_path.string());
+            return std::nullopt;
+        }
+
+        // Measured at the file's own rate; multichannel sources are measured on their stereo downmix
+        Decoder decoder;
+        if (!decoder.open(file_path)) {
+            logger->warn("Loudness analysis: cannot decode {}", file_path.string());
+            return std::nullopt;
+        }
+        const AudioFormat format = decoder.format();
+        LoudnessMeter meter(format.sample_rate, format.channels);
+        std::vector<float> buffer(ANALYSIS_BLOCK_FRAMES * static_cast<size_t>(format.channels));
+        while (!cancel.load(std::memory_order_relaxed)) {
+            const size_t frames = decoder.read(buffer);
+            if (frames == 0) {
+                break;
+            }
+            meter.add_frames(buffer.data(), frames);
+        }
+        if (cancel.load(std::memory_order_relaxed) || !decoder.eof()) {
+            return std::nullopt;
+        }
+
+        // The file may have been rewritten while we were reading it
+        int64_t modified = 0;
+        uintmax_t size = 0;
+        if (!stat_for_loudness(file_path, modified, size) || modified != record.modified || size != record.size) {
+            logger->warn("Loudness analysis: {} changed while being analyzed", file_path.string());
+            return std::nullopt;
+        }
+
+        record.histogram = meter.histogram();
+        const LoudnessMeter::BlockHistogram *histograms[] = {&record.histogram};
+        record.integrated_lufs = LoudnessMeter::integrated_lufs(histograms);
+        // Silence has no meaningful peak in dB; keep it finite so it can be stored and parsed
+        record.true_peak_dbtp = std::max(20.0 * std::log10(meter.true_peak()), -120.0);
+        logger->debug("Loudness of {}: {:.1f} LUFS, {:.1f} dBTP", file_path.string(), record.integrated_lufs,
+                      record.true_peak_dbtp);
+        return record;
+    }
+
+    // ------------------- LoudnessStore -------------------
+
+    // One record per line: modified, size, loudness, peak, histogram (bin:count,...) and the path, tab separated.
+    // Later lines replace earlier ones for the same path.
+    bool LoudnessStore::attach(const std::filesystem::path &file_path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        file_path_.clear();
+
+        size_t lines = 0;
+        std::error_code ec;
+        if (std::filesystem::exists(file_path, ec)) {
+            std::ifstream in(file_path);
+            if (!in) {
+                logger_->error("Cannot read loudness store: {}", file_path.string());
+                return false;
+            }
+            std::string line;
+            while (std::getline(in, line)) {
+                if (line.empty() || line[0] == '#') {
+                    continue;
+                }
+                ++lines;
+                std::string_view rest = line;
+                auto record = std::make_shared<LoudnessRecord>();
+                if (!parse_field(rest, record->modified) || !parse_field(rest, record->size) ||
+                    !parse_field(rest, record->integrated_lufs) || !parse_field(rest, record->true_peak_dbtp)) {
+                    logger_->warn("Skipping malformed line in loudness store: {}", line);
+                    continue;
+                }
+                const size_t tab = rest.find('\t');
+                if (tab == std::string_view::npos) {
+                    logger_->warn("Skipping malformed line in loudness store: {}", line);
+                    continue;
+                }
+                std::string_view bins = rest.substr(0, tab);
+                while (!bins.empty()) {
+                    uint16_t bin = 0;
+                    uint32_t count = 0;
+                    auto result = std::from_chars(bins.data(), bins.data() + bins.size(), bin);
+                    if (result.ec != std::errc{} || result.ptr == bins.data() + bins.size() || *result.ptr != ':') {
+                        break;
+                    }
+                    result = std::from_chars(result.ptr + 1, bins.data() + bins.size(), count);
+                    if (result.ec != std::errc{}) {
+                        break;
+                    }
+                    record->histogram.emplace_back(bin, count);
+                    bins.remove_prefix(static_cast<size_t>(result.ptr - bins.data()));
+                    if (!bins.empty()) {
+                        bins.remove_prefix(1); // ','
+                    }
+                }
+                records_[std::string(rest.substr(tab + 1))] = std::move(record);
+            }
+        }
+
+        // Rewrite the file when it has accumulated superseded lines, then keep appending to it
+        const bool compact = lines > records_.size() || lines == 0;
+        std::ofstream out(file_path, compact ? std::ios::trunc : std::ios::app);
+        if (!out) {
+            logger_->error("Cannot write loudness store: {}", file_path.string());
+            return false;
+        }
+        if (compact) {
+            out << STORE_HEADER << '\n';
+            for (const auto &[key, record]: records_) {
+                append_line(out, key, *record);
+            }
+        }
+        file_path_ = file_path;
+        logger_->info("Loudness store {} attached with {} records.", file_path.string(), records_.size());
+        return true;
+    }
+
+    std::shared_ptr<const LoudnessRecord> LoudnessStore::find(const std::filesystem::path &file_path,
+                                                              int64_t modified, uintmax_t size) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = records_.find(file_path.string());
+        if (it == records_.end() || it->second->modified != modified || it->second->size != size) {
+            return nullptr;
+        }
+        return it->second;
+    }
+
+    void LoudnessStore::put(const std::filesystem::path &file_path, LoudnessRecord record) {
+        const std::string key = file_path.string();
+        auto shared = std::make_shared<const LoudnessRecord>(std::move(record));
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!file_path_.empty()) {
+            std::ofstream out(file_path_, std::ios::app);
+            if (!out || !append_line(out, key, *shared)) {
+                logger_->warn("Failed to append to loudness store: {}", file_path_.string());
+            }
+        }
+        records_[key] = std::move(shared);
+    }
+
+    bool LoudnessStore::append_line(std::ostream &out, const std::string &key, const LoudnessRecord &record) const {
+        std::string bins;
+        for (const auto &[bin, count]: record.histogram) {
+            bins += fmt::format("{}{}:{}", bins.empty() ? "" : ",", bin, count);
+        }
+        out << fmt::format("{}\t{}\t{:.3f}\t{:.3f}\t{}\t{}\n", record.modified, record.size, record.integrated_lufs,
+                           record.true_peak_dbtp, bins, key);
+        return static_cast<bool>(out);
+    }
+
+} // namespace MusicEngine
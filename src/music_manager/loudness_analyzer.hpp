@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "spdlog/spdlog.h"
+
+namespace MusicEngine {
+
+    /**
+     * @class LoudnessMeter
+     * @brief Measures integrated loudness and true peak of interleaved F32 PCM (EBU R128 / ITU-R BS.1770-4).
+     *
+     * Samples are K-weighted, squared and averaged over 400 ms blocks that overlap by 75%. The loudness of each
+     * block is kept in a histogram of 0.1 LU bins, so that the gated integrated loudness of several tracks (an
+     * album) can be computed from their histograms alone. True peak is found by 4x oversampling.
+     */
+    class LoudnessMeter {
+    public:
+        // Non-empty histogram bins as (bin, number of blocks), sorted by bin. Bin `i` covers
+        // [-70 + i / 10, -70 + (i + 1) / 10) LUFS.
+        using BlockHistogram = std::vector<std::pair<uint16_t, uint32_t>>;
+
+        static constexpr double ABSOLUTE_GATE_LUFS = -70.0;
+
+        LoudnessMeter(int sample_rate, int channels);
+
+        void add_frames(const float *samples, size_t frames);
+
+        BlockHistogram histogram() const;
+
+        // Highest sample or inter-sample peak so far, linear
+        double true_peak() const { return true_peak_; }
+
+        /**
+         * @brief Gated integrated loudness over the blocks of all given histograms.
+         * @return The loudness in LUFS, or ABSOLUTE_GATE_LUFS if no block is louder than that (silence).
+         */
+        static double integrated_lufs(std::span<const BlockHistogram *const> histograms);
+
+    private:
+        struct Biquad {
+            double b0, b1, b2, a1, a2;
+        };
+        struct ChannelState {
+            double z[4] = {}; // Transposed direct form II state of both K-weighting stages
+            float history[12] = {}; // Last input samples for the oversampling filter, newest first
+            double weight = 1.0;
+        };
+
+        static constexpr int HISTOGRAM_BINS = 1000; // -70 to +30 LUFS
+
+        int channels_;
+        size_t hop_frames_; // 100 ms
+        Biquad shelf_{};
+        Biquad highpass_{};
+        std::vector<ChannelState> states_;
+
+        double hop_energy_ = 0.0;
+        size_t hop_position_ = 0;
+        double hop_energies_[4] = {}; // The last four 100 ms sub-blocks make up one 400 ms block
+        size_t hops_ = 0;
+        std::vector<uint32_t> bins_;
+        double true_peak_ = 0.0;
+    };
+
+    /**
+     * @brief Loudness measurements of one file, tied to the file's modification time and size.
+     */
+    struct LoudnessRecord {
+        int64_t modified = 0; // file_time_type ticks
+        uintmax_t size = 0;
+        double integrated_lufs = LoudnessMeter::ABSOLUTE_GATE_LUFS;
+        double true_peak_dbtp = 0.0;
+        LoudnessMeter::BlockHistogram histogram; // Kept for album loudness
+    };
+
+    /**
+     * @brief Decodes a whole file and measures it.
+     * @param cancel Checked between reads; the analysis gives up when it becomes true.
+     * @return The measurements, or std::nullopt if the file could not be decoded, changed, or was cancelled.
+     */
+    std::optional<LoudnessRecord> analyze_loudness(const std::filesystem::path &file_path,
+                                                   const std::atomic<bool> &cancel,
+                                                   const std::shared_ptr<spdlog::logger> &logger);
+
+    /**
+     * @brief Reads the modification time and size that a LoudnessRecord is validated against.
+     */
+    bool stat_for_loudness(const std::filesystem::path &file_path, int64_t &modified, uintmax_t &size);
+
+    /**
+     * @class LoudnessStore
+     * @brief Thread-safe map of loudness records by file path, optionally backed by a file.
+     *
+     * With a backing file, every new record is appended as soon as it is measured, so an interrupted analysis
+     * loses nothing and the next one carries on where it stopped.
+     */
+    class LoudnessStore {
+    public:
+        explicit LoudnessStore(std::shared_ptr<spdlog::logger> logger) : logger_(std::move(logger)) {}
+
+        /**
+         * @brief Loads the records in @p file_path (if it exists) and appends new records to it from now on.
+         * @return false if the file exists but cannot be read, or cannot be written.
+         */
+        bool attach(const std::filesystem::path &file_path);
+
+        /**
+         * @brief Looks up the record for a file, provided it still matches the file's modification time and size.
+         */
+        std::shared_ptr<const LoudnessRecord> find(const std::filesystem::path &file_path, int64_t modified,
+                                                   uintmax_t size) const;
+
+        void put(const std::filesystem::path &file_path, LoudnessRecord record);
+
+    private:
+        bool append_line(std::ostream &out, const std::string &key, const LoudnessRecord &record) const;
+
+        std::shared_ptr<spdlog::logger> logger_;
+        mutable std::mutex mutex_;
+        std::unordered_map<std::string, std::shared_ptr<const LoudnessRecord>> records_;
+        std::filesystem::path file_path_;
+    };
+
+} // namespace MusicEngine
@@ -5,14 +5,37 @@
 #include <future>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include "cover_art_cache.hpp"
+#include "loudness_analyzer.hpp"
 #include "music_parser.hpp"
 #include "spdlog/sinks/basic_file_sink.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
 #include "spdlog/spdlog.h"
+#include "waveform_cache.hpp"
 
 
 namespace MusicEngine {
+
+    namespace {
+        // Reference loudness of ReplayGain 2.0
+        constexpr double REFERENCE_LUFS = -18.0;
+        // Keeps near-silent tracks from being boosted into noise
+        constexpr double MAX_GAIN_DB = 24.0;
+
+        // Tracks belong to the same album when album artist (or artist) and album match
+        std::string album_key(const Music &music) {
+            const std::string &artist = music.album_artist.empty() ? music.artist : music.album_artist;
+            if (music.album.empty() || artist.empty()) {
+                return {};
+            }
+            return artist + '\x1f' + music.album;
+        }
+
+        double gain_to_reference(double lufs) { return std::clamp(REFERENCE_LUFS - lufs, -MAX_GAIN_DB, MAX_GAIN_DB); }
+    } // namespace
+
     // Pimpl struct to hide private members from the public header.
     struct MusicManager::Impl {
         std::vector<Music> music_database_;
@@ -25,8 +48,16 @@ namespace MusicEngine {
         // Supported music file extensions
         std::vector<std::string> supported_extensions_ = { ".mp3", ".m4a", ".flac", ".wav"};
 
+        // Loudness analysis job and its results
+        std::future<void> loudness_future_;
+        std::atomic<bool> is_analyzing_{false};
+        std::atomic<bool> cancel_analysis_{false};
+        std::unique_ptr<LoudnessStore> loudness_store_;
+
         // Constructor for the Impl struct
         Impl() {}
+
+        void apply_loudness(std::vector<Music> &musics) const;
     };
 
     MusicManager::MusicManager() : pimpl_(std::make_unique<Impl>()) {
@@ -37,6 +68,7 @@ namespace MusicEngine {
         pimpl_->logger_ = spdlog::stdout_color_mt("MusicManager");
         pimpl_->logger_->set_level(spdlog::level::info);
         pimpl_->logger_->info("MusicManager initialized.");
+        pimpl_->loudness_store_ = std::make_unique<LoudnessStore>(pimpl_->logger_);
 
         // Initialize the MusicParser logger
         MusicParser::logger_init();
@@ -44,6 +76,8 @@ namespace MusicEngine {
 
     // Destructor implementation
     MusicManager::~MusicManager() {
+        cancel_loudness_analysis();
+
         // If a background scan is still running when the program exits, wait for it to complete.
         if (pimpl_->scan_future_.valid()) {
             pimpl_->scan_future_.wait();
@@ -113,6 +147,9 @@ namespace MusicEngine {
             size_t count = new_database.size();
             pimpl_->logger_->info("Scan complete. Found {} musics.", count);
 
+            // Carry over loudness results measured earlier
+            pimpl_->apply_loudness(new_database);
+
             {
                 std::lock_guard<std::mutex> lock(pimpl_->db_mutex_);
                 pimpl_->music_database_ = std::move(new_database);
@@ -174,6 +211,10 @@ namespace MusicEngine {
         return results;
     }
 
+    std::optional<Music> MusicManager::create_music_from_source(std::shared_ptr<InputSource> source) const {
+        return MusicParser::create_music_from_source(std::move(source));
+    }
+
     void MusicManager::set_directory_paths(const std::filesystem::path &directory_path) {
         pimpl_->directory_paths_ = {directory_path};
     }
@@ -229,6 +270,14 @@ namespace MusicEngine {
         for (const auto &music: pimpl_->music_database_) {
             auto format_field = [](const std::string &value) { return value.empty() ? "Unknown" : value; };
 
+            const LoudnessInfo &loudness = music.loudness;
+            const std::string loudness_info =
+                    loudness.analyzed ? fmt::format("{:.1f} LUFS, peak {:.1f} dBTP, track gain {:+.1f} dB, "
+                                                    "album gain {:+.1f} dB",
+                                                    loudness.integrated_lufs, loudness.true_peak_dbtp,
+                                                    loudness.track_gain_db, loudness.album_gain_db)
+                                      : "Not analyzed";
+
             // Format the output string
             std::string music_info =
                     fmt::format("Title: {}\n"
@@ -239,10 +288,12 @@ namespace MusicEngine {
                                 "Duration: {} seconds\n"
                                 "File Path: {}\n"
                                 "Has Cover Art: {}\n"
+                                "Loudness: {}\n"
                                 "----------------------------",
                                 format_field(music.title), format_field(music.artist), format_field(music.album),
                                 format_field(music.genre), music.year == 0 ? "Unknown" : std::to_string(music.year),
-                                music.duration, music.file_path.string(), (music.has_cover_art ? "Yes" : "No"));
+                                music.duration, music.file_path.string(), (music.has_cover_art ? "Yes" : "No"),
+                                loudness_info);
 
             // Write to the file
             file_logger->info(music_info);
@@ -282,4 +333,162 @@ namespace MusicEngine {
         return CoverArtCache::get_instance().get_cover_art(music);
     }
 
-} // namespace MusicEngine
+    std::shared_ptr<const std::span<const char>> MusicManager::get_cover_art_view(const Music &music) const {
+        return CoverArtCache::get_instance().get_cover_art_view(music);
+    }
+
+    void MusicManager::set_cover_art_album_hint(bool enabled) {
+        CoverArtCache::get_instance().set_album_hint_enabled(enabled);
+    }
+
+    void MusicManager::request_waveform(
+            const Music &music, const std::function<void(std::shared_ptr<const WaveformSummary>)> &on_ready) const {
+        WaveformCache::get_instance().request(music.file_path, on_ready);
+    }
+
+    std::shared_ptr<const WaveformSummary> MusicManager::get_cached_waveform(const Music &music) const {
+        return WaveformCache::get_instance().find(music.file_path);
+    }
+
+    void MusicManager::set_waveform_cache_directory(const std::filesystem::path &directory) {
+        WaveformCache::get_instance().set_cache_directory(directory);
+    }
+
+    // Fills Music::loudness from the store: track values per file, album gain over the blocks of each album
+    void MusicManager::Impl::apply_loudness(std::vector<Music> &musics) const {
+        std::vector<std::shared_ptr<const LoudnessRecord>> records(musics.size());
+        std::unordered_map<std::string, std::vector<const LoudnessMeter::BlockHistogram *>> albums;
+        for (size_t i = 0; i < musics.size(); ++i) {
+            int64_t modified = 0;
+            uintmax_t size = 0;
+            if (stat_for_loudness(musics[i].file_path, modified, size)) {
+                records[i] = loudness_store_->find(musics[i].file_path, modified, size);
+            }
+            if (const std::string key = album_key(musics[i]); records[i] && !key.empty()) {
+                albums[key].push_back(&records[i]->histogram);
+            }
+        }
+
+        std::unordered_map<std::string, double> album_lufs;
+        for (const auto &[key, histograms]: albums) {
+            album_lufs[key] = LoudnessMeter::integrated_lufs(histograms);
+        }
+
+        for (size_t i = 0; i < musics.size(); ++i) {
+            LoudnessInfo info;
+            if (const auto &record = records[i]) {
+                info.analyzed = true;
+                info.integrated_lufs = record->integrated_lufs;
+                info.true_peak_dbtp = record->true_peak_dbtp;
+                info.track_gain_db = gain_to_reference(record->integrated_lufs);
+                // A track without album information is its own album
+                auto it = album_lufs.find(album_key(musics[i]));
+                info.album_gain_db = it != album_lufs.end() ? gain_to_reference(it->second) : info.track_gain_db;
+            }
+            musics[i].loudness = info;
+        }
+    }
+
+    bool MusicManager::start_loudness_analysis(const std::function<void(size_t)> &on_finished, unsigned threads) {
+        if (pimpl_->is_analyzing_.exchange(true)) {
+            pimpl_->logger_->warn("Warning: A loudness analysis is already in progress.");
+            return false;
+        }
+
+        std::vector<std::filesystem::path> paths;
+        {
+            std::lock_guard<std::mutex> lock(pimpl_->db_mutex_);
+            for (const auto &music: pimpl_->music_database_) {
+                paths.push_back(music.file_path);
+            }
+        }
+        if (paths.empty()) {
+            pimpl_->logger_->warn("Database is empty. Nothing to analyze.");
+            pimpl_->is_analyzing_ = false;
+            return false;
+        }
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        // The previous job has finished (is_analyzing_ was false); release its future before starting another
+        if (pimpl_->loudness_future_.valid()) {
+            pimpl_->loudness_future_.wait();
+        }
+        pimpl_->cancel_analysis_ = false;
+
+        pimpl_->loudness_future_ = std::async(std::launch::async, [this, paths = std::move(paths), threads,
+                                                                   on_finished]() {
+            // Incremental: only files without an up-to-date result are decoded
+            std::vector<std::filesystem::path> pending;
+            for (const auto &path: paths) {
+                int64_t modified = 0;
+                uintmax_t size = 0;
+                if (stat_for_loudness(path, modified, size) && !pimpl_->loudness_store_->find(path, modified, size)) {
+                    pending.push_back(path);
+                }
+            }
+            const unsigned workers_count = static_cast<unsigned>(std::min<size_t>(threads, pending.size()));
+            pimpl_->logger_->info("Loudness analysis started: {} of {} tracks to analyze on {} threads.",
+                                  pending.size(), paths.size(), workers_count);
+
+            // Workers take the next file from a shared counter; each result is stored as soon as it's measured
+            std::atomic<size_t> next{0};
+            std::atomic<size_t> analyzed{0};
+            auto worker = [&]() {
+                for (size_t i = next++; i < pending.size() && !pimpl_->cancel_analysis_; i = next++) {
+                    if (auto record = analyze_loudness(pending[i], pimpl_->cancel_analysis_, pimpl_->logger_)) {
+                        pimpl_->loudness_store_->put(pending[i], std::move(*record));
+                        ++analyzed;
+                    }
+                }
+            };
+            std::vector<std::thread> workers;
+            for (unsigned i = 0; i < workers_count; ++i) {
+                workers.emplace_back(worker);
+            }
+            for (auto &thread: workers) {
+                thread.join();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(pimpl_->db_mutex_);
+                pimpl_->apply_loudness(pimpl_->music_database_);
+            }
+
+            const size_t count = analyzed;
+            if (pimpl_->cancel_analysis_) {
+                pimpl_->logger_->info("Loudness analysis cancelled after {} tracks.", count);
+            } else {
+                pimpl_->logger_->info("Loudness analysis complete. Analyzed {} tracks.", count);
+            }
+
+            if (on_finished) {
+                on_finished(count);
+            }
+
+            pimpl_->is_analyzing_ = false;
+        });
+
+        return true;
+    }
+
+    bool MusicManager::is_analyzing_loudness() const { return pimpl_->is_analyzing_; }
+
+    void MusicManager::cancel_loudness_analysis() {
+        pimpl_->cancel_analysis_ = true;
+        if (pimpl_->loudness_future_.valid()) {
+            pimpl_->loudness_future_.wait();
+        }
+    }
+
+    bool MusicManager::set_loudness_store(const std::filesystem::path &store_path) {
+        if (!pimpl_->loudness_store_->attach(store_path)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(pimpl_->db_mutex_);
+        pimpl_->apply_loudness(pimpl_->music_database_);
+        return true;
+    }
+
+} // namespace MusicEngine
\ No newline at end of file
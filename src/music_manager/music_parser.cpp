@@ -3,6 +3,9 @@
 #include <cstdio>
 #include <memory>
 
+#include "cover_art_locator.hpp"
+#include "mapped_file.hpp"
+#include "media_input.hpp"
 #include "spdlog/sinks/stdout_color_sinks.h"
 #include "spdlog/spdlog.h"
 
@@ -66,6 +69,9 @@ namespace MusicParser {
             if (AVDictionaryEntry *tag = av_dict_get(metadata, "album", nullptr, AV_DICT_IGNORE_SUFFIX)) {
                 music.album = tag->value;
             }
+            if (AVDictionaryEntry *tag = av_dict_get(metadata, "album_artist", nullptr, AV_DICT_IGNORE_SUFFIX)) {
+                music.album_artist = tag->value;
+            }
             if (AVDictionaryEntry *tag = av_dict_get(metadata, "genre", nullptr, AV_DICT_IGNORE_SUFFIX)) {
                 music.genre = tag->value;
             }
@@ -94,10 +100,14 @@ namespace MusicParser {
     } // namespace
 
     std::optional<MusicEngine::Music> create_music_from_file(const std::filesystem::path &file_path) {
-        // Use a smart pointer to manage the lifecycle of AVFormatContext
+        // Use a smart pointer to manage the lifecycle of AVFormatContext.
+        // The input is declared first so it is destroyed after the format context that reads from it.
+        std::unique_ptr<MusicEngine::MediaInput> input;
         AVFormatContext *format_ctx_raw = nullptr;
         // avformat_open_input allocates memory that we need to free manually; the RAII wrapper handles this automatically
-        if (avformat_open_input(&format_ctx_raw, file_path.c_str(), nullptr, nullptr) != 0) {
+        const int opened = MusicEngine::open_format_input(&format_ctx_raw, file_path,
+                                                          MusicEngine::MediaInput::Access::Probe, input);
+        if (opened != 0) {
             logger->warn("Cannot open file: {}", file_path.string());
             return std::nullopt;
         }
@@ -120,36 +130,112 @@ namespace MusicParser {
         return music;
     }
 
-    std::optional<std::vector<char>> extract_cover_art_data(const std::filesystem::path &file_path) {
+    std::optional<MusicEngine::Music> create_music_from_source(std::shared_ptr<MusicEngine::InputSource> source) {
+        if (!source) {
+            return std::nullopt;
+        }
+        std::unique_ptr<MusicEngine::MediaInput> input;
         AVFormatContext *format_ctx_raw = nullptr;
-        if (avformat_open_input(&format_ctx_raw, file_path.c_str(), nullptr, nullptr) != 0) {
-            logger->warn("extract_cover_art_data: Cannot open file: {}", file_path.string());
+        const int opened =
+                MusicEngine::open_format_input(&format_ctx_raw, source, MusicEngine::MediaInput::Access::Probe, input);
+        if (opened != 0) {
+            logger->warn("Cannot open input source: {}", source->name());
             return std::nullopt;
         }
         AVFormatContextPtr format_ctx(format_ctx_raw);
 
         if (avformat_find_stream_info(format_ctx.get(), nullptr) < 0) {
-            logger->warn("extract_cover_art_data: Cannot find stream information for file: {}", file_path.string());
+            logger->warn("Cannot find stream information for input source: {}", source->name());
             return std::nullopt;
         }
 
-        // Album art is usually stored as an attached video stream
-        int stream_index = av_find_best_stream(format_ctx.get(), AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
-        if (stream_index < 0) {
-            logger->info("extract_cover_art_data: No video stream (cover art) found in file: {}", file_path.string());
+        MusicEngine::Music music;
+        music.source = std::move(source);
+        get_metadata_with_api(music, format_ctx.get());
+        check_cover_art_exists(music, format_ctx.get());
+        return music;
+    }
+
+    namespace {
+
+        // Maps the file and locates the picture without demuxing. Returns std::nullopt if either step fails.
+        std::optional<CoverArtView> map_and_locate(const std::filesystem::path &file_path) {
+            auto mapping = MusicEngine::MappedFile::open(file_path);
+            if (!mapping) {
+                return std::nullopt;
+            }
+            // The tag is walked in place, so a file truncated while we read it must not take the process down
+            std::optional<std::span<const char>> image;
+            if (!mapping->guard([&] { image = locate_cover_art(mapping->bytes()); })) {
+                logger->warn("map_cover_art: File shrank while reading its tags: {}", file_path.string());
+                return std::nullopt;
+            }
+            if (!image) {
+                return std::nullopt;
+            }
+            // Page the whole image in with one request instead of faulting it in page by page
+            mapping->will_need(*image);
+            return CoverArtView{mapping, *image, mapping};
+        }
+
+        std::optional<std::vector<char>> extract_cover_art_with_ffmpeg(const std::filesystem::path &file_path) {
+            AVFormatContext *format_ctx_raw = nullptr;
+            if (avformat_open_input(&format_ctx_raw, file_path.c_str(), nullptr, nullptr) != 0) {
+                logger->warn("extract_cover_art_data: Cannot open file: {}", file_path.string());
+                return std::nullopt;
+            }
+            AVFormatContextPtr format_ctx(format_ctx_raw);
+
+            if (avformat_find_stream_info(format_ctx.get(), nullptr) < 0) {
+                logger->warn("extract_cover_art_data: Cannot find stream information for file: {}", file_path.string());
+                return std::nullopt;
+            }
+
+            // Album art is usually stored as an attached video stream
+            int stream_index = av_find_best_stream(format_ctx.get(), AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+            if (stream_index < 0) {
+                logger->info("extract_cover_art_data: No video stream (cover art) found in file: {}", file_path.string());
+                return std::nullopt;
+            }
+
+            AVStream *stream = format_ctx->streams[stream_index];
+
+            // Check if this stream is an "attached picture" and contains data
+            if (stream->disposition & AV_DISPOSITION_ATTACHED_PIC && stream->attached_pic.size > 0) {
+                const AVPacket &packet = stream->attached_pic;
+                // Copy data from the packet to a vector
+                return std::vector<char>(packet.data, packet.data + packet.size);
+            }
+
+            logger->info("extract_cover_art_data: Video stream is not an attached cover art: {}", file_path.string());
             return std::nullopt;
         }
 
-        AVStream *stream = format_ctx->streams[stream_index];
+    } // namespace
+
+    std::optional<std::vector<char>> extract_cover_art_data(const std::filesystem::path &file_path) {
+        // Fast path: copy straight out of the mapping instead of opening a demuxer
+        if (auto view = map_and_locate(file_path)) {
+            std::vector<char> data(view->data.size());
+            if (view->mapping->copy(view->data, data.data())) {
+                return data;
+            }
+            logger->warn("extract_cover_art_data: File shrank while copying the cover art: {}", file_path.string());
+        }
+        return extract_cover_art_with_ffmpeg(file_path);
+    }
 
-        // Check if this stream is an "attached picture" and contains data
-        if (stream->disposition & AV_DISPOSITION_ATTACHED_PIC && stream->attached_pic.size > 0) {
-            const AVPacket &packet = stream->attached_pic;
-            // Copy data from the packet to a vector
-            return std::vector<char>(packet.data, packet.data + packet.size);
+    std::optional<CoverArtView> map_cover_art(const std::filesystem::path &file_path) {
+        if (auto view = map_and_locate(file_path)) {
+            return view;
         }
 
-        logger->info("extract_cover_art_data: Video stream is not an attached cover art: {}", file_path.string());
+        // Layouts the locator cannot serve in place (e.g. unsynchronised ID3 frames) still work through FFmpeg
+        if (auto data = extract_cover_art_with_ffmpeg(file_path)) {
+            auto owner = std::make_shared<const std::vector<char>>(std::move(*data));
+            std::span<const char> bytes(owner->data(), owner->size());
+            return CoverArtView{std::move(owner), bytes, nullptr};
+        }
         return std::nullopt;
     }
 
@@ -1,8 +1,13 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
 #include <optional>
+#include <span>
+#include <vector>
 #include "Music.h" // Include the definition of the Music struct
+#include "input_source.h"
+#include "mapped_file.hpp"
 
 namespace MusicParser {
 
@@ -15,6 +20,16 @@ namespace MusicParser {
      */
     std::optional<MusicEngine::Music> create_music_from_file(const std::filesystem::path &file_path);
 
+    /**
+     * @brief Parses metadata from an input source (memory, pipe, remote storage).
+     *
+     * Only the headers are read. The returned Music has its source set and an empty file_path. A pipe can only
+     * be read once, so parsing one consumes it.
+     *
+     * @return The music information if successful; otherwise, std::nullopt.
+     */
+    std::optional<MusicEngine::Music> create_music_from_source(std::shared_ptr<MusicEngine::InputSource> source);
+
     /**
      * @brief Extracts cover art data from a file.
      * @param file_path The path to the music file.
@@ -22,6 +37,33 @@ namespace MusicParser {
      */
     std::optional<std::vector<char>> extract_cover_art_data(const std::filesystem::path &file_path);
 
+    /**
+     * @brief Cover art bytes together with the object that owns them.
+     *
+     * `data` stays valid for as long as `owner` is alive. The owner is either the memory mapping of the music
+     * file (zero-copy path) or a vector holding a copy made by FFmpeg (fallback path).
+     *
+     * On the zero-copy path `mapping` is set as well. The file can still be truncated under the mapping, so code
+     * that reads `data` itself should do it inside `mapping->guard()` or copy it out with `mapping->copy()`.
+     */
+    struct CoverArtView {
+        std::shared_ptr<const void> owner;
+        std::span<const char> data;
+        std::shared_ptr<const MusicEngine::MappedFile> mapping;
+    };
+
+    /**
+     * @brief Extracts cover art as a view into a memory mapping of the file.
+     *
+     * The APIC, PICTURE or covr atom is located directly in the mapped bytes, so only the pages holding the
+     * tag and the image are read and nothing is copied. Files the locator does not understand fall back to
+     * extract_cover_art_data().
+     *
+     * @param file_path The path to the music file.
+     * @return The cover art view, or std::nullopt if it fails or does not exist.
+     */
+    std::optional<CoverArtView> map_cover_art(const std::filesystem::path &file_path);
+
 
 
 } // namespace MusicParser
\ No newline at end of file
@@ -0,0 +1,484 @@
+#include "waveform_cache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "decoder.h"
+#include "mix_kernels.hpp"
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/spdlog.h"
+
+namespace MusicEngine {
+
+    namespace {
+
+        constexpr uint32_t FINEST_FRAMES_PER_PEAK = 256;
+        constexpr uint32_t LEVEL_FACTOR = 4;
+        constexpr size_t MIN_LEVEL_PEAKS = 16;
+        constexpr size_t READ_FRAMES = 8192;
+        constexpr uint32_t CHANNELS = 2;
+
+        // Preview: short excerpts spread evenly over tracks long enough for the full pass to take a while
+        constexpr size_t PREVIEW_PEAKS = 256;
+        constexpr size_t PREVIEW_EXCERPT_FRAMES = 1024;
+        constexpr double PREVIEW_MIN_DURATION_SECS = 30.0;
+
+        // On-disk layout (native byte order): FileHeader, the UTF-8 path, then per level a LevelHeader followed by
+        // `count` triples of int16 (min, max, rms) scaled so 32767 is full scale
+        constexpr char FILE_MAGIC[4] = {'M', 'E', 'W', 'F'};
+        constexpr uint32_t FILE_VERSION = 1;
+        struct FileHeader {
+            char magic[4];
+            uint32_t version;
+            int64_t modified;
+            uint64_t size;
+            uint64_t frames;
+            uint32_t sample_rate;
+            uint32_t level_count;
+            uint32_t path_length;
+            uint32_t reserved;
+        };
+        struct LevelHeader {
+            uint32_t frames_per_peak;
+            uint32_t count;
+        };
+
+        bool stat_file(const std::filesystem::path &path, int64_t &modified, uint64_t &size) {
+            std::error_code ec;
+            const auto time = std::filesystem::last_write_time(path, ec);
+            if (ec) {
+                return false;
+            }
+            size = std::filesystem::file_size(path, ec);
+            modified = static_cast<int64_t>(time.time_since_epoch().count());
+            return !ec;
+        }
+
+        // 64-bit FNV-1a of the path names the cache file; the full path inside the file settles collisions
+        uint64_t hash_path(const std::string &path) {
+            uint64_t hash = 14695981039346656037ULL;
+            for (char c: path) {
+                hash ^= static_cast<unsigned char>(c);
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        int16_t quantize(float value) {
+            return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+        }
+
+        float dequantize(int16_t value) { return static_cast<float>(value) / 32767.0f; }
+
+        // Running min/max/sum of squares of one peak under construction
+        struct PeakAccumulator {
+            float min = std::numeric_limits<float>::max();
+            float max = std::numeric_limits<float>::lowest();
+            double sum_squares = 0.0;
+            size_t samples = 0;
+
+            void add(const mix::PeakStats &stats, size_t count) {
+                min = std::min(min, stats.min);
+                max = std::max(max, stats.max);
+                sum_squares += stats.sum_squares;
+                samples += count;
+            }
+
+            WaveformPeak take() {
+                WaveformPeak peak{min, max, static_cast<float>(std::sqrt(sum_squares / static_cast<double>(samples)))};
+                *this = {};
+                return peak;
+            }
+        };
+
+        // Builds each coarser level from the previous one until it would become too short to be useful
+        void add_coarser_levels(WaveformSummary &summary) {
+            while (summary.levels.back().peaks.size() / LEVEL_FACTOR >= MIN_LEVEL_PEAKS) {
+                const WaveformLevel &finer = summary.levels.back();
+                WaveformLevel coarser;
+                coarser.frames_per_peak = finer.frames_per_peak * LEVEL_FACTOR;
+                coarser.peaks.reserve((finer.peaks.size() + LEVEL_FACTOR - 1) / LEVEL_FACTOR);
+                for (size_t i = 0; i < finer.peaks.size(); i += LEVEL_FACTOR) {
+                    const size_t end = std::min(i + LEVEL_FACTOR, finer.peaks.size());
+                    WaveformPeak peak{finer.peaks[i].min, finer.peaks[i].max, 0.0f};
+                    double squares = 0.0;
+                    for (size_t k = i; k < end; ++k) {
+                        peak.min = std::min(peak.min, finer.peaks[k].min);
+                        peak.max = std::max(peak.max, finer.peaks[k].max);
+                        squares += static_cast<double>(finer.peaks[k].rms) * finer.peaks[k].rms;
+                    }
+                    peak.rms = static_cast<float>(std::sqrt(squares / static_cast<double>(end - i)));
+                    coarser.peaks.push_back(peak);
+                }
+                summary.levels.push_back(std::move(coarser));
+            }
+        }
+
+    } // namespace
+
+    struct WaveformCache::Impl {
+        struct Request {
+            std::filesystem::path path;
+            std::vector<Callback> callbacks;
+        };
+
+        std::mutex mutex_;
+        std::condition_variable cond_var_;
+        // Memory cache: weak references, so summaries no longer shown anywhere are released (the disk copy stays)
+        struct MemoryEntry {
+            std::weak_ptr<const WaveformSummary> summary;
+            int64_t modified = 0; // Of the file the summary was made from, as in the disk cache header
+            uint64_t size = 0;
+        };
+        std::unordered_map<std::string, MemoryEntry> memory_;
+        std::deque<Request> queue_; // Most recent request first
+        std::optional<Request> current_;
+        std::filesystem::path cache_directory_;
+        std::atomic<bool> stop_requested_{false};
+        std::thread worker_;
+        std::shared_ptr<spdlog::logger> logger_;
+
+        Impl() {
+            logger_ = spdlog::stdout_color_mt("Waveform");
+            logger_->set_level(spdlog::level::info);
+            std::error_code ec;
+            const auto temp = std::filesystem::temp_directory_path(ec);
+            if (!ec) {
+                cache_directory_ = temp / "MusicEngine" / "waveforms";
+            }
+        }
+
+        std::filesystem::path cache_file(const std::string &key) const {
+            return cache_directory_.empty() ? std::filesystem::path{}
+                                            : cache_directory_ / fmt::format("{:016x}.wfm", hash_path(key));
+        }
+
+        // [mutex_ held] Also drops entries whose summary has been released
+        void remember(const std::string &key, const std::shared_ptr<const WaveformSummary> &summary,
+                      int64_t modified, uint64_t size) {
+            std::erase_if(memory_, [](const auto &entry) { return entry.second.summary.expired(); });
+            memory_[key] = MemoryEntry{summary, modified, size};
+        }
+
+        void worker_loop();
+        std::shared_ptr<const WaveformSummary> generate(const std::filesystem::path &path);
+        void deliver(const std::shared_ptr<const WaveformSummary> &summary);
+        std::shared_ptr<const WaveformSummary> load(const std::filesystem::path &file, const std::string &key,
+                                                    int64_t modified, uint64_t size) const;
+        void save(const std::filesystem::path &file, const std::string &key, int64_t modified, uint64_t size,
+                  const WaveformSummary &summary) const;
+    };
+
+    WaveformCache &WaveformCache::get_instance() {
+        static WaveformCache instance;
+        return instance;
+    }
+
+    WaveformCache::WaveformCache() : pimpl_(std::make_unique<Impl>()) {}
+
+    WaveformCache::~WaveformCache() {
+        pimpl_->stop_requested_ = true;
+        pimpl_->cond_var_.notify_all();
+        if (pimpl_->worker_.joinable()) {
+            pimpl_->worker_.join();
+        }
+    }
+
+    std::shared_ptr<const WaveformSummary> WaveformCache::find(const std::filesystem::path &file_path) {
+        int64_t modified = 0;
+        uint64_t size = 0;
+        if (!stat_file(file_path, modified, size)) {
+            return nullptr;
+        }
+        const std::string key = file_path.string();
+
+        std::filesystem::path file;
+        {
+            std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+            if (auto it = pimpl_->memory_.find(key); it != pimpl_->memory_.end()) {
+                // Held by someone and still matching the file: no need to touch the disk
+                const Impl::MemoryEntry &entry = it->second;
+                if (entry.modified == modified && entry.size == size) {
+                    if (auto summary = entry.summary.lock()) {
+                        return summary;
+                    }
+                }
+                pimpl_->memory_.erase(it); // Released, or made from an older version of the file
+            }
+            file = pimpl_->cache_file(key);
+        }
+        if (file.empty()) {
+            return nullptr;
+        }
+
+        auto summary = pimpl_->load(file, key, modified, size);
+        if (summary) {
+            std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+            pimpl_->remember(key, summary, modified, size);
+        }
+        return summary;
+    }
+
+    void WaveformCache::request(const std::filesystem::path &file_path, const Callback &callback) {
+        if (auto summary = find(file_path)) {
+            if (callback) {
+                callback(summary);
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+        if (pimpl_->current_ && pimpl_->current_->path == file_path) {
+            pimpl_->current_->callbacks.push_back(callback);
+            return;
+        }
+        // Requested again: join the queued entry and move it to the front
+        Impl::Request request{file_path, {}};
+        auto it = std::find_if(pimpl_->queue_.begin(), pimpl_->queue_.end(),
+                               [&](const Impl::Request &queued) { return queued.path == file_path; });
+        if (it != pimpl_->queue_.end()) {
+            request = std::move(*it);
+            pimpl_->queue_.erase(it);
+        }
+        request.callbacks.push_back(callback);
+        pimpl_->queue_.push_front(std::move(request));
+
+        // The worker is started on first use, like the seek index builder
+        if (!pimpl_->worker_.joinable()) {
+            pimpl_->worker_ = std::thread(&Impl::worker_loop, pimpl_.get());
+        }
+        pimpl_->cond_var_.notify_one();
+    }
+
+    void WaveformCache::set_cache_directory(const std::filesystem::path &directory) {
+        std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+        pimpl_->cache_directory_ = directory;
+    }
+
+    void WaveformCache::Impl::worker_loop() {
+        while (true) {
+            std::filesystem::path path;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_var_.wait(lock, [this] { return stop_requested_ || !queue_.empty(); });
+                if (stop_requested_) {
+                    return;
+                }
+                current_ = std::move(queue_.front());
+                queue_.pop_front();
+                path = current_->path;
+            }
+
+            auto summary = generate(path);
+            if (!summary && stop_requested_) {
+                return;
+            }
+            deliver(summary);
+            std::lock_guard<std::mutex> lock(mutex_);
+            current_.reset();
+        }
+    }
+
+    // [Worker] Passes a result to everyone waiting for the current request
+    void WaveformCache::Impl::deliver(const std::shared_ptr<const WaveformSummary> &summary) {
+        std::vector<Callback> callbacks;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            callbacks = current_->callbacks;
+        }
+        for (const auto &callback: callbacks) {
+            if (callback) {
+                callback(summary);
+            }
+        }
+    }
+
+    // [Worker] Decodes the whole file once; long files get a quick preview first
+    std::shared_ptr<const WaveformSummary> WaveformCache::Impl::generate(const std::filesystem::path &path) {
+        int64_t modified = 0;
+        uint64_t size = 0;
+        Decoder decoder;
+        if (!stat_file(path, modified, size) || !decoder.open(path, {0, static_cast<int>(CHANNELS)})) {
+            logger_->warn("Cannot generate waveform for {}", path.string());
+            return nullptr;
+        }
+        const int sample_rate = decoder.format().sample_rate;
+        std::vector<float> buffer(READ_FRAMES * CHANNELS);
+
+        // 1. Preview from excerpts, so a seek bar has something to show within a fraction of the full pass
+        const double duration = decoder.duration();
+        if (duration >= PREVIEW_MIN_DURATION_SECS) {
+            auto preview = std::make_shared<WaveformSummary>();
+            preview->sample_rate = sample_rate;
+            preview->frames = static_cast<uint64_t>(duration * sample_rate);
+            WaveformLevel level;
+            level.frames_per_peak = static_cast<uint32_t>(std::max<uint64_t>(preview->frames / PREVIEW_PEAKS, 1));
+            for (size_t i = 0; i < PREVIEW_PEAKS && !stop_requested_; ++i) {
+                PeakAccumulator accumulator;
+                if (decoder.seek(duration * (static_cast<double>(i) + 0.5) / PREVIEW_PEAKS)) {
+                    const size_t frames = decoder.read({buffer.data(), PREVIEW_EXCERPT_FRAMES * CHANNELS});
+                    accumulator.add(mix::reduce_peaks(buffer.data(), frames * CHANNELS), frames * CHANNELS);
+                }
+                level.peaks.push_back(accumulator.samples > 0 ? accumulator.take() : WaveformPeak{});
+            }
+            preview->levels.push_back(std::move(level));
+            deliver(preview);
+            if (!decoder.seek(0.0)) {
+                decoder.open(path, {0, static_cast<int>(CHANNELS)});
+            }
+        }
+
+        // 2. Full pass at the finest resolution, reduced with the SIMD kernel
+        auto summary = std::make_shared<WaveformSummary>();
+        summary->sample_rate = sample_rate;
+        WaveformLevel finest;
+        finest.frames_per_peak = FINEST_FRAMES_PER_PEAK;
+        PeakAccumulator accumulator;
+        size_t peak_frames = 0;
+        while (!stop_requested_) {
+            const size_t frames = decoder.read(buffer);
+            if (frames == 0) {
+                break;
+            }
+            for (size_t offset = 0; offset < frames;) {
+                const size_t count = std::min<size_t>(frames - offset, FINEST_FRAMES_PER_PEAK - peak_frames);
+                accumulator.add(mix::reduce_peaks(buffer.data() + offset * CHANNELS, count * CHANNELS),
+                                count * CHANNELS);
+                offset += count;
+                peak_frames += count;
+                if (peak_frames == FINEST_FRAMES_PER_PEAK) {
+                    finest.peaks.push_back(accumulator.take());
+                    peak_frames = 0;
+                }
+            }
+            summary->frames += frames;
+        }
+        if (stop_requested_ || summary->frames == 0) {
+            return nullptr;
+        }
+        if (peak_frames > 0) {
+            finest.peaks.push_back(accumulator.take());
+        }
+        summary->levels.push_back(std::move(finest));
+        add_coarser_levels(*summary);
+        summary->complete = true;
+        logger_->debug("Waveform of {}: {} frames, {} levels", path.string(), summary->frames,
+                       summary->levels.size());
+
+        const std::string key = path.string();
+        std::filesystem::path file;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            remember(key, summary, modified, size);
+            file = cache_file(key);
+        }
+        if (!file.empty()) {
+            save(file, key, modified, size, *summary);
+        }
+        return summary;
+    }
+
+    std::shared_ptr<const WaveformSummary> WaveformCache::Impl::load(const std::filesystem::path &file,
+                                                                     const std::string &key, int64_t modified,
+                                                                     uint64_t size) const {
+        std::ifstream in(file, std::ios::binary);
+        FileHeader header{};
+        if (!in || !in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header.version != FILE_VERSION ||
+            header.modified != modified || header.size != size || header.path_length != key.size()) {
+            return nullptr;
+        }
+        std::string stored_path(header.path_length, '\0');
+        if (!in.read(stored_path.data(), static_cast<std::streamsize>(stored_path.size())) || stored_path != key) {
+            return nullptr;
+        }
+
+        auto summary = std::make_shared<WaveformSummary>();
+        summary->sample_rate = static_cast<int>(header.sample_rate);
+        summary->frames = header.frames;
+        summary->complete = true;
+        std::vector<int16_t> values;
+        for (uint32_t l = 0; l < header.level_count; ++l) {
+            LevelHeader level_header{};
+            if (!in.read(reinterpret_cast<char *>(&level_header), sizeof(level_header)) ||
+                level_header.count > header.frames / std::max<uint32_t>(level_header.frames_per_peak, 1) + 1) {
+                logger_->warn("Corrupt waveform cache file: {}", file.string());
+                return nullptr;
+            }
+            values.resize(static_cast<size_t>(level_header.count) * 3);
+            if (!in.read(reinterpret_cast<char *>(values.data()),
+                         static_cast<std::streamsize>(values.size() * sizeof(int16_t)))) {
+                logger_->warn("Truncated waveform cache file: {}", file.string());
+                return nullptr;
+            }
+            WaveformLevel level;
+            level.frames_per_peak = level_header.frames_per_peak;
+            level.peaks.resize(level_header.count);
+            for (size_t i = 0; i < level.peaks.size(); ++i) {
+                level.peaks[i] = {dequantize(values[i * 3]), dequantize(values[i * 3 + 1]),
+                                  dequantize(values[i * 3 + 2])};
+            }
+            summary->levels.push_back(std::move(level));
+        }
+        return summary->levels.empty() ? nullptr : summary;
+    }
+
+    void WaveformCache::Impl::save(const std::filesystem::path &file, const std::string &key, int64_t modified,
+                                   uint64_t size, const WaveformSummary &summary) const {
+        std::error_code ec;
+        std::filesystem::create_directories(file.parent_path(), ec);
+
+        // Written to a temporary name and renamed, so a reader never sees a half-written file
+        std::filesystem::path temp = file;
+        temp += ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            FileHeader header{};
+            std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+            header.version = FILE_VERSION;
+            header.modified = modified;
+            header.size = size;
+            header.frames = summary.frames;
+            header.sample_rate = static_cast<uint32_t>(summary.sample_rate);
+            header.level_count = static_cast<uint32_t>(summary.levels.size());
+            header.path_length = static_cast<uint32_t>(key.size());
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            out.write(key.data(), static_cast<std::streamsize>(key.size()));
+
+            std::vector<int16_t> values;
+            for (const auto &level: summary.levels) {
+                const LevelHeader level_header{level.frames_per_peak, static_cast<uint32_t>(level.peaks.size())};
+                out.write(reinterpret_cast<const char *>(&level_header), sizeof(level_header));
+                values.clear();
+                for (const auto &peak: level.peaks) {
+                    values.push_back(quantize(peak.min));
+                    values.push_back(quantize(peak.max));
+                    values.push_back(quantize(peak.rms));
+                }
+                out.write(reinterpret_cast<const char *>(values.data()),
+                          static_cast<std::streamsize>(values.size() * sizeof(int16_t)));
+            }
+            if (!out) {
+                logger_->warn("Failed to write waveform cache file: {}", temp.string());
+                std::filesystem::remove(temp, ec);
+                return;
+            }
+        }
+        std::filesystem::rename(temp, file, ec);
+        if (ec) {
+            logger_->warn("Failed to store waveform cache file {}: {}", file.string(), ec.message());
+            std::filesystem::remove(temp, ec);
+        }
+    }
+
+} // namespace MusicEngine
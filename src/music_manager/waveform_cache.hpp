@@ -0,0 +1,54 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include "waveform.h"
+
+namespace MusicEngine {
+
+    /**
+     * @class WaveformCache
+     * @brief Generates waveform overviews on a background thread and caches them in memory and on disk.
+     *
+     * Summaries are keyed by file path and validated against the file's size and modification time. On disk each
+     * one is a small binary file (16-bit min/max/RMS per peak) in the cache directory.
+     */
+    class WaveformCache {
+    public:
+        using Callback = std::function<void(std::shared_ptr<const WaveformSummary>)>;
+
+        static WaveformCache &get_instance();
+
+        WaveformCache(const WaveformCache &) = delete;
+        WaveformCache &operator=(const WaveformCache &) = delete;
+
+        /**
+         * @brief Returns the complete summary of @p file_path from memory or disk, or nullptr. Never decodes.
+         */
+        std::shared_ptr<const WaveformSummary> find(const std::filesystem::path &file_path);
+
+        /**
+         * @brief Delivers the summary of @p file_path to @p callback, generating it if necessary.
+         *
+         * A cached summary is passed right away on the calling thread. Otherwise generation is queued (the most
+         * recent request first) and the callback is invoked from the worker thread, first with a coarse preview
+         * (complete == false) for long tracks and then with the complete summary. If the file can't be decoded,
+         * the callback receives nullptr.
+         */
+        void request(const std::filesystem::path &file_path, const Callback &callback);
+
+        /**
+         * @brief Sets where summaries are stored. An empty path disables the disk cache.
+         */
+        void set_cache_directory(const std::filesystem::path &directory);
+
+    private:
+        WaveformCache();
+        ~WaveformCache();
+
+        struct Impl;
+        std::unique_ptr<Impl> pimpl_;
+    };
+
+} // namespace MusicEngine
@@ -0,0 +1,231 @@
+#include "analysis_tap.hpp"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <numbers>
+#include <vector>
+
+namespace MusicEngine {
+
+    namespace {
+
+        constexpr size_t MIN_FFT_SIZE = 64;
+        constexpr size_t MAX_FFT_SIZE = 16384;
+        constexpr double MIN_UPDATE_HZ = 1.0;
+        constexpr double MAX_UPDATE_HZ = 120.0;
+        constexpr size_t READ_CHUNK_FRAMES = 1024;
+        constexpr float SILENCE_DB = -200.0f;
+
+        // In-place iterative radix-2 FFT with precomputed twiddles and bit-reversal table
+        class Fft {
+        public:
+            explicit Fft(size_t size) : size_(size), cos_(size / 2), sin_(size / 2), reversed_(size) {
+                for (size_t i = 0; i < size / 2; ++i) {
+                    const double angle = -2.0 * std::numbers::pi * static_cast<double>(i) / static_cast<double>(size);
+                    cos_[i] = static_cast<float>(std::cos(angle));
+                    sin_[i] = static_cast<float>(std::sin(angle));
+                }
+                const int bits = std::countr_zero(size);
+                for (size_t i = 0; i < size; ++i) {
+                    size_t r = 0;
+                    for (int b = 0; b < bits; ++b) {
+                        r |= ((i >> b) & 1) << (bits - 1 - b);
+                    }
+                    reversed_[i] = r;
+                }
+            }
+
+            void transform(float *re, float *im) const {
+                for (size_t i = 0; i < size_; ++i) {
+                    if (i < reversed_[i]) {
+                        std::swap(re[i], re[reversed_[i]]);
+                        std::swap(im[i], im[reversed_[i]]);
+                    }
+                }
+                for (size_t length = 2; length <= size_; length <<= 1) {
+                    const size_t half = length / 2;
+                    const size_t stride = size_ / length;
+                    for (size_t start = 0; start < size_; start += length) {
+                        for (size_t k = 0; k < half; ++k) {
+                            const float wr = cos_[k * stride];
+                            const float wi = sin_[k * stride];
+                            const size_t a = start + k;
+                            const size_t b = a + half;
+                            const float tr = re[b] * wr - im[b] * wi;
+                            const float ti = re[b] * wi + im[b] * wr;
+                            re[b] = re[a] - tr;
+                            im[b] = im[a] - ti;
+                            re[a] += tr;
+                            im[a] += ti;
+                        }
+                    }
+                }
+            }
+
+        private:
+            size_t size_;
+            std::vector<float> cos_;
+            std::vector<float> sin_;
+            std::vector<size_t> reversed_;
+        };
+
+    } // namespace
+
+    AnalysisTap::AnalysisTap(std::shared_ptr<spdlog::logger> logger) : logger_(std::move(logger)) {}
+
+    AnalysisTap::~AnalysisTap() { stop(); }
+
+    void AnalysisTap::prepare(int sample_rate, uint32_t channels) {
+        std::lock_guard<std::mutex> lock(control_mutex_);
+        // The thread is the ring's consumer, so it must be idle while the ring is reset
+        const bool running = thread_.joinable();
+        stop();
+        sample_rate_ = sample_rate;
+        channels_ = channels;
+        // One second of audio covers the longest interval between two drains (1 Hz updates)
+        ring_.reset(static_cast<size_t>(std::max(sample_rate, 1)), std::max<uint32_t>(channels, 1));
+        if (running) {
+            start();
+        }
+    }
+
+    void AnalysisTap::set_enabled(bool enabled, const AnalysisSettings &settings) {
+        std::lock_guard<std::mutex> lock(control_mutex_);
+        stop();
+        settings_.fft_size = std::bit_ceil(std::clamp(settings.fft_size, MIN_FFT_SIZE, MAX_FFT_SIZE));
+        settings_.update_hz = std::clamp(settings.update_hz, MIN_UPDATE_HZ, MAX_UPDATE_HZ);
+        if (enabled) {
+            start();
+            logger_->info("Output analysis enabled: {}-point FFT at up to {} Hz", settings_.fft_size,
+                          settings_.update_hz);
+        }
+    }
+
+    std::shared_ptr<const AudioAnalysis> AnalysisTap::latest() const {
+        std::lock_guard<std::mutex> lock(results_mutex_);
+        return latest_;
+    }
+
+    void AnalysisTap::set_callback(const std::function<void(const AudioAnalysis &)> &callback) {
+        std::lock_guard<std::mutex> lock(results_mutex_);
+        callback_ = callback;
+    }
+
+    void AnalysisTap::start() {
+        stop_requested_ = false;
+        thread_ = std::thread(&AnalysisTap::run, this);
+        enabled_.store(true, std::memory_order_relaxed);
+    }
+
+    void AnalysisTap::stop() {
+        enabled_.store(false, std::memory_order_relaxed);
+        if (!thread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(thread_mutex_);
+            stop_requested_ = true;
+        }
+        thread_cond_var_.notify_all();
+        thread_.join();
+    }
+
+    // [Analysis Thread] Drains the ring once per update period and publishes one result per period with audio
+    void AnalysisTap::run() {
+        const size_t fft_size = settings_.fft_size;
+        const uint32_t channels = ring_.channels() > 0 ? ring_.channels() : 1;
+        const int sample_rate = sample_rate_;
+        const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(1.0 / settings_.update_hz));
+
+        // Everything the loop needs is allocated here, once
+        const Fft fft(fft_size);
+        std::vector<float> window(fft_size);
+        double window_sum = 0.0;
+        for (size_t i = 0; i < fft_size; ++i) {
+            window[i] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * std::numbers::pi * static_cast<double>(i) /
+                                                                 static_cast<double>(fft_size)));
+            window_sum += window[i];
+        }
+        // A full-scale sine peaks at (window sum / 2) in its bin
+        const float magnitude_scale = static_cast<float>(2.0 / window_sum);
+        std::vector<float> chunk(READ_CHUNK_FRAMES * channels);
+        std::vector<float> history(fft_size, 0.0f); // Newest mono samples, circular
+        size_t history_position = 0;
+        std::vector<float> re(fft_size);
+        std::vector<float> im(fft_size);
+        std::vector<double> sum_squares(channels);
+        std::vector<float> peaks(channels);
+
+        // Whatever is in the ring predates this run
+        bool flushed = false;
+        while (ring_.read(chunk.data(), READ_CHUNK_FRAMES, flushed) > 0) {
+        }
+
+        auto next_update = std::chrono::steady_clock::now() + period;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(thread_mutex_);
+                if (thread_cond_var_.wait_until(lock, next_update, [this] { return stop_requested_; })) {
+                    break;
+                }
+            }
+            next_update = std::max(next_update + period, std::chrono::steady_clock::now());
+
+            std::fill(sum_squares.begin(), sum_squares.end(), 0.0);
+            std::fill(peaks.begin(), peaks.end(), 0.0f);
+            size_t frames_read = 0;
+            while (const size_t frames = ring_.read(chunk.data(), READ_CHUNK_FRAMES, flushed)) {
+                for (size_t f = 0; f < frames; ++f) {
+                    float mono = 0.0f;
+                    for (uint32_t ch = 0; ch < channels; ++ch) {
+                        const float sample = chunk[f * channels + ch];
+                        sum_squares[ch] += static_cast<double>(sample) * sample;
+                        peaks[ch] = std::max(peaks[ch], std::fabs(sample));
+                        mono += sample;
+                    }
+                    history[history_position] = mono / static_cast<float>(channels);
+                    history_position = (history_position + 1) % fft_size;
+                }
+                frames_read += frames;
+            }
+            if (frames_read == 0) {
+                continue; // Paused or stopped: keep the last result
+            }
+
+            // Windowed FFT of the newest fft_size samples, oldest first
+            for (size_t i = 0; i < fft_size; ++i) {
+                re[i] = history[(history_position + i) % fft_size] * window[i];
+                im[i] = 0.0f;
+            }
+            fft.transform(re.data(), im.data());
+
+            auto result = std::make_shared<AudioAnalysis>();
+            result->sequence = ++sequence_;
+            result->sample_rate = sample_rate;
+            result->fft_size = fft_size;
+            result->rms.resize(channels);
+            for (uint32_t ch = 0; ch < channels; ++ch) {
+                result->rms[ch] = static_cast<float>(std::sqrt(sum_squares[ch] / static_cast<double>(frames_read)));
+            }
+            result->peak = peaks;
+            result->spectrum_db.resize(fft_size / 2 + 1);
+            for (size_t i = 0; i <= fft_size / 2; ++i) {
+                const float magnitude = std::sqrt(re[i] * re[i] + im[i] * im[i]) * magnitude_scale;
+                result->spectrum_db[i] = magnitude > 0.0f ? 20.0f * std::log10(magnitude) : SILENCE_DB;
+            }
+
+            std::function<void(const AudioAnalysis &)> callback;
+            {
+                std::lock_guard<std::mutex> lock(results_mutex_);
+                latest_ = result;
+                callback = callback_;
+            }
+            if (callback) {
+                callback(*result);
+            }
+        }
+    }
+
+} // namespace MusicEngine
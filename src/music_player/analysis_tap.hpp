@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "music_player.h"
+#include "pcm_ring_buffer.hpp"
+#include "spdlog/spdlog.h"
+
+namespace MusicEngine {
+
+    /**
+     * @class AnalysisTap
+     * @brief Level meters and spectrum of the output, computed off the audio thread.
+     *
+     * The audio callback hands every output block to push(), which copies it into a PcmRingBuffer and drops it if
+     * the ring is full; it never locks, allocates or waits. A separate thread drains the ring at the configured
+     * update rate, accumulates RMS and peak per channel and runs one windowed FFT over the newest samples.
+     */
+    class AnalysisTap {
+    public:
+        explicit AnalysisTap(std::shared_ptr<spdlog::logger> logger);
+        ~AnalysisTap();
+
+        AnalysisTap(const AnalysisTap &) = delete;
+        AnalysisTap &operator=(const AnalysisTap &) = delete;
+
+        // ------------------- Control side -------------------
+
+        /**
+         * @brief Sizes the ring for the output format. The audio callback must not be running.
+         */
+        void prepare(int sample_rate, uint32_t channels);
+
+        /**
+         * @brief Starts or stops the analysis thread. Changing the settings restarts it.
+         */
+        void set_enabled(bool enabled, const AnalysisSettings &settings);
+
+        std::shared_ptr<const AudioAnalysis> latest() const;
+
+        void set_callback(const std::function<void(const AudioAnalysis &)> &callback);
+
+        // ------------------- Audio side -------------------
+
+        void push(const float *samples, size_t frames) {
+            // All or nothing: a partial write would splice the head of this block onto a later one
+            if (enabled_.load(std::memory_order_relaxed) && ring_.writable_frames() >= frames) {
+                ring_.write(samples, frames);
+            }
+        }
+
+    private:
+        void start();
+        void stop();
+        void run();
+
+        std::shared_ptr<spdlog::logger> logger_;
+        PcmRingBuffer ring_;
+        int sample_rate_ = 0;
+        uint32_t channels_ = 0;
+        AnalysisSettings settings_;
+        std::atomic<bool> enabled_{false};
+        std::mutex control_mutex_; // Serializes prepare() and set_enabled()
+
+        std::thread thread_;
+        std::mutex thread_mutex_;
+        std::condition_variable thread_cond_var_;
+        bool stop_requested_ = false;
+
+        mutable std::mutex results_mutex_;
+        std::shared_ptr<const AudioAnalysis> latest_;
+        std::function<void(const AudioAnalysis &)> callback_;
+        uint64_t sequence_ = 0; // Analysis thread only
+    };
+
+} // namespace MusicEngine
@@ -0,0 +1,671 @@
+#include "audio_decoder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include "mix_kernels.hpp"
+#include "rt_safety.h"
+
+// Include C library headers
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/opt.h>
+#include <libswresample/swresample.h>
+}
+
+namespace MusicEngine {
+
+    namespace {
+        // libswresample supports at most this many channels (SWR_CH_MAX)
+        constexpr size_t MAX_PLANES = 64;
+
+        // Least headroom for the resampler's filter delay when the sample rate changes; see resampler_headroom()
+        constexpr int RESAMPLER_HEADROOM_FRAMES = 64;
+
+        // Lowest input rate a stream may switch to mid-track; bounds max_read_frames()
+        constexpr int MIN_SWITCH_SAMPLE_RATE = 8000;
+
+        // Extra source samples decoded ahead of a seek target, for decoders whose first frames after a jump are
+        // incomplete (e.g. MP3's bit reservoir spans a few frames). Added to the stream's own seek_preroll.
+        constexpr int64_t SEEK_WARMUP_SAMPLES = 4096;
+
+        // Decoded ahead of a seek_to_frame() target with a rate change: enough for libswresample's longest
+        // default filter
+        constexpr double RESAMPLER_WARMUP_SECS = 0.02;
+
+        std::optional<convert::SampleType> sample_type(AVSampleFormat format) {
+            switch (av_get_packed_sample_fmt(format)) {
+                case AV_SAMPLE_FMT_S16:
+                    return convert::SampleType::S16;
+                case AV_SAMPLE_FMT_S32:
+                    return convert::SampleType::S32;
+                case AV_SAMPLE_FMT_FLT:
+                    return convert::SampleType::F32;
+                default:
+                    return std::nullopt;
+            }
+        }
+
+        // The specialized route from a source layout to the default layout for out_channels, if there is one.
+        // Like libswresample, a layout with unspecified order counts as the default layout for its channel count.
+        std::optional<convert::Route> conversion_route(const AVChannelLayout &in, int out_channels) {
+            const auto is = [&in](const AVChannelLayout &layout) {
+                if (in.order == AV_CHANNEL_ORDER_UNSPEC) {
+                    AVChannelLayout assumed;
+                    av_channel_layout_default(&assumed, in.nb_channels);
+                    return av_channel_layout_compare(&assumed, &layout) == 0;
+                }
+                return av_channel_layout_compare(&in, &layout) == 0;
+            };
+            const AVChannelLayout mono = AV_CHANNEL_LAYOUT_MONO;
+            const AVChannelLayout stereo = AV_CHANNEL_LAYOUT_STEREO;
+            const AVChannelLayout surround = AV_CHANNEL_LAYOUT_5POINT1;
+            const AVChannelLayout surround_back = AV_CHANNEL_LAYOUT_5POINT1_BACK;
+
+            if (out_channels == 1 && is(mono)) {
+                return convert::Route::Copy;
+            }
+            if (out_channels == 2) {
+                if (is(stereo)) {
+                    return convert::Route::Copy;
+                }
+                if (is(mono)) {
+                    return convert::Route::MonoToStereo;
+                }
+                if (is(surround) || is(surround_back)) {
+                    return convert::Route::Surround51ToStereo;
+                }
+            }
+            return std::nullopt;
+        }
+    } // namespace
+
+    AudioDecoder::AudioDecoder(std::shared_ptr<spdlog::logger> logger) :
+        logger_(std::move(logger)), packet_(av_packet_alloc()), frame_(av_frame_alloc()) {}
+
+    AudioDecoder::~AudioDecoder() {
+        close();
+        swr_free(&swr_ctx_);
+        av_packet_free(&packet_);
+        av_frame_free(&frame_);
+    }
+
+    bool AudioDecoder::open(const std::filesystem::path &file_path, int out_sample_rate, int out_channels) {
+        close();
+
+        // 1. --- FFmpeg Initialization ---
+        // Reads go through a mapping or a read-ahead thread instead of small synchronous read() calls
+        if (open_format_input(&format_ctx_, file_path, MediaInput::Access::Playback, input_, prefetch_bytes_) != 0) {
+            logger_->error("Cannot open file: {}", file_path.string());
+            return false;
+        }
+        file_path_ = file_path;
+        return open_stream(out_sample_rate, out_channels);
+    }
+
+    bool AudioDecoder::open(const std::shared_ptr<InputSource> &source, int out_sample_rate, int out_channels) {
+        close();
+
+        if (!source) {
+            logger_->error("Cannot open a null input source");
+            return false;
+        }
+        if (open_format_input(&format_ctx_, source, MediaInput::Access::Playback, input_, prefetch_bytes_) != 0) {
+            logger_->error("Cannot open input source: {}", source->name());
+            return false;
+        }
+        source_ = source;
+        return open_stream(out_sample_rate, out_channels);
+    }
+
+    bool AudioDecoder::open_stream(int out_sample_rate, int out_channels) {
+        if (avformat_find_stream_info(format_ctx_, nullptr) < 0) {
+            logger_->error("Cannot find stream information for the file");
+            close();
+            return false;
+        }
+
+        // 计算并存储总时长
+        duration_secs_ = static_cast<double>(format_ctx_->duration) / AV_TIME_BASE;
+
+        // Find the best audio stream
+        audio_stream_index_ = av_find_best_stream(format_ctx_, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+        if (audio_stream_index_ < 0) {
+            logger_->error("No audio stream found in the file");
+            close();
+            return false;
+        }
+        AVCodecParameters *codec_par = format_ctx_->streams[audio_stream_index_]->codecpar;
+
+        // Find the decoder
+        const AVCodec *codec = avcodec_find_decoder(codec_par->codec_id);
+        if (!codec) {
+            logger_->error("Cannot find decoder");
+            close();
+            return false;
+        }
+
+        codec_ctx_ = avcodec_alloc_context3(codec);
+        if (avcodec_parameters_to_context(codec_ctx_, codec_par) < 0) {
+            logger_->error("Cannot copy decoder parameters");
+            close();
+            return false;
+        }
+        // Export encoder delay/padding as frame side data instead of letting the decoder drop it, so that
+        // trim_frame() can choose between it and an iTunSMPB tag
+        codec_ctx_->flags2 |= AV_CODEC_FLAG2_SKIP_MANUAL;
+        // Most audio codecs support neither threading type and keep decoding on this thread
+        if (codec_threads_ != 1 && (codec->capabilities & (AV_CODEC_CAP_FRAME_THREADS | AV_CODEC_CAP_SLICE_THREADS))) {
+            codec_ctx_->thread_count = std::max(0, codec_threads_);
+            codec_ctx_->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+        }
+        if (avcodec_open2(codec_ctx_, codec, nullptr) < 0) {
+            logger_->error("Cannot open decoder");
+            close();
+            return false;
+        }
+
+        // 2. --- Sample Conversion Initialization ---
+        // We convert everything to a format that miniaudio handles easily: interleaved F32
+        out_sample_rate_ = out_sample_rate > 0 ? out_sample_rate : codec_ctx_->sample_rate;
+        out_channels_ = out_channels;
+        if (!configure_conversion(codec_ctx_->sample_fmt, codec_ctx_->ch_layout, codec_ctx_->sample_rate)) {
+            close();
+            return false;
+        }
+
+        read_gapless_info();
+
+        // Containers that carry their own sample table (MP4, Matroska cues, MP3 with a TOC) seek exactly already.
+        // For the rest, build a packet index in the background so later seeks don't have to guess or scan.
+        if (!file_path_.empty()) {
+            seek_index_ = SeekIndexCache::get_instance().find(file_path_);
+            if (!seek_index_ && avformat_index_get_entries_count(format_ctx_->streams[audio_stream_index_]) == 0 &&
+                !(format_ctx_->iformat->flags & AVFMT_NO_BYTE_SEEK)) {
+                SeekIndexCache::get_instance().request(file_path_);
+            }
+        }
+
+        // Callers size their staging buffers once, from this; a later format change must fit in it
+        max_read_frames_ = std::max(min_read_frames_, read_frames_for(MIN_SWITCH_SAMPLE_RATE));
+
+        const bool seekable = source_ ? source_->seekable() : !file_path_.empty();
+        if (segment_workers_ >= 2 && seekable && duration_secs_ >= segment_min_duration_secs_) {
+            start_segments();
+        }
+        return true;
+    }
+
+    // Hands decoding over to segment workers, each with a decoder of its own on the same track
+    void AudioDecoder::start_segments() {
+        SegmentDecoder::Opener opener = [path = file_path_, source = source_, rate = out_sample_rate_,
+                                         channels = out_channels_, prefetch = prefetch_bytes_,
+                                         timings = timings_](AudioDecoder &decoder) {
+            decoder.set_prefetch_bytes(prefetch);
+            decoder.set_timings(timings);
+            return source ? decoder.open(source, rate, channels) : decoder.open(path, rate, channels);
+        };
+        segments_ = std::make_unique<SegmentDecoder>(logger_, std::move(opener), segment_workers_, out_sample_rate_,
+                                                     out_channels_);
+        segments_->start(0.0);
+        logger_->debug("Decoding {:.0f}s track on {} segment workers", duration_secs_, segment_workers_);
+    }
+
+    bool AudioDecoder::configure_conversion(int sample_format, const AVChannelLayout &layout, int sample_rate) {
+        const auto format = static_cast<AVSampleFormat>(sample_format);
+        in_sample_format_ = sample_format;
+        in_channels_ = layout.nb_channels;
+        in_sample_rate_ = sample_rate;
+
+        // A kernel only covers format and layout conversion; a rate change always needs the resampler
+        // Buffers sized from max_read_frames() must still hold one step after the change
+        const int read_frames = sample_rate == out_sample_rate_ ? 1 : read_frames_for(sample_rate);
+        if (max_read_frames_ > 0 && read_frames > max_read_frames_) {
+            logger_->error("Cannot switch to {} Hz mid-stream", sample_rate);
+            return false;
+        }
+        min_read_frames_ = read_frames;
+
+        convert_kernel_ = nullptr;
+        if (sample_rate == out_sample_rate_) {
+            const auto type = sample_type(format);
+            const auto route = conversion_route(layout, out_channels_);
+            if (type && route) {
+                convert_kernel_ = convert::find_kernel(*type, av_sample_fmt_is_planar(format) != 0,
+                                                       layout.nb_channels, *route);
+            }
+        }
+        if (convert_kernel_) {
+            logger_->debug("Converting {} ({} channels) without the resampler", av_get_sample_fmt_name(format),
+                           layout.nb_channels);
+            return true;
+        }
+
+        // The resampler context outlives close(), so a decoder that is reused for the next track only reconfigures it
+        if (!swr_ctx_) {
+            swr_ctx_ = swr_alloc();
+        }
+        if (!swr_ctx_) {
+            logger_->error("Cannot allocate resampler");
+            return false;
+        }
+        av_opt_set_chlayout(swr_ctx_, "in_chlayout", &layout, 0);
+        av_opt_set_int(swr_ctx_, "in_sample_rate", sample_rate, 0);
+        av_opt_set_sample_fmt(swr_ctx_, "in_sample_fmt", format, 0);
+
+        AVChannelLayout out_ch_layout;
+        av_channel_layout_default(&out_ch_layout, out_channels_);
+        av_opt_set_chlayout(swr_ctx_, "out_chlayout", &out_ch_layout, 0);
+        av_opt_set_int(swr_ctx_, "out_sample_rate", out_sample_rate_, 0);
+        av_opt_set_sample_fmt(swr_ctx_, "out_sample_fmt", AV_SAMPLE_FMT_FLT, 0);
+        av_channel_layout_uninit(&out_ch_layout);
+
+        if (swr_init(swr_ctx_) < 0) {
+            logger_->error("Cannot initialize resampler");
+            return false;
+        }
+        swr_primed_frames_ = 0;
+        return true;
+    }
+
+    // Output frames the resampler may hold back as filter delay. A step only fits once the space left exceeds it, so
+    // with a fixed margin a large upsampling ratio (8 kHz to 48 kHz delays ~100 frames) would never make progress.
+    int AudioDecoder::resampler_headroom(int in_sample_rate) const {
+        int64_t taps = 0;
+        if (!swr_ctx_ || av_opt_get_int(swr_ctx_, "filter_size", 0, &taps) < 0 || taps <= 0) {
+            taps = 32; // libswresample's default
+        }
+        // The filter spans taps input samples when upsampling and taps output samples when downsampling
+        const int64_t delay = std::max(av_rescale_rnd(taps + 2, out_sample_rate_, in_sample_rate, AV_ROUND_UP),
+                                       taps + 2);
+        return std::max(static_cast<int>(delay), RESAMPLER_HEADROOM_FRAMES);
+    }
+
+    // Room one resampler step from in_sample_rate needs: one output sample per input sample, plus the filter delay
+    int AudioDecoder::read_frames_for(int in_sample_rate) const {
+        return static_cast<int>(av_rescale_rnd(1, out_sample_rate_, in_sample_rate, AV_ROUND_UP)) +
+               resampler_headroom(in_sample_rate);
+    }
+
+    void AudioDecoder::close() {
+        segments_.reset(); // Joins the workers
+        avcodec_free_context(&codec_ctx_);
+        avformat_close_input(&format_ctx_);
+        input_.reset(); // Only after the format context that reads from it
+        if (swr_ctx_) {
+            swr_close(swr_ctx_);
+        }
+        convert_kernel_ = nullptr;
+        in_sample_format_ = -1;
+        in_channels_ = 0;
+        in_sample_rate_ = 0;
+        max_read_frames_ = 0;
+        av_packet_unref(packet_);
+        av_frame_unref(frame_);
+        audio_stream_index_ = -1;
+        file_path_.clear();
+        source_.reset();
+        seek_index_.reset();
+
+        frame_offset_ = 0;
+        frame_end_ = 0;
+        priming_samples_ = 0;
+        valid_samples_ = -1;
+        leading_skip_ = 0;
+        decoded_position_ = 0;
+        seek_target_ = -1;
+        discard_frames_ = 0;
+        demuxer_eof_ = false;
+        decoder_drained_ = false;
+        eof_ = false;
+        duration_secs_ = 0.0;
+    }
+
+    int AudioDecoder::source_sample_rate() const { return codec_ctx_ ? codec_ctx_->sample_rate : 0; }
+
+    // iTunSMPB: " 00000000 PPPPPPPP EEEEEEEE SSSSSSSSSSSSSSSS" = reserved, priming, end padding, valid sample count.
+    // iTunes writes it into MP4 atoms and into an ID3 COMM frame of MP3s; FFmpeg exposes the latter as a tag.
+    void AudioDecoder::read_gapless_info() {
+        const AVDictionaryEntry *tag =
+                av_dict_get(format_ctx_->streams[audio_stream_index_]->metadata, "iTunSMPB", nullptr, 0);
+        if (!tag) {
+            tag = av_dict_get(format_ctx_->metadata, "iTunSMPB", nullptr, 0);
+        }
+        if (!tag) {
+            return;
+        }
+
+        unsigned int reserved = 0, priming = 0, padding = 0;
+        unsigned long long valid = 0;
+        if (std::sscanf(tag->value, "%x %x %x %llx", &reserved, &priming, &padding, &valid) == 4 && valid > 0) {
+            priming_samples_ = priming;
+            valid_samples_ = static_cast<int64_t>(valid);
+            logger_->debug("iTunSMPB: priming {}, padding {}, valid samples {}", priming, padding, valid);
+        }
+    }
+
+    // Stream position of frame_ in source samples, recovered from its timestamp
+    int64_t AudioDecoder::frame_position() const {
+        const AVStream *stream = format_ctx_->streams[audio_stream_index_];
+        const int64_t pts = frame_->best_effort_timestamp;
+        if (pts == AV_NOPTS_VALUE) {
+            // Nothing better to go on: assume the demuxer landed where it was asked to
+            return seek_target_ >= 0 ? seek_target_ : priming_samples_;
+        }
+        const int64_t start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+        return av_rescale_q(pts - start, stream->time_base, {1, codec_ctx_->sample_rate});
+    }
+
+    // Narrows frame_ to the samples that belong to the track, dropping encoder delay and padding,
+    // and anything before the target of an accurate seek.
+    void AudioDecoder::trim_frame() {
+        const int nb_samples = frame_->nb_samples;
+        frame_offset_ = 0;
+        frame_end_ = nb_samples;
+
+        if (decoded_position_ < 0) {
+            // First frame after a seek without a known landing position
+            decoded_position_ = frame_position();
+        }
+
+        if (valid_samples_ >= 0) {
+            const int64_t begin = priming_samples_ - decoded_position_;
+            const int64_t end = priming_samples_ + valid_samples_ - decoded_position_;
+            frame_offset_ = static_cast<int>(std::clamp<int64_t>(begin, 0, nb_samples));
+            frame_end_ = static_cast<int>(std::clamp<int64_t>(end, frame_offset_, nb_samples));
+        } else if (const AVFrameSideData *side = av_frame_get_side_data(frame_, AV_FRAME_DATA_SKIP_SAMPLES);
+                   side && side->size >= 8) {
+            // le32 samples to skip at the start, le32 samples to discard at the end
+            const int64_t skip_start = AV_RL32(side->data);
+            const int64_t skip_end = AV_RL32(side->data + 4);
+            frame_offset_ = static_cast<int>(std::min<int64_t>(skip_start, nb_samples));
+            frame_end_ = static_cast<int>(std::max<int64_t>(frame_offset_, nb_samples - skip_end));
+            if (decoded_position_ == 0) {
+                leading_skip_ = skip_start;
+            }
+        }
+
+        if (seek_target_ >= 0) {
+            const int64_t skip = seek_target_ - decoded_position_;
+            if (skip >= nb_samples) {
+                frame_offset_ = frame_end_; // Entirely before the target
+            } else {
+                frame_offset_ = static_cast<int>(std::clamp<int64_t>(skip, frame_offset_, frame_end_));
+                seek_target_ = -1;
+            }
+        }
+
+        decoded_position_ += nb_samples;
+    }
+
+    // Pulls the next decoded frame into frame_. Returns false once the decoder is fully drained.
+    bool AudioDecoder::receive_frame() {
+        // Demuxing and decoding allocate packets and frames inside FFmpeg, which the decoder step can't avoid
+        MUSICENGINE_REALTIME_EXEMPT("FFmpeg demux and decode");
+        while (true) {
+            const int64_t receive_start = timings_ ? TimingHistogram::now_ns() : 0;
+            int ret = avcodec_receive_frame(codec_ctx_, frame_);
+            if (ret == 0) {
+                if (timings_) {
+                    timings_->decode.record_since(receive_start); // Empty-handed polls aren't counted
+                }
+                // Some streams change format mid-track (e.g. a radio stream switching programs)
+                if (frame_->format != in_sample_format_ || frame_->ch_layout.nb_channels != in_channels_ ||
+                    frame_->sample_rate != in_sample_rate_) {
+                    logger_->debug("Stream format changed, setting up the conversion again");
+                    if (!configure_conversion(frame_->format, frame_->ch_layout, frame_->sample_rate)) {
+                        decoder_drained_ = true;
+                        frame_offset_ = 0;
+                        frame_end_ = 0;
+                        return false;
+                    }
+                }
+                trim_frame();
+                return true;
+            }
+            if (ret != AVERROR(EAGAIN) || demuxer_eof_) {
+                // AVERROR_EOF after the flush packet, or an unrecoverable decoder error
+                decoder_drained_ = true;
+                frame_offset_ = 0;
+                frame_end_ = 0;
+                return false;
+            }
+
+            int read_ret;
+            {
+                DecoderTimings::Scope timer(timings_, &DecoderTimings::read);
+                read_ret = av_read_frame(format_ctx_, packet_);
+            }
+            if (read_ret < 0) {
+                // End of file: send the flush packet so the decoder hands out its delayed frames
+                demuxer_eof_ = true;
+                avcodec_send_packet(codec_ctx_, nullptr);
+                continue;
+            }
+            if (packet_->stream_index == audio_stream_index_) {
+                DecoderTimings::Scope timer(timings_, &DecoderTimings::decode);
+                if (avcodec_send_packet(codec_ctx_, packet_) < 0) {
+                    logger_->debug("Skipping a packet the decoder rejected");
+                }
+            }
+            av_packet_unref(packet_);
+        }
+    }
+
+    int AudioDecoder::read(float *dst, int max_frames) {
+        if (!is_open() || eof_) {
+            return 0;
+        }
+
+        int produced;
+        for (;;) {
+            if (segments_) {
+                produced = segments_->read(dst, max_frames);
+                eof_ = segments_->eof();
+            } else {
+                produced = decode(dst, max_frames);
+            }
+            if (produced <= 0 || discard_frames_ == 0) {
+                break;
+            }
+            // Output before the target of seek_to_frame() only primed the resampler
+            const int dropped = static_cast<int>(std::min<int64_t>(discard_frames_, produced));
+            std::memmove(dst, dst + static_cast<size_t>(dropped) * out_channels_,
+                         static_cast<size_t>(produced - dropped) * out_channels_ * sizeof(float));
+            discard_frames_ -= dropped;
+            produced -= dropped;
+            if (produced > 0) {
+                break;
+            }
+        }
+        if (output_gain_ != 1.0f && produced > 0) {
+            mix::apply_gain(dst, static_cast<size_t>(produced) * out_channels_, output_gain_);
+        }
+        return produced;
+    }
+
+    int AudioDecoder::decode(float *dst, int max_frames) {
+        int produced = 0;
+
+        while (produced < max_frames) {
+            const int space = max_frames - produced;
+            float *out = dst + static_cast<size_t>(produced) * out_channels_;
+            uint8_t *out_planes[1] = {reinterpret_cast<uint8_t *>(out)};
+
+            if (frame_offset_ >= frame_end_) {
+                if (!receive_frame()) {
+                    // Decoder drained: flush the samples the resampler still holds
+                    int flushed = 0;
+                    if (!convert_kernel_) {
+                        DecoderTimings::Scope timer(timings_, &DecoderTimings::resample);
+                        // Once per track, at its end
+                        MUSICENGINE_REALTIME_EXEMPT("swr_convert flush");
+                        flushed = swr_convert(swr_ctx_, out_planes, space, nullptr, 0);
+                    }
+                    if (flushed > 0) {
+                        produced += flushed;
+                        continue;
+                    }
+                    eof_ = true;
+                    break;
+                }
+                continue;
+            }
+
+            // Point the input planes at the unconsumed part of the frame
+            const int in_available = frame_end_ - frame_offset_;
+            const int channels = frame_->ch_layout.nb_channels;
+            const auto in_format = static_cast<AVSampleFormat>(frame_->format);
+            const int bytes_per_sample = av_get_bytes_per_sample(in_format);
+            std::array<const uint8_t *, MAX_PLANES> in_planes{};
+            if (av_sample_fmt_is_planar(in_format)) {
+                for (int ch = 0; ch < channels && ch < static_cast<int>(MAX_PLANES); ++ch) {
+                    in_planes[ch] = frame_->extended_data[ch] + static_cast<size_t>(frame_offset_) * bytes_per_sample;
+                }
+            } else {
+                in_planes[0] = frame_->extended_data[0] +
+                               static_cast<size_t>(frame_offset_) * bytes_per_sample * channels;
+            }
+
+            // Same rate, so one output frame per input frame and no state carried between calls
+            if (convert_kernel_) {
+                const int chunk = std::min(space, in_available);
+                {
+                    DecoderTimings::Scope timer(timings_, &DecoderTimings::resample);
+                    convert_kernel_(out, in_planes.data(), static_cast<size_t>(chunk));
+                }
+                frame_offset_ += chunk;
+                produced += chunk;
+                continue;
+            }
+
+            // Only hand the resampler as much input as is guaranteed to fit into the remaining space, so it never
+            // has to buffer output internally. The rest of the frame stays in frame_ for the next call.
+            const int64_t delay = swr_get_delay(swr_ctx_, out_sample_rate_);
+            int in_chunk = static_cast<int>(std::min<int64_t>(
+                    in_available, av_rescale_rnd(space - delay, in_sample_rate_, out_sample_rate_, AV_ROUND_DOWN)));
+            while (in_chunk > 0 && swr_get_out_samples(swr_ctx_, in_chunk) > space) {
+                in_chunk -= std::max(1, in_chunk / 8);
+            }
+            const bool forced = in_chunk <= 0;
+            if (forced) {
+                if (produced > 0) {
+                    break; // Not enough room left in dst for one more step
+                }
+                // Returning 0 without eof would make callers retry forever; feed one sample and let swr buffer what
+                // doesn't fit for the next call
+                in_chunk = 1;
+            }
+
+            int converted;
+            {
+                DecoderTimings::Scope timer(timings_, &DecoderTimings::resample);
+                const auto convert = [&] {
+                    return swr_convert(swr_ctx_, out_planes, space, in_planes.data(), in_chunk);
+                };
+                // swr_convert() sizes its internal buffers for the largest chunk it has been given, and buffers the
+                // output that didn't fit when a step is forced. After that it runs without allocating.
+                if (in_chunk > swr_primed_frames_ || forced) {
+                    MUSICENGINE_REALTIME_EXEMPT("swr_convert growing its buffers");
+                    converted = convert();
+                    swr_primed_frames_ = std::max(swr_primed_frames_, in_chunk);
+                } else {
+                    converted = convert();
+                }
+            }
+            if (converted < 0) {
+                logger_->error("Resampling failed");
+                if (produced == 0) {
+                    return converted;
+                }
+                break;
+            }
+            frame_offset_ += in_chunk;
+            produced += converted;
+        }
+        return produced;
+    }
+
+    bool AudioDecoder::reset_resampler() {
+        // Re-initializing drops any samples the resampler buffered from before the seek
+        swr_primed_frames_ = 0;
+        return convert_kernel_ || swr_init(swr_ctx_) >= 0;
+    }
+
+    bool AudioDecoder::seek(double position_secs, bool accurate) {
+        if (!is_open()) {
+            return false;
+        }
+        discard_frames_ = 0;
+        if (segments_) {
+            segments_->start(position_secs);
+            eof_ = false;
+            return true;
+        }
+
+        const AVStream *stream = format_ctx_->streams[audio_stream_index_];
+        const AVRational sample_time_base{1, codec_ctx_->sample_rate};
+        const int64_t start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+
+        // 计算FFmpeg时间戳
+        int64_t target_timestamp = start + av_rescale_q(static_cast<int64_t>(position_secs * AV_TIME_BASE),
+                                                        {1, AV_TIME_BASE}, stream->time_base);
+        // The target as a stream position: encoder delay comes before the track's 0:00
+        const int64_t lead = valid_samples_ >= 0 ? priming_samples_ : leading_skip_;
+        const int64_t target_position =
+                av_rescale_q(target_timestamp - start, stream->time_base, sample_time_base) + lead;
+
+        // Land early enough for the decoder to warm up before the samples we keep
+        const int64_t warmup = accurate ? stream->codecpar->seek_preroll + SEEK_WARMUP_SAMPLES : 0;
+        const int64_t landing_timestamp =
+                std::max(start, target_timestamp - av_rescale_q(warmup, sample_time_base, stream->time_base));
+
+        // 执行 seek
+        // Prefer the packet index: it gives an exact byte offset and timestamp where the container can't
+        if (!seek_index_ && !file_path_.empty()) {
+            seek_index_ = SeekIndexCache::get_instance().find(file_path_);
+        }
+        int64_t landed_position = -1;
+        const SeekIndex::Entry *entry = seek_index_ ? seek_index_->find(landing_timestamp) : nullptr;
+        if (entry && av_seek_frame(format_ctx_, audio_stream_index_, entry->pos, AVSEEK_FLAG_BYTE) >= 0) {
+            landed_position = av_rescale_q(entry->pts - start, stream->time_base, sample_time_base);
+        } else if (av_seek_frame(format_ctx_, audio_stream_index_, landing_timestamp, AVSEEK_FLAG_BACKWARD) < 0) {
+            logger_->error("Failed to seek to position {}", position_secs);
+            return false;
+        }
+
+        // 清空解码器缓冲区
+        avcodec_flush_buffers(codec_ctx_);
+        av_frame_unref(frame_);
+        frame_offset_ = 0;
+        frame_end_ = 0;
+        // Without the index, the position is recovered from the first decoded frame's timestamp
+        decoded_position_ = landed_position;
+        seek_target_ = accurate ? target_position : -1;
+        demuxer_eof_ = false;
+        decoder_drained_ = false;
+        eof_ = false;
+        return reset_resampler();
+    }
+
+    bool AudioDecoder::seek_to_frame(int64_t frame) {
+        if (!is_open()) {
+            return false;
+        }
+        const double target_secs = static_cast<double>(frame) / out_sample_rate_;
+        const bool resampling = out_sample_rate_ != codec_ctx_->sample_rate;
+        const double seek_secs = resampling ? std::max(0.0, target_secs - RESAMPLER_WARMUP_SECS) : target_secs;
+        if (!seek(seek_secs, true)) {
+            return false;
+        }
+        discard_frames_ = std::max<int64_t>(0, frame - std::llround(seek_secs * out_sample_rate_));
+        return true;
+    }
+
+} // namespace MusicEngine
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "convert_kernels.hpp"
+#include "media_input.hpp"
+#include "playback_telemetry.hpp"
+#include "seek_index.hpp"
+#include "segment_decoder.hpp"
+#include "spdlog/spdlog.h"
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct SwrContext;
+struct AVPacket;
+struct AVFrame;
+struct AVChannelLayout;
+
+namespace MusicEngine {
+
+    /**
+     * @class AudioDecoder
+     * @brief Demuxes, decodes and converts one audio file to interleaved F32 PCM.
+     *
+     * When the sample rate doesn't change and the channel layout is a common one (mono, stereo, 5.1), frames are
+     * converted by a kernel from convert_kernels.hpp, or just copied if they are interleaved float already;
+     * libswresample is only set up for everything else.
+     * read() converts straight into the caller's buffer (typically a region of the playback ring), so no
+     * intermediate copies are made. All buffers are allocated in open(); reading does not allocate on our side.
+     * Not thread-safe: a decoder is driven by one thread at a time.
+     *
+     * Encoder delay and padding are removed so that consecutive tracks can be spliced sample-accurately: an
+     * iTunSMPB tag takes precedence, otherwise the skip information FFmpeg derives from LAME/Xing headers,
+     * Opus pre-skip or MP4 edit lists is applied.
+     */
+    class AudioDecoder {
+    public:
+        explicit AudioDecoder(std::shared_ptr<spdlog::logger> logger);
+        ~AudioDecoder();
+
+        AudioDecoder(const AudioDecoder &) = delete;
+        AudioDecoder &operator=(const AudioDecoder &) = delete;
+
+        /**
+         * @brief Opens a file and prepares conversion to the given output format.
+         * Any previously opened file is closed first.
+         * @param file_path The music file to open.
+         * @param out_sample_rate Output sample rate, or 0 to keep the source rate.
+         * @param out_channels Number of interleaved output channels.
+         * @return true on success. On failure the decoder is left closed and the reason is logged.
+         */
+        bool open(const std::filesystem::path &file_path, int out_sample_rate = 0, int out_channels = 2);
+
+        /**
+         * @brief Opens a track read from @p source, otherwise like the overload above.
+         *
+         * Seeking uses the container's own index only, since SeekIndexCache keys its indexes by path.
+         */
+        bool open(const std::shared_ptr<InputSource> &source, int out_sample_rate = 0, int out_channels = 2);
+
+        /**
+         * @brief How much data the read-ahead thread keeps ahead of the demuxer, for sources and for files on
+         * network filesystems. Applies from the next open().
+         */
+        void set_prefetch_bytes(size_t bytes) { prefetch_bytes_ = bytes; }
+
+        /**
+         * @brief Threads the codec may decode with, for codecs that support frame or slice threading (e.g. FLAC,
+         * ALAC). 0 picks a count from the number of cores; 1, the default, decodes on the calling thread.
+         * Frame threading delays output by one frame per thread. Applies from the next open().
+         */
+        void set_codec_threads(int threads) { codec_threads_ = threads; }
+
+        /**
+         * @brief Decodes tracks of at least @p min_duration_secs with a SegmentDecoder of @p workers threads
+         * instead of on the calling thread. Fewer than 2 workers turns this off. Applies from the next open().
+         *
+         * Only tracks that can be seeked are split. seek() then always seeks accurately.
+         */
+        void set_parallel_segments(int workers, double min_duration_secs) {
+            segment_workers_ = workers;
+            segment_min_duration_secs_ = min_duration_secs;
+        }
+
+        /**
+         * @brief Records how long reading, decoding and converting take into @p timings, or stops recording if
+         * nullptr (the default). Applies at once; segment workers started afterwards record into it as well.
+         * @p timings must outlive the decoder or be unset first.
+         */
+        void set_timings(DecoderTimings *timings) { timings_ = timings; }
+
+        /**
+         * @brief Closes the track. Safe to call on a closed decoder.
+         *
+         * The packet, frame and resampler context are kept, so opening the next track with the same decoder
+         * doesn't allocate them again.
+         */
+        void close();
+
+        bool is_open() const { return codec_ctx_ != nullptr; }
+
+        /**
+         * @brief Decodes and converts up to @p max_frames frames into @p dst.
+         *
+         * May return fewer frames than requested. A return value of 0 means either end of stream (eof() is
+         * true) or that @p max_frames is too small for the resampler to make progress; the caller should then
+         * retry with a larger buffer.
+         *
+         * @return The number of frames written, or a negative value on a decoding error.
+         */
+        int read(float *dst, int max_frames);
+
+        /**
+         * @brief Seeks to @p position_secs and resets decoder and resampler state.
+         *
+         * The demuxer lands on a packet at or before the target, found through the file's SeekIndex when one
+         * has been built (see SeekIndexCache) and through the container otherwise. With @p accurate set, the
+         * samples between that packet and the target are decoded and discarded, so the next read() starts
+         * exactly at @p position_secs; otherwise reading resumes at the packet.
+         *
+         * @return true on success.
+         */
+        bool seek(double position_secs, bool accurate = true);
+
+        /**
+         * @brief Seeks so that the next read() continues exactly with output frame @p frame, as if the track had
+         * been read from its start: with a rate change, decoding starts a little earlier to prime the resampler
+         * and the output before @p frame is dropped. Used to splice a decoder onto audio decoded elsewhere.
+         * @return true on success.
+         */
+        bool seek_to_frame(int64_t frame);
+
+        bool eof() const { return eof_; }
+        double duration() const { return duration_secs_; }
+        int source_sample_rate() const;
+        int output_sample_rate() const { return out_sample_rate_; }
+        int output_channels() const { return out_channels_; }
+
+        /**
+         * @brief Sets a linear gain that read() applies to everything it produces (e.g. ReplayGain).
+         * The multiply runs vectorized on the converted output, so it costs nothing on the consumer side.
+         */
+        void set_output_gain(float gain) { output_gain_ = gain; }
+        float output_gain() const { return output_gain_; }
+
+        /**
+         * @brief Smallest buffer, in frames, that read() always makes progress with.
+         */
+        int min_read_frames() const { return min_read_frames_; }
+
+        /**
+         * @brief Largest value min_read_frames() can take while this track is open, including after a mid-stream
+         * format change. Buffers that stage read() output should be sized from this.
+         */
+        int max_read_frames() const { return max_read_frames_; }
+
+    private:
+        // Everything after avformat_open_input(): stream info, codec and resampler
+        bool open_stream(int out_sample_rate, int out_channels);
+        void start_segments();
+        int decode(float *dst, int max_frames);
+        bool receive_frame();
+        void trim_frame();
+        bool configure_conversion(int sample_format, const AVChannelLayout &layout, int sample_rate);
+        bool reset_resampler();
+        int resampler_headroom(int in_sample_rate) const;
+        int read_frames_for(int in_sample_rate) const;
+        void read_gapless_info();
+        int64_t frame_position() const;
+
+        std::shared_ptr<spdlog::logger> logger_;
+
+        std::unique_ptr<MediaInput> input_; // Custom I/O of format_ctx_; nullptr if FFmpeg opened the file itself
+        AVFormatContext *format_ctx_ = nullptr;
+        AVCodecContext *codec_ctx_ = nullptr;
+        SwrContext *swr_ctx_ = nullptr; // Configured only while convert_kernel_ is nullptr
+        int swr_primed_frames_ = 0;     // Largest input chunk swr_ctx_ has been given since it was last initialized
+        convert::Kernel convert_kernel_ = nullptr;
+        AVPacket *packet_ = nullptr;
+        AVFrame *frame_ = nullptr;
+        int audio_stream_index_ = -1;
+        std::filesystem::path file_path_; // Empty when reading from an InputSource
+        std::shared_ptr<InputSource> source_;
+        std::shared_ptr<const SeekIndex> seek_index_;
+        size_t prefetch_bytes_ = MediaInput::DEFAULT_PREFETCH_BYTES;
+        int codec_threads_ = 1;
+        int segment_workers_ = 0;
+        double segment_min_duration_secs_ = 0.0;
+        // Set while a long track is decoded in parallel; read() and seek() then go through it
+        std::unique_ptr<SegmentDecoder> segments_;
+        DecoderTimings *timings_ = nullptr;
+
+        // Samples of frame_ that have already been handed to the resampler, and the end of its usable part
+        int frame_offset_ = 0;
+        int frame_end_ = 0;
+
+        // Gapless information from iTunSMPB, in source samples. valid_samples_ is -1 if the tag is absent.
+        int64_t priming_samples_ = 0;
+        int64_t valid_samples_ = -1;
+        // Encoder delay reported by skip-samples side data on the first frame
+        int64_t leading_skip_ = 0;
+        // Source samples decoded since the start of the stream, -1 if unknown (after a seek until the next frame)
+        int64_t decoded_position_ = 0;
+        // Accurate seek in progress: samples before this stream position are discarded. -1 if none.
+        int64_t seek_target_ = -1;
+        // Output frames read() still drops after seek_to_frame()
+        int64_t discard_frames_ = 0;
+        bool demuxer_eof_ = false;
+        bool decoder_drained_ = false;
+        bool eof_ = false;
+
+        // Input format the conversion is currently set up for; a frame that differs sets it up again
+        int in_sample_format_ = -1;
+        int in_channels_ = 0;
+        int in_sample_rate_ = 0;
+
+        int out_sample_rate_ = 0;
+        int out_channels_ = 0;
+        int min_read_frames_ = 1;
+        int max_read_frames_ = 0; // 0 while no track is open
+        float output_gain_ = 1.0f;
+        double duration_secs_ = 0.0;
+    };
+
+} // namespace MusicEngine
@@ -0,0 +1,221 @@
+#include "convert_kernels.hpp"
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MUSICENGINE_CONVERT_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MUSICENGINE_CONVERT_NEON 1
+#endif
+
+namespace MusicEngine::convert {
+
+    namespace {
+
+        // -3 dB, the level libswresample mixes center and surround channels into stereo with
+        constexpr float DOWNMIX_LEVEL = 0.70710678f;
+
+        template<typename T>
+        constexpr float SCALE = 1.0f;
+        template<>
+        constexpr float SCALE<int16_t> = 1.0f / 32768.0f;
+        template<>
+        constexpr float SCALE<int32_t> = 1.0f / 2147483648.0f;
+
+        template<typename T>
+        float to_float(T sample) {
+            return static_cast<float>(sample) * SCALE<T>;
+        }
+
+        template<typename T>
+        const T *plane(const uint8_t *const *planes, int channel) {
+            return reinterpret_cast<const T *>(planes[channel]);
+        }
+
+        // Four samples at a time. Interleaving two channels is an unpack on SSE2 and a structured store on NEON;
+        // wider vectors would need lane-crossing shuffles for the same job, so the kernels stay at 128 bits.
+#if defined(MUSICENGINE_CONVERT_SSE2)
+#define MUSICENGINE_CONVERT_VECTOR 1
+        using Vec = __m128;
+
+        template<typename T>
+        Vec load(const T *p) {
+            if constexpr (std::is_same_v<T, float>) {
+                return _mm_loadu_ps(p);
+            } else if constexpr (std::is_same_v<T, int16_t>) {
+                // Sign-extend by placing each sample in the upper half of a 32-bit lane and shifting it back down
+                const __m128i s16 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+                const __m128i s32 = _mm_srai_epi32(_mm_unpacklo_epi16(s16, s16), 16);
+                return _mm_mul_ps(_mm_cvtepi32_ps(s32), _mm_set1_ps(SCALE<T>));
+            } else {
+                const __m128i s32 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                return _mm_mul_ps(_mm_cvtepi32_ps(s32), _mm_set1_ps(SCALE<T>));
+            }
+        }
+
+        void store(float *dst, Vec v) { _mm_storeu_ps(dst, v); }
+
+        void store_stereo(float *dst, Vec left, Vec right) {
+            _mm_storeu_ps(dst, _mm_unpacklo_ps(left, right));
+            _mm_storeu_ps(dst + 4, _mm_unpackhi_ps(left, right));
+        }
+
+        // a + b * c
+        Vec mul_add(Vec a, Vec b, Vec c) { return _mm_add_ps(a, _mm_mul_ps(b, c)); }
+        Vec add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+        Vec mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+        Vec splat(float value) { return _mm_set1_ps(value); }
+#elif defined(MUSICENGINE_CONVERT_NEON)
+#define MUSICENGINE_CONVERT_VECTOR 1
+        using Vec = float32x4_t;
+
+        template<typename T>
+        Vec load(const T *p) {
+            if constexpr (std::is_same_v<T, float>) {
+                return vld1q_f32(p);
+            } else if constexpr (std::is_same_v<T, int16_t>) {
+                return vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(p))), SCALE<T>);
+            } else {
+                return vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(p)), SCALE<T>);
+            }
+        }
+
+        void store(float *dst, Vec v) { vst1q_f32(dst, v); }
+        void store_stereo(float *dst, Vec left, Vec right) { vst2q_f32(dst, (float32x4x2_t{{left, right}})); }
+        Vec mul_add(Vec a, Vec b, Vec c) { return vmlaq_f32(a, b, c); }
+        Vec add(Vec a, Vec b) { return vaddq_f32(a, b); }
+        Vec mul(Vec a, Vec b) { return vmulq_f32(a, b); }
+        Vec splat(float value) { return vdupq_n_f32(value); }
+#endif
+
+        // Same layout in and out. Interleaved and mono input is converted sample by sample, planar stereo is
+        // interleaved on the way.
+        template<typename T, bool Planar, int Channels>
+        void copy_frames(float *dst, const uint8_t *const *planes, size_t frames) {
+            static_assert(Channels == 1 || Channels == 2);
+            size_t i = 0;
+            if constexpr (!Planar || Channels == 1) {
+                const T *in = plane<T>(planes, 0);
+                const size_t count = frames * Channels;
+                if constexpr (std::is_same_v<T, float>) {
+                    std::memcpy(dst, in, count * sizeof(float)); // Already the output format
+                } else {
+#if defined(MUSICENGINE_CONVERT_VECTOR)
+                    for (; i + 4 <= count; i += 4) {
+                        store(dst + i, load(in + i));
+                    }
+#endif
+                    for (; i < count; ++i) {
+                        dst[i] = to_float(in[i]);
+                    }
+                }
+            } else {
+                const T *left = plane<T>(planes, 0);
+                const T *right = plane<T>(planes, 1);
+#if defined(MUSICENGINE_CONVERT_VECTOR)
+                for (; i + 4 <= frames; i += 4) {
+                    store_stereo(dst + 2 * i, load(left + i), load(right + i));
+                }
+#endif
+                for (; i < frames; ++i) {
+                    dst[2 * i] = to_float(left[i]);
+                    dst[2 * i + 1] = to_float(right[i]);
+                }
+            }
+        }
+
+        // A single channel is laid out the same whether the format is planar or not. Like libswresample, which
+        // treats mono as FC, it goes to both sides at -3 dB
+        template<typename T>
+        void mono_to_stereo(float *dst, const uint8_t *const *planes, size_t frames) {
+            const T *in = plane<T>(planes, 0);
+            size_t i = 0;
+#if defined(MUSICENGINE_CONVERT_VECTOR)
+            const Vec level = splat(DOWNMIX_LEVEL);
+            for (; i + 4 <= frames; i += 4) {
+                const Vec mono = mul(load(in + i), level);
+                store_stereo(dst + 2 * i, mono, mono);
+            }
+#endif
+            for (; i < frames; ++i) {
+                dst[2 * i] = dst[2 * i + 1] = to_float(in[i]) * DOWNMIX_LEVEL;
+            }
+        }
+
+        // FFmpeg orders both 5.1 layouts FL FR FC LFE, then BL BR or SL SR:
+        // L = FL + (FC + BL) * -3 dB, R = FR + (FC + BR) * -3 dB
+        template<typename T, bool Planar>
+        void downmix_51(float *dst, const uint8_t *const *planes, size_t frames) {
+            size_t i = 0;
+            if constexpr (Planar) {
+                const T *fl = plane<T>(planes, 0);
+                const T *fr = plane<T>(planes, 1);
+                const T *fc = plane<T>(planes, 2);
+                const T *bl = plane<T>(planes, 4);
+                const T *br = plane<T>(planes, 5);
+#if defined(MUSICENGINE_CONVERT_VECTOR)
+                const Vec level = splat(DOWNMIX_LEVEL);
+                for (; i + 4 <= frames; i += 4) {
+                    const Vec center = load(fc + i);
+                    const Vec left = mul_add(load(fl + i), add(center, load(bl + i)), level);
+                    const Vec right = mul_add(load(fr + i), add(center, load(br + i)), level);
+                    store_stereo(dst + 2 * i, left, right);
+                }
+#endif
+                for (; i < frames; ++i) {
+                    const float center = to_float(fc[i]);
+                    dst[2 * i] = to_float(fl[i]) + (center + to_float(bl[i])) * DOWNMIX_LEVEL;
+                    dst[2 * i + 1] = to_float(fr[i]) + (center + to_float(br[i])) * DOWNMIX_LEVEL;
+                }
+            } else {
+                const T *in = plane<T>(planes, 0);
+                for (; i < frames; ++i) {
+                    const T *frame = in + 6 * i;
+                    const float center = to_float(frame[2]);
+                    dst[2 * i] = to_float(frame[0]) + (center + to_float(frame[4])) * DOWNMIX_LEVEL;
+                    dst[2 * i + 1] = to_float(frame[1]) + (center + to_float(frame[5])) * DOWNMIX_LEVEL;
+                }
+            }
+        }
+
+        template<typename T, bool Planar>
+        Kernel kernel_for(int channels, Route route) {
+            switch (route) {
+                case Route::Copy:
+                    if (channels == 1) {
+                        return copy_frames<T, Planar, 1>;
+                    }
+                    if (channels == 2) {
+                        return copy_frames<T, Planar, 2>;
+                    }
+                    return nullptr;
+                case Route::MonoToStereo:
+                    return channels == 1 ? mono_to_stereo<T> : nullptr;
+                case Route::Surround51ToStereo:
+                    return channels == 6 ? downmix_51<T, Planar> : nullptr;
+            }
+            return nullptr;
+        }
+
+        template<typename T>
+        Kernel kernel_for(bool planar, int channels, Route route) {
+            return planar ? kernel_for<T, true>(channels, route) : kernel_for<T, false>(channels, route);
+        }
+
+    } // namespace
+
+    Kernel find_kernel(SampleType type, bool planar, int channels, Route route) {
+        switch (type) {
+            case SampleType::S16:
+                return kernel_for<int16_t>(planar, channels, route);
+            case SampleType::S32:
+                return kernel_for<int32_t>(planar, channels, route);
+            case SampleType::F32:
+                return kernel_for<float>(planar, channels, route);
+        }
+        return nullptr;
+    }
+
+} // namespace MusicEngine::convert
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace MusicEngine::convert {
+
+    /**
+     * @brief Sample type of a decoded frame. 16- and 32-bit integers are scaled to [-1, 1) like libswresample does.
+     */
+    enum class SampleType { S16, S32, F32 };
+
+    /**
+     * @brief How source channels map onto the output channels.
+     */
+    enum class Route {
+        Copy,              ///< Same layout on both sides (mono or stereo)
+        MonoToStereo,      ///< The mono channel is copied to left and right
+        Surround51ToStereo ///< 5.1 downmix: center and surrounds at -3 dB, LFE dropped
+    };
+
+    /**
+     * @brief Converts @p frames frames into interleaved F32 at @p dst.
+     *
+     * @p planes holds one pointer per channel for planar input and a single pointer for interleaved input,
+     * each already pointing at the first frame to convert.
+     */
+    using Kernel = void (*)(float *dst, const uint8_t *const *planes, size_t frames);
+
+    /**
+     * @brief Returns the kernel specialized for this input format and route, or nullptr if there is none and the
+     * conversion has to go through libswresample.
+     *
+     * Kernels are instantiated at compile time for each combination and vectorized with SSE2 or NEON where
+     * available. Interleaved float input with Route::Copy is a plain copy.
+     *
+     * @param channels Number of source channels; for Route::Copy also the number of output channels.
+     */
+    Kernel find_kernel(SampleType type, bool planar, int channels, Route route);
+
+} // namespace MusicEngine::convert
@@ -0,0 +1,139 @@
+#include "decoder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "audio_decoder.hpp"
+
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/spdlog.h"
+
+namespace MusicEngine {
+
+    struct Decoder::Impl {
+        std::unique_ptr<AudioDecoder> decoder_;
+
+        // Output of a read() step that didn't fit into the caller's buffer, handed out first on the next call.
+        // The resampler needs min_read_frames() of room to make progress, which a small span may not have.
+        std::vector<float> carry_;
+        size_t carry_offset_ = 0; // In frames
+        size_t carry_frames_ = 0;
+
+        Impl() {
+            // All decoders share one logger; spdlog refuses to register a name twice
+            auto logger = spdlog::get("Decoder");
+            if (!logger) {
+                logger = spdlog::stdout_color_mt("Decoder");
+                logger->set_level(spdlog::level::info);
+            }
+            decoder_ = std::make_unique<AudioDecoder>(std::move(logger));
+        }
+
+        void drop_carry() {
+            carry_offset_ = 0;
+            carry_frames_ = 0;
+        }
+
+        // Opens @p input (a path or an InputSource) and sizes the carry buffer for it
+        template<typename Input>
+        bool open(const Input &input, const AudioFormat &target_format) {
+            drop_carry();
+            if (target_format.channels <= 0) {
+                decoder_->close();
+                return false;
+            }
+            if (!decoder_->open(input, target_format.sample_rate, target_format.channels)) {
+                return false;
+            }
+            carry_.resize(static_cast<size_t>(decoder_->max_read_frames()) * target_format.channels);
+            return true;
+        }
+    };
+
+    Decoder::Decoder() : pimpl_(std::make_unique<Impl>()) {}
+
+    Decoder::~Decoder() = default;
+
+    Decoder::Decoder(Decoder &&) noexcept = default;
+
+    Decoder &Decoder::operator=(Decoder &&) noexcept = default;
+
+    bool Decoder::open(const std::filesystem::path &file_path, const AudioFormat &target_format) {
+        return pimpl_->open(file_path, target_format);
+    }
+
+    bool Decoder::open(std::shared_ptr<InputSource> source, const AudioFormat &target_format) {
+        return pimpl_->open(source, target_format);
+    }
+
+    void Decoder::set_threading(int codec_threads, int segment_workers, double min_duration_secs) {
+        pimpl_->decoder_->set_codec_threads(std::max(0, codec_threads));
+        pimpl_->decoder_->set_parallel_segments(segment_workers, std::max(0.0, min_duration_secs));
+    }
+
+    void Decoder::close() {
+        pimpl_->drop_carry();
+        pimpl_->decoder_->close();
+    }
+
+    bool Decoder::is_open() const { return pimpl_->decoder_->is_open(); }
+
+    size_t Decoder::read(std::span<float> buffer) {
+        AudioDecoder &decoder = *pimpl_->decoder_;
+        if (!decoder.is_open()) {
+            return 0;
+        }
+
+        const size_t channels = static_cast<size_t>(decoder.output_channels());
+        const size_t capacity = buffer.size() / channels;
+        const size_t min_frames = static_cast<size_t>(decoder.min_read_frames());
+        size_t produced = 0;
+
+        while (produced < capacity) {
+            float *dst = buffer.data() + produced * channels;
+            const size_t space = capacity - produced;
+
+            if (pimpl_->carry_frames_ > 0) {
+                const size_t frames = std::min(space, pimpl_->carry_frames_);
+                std::memcpy(dst, pimpl_->carry_.data() + pimpl_->carry_offset_ * channels,
+                            frames * channels * sizeof(float));
+                pimpl_->carry_offset_ += frames;
+                pimpl_->carry_frames_ -= frames;
+                produced += frames;
+                continue;
+            }
+
+            // Decode straight into the caller's buffer when there is room for a resampler step
+            const bool direct = space >= min_frames;
+            const int frames = direct ? decoder.read(dst, static_cast<int>(space))
+                                      : decoder.read(pimpl_->carry_.data(), static_cast<int>(min_frames));
+            if (frames <= 0) {
+                break; // End of file or a decoding error (already logged)
+            }
+            if (direct) {
+                produced += static_cast<size_t>(frames);
+            } else {
+                pimpl_->carry_offset_ = 0;
+                pimpl_->carry_frames_ = static_cast<size_t>(frames);
+            }
+        }
+        return produced;
+    }
+
+    bool Decoder::seek(double position_secs) {
+        pimpl_->drop_carry();
+        return pimpl_->decoder_->seek(position_secs, true);
+    }
+
+    bool Decoder::eof() const { return pimpl_->carry_frames_ == 0 && pimpl_->decoder_->eof(); }
+
+    double Decoder::duration() const { return pimpl_->decoder_->duration(); }
+
+    AudioFormat Decoder::format() const {
+        return {pimpl_->decoder_->output_sample_rate(), pimpl_->decoder_->output_channels()};
+    }
+
+    int Decoder::source_sample_rate() const { return pimpl_->decoder_->source_sample_rate(); }
+
+} // namespace MusicEngine
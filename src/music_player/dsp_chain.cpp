@@ -0,0 +1,555 @@
+#include "dsp_chain.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numbers>
+#include "mix_kernels.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MUSICENGINE_DSP_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MUSICENGINE_DSP_NEON 1
+#endif
+
+namespace MusicEngine {
+
+    namespace {
+
+        // Parameters glide once per sub-block; the preamp additionally ramps linearly within it
+        constexpr size_t SUB_BLOCK_FRAMES = 32;
+        constexpr double SMOOTHING_SECS = 0.02;
+        constexpr double MIN_FREQUENCY_HZ = 10.0;
+        constexpr double MIN_Q = 0.1;
+
+        struct Coeffs {
+            float b0 = 1.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+        };
+
+        // One biquad of the cascade: coefficients and the transposed direct form II state of every channel,
+        // stored as z1[lanes] followed by z2[lanes]
+        struct Section {
+            Coeffs coeffs;
+            float *state;
+        };
+
+        bool is_pass_filter(EqFilterType type) {
+            return type == EqFilterType::LowPass || type == EqFilterType::HighPass;
+        }
+
+        // Audio EQ Cookbook (R. Bristow-Johnson) designs, normalized to a0 = 1
+        Coeffs design(EqFilterType type, double sample_rate, double frequency, double gain_db, double q) {
+            const double a = std::pow(10.0, gain_db / 40.0);
+            const double w0 = 2.0 * std::numbers::pi * frequency / sample_rate;
+            const double cos_w0 = std::cos(w0);
+            const double alpha = std::sin(w0) / (2.0 * q);
+            const double sqrt_a_alpha = 2.0 * std::sqrt(a) * alpha;
+
+            double b0, b1, b2, a0, a1, a2;
+            switch (type) {
+                case EqFilterType::LowShelf:
+                    b0 = a * ((a + 1) - (a - 1) * cos_w0 + sqrt_a_alpha);
+                    b1 = 2 * a * ((a - 1) - (a + 1) * cos_w0);
+                    b2 = a * ((a + 1) - (a - 1) * cos_w0 - sqrt_a_alpha);
+                    a0 = (a + 1) + (a - 1) * cos_w0 + sqrt_a_alpha;
+                    a1 = -2 * ((a - 1) + (a + 1) * cos_w0);
+                    a2 = (a + 1) + (a - 1) * cos_w0 - sqrt_a_alpha;
+                    break;
+                case EqFilterType::HighShelf:
+                    b0 = a * ((a + 1) + (a - 1) * cos_w0 + sqrt_a_alpha);
+                    b1 = -2 * a * ((a - 1) + (a + 1) * cos_w0);
+                    b2 = a * ((a + 1) + (a - 1) * cos_w0 - sqrt_a_alpha);
+                    a0 = (a + 1) - (a - 1) * cos_w0 + sqrt_a_alpha;
+                    a1 = 2 * ((a - 1) - (a + 1) * cos_w0);
+                    a2 = (a + 1) - (a - 1) * cos_w0 - sqrt_a_alpha;
+                    break;
+                case EqFilterType::LowPass:
+                    b0 = (1 - cos_w0) / 2;
+                    b1 = 1 - cos_w0;
+                    b2 = (1 - cos_w0) / 2;
+                    a0 = 1 + alpha;
+                    a1 = -2 * cos_w0;
+                    a2 = 1 - alpha;
+                    break;
+                case EqFilterType::HighPass:
+                    b0 = (1 + cos_w0) / 2;
+                    b1 = -(1 + cos_w0);
+                    b2 = (1 + cos_w0) / 2;
+                    a0 = 1 + alpha;
+                    a1 = -2 * cos_w0;
+                    a2 = 1 - alpha;
+                    break;
+                case EqFilterType::Peaking:
+                default:
+                    b0 = 1 + alpha * a;
+                    b1 = -2 * cos_w0;
+                    b2 = 1 - alpha * a;
+                    a0 = 1 + alpha / a;
+                    a1 = -2 * cos_w0;
+                    a2 = 1 - alpha / a;
+                    break;
+            }
+            return {static_cast<float>(b0 / a0), static_cast<float>(b1 / a0), static_cast<float>(b2 / a0),
+                    static_cast<float>(a1 / a0), static_cast<float>(a2 / a0)};
+        }
+
+        // Scalar reference, used for channel counts the vector path doesn't cover
+        void biquad_cascade_scalar(float *samples, size_t frames, uint32_t channels, const Section *sections,
+                                   size_t count) {
+            for (size_t s = 0; s < count; ++s) {
+                const Coeffs &c = sections[s].coeffs;
+                float *z1 = sections[s].state;
+                float *z2 = sections[s].state + channels;
+                for (uint32_t ch = 0; ch < channels; ++ch) {
+                    float s1 = z1[ch];
+                    float s2 = z2[ch];
+                    for (size_t f = 0; f < frames; ++f) {
+                        float &sample = samples[f * channels + ch];
+                        const float x = sample;
+                        const float y = c.b0 * x + s1;
+                        s1 = c.b1 * x - c.a1 * y + s2;
+                        s2 = c.b2 * x - c.a2 * y;
+                        sample = y;
+                    }
+                    z1[ch] = s1;
+                    z2[ch] = s2;
+                }
+            }
+        }
+
+#if defined(MUSICENGINE_DSP_SSE2) || defined(MUSICENGINE_DSP_NEON)
+#if defined(MUSICENGINE_DSP_SSE2)
+        using Vec = __m128;
+        inline Vec splat(float v) { return _mm_set1_ps(v); }
+        inline Vec add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+        inline Vec sub(Vec a, Vec b) { return _mm_sub_ps(a, b); }
+        inline Vec mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+        inline Vec load4(const float *p) { return _mm_loadu_ps(p); }
+        inline void store4(float *p, Vec v) { _mm_storeu_ps(p, v); }
+
+        // One frame of C channels in the low lanes of a vector
+        template<uint32_t C>
+        inline Vec load_frame(const float *p) {
+            if constexpr (C == 1) {
+                return _mm_load_ss(p);
+            } else if constexpr (C == 2) {
+                return _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double *>(p)));
+            } else {
+                return _mm_loadu_ps(p);
+            }
+        }
+        template<uint32_t C>
+        inline void store_frame(float *p, Vec v) {
+            if constexpr (C == 1) {
+                _mm_store_ss(p, v);
+            } else if constexpr (C == 2) {
+                _mm_store_sd(reinterpret_cast<double *>(p), _mm_castps_pd(v));
+            } else {
+                _mm_storeu_ps(p, v);
+            }
+        }
+#else
+        using Vec = float32x4_t;
+        inline Vec splat(float v) { return vdupq_n_f32(v); }
+        inline Vec add(Vec a, Vec b) { return vaddq_f32(a, b); }
+        inline Vec sub(Vec a, Vec b) { return vsubq_f32(a, b); }
+        inline Vec mul(Vec a, Vec b) { return vmulq_f32(a, b); }
+        inline Vec load4(const float *p) { return vld1q_f32(p); }
+        inline void store4(float *p, Vec v) { vst1q_f32(p, v); }
+
+        template<uint32_t C>
+        inline Vec load_frame(const float *p) {
+            if constexpr (C == 1) {
+                return vsetq_lane_f32(*p, vdupq_n_f32(0.0f), 0);
+            } else if constexpr (C == 2) {
+                return vcombine_f32(vld1_f32(p), vdup_n_f32(0.0f));
+            } else {
+                return vld1q_f32(p);
+            }
+        }
+        template<uint32_t C>
+        inline void store_frame(float *p, Vec v) {
+            if constexpr (C == 1) {
+                vst1q_lane_f32(p, v, 0);
+            } else if constexpr (C == 2) {
+                vst1_f32(p, vget_low_f32(v));
+            } else {
+                vst1q_f32(p, v);
+            }
+        }
+#endif
+
+        // All sections run per frame, one lane per channel, so the cascade stays in registers and every sample is
+        // loaded and stored once per block. State is kept in 4 lanes per section.
+        template<uint32_t C>
+        void biquad_cascade_vector(float *samples, size_t frames, const Section *sections, size_t count) {
+            Vec b0[DspChain::MAX_EQ_BANDS], b1[DspChain::MAX_EQ_BANDS], b2[DspChain::MAX_EQ_BANDS];
+            Vec a1[DspChain::MAX_EQ_BANDS], a2[DspChain::MAX_EQ_BANDS];
+            Vec z1[DspChain::MAX_EQ_BANDS], z2[DspChain::MAX_EQ_BANDS];
+            for (size_t s = 0; s < count; ++s) {
+                const Coeffs &c = sections[s].coeffs;
+                b0[s] = splat(c.b0);
+                b1[s] = splat(c.b1);
+                b2[s] = splat(c.b2);
+                a1[s] = splat(c.a1);
+                a2[s] = splat(c.a2);
+                z1[s] = load4(sections[s].state);
+                z2[s] = load4(sections[s].state + 4);
+            }
+
+            for (size_t f = 0; f < frames; ++f) {
+                float *frame = samples + f * C;
+                Vec x = load_frame<C>(frame);
+                for (size_t s = 0; s < count; ++s) {
+                    const Vec y = add(mul(b0[s], x), z1[s]);
+                    z1[s] = add(sub(mul(b1[s], x), mul(a1[s], y)), z2[s]);
+                    z2[s] = sub(mul(b2[s], x), mul(a2[s], y));
+                    x = y;
+                }
+                store_frame<C>(frame, x);
+            }
+
+            for (size_t s = 0; s < count; ++s) {
+                store4(sections[s].state, z1[s]);
+                store4(sections[s].state + 4, z2[s]);
+            }
+        }
+#endif
+
+#if defined(MUSICENGINE_DSP_SSE2)
+        // Decaying filter tails would otherwise end up in slow denormal arithmetic. Sets flush-to-zero and
+        // denormals-are-zero for the lifetime of the object and then restores the caller's MXCSR, since the same
+        // thread runs the other voices, the mixer and the audio backend.
+        class DenormalsOff {
+        public:
+            DenormalsOff() : saved_(_mm_getcsr()) { _mm_setcsr(saved_ | 0x8040); }
+            ~DenormalsOff() { _mm_setcsr(saved_); }
+
+            DenormalsOff(const DenormalsOff &) = delete;
+            DenormalsOff &operator=(const DenormalsOff &) = delete;
+
+        private:
+            unsigned int saved_;
+        };
+#endif
+
+        void biquad_cascade(float *samples, size_t frames, uint32_t channels, const Section *sections, size_t count) {
+#if defined(MUSICENGINE_DSP_SSE2) || defined(MUSICENGINE_DSP_NEON)
+            switch (channels) {
+                case 1:
+                    return biquad_cascade_vector<1>(samples, frames, sections, count);
+                case 2:
+                    return biquad_cascade_vector<2>(samples, frames, sections, count);
+                case 4:
+                    return biquad_cascade_vector<4>(samples, frames, sections, count);
+                default:
+                    break;
+            }
+#endif
+            biquad_cascade_scalar(samples, frames, channels, sections, count);
+        }
+
+    } // namespace
+
+    struct DspChain::Impl {
+        TripleBuffer<Params> mailbox_;
+        Params params_; // Audio side copy of the newest parameters
+
+        double sample_rate_ = 48000.0;
+        uint32_t channels_ = 2;
+        uint32_t state_lanes_ = 4; // Per-section state stride: 4 lanes for the vector path, else one per channel
+        double smoothing_ = 1.0; // Fraction of the remaining distance covered per sub-block
+
+        // --- Preamp ---
+        float preamp_gain_ = 1.0f;
+        float preamp_target_ = 1.0f;
+
+        // --- EQ ---
+        struct Band {
+            bool present = false; // Part of the cascade
+            EqFilterType type = EqFilterType::Peaking;
+            // Frequency is smoothed on a log scale so glides sound even across octaves
+            double log_frequency = 0.0, gain_db = 0.0, q = 0.0;
+            double target_log_frequency = 0.0, target_gain_db = 0.0, target_q = 0.0;
+            bool settled = true;
+            Coeffs coeffs;
+        };
+        std::array<Band, MAX_EQ_BANDS> bands_{};
+        std::vector<float> eq_state_;
+
+        // --- Limiter ---
+        float limiter_threshold_ = 1.0f;
+        float release_coeff_ = 1.0f;
+        size_t lookahead_ = 1;
+        std::vector<float> delay_; // The last lookahead_ input frames
+        size_t delay_position_ = 0;
+        // Monotonic queue of (frame, required gain) giving the minimum over the look-ahead window
+        std::vector<uint64_t> queue_frames_;
+        std::vector<float> queue_gains_;
+        size_t queue_head_ = 0;
+        size_t queue_size_ = 0;
+        std::vector<float> average_; // Moving average of the envelope over the look-ahead
+        size_t average_position_ = 0;
+        double average_sum_ = 0.0;
+        float envelope_ = 1.0f;
+        uint64_t frame_counter_ = 0;
+
+        // --- Statistics (written by the audio thread only) ---
+        std::atomic<uint64_t> blocks_{0};
+        std::atomic<uint64_t> frames_{0};
+        std::atomic<uint64_t> total_ns_{0};
+        std::atomic<uint64_t> peak_ns_{0};
+
+        float *band_state(size_t band) { return eq_state_.data() + band * 2 * state_lanes_; }
+
+        void apply_params(const Params &params);
+        void update_coeffs(Band &band) const;
+        void smooth_preamp(float *samples, size_t frames);
+        size_t smooth_bands(Section *sections);
+        void limit(float *samples, size_t frames);
+        void reset_limiter();
+    };
+
+    DspChain::DspChain() : pimpl_(std::make_unique<Impl>()) {}
+
+    DspChain::~DspChain() = default;
+
+    void DspChain::publish(const Params &params) {
+        pimpl_->mailbox_.back() = params;
+        pimpl_->mailbox_.publish();
+    }
+
+    void DspChain::prepare(int sample_rate, uint32_t channels) {
+        Impl &d = *pimpl_;
+        d.sample_rate_ = sample_rate > 0 ? sample_rate : 48000.0;
+        d.channels_ = std::max<uint32_t>(channels, 1);
+        d.state_lanes_ = std::max<uint32_t>(d.channels_, 4);
+        d.smoothing_ = 1.0 - std::exp(-static_cast<double>(SUB_BLOCK_FRAMES) / (SMOOTHING_SECS * d.sample_rate_));
+
+        d.eq_state_.assign(MAX_EQ_BANDS * 2 * d.state_lanes_, 0.0f);
+        d.lookahead_ = std::max<size_t>(static_cast<size_t>(d.sample_rate_) * LIMITER_LOOKAHEAD_MS / 1000, 1);
+        d.delay_.resize(d.lookahead_ * d.channels_);
+        d.queue_frames_.resize(d.lookahead_ + 1);
+        d.queue_gains_.resize(d.lookahead_ + 1);
+        d.average_.resize(d.lookahead_);
+        d.reset_limiter();
+
+        // Settle everything at its target for the new rate
+        d.mailbox_.update();
+        d.apply_params(d.mailbox_.front());
+        d.preamp_gain_ = d.preamp_target_;
+        for (auto &band: d.bands_) {
+            band.log_frequency = band.target_log_frequency;
+            band.gain_db = band.target_gain_db;
+            band.q = band.target_q;
+            band.settled = true;
+            d.update_coeffs(band);
+        }
+
+        d.blocks_ = 0;
+        d.frames_ = 0;
+        d.total_ns_ = 0;
+        d.peak_ns_ = 0;
+    }
+
+    DspStats DspChain::stats() const {
+        const Impl &d = *pimpl_;
+        DspStats stats;
+        stats.blocks = d.blocks_.load(std::memory_order_relaxed);
+        const double total_us = static_cast<double>(d.total_ns_.load(std::memory_order_relaxed)) / 1000.0;
+        const double audio_us =
+                static_cast<double>(d.frames_.load(std::memory_order_relaxed)) * 1e6 / d.sample_rate_;
+        stats.average_us = stats.blocks > 0 ? total_us / static_cast<double>(stats.blocks) : 0.0;
+        stats.peak_us = static_cast<double>(d.peak_ns_.load(std::memory_order_relaxed)) / 1000.0;
+        stats.load = audio_us > 0.0 ? total_us / audio_us : 0.0;
+        return stats;
+    }
+
+    void DspChain::process(float *samples, size_t frames) {
+        Impl &d = *pimpl_;
+        if (d.mailbox_.update()) {
+            d.apply_params(d.mailbox_.front());
+        }
+        if (!d.params_.enabled || frames == 0) {
+            return;
+        }
+        const auto start = std::chrono::steady_clock::now();
+
+#if defined(MUSICENGINE_DSP_SSE2)
+        const DenormalsOff denormals_off;
+#endif
+
+        Section sections[MAX_EQ_BANDS];
+        for (size_t offset = 0; offset < frames; offset += SUB_BLOCK_FRAMES) {
+            const size_t count = std::min(SUB_BLOCK_FRAMES, frames - offset);
+            float *block = samples + offset * d.channels_;
+            d.smooth_preamp(block, count);
+            if (const size_t active = d.smooth_bands(sections); active > 0) {
+                biquad_cascade(block, count, d.channels_, sections, active);
+            }
+        }
+        // Runs even with limiting off, so the output delay doesn't change when the limiter is toggled
+        d.limit(samples, frames);
+
+        const auto elapsed = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+                        .count());
+        d.blocks_.store(d.blocks_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        d.frames_.store(d.frames_.load(std::memory_order_relaxed) + frames, std::memory_order_relaxed);
+        d.total_ns_.store(d.total_ns_.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+        if (elapsed > d.peak_ns_.load(std::memory_order_relaxed)) {
+            d.peak_ns_.store(elapsed, std::memory_order_relaxed);
+        }
+    }
+
+    // [Audio] Takes over a new parameter set as the targets the smoothing glides to
+    void DspChain::Impl::apply_params(const Params &params) {
+        params_ = params;
+        preamp_target_ = static_cast<float>(std::pow(10.0, params.preamp_db / 20.0));
+        limiter_threshold_ =
+                params.limiter_enabled ? static_cast<float>(std::pow(10.0, params.limiter_threshold_db / 20.0)) : 1e30f;
+        release_coeff_ = static_cast<float>(
+                1.0 - std::exp(-1.0 / (std::max(params.limiter_release_ms, 1.0f) / 1000.0 * sample_rate_)));
+
+        const size_t count = std::min(params.band_count, MAX_EQ_BANDS);
+        for (size_t i = 0; i < MAX_EQ_BANDS; ++i) {
+            Band &band = bands_[i];
+            const bool wanted = i < count && params.bands[i].enabled;
+            if (i >= count) {
+                // Removed: peaking and shelf bands fade to flat before leaving the cascade
+                band.target_gain_db = 0.0;
+                band.settled = false;
+                band.present = band.present && !is_pass_filter(band.type);
+                continue;
+            }
+
+            const EqBand &eq = params.bands[i];
+            if (is_pass_filter(eq.type) && !wanted) {
+                band.present = false;
+                continue;
+            }
+            if (!band.present && !wanted) {
+                continue;
+            }
+            band.target_log_frequency =
+                    std::log(std::clamp(eq.frequency_hz, MIN_FREQUENCY_HZ, sample_rate_ * 0.49));
+            band.target_gain_db = wanted && !is_pass_filter(eq.type) ? eq.gain_db : 0.0;
+            band.target_q = std::max(eq.q, MIN_Q);
+            if (!band.present || band.type != eq.type) {
+                // New band or changed response: start from its shape at unity gain and glide in the gain
+                band.type = eq.type;
+                band.log_frequency = band.target_log_frequency;
+                band.q = band.target_q;
+                band.gain_db = 0.0;
+                std::fill_n(band_state(i), 2 * state_lanes_, 0.0f);
+                band.present = true;
+                update_coeffs(band);
+            }
+            band.settled = false;
+        }
+    }
+
+    void DspChain::Impl::update_coeffs(Band &band) const {
+        band.coeffs = design(band.type, sample_rate_, std::exp(band.log_frequency), band.gain_db, band.q);
+    }
+
+    // [Audio] Ramps the preamp gain towards its target across the sub-block
+    void DspChain::Impl::smooth_preamp(float *samples, size_t frames) {
+        float next = preamp_gain_ + static_cast<float>(smoothing_) * (preamp_target_ - preamp_gain_);
+        if (std::fabs(next - preamp_target_) < 1e-5f) {
+            next = preamp_target_;
+        }
+        if (preamp_gain_ != 1.0f || next != 1.0f) {
+            mix::apply_gain(samples, frames, channels_,
+                            {preamp_gain_, (next - preamp_gain_) / static_cast<float>(frames)});
+        }
+        preamp_gain_ = next;
+    }
+
+    // [Audio] Advances band parameters by one sub-block and lists the sections to run
+    size_t DspChain::Impl::smooth_bands(Section *sections) {
+        size_t active = 0;
+        for (size_t i = 0; i < MAX_EQ_BANDS; ++i) {
+            Band &band = bands_[i];
+            if (!band.present) {
+                continue;
+            }
+            if (!band.settled) {
+                band.log_frequency += smoothing_ * (band.target_log_frequency - band.log_frequency);
+                band.gain_db += smoothing_ * (band.target_gain_db - band.gain_db);
+                band.q += smoothing_ * (band.target_q - band.q);
+                if (std::fabs(band.target_log_frequency - band.log_frequency) < 1e-4 &&
+                    std::fabs(band.target_gain_db - band.gain_db) < 1e-3 &&
+                    std::fabs(band.target_q - band.q) < 1e-4 * band.target_q) {
+                    band.log_frequency = band.target_log_frequency;
+                    band.gain_db = band.target_gain_db;
+                    band.q = band.target_q;
+                    band.settled = true;
+                }
+                update_coeffs(band);
+            }
+            // A flat peaking or shelf band is an identity; leave it out until it has a gain again
+            if (band.settled && band.gain_db == 0.0 && !is_pass_filter(band.type)) {
+                band.present = false;
+                continue;
+            }
+            sections[active++] = {band.coeffs, band_state(i)};
+        }
+        return active;
+    }
+
+    // [Audio] Look-ahead peak limiter. The gain each frame needs is known lookahead_ frames before the frame is
+    // output: the minimum over that window drops the gain in time, instant attack plus exponential release forms
+    // the envelope, and a moving average over the window turns its steps into ramps that still arrive in time.
+    void DspChain::Impl::limit(float *samples, size_t frames) {
+        const size_t capacity = queue_frames_.size();
+        for (size_t f = 0; f < frames; ++f) {
+            float *frame = samples + f * channels_;
+            float peak = 0.0f;
+            for (uint32_t ch = 0; ch < channels_; ++ch) {
+                peak = std::max(peak, std::fabs(frame[ch]));
+            }
+            const float required = peak > limiter_threshold_ ? limiter_threshold_ / peak : 1.0f;
+
+            // Drop the frame leaving the window, then everything the new one undercuts
+            if (queue_size_ > 0 && queue_frames_[queue_head_] + lookahead_ < frame_counter_) {
+                queue_head_ = (queue_head_ + 1) % capacity;
+                --queue_size_;
+            }
+            while (queue_size_ > 0 && queue_gains_[(queue_head_ + queue_size_ - 1) % capacity] >= required) {
+                --queue_size_;
+            }
+            queue_frames_[(queue_head_ + queue_size_) % capacity] = frame_counter_;
+            queue_gains_[(queue_head_ + queue_size_) % capacity] = required;
+            ++queue_size_;
+            const float minimum = queue_gains_[queue_head_];
+
+            envelope_ = minimum < envelope_ ? minimum : envelope_ + (minimum - envelope_) * release_coeff_;
+            average_sum_ += envelope_ - average_[average_position_];
+            average_[average_position_] = envelope_;
+            average_position_ = (average_position_ + 1) % lookahead_;
+            const float gain = static_cast<float>(average_sum_ / static_cast<double>(lookahead_));
+
+            float *delayed = delay_.data() + delay_position_ * channels_;
+            for (uint32_t ch = 0; ch < channels_; ++ch) {
+                const float input = frame[ch];
+                frame[ch] = delayed[ch] * gain;
+                delayed[ch] = input;
+            }
+            delay_position_ = (delay_position_ + 1) % lookahead_;
+            ++frame_counter_;
+        }
+    }
+
+    void DspChain::Impl::reset_limiter() {
+        std::fill(delay_.begin(), delay_.end(), 0.0f);
+        std::fill(average_.begin(), average_.end(), 1.0f);
+        average_sum_ = static_cast<double>(lookahead_);
+        delay_position_ = average_position_ = 0;
+        queue_head_ = queue_size_ = 0;
+        envelope_ = 1.0f;
+        frame_counter_ = 0;
+    }
+
+} // namespace MusicEngine
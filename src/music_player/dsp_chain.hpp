@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "music_player.h"
+
+namespace MusicEngine {
+
+    /**
+     * @class TripleBuffer
+     * @brief Wait-free mailbox that hands the latest value of @p T from one writer thread to one reader thread.
+     *
+     * The writer fills back() and publishes it; the reader picks up the newest published value with update().
+     * Neither side ever waits for the other, and the reader always sees a complete value.
+     */
+    template<typename T>
+    class TripleBuffer {
+    public:
+        // ------------------- Writer side -------------------
+        T &back() { return slots_[back_]; }
+
+        void publish() { back_ = state_.exchange(back_ | DIRTY, std::memory_order_acq_rel) & INDEX; }
+
+        // ------------------- Reader side -------------------
+
+        /**
+         * @brief Takes the newest published value, if there is one.
+         * @return true if front() changed.
+         */
+        bool update() {
+            if ((state_.load(std::memory_order_relaxed) & DIRTY) == 0) {
+                return false;
+            }
+            front_ = state_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+            return true;
+        }
+
+        const T &front() const { return slots_[front_]; }
+
+    private:
+        static constexpr uint32_t INDEX = 3;
+        static constexpr uint32_t DIRTY = 4;
+
+        T slots_[3]{};
+        uint32_t back_ = 0; // Writer only
+        uint32_t front_ = 1; // Reader only
+        std::atomic<uint32_t> state_{2}; // Index of the slot in the middle, plus DIRTY once it holds a new value
+    };
+
+    /**
+     * @class DspChain
+     * @brief Preamp, parametric EQ and look-ahead limiter for interleaved F32 PCM, run in the audio callback.
+     *
+     * process() never locks, allocates or waits. Parameters arrive through a TripleBuffer and are glided to in
+     * small sub-blocks, so changes don't click. The EQ runs all bands per frame with one SIMD lane per channel
+     * (SSE or NEON, up to four channels). Storage is allocated in prepare(), which must not run concurrently
+     * with process().
+     */
+    class DspChain {
+    public:
+        static constexpr size_t MAX_EQ_BANDS = 10;
+        static constexpr int LIMITER_LOOKAHEAD_MS = 5;
+
+        struct Params {
+            bool enabled = false;
+            float preamp_db = 0.0f;
+            std::array<EqBand, MAX_EQ_BANDS> bands{};
+            size_t band_count = 0;
+            bool limiter_enabled = false;
+            float limiter_threshold_db = -1.0f;
+            float limiter_release_ms = 50.0f;
+        };
+
+        DspChain();
+        ~DspChain();
+
+        DspChain(const DspChain &) = delete;
+        DspChain &operator=(const DspChain &) = delete;
+
+        // ------------------- Control side -------------------
+
+        /**
+         * @brief Hands a complete parameter set to the audio thread. Calls must be serialized by the caller.
+         */
+        void publish(const Params &params);
+
+        /**
+         * @brief Allocates storage for the given format and clears all filter state and statistics.
+         */
+        void prepare(int sample_rate, uint32_t channels);
+
+        DspStats stats() const;
+
+        // ------------------- Audio side -------------------
+
+        /**
+         * @brief Processes @p frames frames in place. A disabled chain returns immediately.
+         */
+        void process(float *samples, size_t frames);
+
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> pimpl_;
+    };
+
+} // namespace MusicEngine
@@ -0,0 +1,317 @@
+#include "intro_cache.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "audio_decoder.hpp"
+#include "convert_kernels.hpp"
+#include "input_source.h"
+#include "output_mixer.hpp"
+
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/spdlog.h"
+
+namespace MusicEngine {
+
+    void Intro::read(float *dst, size_t first, size_t count) const {
+        const size_t offset = first * static_cast<size_t>(channels_);
+        if (compact_samples_.empty()) {
+            std::memcpy(dst, samples_.data() + offset, count * channels_ * sizeof(float));
+            return;
+        }
+        const int16_t *src = compact_samples_.data() + offset;
+        using convert::Route, convert::SampleType;
+        if (const auto kernel = convert::find_kernel(SampleType::S16, false, channels_, Route::Copy)) {
+            const uint8_t *planes[1] = {reinterpret_cast<const uint8_t *>(src)};
+            kernel(dst, planes, count);
+            return;
+        }
+        for (size_t i = 0; i < count * channels_; ++i) {
+            dst[i] = static_cast<float>(src[i]) / 32768.0f;
+        }
+    }
+
+    struct IntroCache::Impl {
+        struct Entry {
+            std::shared_ptr<const Intro> intro;
+            // Files: the state the intro was decoded from. Sources: the source object itself.
+            std::filesystem::file_time_type modified;
+            uintmax_t size = 0;
+            std::weak_ptr<InputSource> source;
+            std::list<std::string>::iterator lru_position;
+        };
+        struct Request {
+            Music music;
+        };
+
+        std::mutex mutex_;
+        std::condition_variable cond_var_;
+        std::unordered_map<std::string, Entry> cache_;
+        std::list<std::string> lru_; // Most recently used first
+        size_t used_bytes_ = 0;
+        size_t budget_bytes_ = 0;
+        double intro_secs_ = 5.0;
+        bool compact_ = false;
+        std::deque<Request> queue_;
+        std::deque<Request> deferred_; // Requested while the output device was closed
+        std::atomic<bool> stop_requested_{false};
+        std::thread worker_;
+        std::shared_ptr<spdlog::logger> logger_;
+
+        Impl() {
+            logger_ = spdlog::stdout_color_mt("IntroCache");
+            logger_->set_level(spdlog::level::info);
+        }
+
+        // Identifies the track independently of the output format, or "" if it can't be cached
+        static std::string track_key(const Music &music) {
+            if (music.source) {
+                if (!music.source->seekable()) {
+                    return {}; // Reading the intro would consume it
+                }
+                return "source:" + std::to_string(reinterpret_cast<uintptr_t>(music.source.get()));
+            }
+            if (music.file_path.empty()) {
+                return {};
+            }
+            return "file:" + music.file_path.string();
+        }
+
+        static std::string cache_key(const std::string &track, int sample_rate, int channels) {
+            return track + "@" + std::to_string(sample_rate) + "/" + std::to_string(channels);
+        }
+
+        static bool stat_file(const std::filesystem::path &path, std::filesystem::file_time_type &modified,
+                              uintmax_t &size) {
+            std::error_code ec;
+            modified = std::filesystem::last_write_time(path, ec);
+            if (ec) {
+                return false;
+            }
+            size = std::filesystem::file_size(path, ec);
+            return !ec;
+        }
+
+        // Called with mutex_ held
+        void erase(std::unordered_map<std::string, Entry>::iterator it) {
+            used_bytes_ -= it->second.intro->bytes();
+            lru_.erase(it->second.lru_position);
+            cache_.erase(it);
+        }
+
+        // Called with mutex_ held
+        void evict_to(size_t budget) {
+            while (used_bytes_ > budget && !lru_.empty()) {
+                erase(cache_.find(lru_.back()));
+            }
+        }
+
+        std::shared_ptr<Intro> decode(const Request &request, int sample_rate, int channels, double intro_secs,
+                                      bool compact);
+        void worker_loop();
+    };
+
+    IntroCache &IntroCache::get_instance() {
+        static IntroCache instance;
+        return instance;
+    }
+
+    IntroCache::IntroCache() : pimpl_(std::make_unique<Impl>()) {}
+
+    IntroCache::~IntroCache() {
+        pimpl_->stop_requested_ = true;
+        pimpl_->cond_var_.notify_all();
+        if (pimpl_->worker_.joinable()) {
+            pimpl_->worker_.join();
+        }
+    }
+
+    void IntroCache::configure(size_t budget_bytes, double intro_secs, bool compact) {
+        std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+        pimpl_->budget_bytes_ = budget_bytes;
+        pimpl_->intro_secs_ = std::max(0.0, intro_secs);
+        pimpl_->compact_ = compact;
+        pimpl_->evict_to(budget_bytes);
+        if (budget_bytes == 0) {
+            pimpl_->queue_.clear();
+        }
+    }
+
+    std::shared_ptr<const Intro> IntroCache::find(const Music &music, int sample_rate, int channels) {
+        const std::string track = Impl::track_key(music);
+        if (track.empty()) {
+            return nullptr;
+        }
+        std::filesystem::file_time_type modified;
+        uintmax_t size = 0;
+        if (!music.source && !Impl::stat_file(music.file_path, modified, size)) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+        auto it = pimpl_->cache_.find(Impl::cache_key(track, sample_rate, channels));
+        if (it == pimpl_->cache_.end()) {
+            return nullptr;
+        }
+        const Impl::Entry &entry = it->second;
+        // A source at the same address may be a new object; a file may have been rewritten
+        const bool stale = music.source ? entry.source.lock() != music.source
+                                        : entry.modified != modified || entry.size != size;
+        if (stale) {
+            pimpl_->erase(it);
+            return nullptr;
+        }
+        pimpl_->lru_.splice(pimpl_->lru_.begin(), pimpl_->lru_, entry.lru_position);
+        return entry.intro;
+    }
+
+    void IntroCache::request(const Music &music) {
+        const std::string track = Impl::track_key(music);
+        if (track.empty()) {
+            pimpl_->logger_->debug("Not caching the intro of an unseekable track");
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+        if (pimpl_->budget_bytes_ == 0) {
+            return;
+        }
+        const auto same_track = [&](const Impl::Request &r) { return Impl::track_key(r.music) == track; };
+        if (std::any_of(pimpl_->queue_.begin(), pimpl_->queue_.end(), same_track) ||
+            std::any_of(pimpl_->deferred_.begin(), pimpl_->deferred_.end(), same_track)) {
+            return;
+        }
+        pimpl_->queue_.push_back({music});
+
+        // Started on first use, like the seek index builder
+        if (!pimpl_->worker_.joinable()) {
+            pimpl_->worker_ = std::thread(&Impl::worker_loop, pimpl_.get());
+        }
+        pimpl_->cond_var_.notify_one();
+    }
+
+    void IntroCache::device_opened() {
+        std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+        if (pimpl_->deferred_.empty()) {
+            return;
+        }
+        std::move(pimpl_->deferred_.begin(), pimpl_->deferred_.end(), std::back_inserter(pimpl_->queue_));
+        pimpl_->deferred_.clear();
+        pimpl_->cond_var_.notify_one();
+    }
+
+    std::shared_ptr<Intro> IntroCache::Impl::decode(const Request &request, int sample_rate, int channels,
+                                                    double intro_secs, bool compact) {
+        AudioDecoder decoder(logger_);
+        const Music &music = request.music;
+        if (!(music.source ? decoder.open(music.source, sample_rate, channels)
+                           : decoder.open(music.file_path, sample_rate, channels))) {
+            return nullptr;
+        }
+
+        const size_t target = static_cast<size_t>(intro_secs * sample_rate);
+        const size_t room = target + static_cast<size_t>(decoder.max_read_frames());
+        std::vector<float> pcm(room * channels);
+        size_t frames = 0;
+        while (frames < target && !stop_requested_) {
+            const int read = decoder.read(pcm.data() + frames * channels, static_cast<int>(room - frames));
+            if (read <= 0) {
+                break;
+            }
+            frames += static_cast<size_t>(read);
+        }
+        frames = std::min(frames, target);
+        if (frames == 0) {
+            return nullptr;
+        }
+
+        auto intro = std::make_shared<Intro>();
+        intro->frames_ = frames;
+        intro->sample_rate_ = sample_rate;
+        intro->channels_ = channels;
+        intro->track_duration_secs_ = decoder.duration();
+        pcm.resize(frames * channels);
+        if (compact) {
+            intro->compact_samples_.resize(pcm.size());
+            std::transform(pcm.begin(), pcm.end(), intro->compact_samples_.begin(), [](float sample) {
+                return static_cast<int16_t>(std::lrint(std::clamp(sample * 32768.0f, -32768.0f, 32767.0f)));
+            });
+        } else {
+            pcm.shrink_to_fit();
+            intro->samples_ = std::move(pcm);
+        }
+        return intro;
+    }
+
+    void IntroCache::Impl::worker_loop() {
+        while (true) {
+            Request request;
+            double intro_secs;
+            bool compact;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_var_.wait(lock, [this] { return stop_requested_ || !queue_.empty(); });
+                if (stop_requested_) {
+                    return;
+                }
+                request = std::move(queue_.front());
+                queue_.pop_front();
+                intro_secs = intro_secs_;
+                compact = compact_;
+            }
+
+            // The format every player converts to. Never open the device from here: with no voice attached, that
+            // would reopen it under a paused or opening player with other settings, whose attach() then fails.
+            const auto format = OutputMixer::get_instance().current_format();
+            if (!format) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                deferred_.push_back(std::move(request));
+                continue;
+            }
+            const std::string track = track_key(request.music);
+            const std::string key = cache_key(track, format->sample_rate, format->channels);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (cache_.count(key)) {
+                    continue;
+                }
+            }
+
+            // Stat before decoding, so a file modified in the meantime is decoded again on the next request
+            Entry entry;
+            if (!request.music.source && !stat_file(request.music.file_path, entry.modified, entry.size)) {
+                continue;
+            }
+            entry.source = request.music.source;
+            entry.intro = decode(request, format->sample_rate, format->channels, intro_secs, compact);
+            if (!entry.intro) {
+                logger_->debug("Could not decode the intro of {}", track);
+                continue;
+            }
+
+            const size_t bytes = entry.intro->bytes();
+            const double secs = static_cast<double>(entry.intro->frames()) / format->sample_rate;
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (bytes > budget_bytes_ || cache_.count(key)) {
+                continue;
+            }
+            evict_to(budget_bytes_ - bytes);
+            lru_.push_front(key);
+            entry.lru_position = lru_.begin();
+            used_bytes_ += bytes;
+            cache_.emplace(key, std::move(entry));
+            logger_->debug("Cached {:.1f}s intro of {} ({} KiB)", secs, track, bytes / 1024);
+        }
+    }
+
+} // namespace MusicEngine
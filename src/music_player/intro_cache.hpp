@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Music.h"
+#include "music_player.h"
+
+namespace MusicEngine {
+
+    /**
+     * @class Intro
+     * @brief The first seconds of a track, decoded to the output format and ready to be copied into a ring.
+     *
+     * Samples are kept as F32, or as 16-bit integers in compact mode (half the memory; the difference from the
+     * decoder's output at the splice point is below the 16-bit noise floor). Immutable once built.
+     */
+    class Intro {
+    public:
+        size_t frames() const { return frames_; }
+        int sample_rate() const { return sample_rate_; }
+        int channels() const { return channels_; }
+        double track_duration() const { return track_duration_secs_; }
+        size_t bytes() const { return samples_.size() * sizeof(float) + compact_samples_.size() * sizeof(int16_t); }
+
+        /**
+         * @brief Writes frames [@p first, @p first + @p count) as interleaved F32 to @p dst.
+         */
+        void read(float *dst, size_t first, size_t count) const;
+
+    private:
+        friend class IntroCache;
+
+        std::vector<float> samples_;
+        std::vector<int16_t> compact_samples_;
+        size_t frames_ = 0;
+        int sample_rate_ = 0;
+        int channels_ = 0;
+        double track_duration_secs_ = 0.0;
+    };
+
+    /**
+     * @class IntroCache
+     * @brief Process-wide cache of track intros, so play() can start sounding before the track's decoder is open.
+     *
+     * Intros are decoded one at a time on a background thread and kept within a memory budget; the least
+     * recently played ones are evicted first. Files are keyed by path and dropped once modified; tracks from an
+     * InputSource are keyed by the source object and only cached if it is seekable.
+     */
+    class IntroCache {
+    public:
+        static IntroCache &get_instance();
+
+        IntroCache(const IntroCache &) = delete;
+        IntroCache &operator=(const IntroCache &) = delete;
+
+        /**
+         * @brief Sets the memory budget and what to keep. Evicts intros that no longer fit; intros decoded with
+         * other settings stay until they are evicted.
+         */
+        void configure(size_t budget_bytes, double intro_secs, bool compact);
+
+        /**
+         * @brief Returns the intro of @p music in the given output format, or nullptr.
+         */
+        std::shared_ptr<const Intro> find(const Music &music, int sample_rate, int channels);
+
+        /**
+         * @brief Queues @p music for decoding unless it is already cached or queued.
+         *
+         * Intros are decoded to the format of the open output device. The cache never opens the device itself,
+         * as a reopen would pull the format from under a paused or opening player: until a player has opened
+         * it, requests wait (see device_opened()).
+         */
+        void request(const Music &music);
+
+        /**
+         * @brief Called by players once they have opened the output device; decodes the requests that waited.
+         */
+        void device_opened();
+
+    private:
+        IntroCache();
+        ~IntroCache();
+
+        struct Impl;
+        std::unique_ptr<Impl> pimpl_;
+    };
+
+} // namespace MusicEngine
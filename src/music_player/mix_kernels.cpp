@@ -0,0 +1,237 @@
+#include "mix_kernels.hpp"
+#include <algorithm>
+
+// Four lanes, like the conversion kernels: the library is built for baseline x86-64, where AVX can't be assumed
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MUSICENGINE_MIX_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MUSICENGINE_MIX_NEON 1
+#endif
+
+namespace MusicEngine::mix {
+
+    namespace {
+
+        // Scalar reference, also used for the tail and for channel layouts the vector path doesn't cover
+        void crossfade_scalar(float *dst, const float *a, const float *b, size_t first_sample, size_t samples,
+                              uint32_t channels, GainRamp ramp_a, GainRamp ramp_b) {
+            for (size_t i = first_sample; i < samples; ++i) {
+                const float frame = static_cast<float>(i / channels);
+                dst[i] = a[i] * (ramp_a.start + frame * ramp_a.step) + b[i] * (ramp_b.start + frame * ramp_b.step);
+            }
+        }
+
+        // Lane `k` of a vector holding samples [i, i + W) belongs to frame (i + k) / channels. With W a multiple
+        // of the channel count, every vector starts on a frame boundary, so the per-lane gain is
+        // start + step * (frame_of_vector + k / channels) and advances by step * W / channels per vector.
+        template<int W>
+        void lane_frames(float (&out)[W], uint32_t channels) {
+            for (int k = 0; k < W; ++k) {
+                out[k] = static_cast<float>(static_cast<uint32_t>(k) / channels);
+            }
+        }
+
+    } // namespace
+
+    void crossfade(float *dst, const float *a, const float *b, size_t frames, uint32_t channels, GainRamp ramp_a,
+                   GainRamp ramp_b) {
+        const size_t samples = frames * channels;
+        size_t i = 0;
+
+#if defined(MUSICENGINE_MIX_SSE2)
+        if (channels == 1 || channels == 2 || channels == 4) {
+            alignas(16) float lanes[4];
+            lane_frames(lanes, channels);
+            const __m128 lane = _mm_load_ps(lanes);
+            const float frames_per_vector = 4.0f / static_cast<float>(channels);
+            __m128 gain_a = _mm_add_ps(_mm_set1_ps(ramp_a.start), _mm_mul_ps(lane, _mm_set1_ps(ramp_a.step)));
+            __m128 gain_b = _mm_add_ps(_mm_set1_ps(ramp_b.start), _mm_mul_ps(lane, _mm_set1_ps(ramp_b.step)));
+            const __m128 step_a = _mm_set1_ps(ramp_a.step * frames_per_vector);
+            const __m128 step_b = _mm_set1_ps(ramp_b.step * frames_per_vector);
+            for (; i + 4 <= samples; i += 4) {
+                const __m128 mixed =
+                        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), gain_a), _mm_mul_ps(_mm_loadu_ps(b + i), gain_b));
+                _mm_storeu_ps(dst + i, mixed);
+                gain_a = _mm_add_ps(gain_a, step_a);
+                gain_b = _mm_add_ps(gain_b, step_b);
+            }
+        }
+#elif defined(MUSICENGINE_MIX_NEON)
+        if (channels == 1 || channels == 2 || channels == 4) {
+            float lanes[4];
+            lane_frames(lanes, channels);
+            const float32x4_t lane = vld1q_f32(lanes);
+            const float frames_per_vector = 4.0f / static_cast<float>(channels);
+            float32x4_t gain_a = vmlaq_n_f32(vdupq_n_f32(ramp_a.start), lane, ramp_a.step);
+            float32x4_t gain_b = vmlaq_n_f32(vdupq_n_f32(ramp_b.start), lane, ramp_b.step);
+            const float32x4_t step_a = vdupq_n_f32(ramp_a.step * frames_per_vector);
+            const float32x4_t step_b = vdupq_n_f32(ramp_b.step * frames_per_vector);
+            for (; i + 4 <= samples; i += 4) {
+                const float32x4_t mixed = vmlaq_f32(vmulq_f32(vld1q_f32(a + i), gain_a), vld1q_f32(b + i), gain_b);
+                vst1q_f32(dst + i, mixed);
+                gain_a = vaddq_f32(gain_a, step_a);
+                gain_b = vaddq_f32(gain_b, step_b);
+            }
+        }
+#endif
+
+        crossfade_scalar(dst, a, b, i, samples, channels, ramp_a, ramp_b);
+    }
+
+    void apply_gain(float *samples, size_t count, float gain) {
+        size_t i = 0;
+
+#if defined(MUSICENGINE_MIX_SSE2)
+        const __m128 factor = _mm_set1_ps(gain);
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), factor));
+        }
+#elif defined(MUSICENGINE_MIX_NEON)
+        for (; i + 4 <= count; i += 4) {
+            vst1q_f32(samples + i, vmulq_n_f32(vld1q_f32(samples + i), gain));
+        }
+#endif
+
+        for (; i < count; ++i) {
+            samples[i] *= gain;
+        }
+    }
+
+    void apply_gain(float *samples, size_t frames, uint32_t channels, GainRamp ramp) {
+        const size_t count = frames * channels;
+        size_t i = 0;
+
+#if defined(MUSICENGINE_MIX_SSE2)
+        if (channels == 1 || channels == 2 || channels == 4) {
+            alignas(16) float lanes[4];
+            lane_frames(lanes, channels);
+            __m128 gain = _mm_add_ps(_mm_set1_ps(ramp.start), _mm_mul_ps(_mm_load_ps(lanes), _mm_set1_ps(ramp.step)));
+            const __m128 step = _mm_set1_ps(ramp.step * 4.0f / static_cast<float>(channels));
+            for (; i + 4 <= count; i += 4) {
+                _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), gain));
+                gain = _mm_add_ps(gain, step);
+            }
+        }
+#elif defined(MUSICENGINE_MIX_NEON)
+        if (channels == 1 || channels == 2 || channels == 4) {
+            float lanes[4];
+            lane_frames(lanes, channels);
+            float32x4_t gain = vmlaq_n_f32(vdupq_n_f32(ramp.start), vld1q_f32(lanes), ramp.step);
+            const float32x4_t step = vdupq_n_f32(ramp.step * 4.0f / static_cast<float>(channels));
+            for (; i + 4 <= count; i += 4) {
+                vst1q_f32(samples + i, vmulq_f32(vld1q_f32(samples + i), gain));
+                gain = vaddq_f32(gain, step);
+            }
+        }
+#endif
+
+        for (; i < count; ++i) {
+            samples[i] *= ramp.start + static_cast<float>(i / channels) * ramp.step;
+        }
+    }
+
+    void mix_into(float *dst, const float *src, size_t frames, uint32_t channels, GainRamp ramp) {
+        const size_t count = frames * channels;
+        size_t i = 0;
+
+#if defined(MUSICENGINE_MIX_SSE2)
+        if (channels == 1 || channels == 2 || channels == 4) {
+            alignas(16) float lanes[4];
+            lane_frames(lanes, channels);
+            __m128 gain = _mm_add_ps(_mm_set1_ps(ramp.start), _mm_mul_ps(_mm_load_ps(lanes), _mm_set1_ps(ramp.step)));
+            const __m128 step = _mm_set1_ps(ramp.step * 4.0f / static_cast<float>(channels));
+            for (; i + 4 <= count; i += 4) {
+                _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), gain)));
+                gain = _mm_add_ps(gain, step);
+            }
+        }
+#elif defined(MUSICENGINE_MIX_NEON)
+        if (channels == 1 || channels == 2 || channels == 4) {
+            float lanes[4];
+            lane_frames(lanes, channels);
+            float32x4_t gain = vmlaq_n_f32(vdupq_n_f32(ramp.start), vld1q_f32(lanes), ramp.step);
+            const float32x4_t step = vdupq_n_f32(ramp.step * 4.0f / static_cast<float>(channels));
+            for (; i + 4 <= count; i += 4) {
+                vst1q_f32(dst + i, vmlaq_f32(vld1q_f32(dst + i), vld1q_f32(src + i), gain));
+                gain = vaddq_f32(gain, step);
+            }
+        }
+#endif
+
+        for (; i < count; ++i) {
+            dst[i] += src[i] * (ramp.start + static_cast<float>(i / channels) * ramp.step);
+        }
+    }
+
+    PeakStats reduce_peaks(const float *samples, size_t count) {
+        if (count == 0) {
+            return {};
+        }
+        PeakStats stats{samples[0], samples[0], 0.0f};
+        size_t i = 0;
+
+#if defined(MUSICENGINE_MIX_SSE2)
+        if (count >= 4) {
+            __m128 lo = _mm_loadu_ps(samples);
+            __m128 hi = lo;
+            __m128 squares = _mm_setzero_ps();
+            for (; i + 4 <= count; i += 4) {
+                const __m128 v = _mm_loadu_ps(samples + i);
+                lo = _mm_min_ps(lo, v);
+                hi = _mm_max_ps(hi, v);
+                squares = _mm_add_ps(squares, _mm_mul_ps(v, v));
+            }
+            alignas(16) float lo_lanes[4], hi_lanes[4], square_lanes[4];
+            _mm_store_ps(lo_lanes, lo);
+            _mm_store_ps(hi_lanes, hi);
+            _mm_store_ps(square_lanes, squares);
+            for (int k = 0; k < 4; ++k) {
+                stats.min = std::min(stats.min, lo_lanes[k]);
+                stats.max = std::max(stats.max, hi_lanes[k]);
+                stats.sum_squares += square_lanes[k];
+            }
+        }
+#elif defined(MUSICENGINE_MIX_NEON)
+        if (count >= 4) {
+            float32x4_t lo = vld1q_f32(samples);
+            float32x4_t hi = lo;
+            float32x4_t squares = vdupq_n_f32(0.0f);
+            for (; i + 4 <= count; i += 4) {
+                const float32x4_t v = vld1q_f32(samples + i);
+                lo = vminq_f32(lo, v);
+                hi = vmaxq_f32(hi, v);
+                squares = vmlaq_f32(squares, v, v);
+            }
+            float lo_lanes[4], hi_lanes[4], square_lanes[4];
+            vst1q_f32(lo_lanes, lo);
+            vst1q_f32(hi_lanes, hi);
+            vst1q_f32(square_lanes, squares);
+            for (int k = 0; k < 4; ++k) {
+                stats.min = std::min(stats.min, lo_lanes[k]);
+                stats.max = std::max(stats.max, hi_lanes[k]);
+                stats.sum_squares += square_lanes[k];
+            }
+        }
+#endif
+
+        for (; i < count; ++i) {
+            stats.min = std::min(stats.min, samples[i]);
+            stats.max = std::max(stats.max, samples[i]);
+            stats.sum_squares += samples[i] * samples[i];
+        }
+        return stats;
+    }
+
+    const char *instruction_set() {
+#if defined(MUSICENGINE_MIX_SSE2)
+        return "SSE2";
+#elif defined(MUSICENGINE_MIX_NEON)
+        return "NEON";
+#else
+        return "scalar";
+#endif
+    }
+
+} // namespace MusicEngine::mix
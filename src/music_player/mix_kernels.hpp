@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace MusicEngine::mix {
+
+    /**
+     * @brief A gain that changes linearly from frame to frame: frame `n` gets `start + n * step`.
+     */
+    struct GainRamp {
+        float start = 1.0f;
+        float step = 0.0f;
+    };
+
+    /**
+     * @brief Mixes two interleaved F32 buffers with independent gain ramps: dst = a * ramp_a + b * ramp_b.
+     *
+     * Vectorized with SSE2 or NEON depending on the target; channel counts of 1, 2 and 4 use the
+     * vector path, others fall back to scalar code. @p dst may alias @p a or @p b.
+     */
+    void crossfade(float *dst, const float *a, const float *b, size_t frames, uint32_t channels, GainRamp ramp_a,
+                   GainRamp ramp_b);
+
+    /**
+     * @brief Multiplies @p samples interleaved F32 samples in place by a constant @p gain.
+     *
+     * Vectorized the same way as crossfade(); the channel layout doesn't matter.
+     */
+    void apply_gain(float *samples, size_t count, float gain);
+
+    /**
+     * @brief Multiplies @p frames interleaved F32 frames in place by a gain ramp, e.g. to glide between two gains.
+     */
+    void apply_gain(float *samples, size_t frames, uint32_t channels, GainRamp ramp);
+
+    /**
+     * @brief Adds @p frames interleaved F32 frames of @p src, scaled by a gain ramp, onto @p dst: dst += src * ramp.
+     *
+     * Used to sum several sources into one output buffer.
+     */
+    void mix_into(float *dst, const float *src, size_t frames, uint32_t channels, GainRamp ramp);
+
+    /**
+     * @brief Smallest and largest sample and the sum of squares of a run of samples.
+     */
+    struct PeakStats {
+        float min = 0.0f;
+        float max = 0.0f;
+        float sum_squares = 0.0f;
+    };
+
+    /**
+     * @brief Reduces @p count samples (any channel layout) to their PeakStats. @p count may be 0.
+     */
+    PeakStats reduce_peaks(const float *samples, size_t count);
+
+    /**
+     * @brief Name of the instruction set the kernels were compiled for ("SSE2", "NEON" or "scalar").
+     */
+    const char *instruction_set();
+
+} // namespace MusicEngine::mix
@@ -1,300 +1,1217 @@
 #include "music_player.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
 #include <iostream>
 #include <mutex>
+#include <numbers>
 #include <optional>
-#include <queue>
+#include <semaphore>
 #include <thread>
 #include <vector>
 
+#include "analysis_tap.hpp"
+#include "audio_decoder.hpp"
+#include "dsp_chain.hpp"
+#include "intro_cache.hpp"
+#include "mix_kernels.hpp"
+#include "output_mixer.hpp"
+#include "pcm_ring_buffer.hpp"
+#include "playback_telemetry.hpp"
+#include "rt_safety.h"
+
 #include "spdlog/sinks/stdout_color_sinks.h"
 #include "spdlog/spdlog.h"
 
-// Include C library headers
-extern "C" {
-#include <libavcodec/avcodec.h>
-#include <libavformat/avformat.h>
-#include <libavutil/opt.h>
-#include <libswresample/swresample.h>
-}
-
-#define MINIAUDIO_IMPLEMENTATION
-#include "miniaudio.h"
-
 namespace MusicEngine {
 
-    // Define the AudioFrame struct
-    struct AudioFrame {
-        std::vector<uint8_t> data;
-        size_t consumed_bytes = 0; // Track the amount of data that has been consumed
-    };
-
-    // Pimpl (Pointer to implementation) struct, hiding all private members and complexity
-    struct MusicPlayer::Impl {
-        // --- Threading and Synchronization ---
-        std::thread decoder_thread_;
+    // Pimpl (Pointer to implementation) struct, hiding all private members and complexity.
+    // While playing, it is a voice of the shared OutputMixer, which calls render() from the device callback.
+    struct MusicPlayer::Impl : OutputMixer::Voice {
+        // --- Decoder Worker ---
+        // One thread, the decoder thread, lives as long as the player: it opens each track, decodes it into the
+        // ring and tears it down, taking its orders from a command queue. Skipping through tracks therefore creates
+        // no threads, and the decoder's packet, frame and resampler are reused from track to track.
+        // Control calls only post commands, so none of them waits for FFmpeg, the device or the decoder thread.
+        struct Command {
+            enum class Type {
+                Play,
+                Stop,
+                Pause,
+                Resume,
+                Seek,
+                QueueNext,
+                SetFinishedCallback,
+                SetTrackChangedCallback,
+                Quit
+            };
+            Type type;
+            Music music; // Play and QueueNext
+            double position_secs = 0.0; // Seek
+            std::function<void()> on_finished; // SetFinishedCallback
+            std::function<void(const Music &)> on_track_changed; // SetTrackChangedCallback
+            int64_t posted_ns = 0; // When the control call was made, for time-to-first-audio
+            std::promise<bool> done; // Set once the command has been carried out (or superseded: false)
+        };
+        std::thread worker_thread_;
+        std::mutex command_mutex_;
+        std::condition_variable command_cond_var_;
+        std::deque<Command> commands_;
+        std::atomic<bool> command_pending_{false};
+        std::atomic<int> pending_plays_{0}; // Play commands not carried out yet, so seek() knows a track is coming
+        // Abandons the track being decoded; set by every command that replaces it, cleared by the worker
         std::atomic<bool> stop_requested_{false};
+        bool session_active_ = false; // Worker only: a track is open and attached
 
         // --- State Management ---
         std::atomic<PlayerState> state_{PlayerState::Stopped};
         std::mutex control_mutex_;
         std::condition_variable control_cond_var_;
 
-        // --- Data Buffer Queue ---
-        std::queue<std::shared_ptr<AudioFrame>> frame_queue_;
-        std::mutex queue_mutex_;
-        std::condition_variable queue_cond_var_;
-        static constexpr size_t MAX_QUEUE_SIZE = 50; // Buffer about 1 second of data
+        // --- PCM Ring Buffer ---
+        // Decoder thread writes, audio callback reads. The callback never locks or waits;
+        // the decoder sleeps on its own semaphore when the ring is full.
+        PcmRingBuffer ring_buffer_;
+        std::counting_semaphore<> decoder_wakeup_{0};
+        // Used only when the contiguous space before the ring's wrap point is too short for the resampler
+        std::vector<float> scratch_buffer_;
+        // Buffered window around the play head: decoded ahead, and kept after playing. Applied on play().
+        // An ahead time of 0 uses the latency profile's buffer depth.
+        std::atomic<double> window_back_secs_{0.0};
+        std::atomic<double> window_ahead_secs_{0.0};
+
+        // --- Latency Profile ---
+        // The device period of each profile is set by the OutputMixer; these are the decoder's side of it
+        struct ProfileSettings {
+            int buffer_ms; // Initial decode-ahead depth
+            int max_buffer_ms; // How far the depth may grow after underruns
+            std::chrono::milliseconds decoder_wait; // Longest the decoder sleeps while the buffer is full
+        };
+        static constexpr ProfileSettings profile_settings(LatencyProfile profile) {
+            switch (profile) {
+                case LatencyProfile::LowLatency:
+                    return {40, 500, std::chrono::milliseconds(2)};
+                case LatencyProfile::PowerSaving:
+                    return {4000, 16000, std::chrono::milliseconds(500)};
+                case LatencyProfile::Balanced:
+                    break;
+            }
+            return {1000, 4000, std::chrono::milliseconds(10)};
+        }
+        std::atomic<LatencyProfile> latency_profile_{LatencyProfile::Balanced};
+        std::chrono::milliseconds decoder_wait_{10};
+        // Decoder thread only: how far ahead it currently fills, grown when the callback reports underruns
+        size_t fill_target_frames_ = 0;
+        uint64_t seen_underruns_ = 0;
+        // Callbacks that ran out of data mid-track, and whether the decoder has reached the end of its input
+        std::atomic<uint64_t> underruns_{0};
+        std::atomic<bool> end_of_stream_{false};
+
+        // --- Telemetry ---
+        // Recorded lock-free by the decoder thread, the prepare thread, segment workers and the callback.
+        // Declared before every decoder, which records into it until it is destroyed.
+        std::unique_ptr<PlaybackTelemetry> telemetry_ = std::make_unique<PlaybackTelemetry>();
+        // Start of the latest play() and seek() that haven't been heard yet, in steady clock ns; 0 if none
+        std::atomic<int64_t> first_audio_start_ns_{0};
+        std::atomic<int64_t> seek_start_ns_{0};
+        // Callback only: a seek has been applied to the ring, the start of this callback and the start and length
+        // of the previous one
+        bool seek_landed_ = false;
+        int64_t callback_start_ns_ = 0;
+        int64_t last_callback_ns_ = 0;
+        uint32_t last_callback_frames_ = 0;
 
         // --- FFmpeg Related ---
-        AVFormatContext *format_ctx_ = nullptr;
-        AVCodecContext *codec_ctx_ = nullptr;
-        SwrContext *swr_ctx_ = nullptr;
-        int audio_stream_index_ = -1;
+        // Converts straight into the ring buffer; all of its buffers are allocated when a track is opened
+        std::unique_ptr<AudioDecoder> decoder_;
 
         // --- Audio Output ---
-        ma_device audio_device_;
-        ma_device_config device_config_;
+        // The device belongs to the OutputMixer and is shared with every other player; every track is converted
+        // to its rate and channel layout. The player is attached to the mixer while it is playing.
+        OutputMixer::Format stream_format_; // Format of the device, as of the last play(); decoder thread only
+        std::atomic<int> stream_sample_rate_{0}; // stream_format_.sample_rate, for the control side
+        bool attached_ = false; // Decoder thread only
+        std::atomic<int> output_sample_rate_{0}; // Requested; 0 = the device's native rate
+        std::atomic<int> output_channels_{2};
 
         // --- Logging ---
         std::shared_ptr<spdlog::logger> logger_;
 
         // --- Playback Progress ---
-        double total_duration_secs_{0.0};
+        std::atomic<double> total_duration_secs_{0.0};
         std::atomic<int64_t> total_samples_played_{0};
         std::atomic<double> seek_request_secs_{-1.0}; // -1.0 means no seek request
+        std::optional<std::promise<bool>> seek_done_; // Decoder thread only: answers the seek() behind the request
+        // Position the callback jumps to when it applies the ring buffer flush that follows a seek
+        std::atomic<int64_t> seek_target_samples_{0};
+        std::atomic<SeekMode> seek_mode_{SeekMode::Accurate};
+        // Instant seek: a target position (in samples) the callback serves from the ring, -1 if none
+        std::atomic<int64_t> jump_request_{-1};
+        // Written by the callback: ring position of the current track's first sample, and the oldest ring
+        // position that still belongs to it (everything before a flush or track boundary is unusable)
+        std::atomic<int64_t> ring_origin_{0};
+        std::atomic<uint64_t> window_start_{0};
+
+        // --- Gapless Playback ---
+        // A track queued with queue_next() is opened and pre-decoded on prepare_thread_, then handed over to the
+        // decoder thread, which splices it into the ring right after the last sample of the current track.
+        // The prepare thread, like the worker, lives as long as the player and takes one request at a time.
+        struct PreparedTrack {
+            Music music;
+            std::unique_ptr<AudioDecoder> decoder; // nullptr if the track could not be opened
+            std::vector<float> preroll;
+            size_t preroll_frames = 0;
+        };
+        struct PrepareRequest {
+            Music music;
+            int sample_rate;
+            int channels;
+        };
+        std::thread prepare_thread_;
+        std::mutex next_mutex_;
+        std::condition_variable next_cond_var_;
+        // Guarded by next_mutex_: the track to prepare next, and a counter bumped whenever the queued track
+        // changes, so a preparation that has been overtaken is dropped instead of published
+        std::optional<PrepareRequest> prepare_request_;
+        uint64_t prepare_generation_ = 0;
+        bool prepare_quit_ = false;
+        std::unique_ptr<PreparedTrack> prepared_next_;
+        std::atomic<bool> next_queued_{false};
+        // Closed decoders left over from earlier tracks, reused by the prepare thread. Guarded by next_mutex_.
+        std::vector<std::unique_ptr<AudioDecoder>> spare_decoders_;
+        static constexpr size_t MAX_SPARE_DECODERS = 2;
+        static constexpr int PREROLL_MS = 250;
+
+        // Ring position of the first sample of the spliced track, and the last boundary the callback has crossed
+        std::atomic<uint64_t> track_boundary_{0};
+        std::atomic<uint64_t> boundary_reached_{0};
+        // Decoder thread only: the spliced track, reported once the callback reaches its first sample
+        std::optional<Music> pending_track_change_;
+        double pending_duration_secs_ = 0.0;
+        // Decoder thread only: frames of the current track written to the ring (its position in ring time)
+        int64_t track_frames_written_ = 0;
+
+        // --- Crossfade ---
+        // Frames decoded from one side of a transition that haven't reached the ring yet.
+        // The incoming side also carries the pre-decoded start of a spliced track.
+        struct FadeSource {
+            AudioDecoder *decoder = nullptr;
+            std::vector<float> samples;
+            size_t frames = 0;
+
+            // Reads until at least `target` frames are buffered. Once the decoder has ended, the rest is silence.
+            void fill(size_t target, uint32_t channels) {
+                while (frames < target) {
+                    const size_t space = samples.size() / channels - frames;
+                    int read = decoder->read(samples.data() + frames * channels, static_cast<int>(space));
+                    if (read <= 0) {
+                        std::fill(samples.begin() + frames * channels, samples.begin() + target * channels, 0.0f);
+                        frames = target;
+                    } else {
+                        frames += static_cast<size_t>(read);
+                    }
+                }
+            }
 
+            void consume(size_t count, uint32_t channels) {
+                std::memmove(samples.data(), samples.data() + count * channels,
+                             (frames - count) * channels * sizeof(float));
+                frames -= count;
+            }
+        };
+        std::atomic<double> crossfade_secs_{0.0};
+        std::atomic<CrossfadeCurve> crossfade_curve_{CrossfadeCurve::EqualPower};
+        // Decoder thread only: the track fading out (decoder_ already holds the one fading in)
+        std::unique_ptr<AudioDecoder> fade_out_decoder_;
+        FadeSource outgoing_;
+        FadeSource incoming_;
+        int64_t fade_length_ = 0;
+        int64_t fade_position_ = 0;
+        CrossfadeCurve fade_curve_ = CrossfadeCurve::EqualPower;
+        static constexpr size_t FADE_BLOCK_FRAMES = 256; // Gains are exact at block edges, interpolated in between
+
+        // --- DSP ---
+        // Runs in the callback on what leaves the ring; the control thread only publishes parameter sets to it
+        DspChain dsp_chain_;
+        std::mutex dsp_mutex_;
+        DspChain::Params dsp_params_; // Control side copy, guarded by dsp_mutex_
+        // Copies the final output for meters and spectrum; created with the logger
+        std::unique_ptr<AnalysisTap> analysis_tap_;
+
+        // --- ReplayGain ---
+        std::atomic<ReplayGainMode> replay_gain_mode_{ReplayGainMode::Off};
+        std::atomic<double> replay_gain_preamp_db_{0.0};
+
+        // --- Input ---
+        // Read-ahead window for tracks from an InputSource or a network filesystem
+        std::atomic<size_t> prefetch_bytes_{MediaInput::DEFAULT_PREFETCH_BYTES};
+
+        // --- Decoding threads ---
+        std::atomic<int> decoder_threads_{1};
+        std::atomic<int> segment_workers_{0};
+        std::atomic<double> segment_min_duration_secs_{600.0};
+
+        // Decoder thread only, which also invokes them; set through the command queue
         std::function<void()> on_playback_finished_callback_;
+        std::function<void(const Music &)> on_track_changed_callback_;
 
         Impl() {
-            logger_ = spdlog::stdout_color_mt("MusicPlayer");
-            logger_->set_level(spdlog::level::info);
+            // All players share one logger; spdlog refuses to register a name twice
+            logger_ = spdlog::get("MusicPlayer");
+            if (!logger_) {
+                logger_ = spdlog::stdout_color_mt("MusicPlayer");
+                logger_->set_level(spdlog::level::info);
+            }
+            decoder_ = std::make_unique<AudioDecoder>(logger_);
+            analysis_tap_ = std::make_unique<AnalysisTap>(logger_);
+            worker_thread_ = std::thread(&Impl::worker_loop, this);
+            prepare_thread_ = std::thread(&Impl::prepare_loop, this);
+        }
+
+        ~Impl() override {
+            post(Command::Type::Quit);
+            worker_thread_.join();
+            {
+                std::lock_guard<std::mutex> lock(next_mutex_);
+                prepare_quit_ = true;
+            }
+            next_cond_var_.notify_all();
+            prepare_thread_.join();
         }
 
         // Member function declarations
-        void decoder_loop();
-        void process_playback_frames(void *p_output, ma_uint32 frame_count);
+        std::future<bool> post(Command::Type type, const Music *music = nullptr, double position_secs = 0.0);
+        std::future<bool> post(Command &&command);
+        static std::future<bool> rejected();
+        static bool is_setting(Command::Type type);
+        bool apply_setting(Command &command);
+        static bool supersedes(Command::Type later, Command::Type earlier);
+        void worker_loop();
+        bool take_command(Command &command);
+        bool start_session(const Music &music);
+        void end_session();
+        bool take_session_commands();
+        bool pause_session();
+        bool resume_session();
+        void apply_seek(double position_secs, std::promise<bool> done);
+        void finish_seek(bool landed);
+        bool decoder_loop();
+        int decode_into_ring();
+        bool wait_for_drain();
+        void prepare_loop();
+        bool prepare_next_track(PreparedTrack &track, int sample_rate, int channels);
+        void queue_next_track(Music music);
+        void recycle_decoder(std::unique_ptr<AudioDecoder> decoder);
+        bool splice_next_track();
+        bool start_crossfade();
+        int crossfade_into_ring();
+        void reset_transition();
+        void notify_track_change();
+        void cancel_next_track();
+        void wake_decoder() { decoder_wakeup_.release(); }
+        template<typename Update>
+        void update_dsp(Update update) {
+            std::lock_guard<std::mutex> lock(dsp_mutex_);
+            update(dsp_params_);
+            dsp_chain_.publish(dsp_params_);
+        }
+        bool process_playback_frames(float *p_output, uint32_t frame_count);
         void cleanup();
+        size_t fill_room() const;
+        void wait_for_room();
+        void adapt_buffering();
+        bool request_instant_seek(double position_secs);
+        bool apply_jump(int64_t target_samples);
+        bool attach();
+        void detach();
+        float replay_gain_for(const Music &music) const;
+        bool open_track(AudioDecoder &decoder, const Music &music, int sample_rate, int channels) const;
+        static std::string track_name(const Music &music);
+
+        bool render(float *output, uint32_t frames) override { return process_playback_frames(output, frames); }
+        void begin_block(uint32_t frames) override;
+        void end_block() override { telemetry_->callback.record_since(callback_start_ns_); }
+    };
+
+    MusicPlayer::MusicPlayer() : pimpl_(std::make_unique<Impl>()) {}
+
+    MusicPlayer::~MusicPlayer() = default; // The Impl stops playback and its threads
+
+    std::future<bool> MusicPlayer::play(const MusicEngine::Music &music) {
+        // The decoder thread stops and cleans up the old track before it opens the new one
+        return pimpl_->post(Impl::Command::Type::Play, &music);
+    }
+
+    std::future<bool> MusicPlayer::stop() { return pimpl_->post(Impl::Command::Type::Stop); }
+
+    void MusicPlayer::set_output_format(int sample_rate, int channels) {
+        pimpl_->output_sample_rate_ = std::max(0, sample_rate);
+        pimpl_->output_channels_ = std::max(1, channels);
+    }
+
+    void MusicPlayer::set_null_output(bool enabled) { OutputMixer::get_instance().set_null_backend(enabled); }
+
+    // 暂停与恢复都在解码线程上执行：从混音器中移除或重新加入
+    std::future<bool> MusicPlayer::pause() { return pimpl_->post(Impl::Command::Type::Pause); }
+
+    std::future<bool> MusicPlayer::resume() { return pimpl_->post(Impl::Command::Type::Resume); }
+
+    PlayerState MusicPlayer::get_state() const { return pimpl_->state_; }
+
+    std::future<bool> MusicPlayer::queue_next(const MusicEngine::Music &music) {
+        if (pimpl_->state_ == PlayerState::Stopped && pimpl_->pending_plays_ == 0) {
+            return play(music);
+        }
+        // Queued behind a play() that hasn't opened its track yet, it follows that track.
+        // The worker starts preparing it; should the current track end first, the worker plays it instead
+        pimpl_->logger_->info("Queued next track: {}", Impl::track_name(music));
+        return pimpl_->post(Impl::Command::Type::QueueNext, &music);
+    }
+
+    // ------------------- Decoder Worker -------------------
+
+    // [Control] Queues a command for the decoder thread and returns at once
+    std::future<bool> MusicPlayer::Impl::post(Command::Type type, const Music *music, double position_secs) {
+        Command command;
+        command.type = type;
+        if (music) {
+            command.music = *music;
+        }
+        command.position_secs = position_secs;
+        return post(std::move(command));
+    }
 
-        static void audio_callback_wrapper(ma_device *p_device, void *p_output, const void *p_input,
-                                           ma_uint32 frame_count) {
-            Impl *p_impl = static_cast<Impl *>(p_device->pUserData);
-            if (p_impl) {
-                p_impl->process_playback_frames(p_output, frame_count);
+    std::future<bool> MusicPlayer::Impl::post(Command &&posted) {
+        const Command::Type type = posted.type;
+        std::future<bool> done;
+        {
+            std::lock_guard<std::mutex> lock(command_mutex_);
+            Command &command = commands_.emplace_back(std::move(posted));
+            command.posted_ns = TimingHistogram::now_ns();
+            done = command.done.get_future();
+            if (type == Command::Type::Play) {
+                ++pending_plays_;
             }
+            if (type == Command::Type::Play || type == Command::Type::Stop || type == Command::Type::Quit) {
+                // Whatever the worker is decoding is about to be replaced: silence it and let it give up right away
+                stop_requested_ = true;
+            }
+            command_pending_ = true;
         }
-    };
+        command_cond_var_.notify_one();
 
-    MusicPlayer::MusicPlayer() : pimpl_(std::make_unique<Impl>()) {}
+        // Wake the worker wherever a running track may be waiting. The flags above aren't guarded by these
+        // mutexes, so lock each before notifying: otherwise a waiter that just checked its predicate misses the wakeup
+        {
+            std::lock_guard<std::mutex> lock(control_mutex_);
+        }
+        control_cond_var_.notify_one();
+        wake_decoder();
+        {
+            std::lock_guard<std::mutex> lock(next_mutex_);
+        }
+        next_cond_var_.notify_all();
+        return done;
+    }
 
-    MusicPlayer::~MusicPlayer() { stop(); }
+    // For a control call that is turned down before it reaches the worker
+    std::future<bool> MusicPlayer::Impl::rejected() {
+        std::promise<bool> done;
+        done.set_value(false);
+        return done.get_future();
+    }
 
-    void MusicPlayer::play(const MusicEngine::Music &music) {
-        stop(); // Before playing a new music, stop and clean up the old one
+    // Commands that change the player's settings rather than its track
+    bool MusicPlayer::Impl::is_setting(Command::Type type) {
+        return type == Command::Type::SetFinishedCallback || type == Command::Type::SetTrackChangedCallback;
+    }
 
-        pimpl_->stop_requested_ = false;
+    // [Worker] Carries out a setting command, in order with the track commands around it
+    bool MusicPlayer::Impl::apply_setting(Command &command) {
+        if (command.type == Command::Type::SetFinishedCallback) {
+            on_playback_finished_callback_ = std::move(command.on_finished);
+        } else {
+            on_track_changed_callback_ = std::move(command.on_track_changed);
+        }
+        return true;
+    }
 
-        // 重置样本计数器
-        pimpl_->total_samples_played_ = 0;
+    // Whether a command posted after @p earlier makes it pointless to carry @p earlier out
+    bool MusicPlayer::Impl::supersedes(Command::Type later, Command::Type earlier) {
+        if (is_setting(earlier)) {
+            return false; // Settings always apply
+        }
+        switch (later) {
+            case Command::Type::Play:
+            case Command::Type::Stop:
+            case Command::Type::Quit:
+                return true; // They end the track every earlier command was about
+            case Command::Type::Pause:
+            case Command::Type::Resume:
+                return earlier == Command::Type::Pause || earlier == Command::Type::Resume;
+            case Command::Type::Seek:
+                return earlier == Command::Type::Seek;
+            case Command::Type::QueueNext:
+                break; // queue_next_track() replaces the previous one itself, keeping what it has prepared
+            case Command::Type::SetFinishedCallback:
+            case Command::Type::SetTrackChangedCallback:
+                break;
+        }
+        return false;
+    }
 
-        // 1. --- FFmpeg Initialization ---
-        pimpl_->format_ctx_ = avformat_alloc_context();
-        if (avformat_open_input(&pimpl_->format_ctx_, music.file_path.c_str(), nullptr, nullptr) != 0) {
-            pimpl_->logger_->error("Cannot open file: {}", music.file_path.string());
-            return;
+    // [Worker] Waits for the next command. Superseded commands are answered with false without being carried
+    // out, so when tracks are skipped faster than they open, only the last one is opened. Returns false for Quit.
+    bool MusicPlayer::Impl::take_command(Command &command) {
+        std::unique_lock<std::mutex> lock(command_mutex_);
+        for (;;) {
+            command_cond_var_.wait(lock, [this] { return !commands_.empty(); });
+            command = std::move(commands_.front());
+            commands_.pop_front();
+            const bool superseded = std::any_of(commands_.begin(), commands_.end(), [&](const Command &later) {
+                return supersedes(later.type, command.type);
+            });
+            if (!superseded || command.type == Command::Type::Quit) {
+                break;
+            }
+            if (command.type == Command::Type::Play) {
+                --pending_plays_;
+            }
+            command.done.set_value(false);
         }
-        if (avformat_find_stream_info(pimpl_->format_ctx_, nullptr) < 0) {
-            pimpl_->logger_->error("Cannot find stream information for the file");
-            pimpl_->cleanup();
-            return;
+        // No Play, Stop or Quit follows, so nothing asks to stop the track this command may be about to start
+        command_pending_ = !commands_.empty();
+        stop_requested_ = false;
+        return command.type != Command::Type::Quit;
+    }
+
+    // [Worker] Runs the player: one command at a time, and a whole track for each Play
+    void MusicPlayer::Impl::worker_loop() {
+        Command command;
+        while (take_command(command)) {
+            switch (command.type) {
+                case Command::Type::Stop:
+                    end_session();
+                    command.done.set_value(true);
+                    continue;
+                case Command::Type::Pause:
+                case Command::Type::Resume:
+                case Command::Type::Seek:
+                    // A track is only open while decoder_loop() runs, which handles these itself
+                    command.done.set_value(false);
+                    continue;
+                case Command::Type::SetFinishedCallback:
+                case Command::Type::SetTrackChangedCallback:
+                    command.done.set_value(apply_setting(command));
+                    continue;
+                default:
+                    break; // Play, or a track queued just as the current one ended, which plays on its own
+            }
+
+            end_session();
+            // A track queued long ago that plays on its own says nothing about start-up time
+            first_audio_start_ns_ = command.type == Command::Type::Play ? command.posted_ns : 0;
+            const bool started = start_session(command.music);
+            if (!started) {
+                first_audio_start_ns_ = 0;
+            }
+            if (command.type == Command::Type::Play) {
+                --pending_plays_;
+            }
+            command.done.set_value(started);
+            if (!started || !decoder_loop()) {
+                continue; // Not opened, or stopped by a command that worker_loop() carries out next
+            }
+
+            // The track has played to its end
+            logger_->info("Finished decoding file");
+            end_session();
+            // 调用回调通知上层应用
+            if (on_playback_finished_callback_) {
+                logger_->info("Invoking on_playback_finished callback.");
+                on_playback_finished_callback_();
+            }
         }
+        end_session();
+        command.done.set_value(true);
+        logger_->info("Decoder worker exited");
+    }
+
+    // [Worker] Opens @p music and joins the mixer
+    bool MusicPlayer::Impl::start_session(const Music &music) {
+        // 重置样本计数器
+        total_samples_played_ = 0;
+        track_boundary_ = 0;
+        boundary_reached_ = 0;
+        pending_track_change_.reset();
+        track_frames_written_ = 0;
+        jump_request_ = -1;
+        seek_request_secs_ = -1.0;
+        ring_origin_ = 0;
+        window_start_ = 0;
+        end_of_stream_ = false;
+
+        // 1. --- Output Device ---
+        // Shared and kept open, so starting a track doesn't pay for (or pop on) a device reopen. While other
+        // players are playing, the device keeps its format and this track is converted to it.
+        const auto format = OutputMixer::get_instance().open(output_sample_rate_, output_channels_, latency_profile_);
+        if (!format) {
+            return false;
+        }
+        stream_format_ = *format;
+        stream_sample_rate_ = format->sample_rate;
+        IntroCache::get_instance().device_opened();
+        const int sample_rate = format->sample_rate;
+        const int channels = format->channels;
+
+        // 2. --- Buffers ---
+        // Size the ring in frames rather than in decoded packets, so the buffered time no longer depends on the codec.
+        // The player isn't attached to the mixer here, so the callback can't observe the reset.
+        // The decoder starts at the profile's depth (or the configured window) and may grow up to the ring's limit.
+        // A cached intro goes into the ring in one piece, so the ring is at least as long.
+        const auto intro = IntroCache::get_instance().find(music, sample_rate, channels);
+        const size_t intro_frames = intro ? intro->frames() : 0;
+        const ProfileSettings profile = profile_settings(latency_profile_);
+        const double window_ahead = window_ahead_secs_;
+        const double ahead_secs = window_ahead > 0.0 ? window_ahead : profile.buffer_ms / 1000.0;
+        const double max_ahead_secs = std::max(ahead_secs, profile.max_buffer_ms / 1000.0);
+        ring_buffer_.reset(std::max(static_cast<size_t>(max_ahead_secs * sample_rate), intro_frames), channels,
+                           static_cast<size_t>(window_back_secs_ * sample_rate));
+        fill_target_frames_ = static_cast<size_t>(ahead_secs * sample_rate);
+        telemetry_->buffer_target_frames = fill_target_frames_;
+        seen_underruns_ = underruns_;
+        decoder_wait_ = profile.decoder_wait;
+        dsp_chain_.prepare(sample_rate, static_cast<uint32_t>(channels));
+        analysis_tap_->prepare(sample_rate, static_cast<uint32_t>(channels));
+        const float gain = replay_gain_for(music);
+
+        // 3. --- Intro Cache ---
+        // Output starts from the cached intro right away; the decoder opens meanwhile and continues where it ends
+        if (intro) {
+            size_t contiguous = 0;
+            float *region = ring_buffer_.write_region(contiguous); // The whole ring: it has just been reset
+            intro->read(region, 0, intro_frames);
+            if (gain != 1.0f) {
+                mix::apply_gain(region, intro_frames * channels, gain);
+            }
+            ring_buffer_.commit(intro_frames);
+            track_frames_written_ = static_cast<int64_t>(intro_frames);
+            total_duration_secs_ = intro->track_duration();
+            if (!attach()) {
+                return false;
+            }
+            state_ = PlayerState::Playing;
+            logger_->debug("Playing {} ms from the intro cache", intro_frames * 1000 / sample_rate);
+        }
+
+        // 4. --- Decoder Initialization ---
+        // The decoder converts everything to interleaved F32 at the device's rate and channel layout
+        const bool opened = open_track(*decoder_, music, sample_rate, channels) &&
+                            (!intro || decoder_->seek_to_frame(static_cast<int64_t>(intro_frames)));
+        if (!opened) {
+            if (intro) {
+                state_ = PlayerState::Stopped;
+                detach();
+                cleanup();
+            }
+            return false;
+        }
+
+        decoder_->set_output_gain(gain);
 
         // 计算并存储总时长
-        pimpl_->total_duration_secs_ = static_cast<double>(pimpl_->format_ctx_->duration) / AV_TIME_BASE;
-
-        // Find the best audio stream
-        AVCodecParameters *codec_par = nullptr;
-        pimpl_->audio_stream_index_ = av_find_best_stream(pimpl_->format_ctx_, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
-        if (pimpl_->audio_stream_index_ < 0) {
-            pimpl_->logger_->error("No audio stream found in the file");
-            pimpl_->cleanup();
-            return;
+        total_duration_secs_ = decoder_->duration();
+        scratch_buffer_.resize(static_cast<size_t>(decoder_->max_read_frames()) * channels);
+
+        if (!intro && !attach()) {
+            cleanup();
+            return false;
         }
-        codec_par = pimpl_->format_ctx_->streams[pimpl_->audio_stream_index_]->codecpar;
 
-        // Find the decoder
-        const AVCodec *codec = avcodec_find_decoder(codec_par->codec_id);
-        if (!codec) {
-            pimpl_->logger_->error("Cannot find decoder");
-            pimpl_->cleanup();
+        // 所有初始化都成功了再设置播放状态
+        state_ = PlayerState::Playing;
+        session_active_ = true;
+        logger_->info("Started playing: {}", track_name(music));
+        return true;
+    }
+
+    // [Worker] Stops preparing the next track, leaves the mixer and closes the decoder. The device stays open for
+    // the next track; once detached, the callback no longer reads this player's ring, so it can be reused.
+    void MusicPlayer::Impl::end_session() {
+        if (!session_active_) {
             return;
         }
+        logger_->info("Stopping playback...");
+        session_active_ = false;
+        finish_seek(false);
+        cancel_next_track();
+        state_ = PlayerState::Stopped;
+        detach();
+        cleanup();
+    }
 
-        pimpl_->codec_ctx_ = avcodec_alloc_context3(codec);
-        if (avcodec_parameters_to_context(pimpl_->codec_ctx_, codec_par) < 0) {
-            pimpl_->logger_->error("Cannot copy decoder parameters");
-            pimpl_->cleanup();
-            return;
+    // [Worker] Carries out the commands at the front of the queue that apply to the current track. Play, Stop and
+    // Quit are left for worker_loop(); decoder_loop() returns to it as they set stop_requested_.
+    // Returns false if the track can't continue.
+    bool MusicPlayer::Impl::take_session_commands() {
+        std::unique_lock<std::mutex> lock(command_mutex_);
+        while (!commands_.empty()) {
+            const Command::Type type = commands_.front().type;
+            if (type == Command::Type::Play || type == Command::Type::Stop || type == Command::Type::Quit) {
+                break;
+            }
+            Command command = std::move(commands_.front());
+            commands_.pop_front();
+            command_pending_ = !commands_.empty();
+            const bool superseded = std::any_of(commands_.begin(), commands_.end(), [&](const Command &later) {
+                return supersedes(later.type, command.type);
+            });
+            lock.unlock();
+
+            bool done = false;
+            if (superseded) {
+                // Answered below with false
+            } else if (type == Command::Type::QueueNext) {
+                queue_next_track(std::move(command.music));
+                done = true;
+            } else if (type == Command::Type::Pause) {
+                done = pause_session();
+            } else if (type == Command::Type::Resume) {
+                done = resume_session();
+                if (!done && state_ == PlayerState::Paused) {
+                    // The output couldn't be rejoined
+                    // 如果设备启动失败，最好还是停下来
+                    command.done.set_value(false);
+                    return false;
+                }
+            } else if (type == Command::Type::Seek) {
+                apply_seek(command.position_secs, std::move(command.done)); // Answered once the seek has landed
+                lock.lock();
+                continue;
+            } else if (is_setting(type)) {
+                done = apply_setting(command);
+            }
+            command.done.set_value(done);
+            lock.lock();
         }
-        if (avcodec_open2(pimpl_->codec_ctx_, codec, nullptr) < 0) {
-            pimpl_->logger_->error("Cannot open decoder");
-            pimpl_->cleanup();
-            return;
+        return true;
+    }
+
+    // [Worker] 从混音器中移除，回调将不再读取本播放器的数据（其他播放器不受影响）
+    bool MusicPlayer::Impl::pause_session() {
+        if (state_ != PlayerState::Playing) {
+            return false;
         }
+        state_ = PlayerState::Paused;
+        detach();
+        logger_->info("Playback paused");
+        return true;
+    }
 
-        // 2. --- Audio Resampling (SwrContext) Initialization ---
-        // We resample everything to a format that miniaudio handles easily: F32 stereo
-        pimpl_->swr_ctx_ = swr_alloc();
-        av_opt_set_chlayout(pimpl_->swr_ctx_, "in_chlayout", &pimpl_->codec_ctx_->ch_layout, 0);
-        av_opt_set_int(pimpl_->swr_ctx_, "in_sample_rate", pimpl_->codec_ctx_->sample_rate, 0);
-        av_opt_set_sample_fmt(pimpl_->swr_ctx_, "in_sample_fmt", pimpl_->codec_ctx_->sample_fmt, 0);
-
-        AVChannelLayout out_ch_layout = AV_CHANNEL_LAYOUT_STEREO;
-        av_opt_set_chlayout(pimpl_->swr_ctx_, "out_chlayout", &out_ch_layout, 0);
-        av_opt_set_int(pimpl_->swr_ctx_, "out_sample_rate", pimpl_->codec_ctx_->sample_rate, 0);
-        av_opt_set_sample_fmt(pimpl_->swr_ctx_, "out_sample_fmt", AV_SAMPLE_FMT_FLT, 0);
-        swr_init(pimpl_->swr_ctx_);
-
-        // 3. --- Miniaudio Initialization ---
-        pimpl_->device_config_ = ma_device_config_init(ma_device_type_playback);
-        pimpl_->device_config_.playback.format = ma_format_f32;
-        pimpl_->device_config_.playback.channels = out_ch_layout.nb_channels;
-        pimpl_->device_config_.sampleRate = pimpl_->codec_ctx_->sample_rate;
-        pimpl_->device_config_.dataCallback = pimpl_->audio_callback_wrapper;
-        pimpl_->device_config_.pUserData = pimpl_.get();
-
-        if (ma_device_init(NULL, &pimpl_->device_config_, &pimpl_->audio_device_) != MA_SUCCESS) {
-            pimpl_->logger_->error("Failed to initialize audio device");
-            pimpl_->cleanup();
-            return;
+    // [Worker] 重新加入混音器，回调将恢复读取本播放器的数据
+    bool MusicPlayer::Impl::resume_session() {
+        if (state_ != PlayerState::Paused) {
+            return false;
         }
-        if (ma_device_start(&pimpl_->audio_device_) != MA_SUCCESS) {
-            pimpl_->logger_->error("Failed to start audio device");
-            pimpl_->cleanup();
-            return;
+        if (!attach()) {
+            logger_->error("Failed to rejoin the output on resume. Playback may not continue.");
+            return false;
         }
+        state_ = PlayerState::Playing;
+        logger_->info("Playback resumed");
+        return true;
+    }
 
-        // 所有初始化都成功了再设置播放状态
-        pimpl_->state_ = PlayerState::Playing;
+    bool MusicPlayer::Impl::attach() {
+        attached_ = OutputMixer::get_instance().attach(this, stream_format_);
+        return attached_;
+    }
 
-        // 4. --- Start the Decoder Thread ---
-        pimpl_->decoder_thread_ = std::thread(&Impl::decoder_loop, pimpl_.get());
-        pimpl_->logger_->info("Started playing: {}", music.file_path.string());
+    void MusicPlayer::Impl::detach() {
+        if (attached_) {
+            OutputMixer::get_instance().detach(this);
+            attached_ = false;
+        }
     }
 
-    void MusicPlayer::stop() {
-        if (pimpl_->state_ == PlayerState::Stopped) {
-            return;
+    void MusicPlayer::Impl::cleanup() {
+        reset_transition();
+        decoder_->close();
+
+        // 重置时长
+        total_duration_secs_ = 0.0;
+    }
+
+
+    // ------------------- Producer-Consumer Core Logic -------------------
+
+    // [Producer] Decodes straight into the free region of the ring buffer, sleeping on the decoder's own semaphore
+    // while it is full. Returns the number of frames added, 0 if there was no room, or -1 at the end of the stream.
+    int MusicPlayer::Impl::decode_into_ring() {
+        // Steady-state decoding must not allocate; waiting for room in the ring is expected here
+        MUSICENGINE_ALLOCATION_FREE_SCOPE("MusicPlayer decode step");
+        // Pre-decoded frames of a spliced track, or the rest of the incoming side of a finished crossfade
+        if (incoming_.frames > 0) {
+            const int64_t enqueue_start = TimingHistogram::now_ns();
+            const size_t written =
+                    ring_buffer_.write(incoming_.samples.data(), std::min(incoming_.frames, fill_room()));
+            if (written == 0) {
+                wait_for_room();
+                return 0;
+            }
+            telemetry_->enqueue.record_since(enqueue_start);
+            incoming_.consume(written, ring_buffer_.channels());
+            track_frames_written_ += static_cast<int64_t>(written);
+            return static_cast<int>(written);
         }
 
-        pimpl_->logger_->info("Stopping playback...");
-        pimpl_->state_ = PlayerState::Stopped;
-        pimpl_->stop_requested_ = true;
+        const size_t min_frames = static_cast<size_t>(decoder_->min_read_frames());
+        const size_t writable = fill_room();
+        if (writable < min_frames) {
+            wait_for_room();
+            return 0;
+        }
 
-        // Wake up any waiting threads
-        pimpl_->control_cond_var_.notify_one();
-        pimpl_->queue_cond_var_.notify_all();
+        size_t contiguous = 0;
+        float *region = ring_buffer_.write_region(contiguous);
+        contiguous = std::min(contiguous, writable);
+        int frames;
+        if (contiguous >= min_frames) {
+            frames = decoder_->read(region, static_cast<int>(contiguous));
+            if (frames > 0) {
+                const int64_t enqueue_start = TimingHistogram::now_ns();
+                ring_buffer_.commit(static_cast<size_t>(frames));
+                telemetry_->enqueue.record_since(enqueue_start);
+            }
+        } else {
+            // The space before the wrap point is too short for one resampler step; stage through the scratch buffer
+            frames = decoder_->read(scratch_buffer_.data(), static_cast<int>(min_frames));
+            if (frames > 0) {
+                const int64_t enqueue_start = TimingHistogram::now_ns();
+                ring_buffer_.write(scratch_buffer_.data(), static_cast<size_t>(frames));
+                telemetry_->enqueue.record_since(enqueue_start);
+            }
+        }
 
-        if (pimpl_->decoder_thread_.joinable()) {
-            pimpl_->decoder_thread_.join();
+        if (frames < 0 || (frames == 0 && decoder_->eof())) {
+            return -1;
         }
+        track_frames_written_ += frames;
+        return frames;
+    }
 
-        ma_device_uninit(&pimpl_->audio_device_);
-        pimpl_->cleanup();
+    // [Producer] Frames that may be written before reaching the current decode-ahead depth
+    size_t MusicPlayer::Impl::fill_room() const {
+        const size_t buffered = ring_buffer_.buffered_frames();
+        if (buffered >= fill_target_frames_) {
+            return 0;
+        }
+        return std::min(ring_buffer_.writable_frames(), fill_target_frames_ - buffered);
+    }
 
-        // Clear the queue
-        std::lock_guard<std::mutex> lock(pimpl_->queue_mutex_);
-        std::queue<std::shared_ptr<AudioFrame>> empty_queue;
-        pimpl_->frame_queue_.swap(empty_queue);
+    // [Producer] Sleeps while the buffer is full: up to the profile's decoder wait, but never past the point where
+    // the buffer has drained to half its depth, so long sleeps (power saving) can't starve the callback
+    void MusicPlayer::Impl::wait_for_room() {
+        const size_t buffered = ring_buffer_.buffered_frames();
+        const size_t low_water = fill_target_frames_ / 2;
+        auto wait = decoder_wait_;
+        if (buffered > low_water && stream_format_.sample_rate > 0) {
+            const auto until_low = std::chrono::milliseconds((buffered - low_water) * 1000 /
+                                                             static_cast<size_t>(stream_format_.sample_rate));
+            wait = std::clamp(until_low, std::chrono::milliseconds(1), decoder_wait_);
+        }
+        decoder_wakeup_.try_acquire_for(wait);
     }
 
-    void MusicPlayer::pause() {
-        // 检查状态
-        if (pimpl_->state_ != PlayerState::Playing) {
+    // [Producer] Decodes further ahead after the callback has run dry, up to the ring's limit
+    void MusicPlayer::Impl::adapt_buffering() {
+        const uint64_t underruns = underruns_.load(std::memory_order_relaxed);
+        if (underruns == seen_underruns_) {
             return;
         }
+        seen_underruns_ = underruns;
+        const size_t grown = std::min(ring_buffer_.ahead_limit(), fill_target_frames_ + fill_target_frames_ / 2);
+        if (grown > fill_target_frames_) {
+            fill_target_frames_ = grown;
+            telemetry_->buffer_target_frames = fill_target_frames_;
+            logger_->warn("Output underrun, now decoding {} ms ahead",
+                          fill_target_frames_ * 1000 / std::max(stream_format_.sample_rate, 1));
+        }
+    }
 
-        pimpl_->state_ = PlayerState::Paused;
+    // [Producer] Waits until the callback has played everything that was decoded.
+    // Returns false if a stop or seek request, a command, or a track to splice arrived in the meantime.
+    bool MusicPlayer::Impl::wait_for_drain() {
+        while (ring_buffer_.buffered_frames() > 0) {
+            if (stop_requested_ || seek_request_secs_ >= 0.0 || next_queued_ || command_pending_) {
+                return false;
+            }
+            notify_track_change();
+            decoder_wakeup_.try_acquire_for(decoder_wait_);
+        }
+        notify_track_change();
+        return !stop_requested_;
+    }
 
-        // 显式停止 miniaudio 设备，这将停止调用我们的回调函数
-        if (ma_device_stop(&pimpl_->audio_device_) != MA_SUCCESS) {
-            pimpl_->logger_->warn("Failed to stop audio device on pause.");
+    // Linear gain for a track under the current ReplayGain settings, limited so its true peak stays below 0 dBFS
+    float MusicPlayer::Impl::replay_gain_for(const Music &music) const {
+        const ReplayGainMode mode = replay_gain_mode_;
+        if (mode == ReplayGainMode::Off || !music.loudness.analyzed) {
+            return 1.0f;
         }
+        const double gain_db =
+                (mode == ReplayGainMode::Album ? music.loudness.album_gain_db : music.loudness.track_gain_db) +
+                replay_gain_preamp_db_;
+        const double peak = std::pow(10.0, music.loudness.true_peak_dbtp / 20.0);
+        return static_cast<float>(std::min(std::pow(10.0, gain_db / 20.0), peak > 0.0 ? 1.0 / peak : 1.0));
+    }
 
-        pimpl_->logger_->info("Playback paused");
+    // Opens @p music from its source if it has one, from its file otherwise
+    bool MusicPlayer::Impl::open_track(AudioDecoder &decoder, const Music &music, int sample_rate,
+                                       int channels) const {
+        decoder.set_prefetch_bytes(prefetch_bytes_);
+        decoder.set_timings(&telemetry_->decoder);
+        decoder.set_codec_threads(decoder_threads_);
+        decoder.set_parallel_segments(segment_workers_, segment_min_duration_secs_);
+        if (music.source) {
+            return decoder.open(music.source, sample_rate, channels);
+        }
+        return decoder.open(music.file_path, sample_rate, channels);
     }
 
-    void MusicPlayer::resume() {
-        // 检查状态必须放在前面
-        if (pimpl_->state_ != PlayerState::Paused) {
-            return;
+    std::string MusicPlayer::Impl::track_name(const Music &music) {
+        return music.source ? music.source->name() : music.file_path.string();
+    }
+
+    // ------------------- Gapless Playback -------------------
+
+    // [Prepare Thread] Prepares one queued track at a time. A result that has been overtaken by a newer
+    // queue_next() or by the end of the session is dropped, its decoder kept for reuse.
+    void MusicPlayer::Impl::prepare_loop() {
+        std::unique_lock<std::mutex> lock(next_mutex_);
+        for (;;) {
+            next_cond_var_.wait(lock, [this] { return prepare_request_ || prepare_quit_; });
+            if (prepare_quit_) {
+                return;
+            }
+            PrepareRequest request = std::move(*prepare_request_);
+            prepare_request_.reset();
+            const uint64_t generation = prepare_generation_;
+            auto track = std::make_unique<PreparedTrack>();
+            track->music = std::move(request.music);
+            if (!spare_decoders_.empty()) {
+                track->decoder = std::move(spare_decoders_.back());
+                spare_decoders_.pop_back();
+            }
+            lock.unlock();
+
+            if (!track->decoder) {
+                track->decoder = std::make_unique<AudioDecoder>(logger_);
+            }
+            if (!prepare_next_track(*track, request.sample_rate, request.channels)) {
+                recycle_decoder(std::move(track->decoder));
+            }
+
+            lock.lock();
+            if (generation != prepare_generation_) {
+                lock.unlock();
+                recycle_decoder(std::move(track->decoder));
+                lock.lock();
+                continue;
+            }
+            prepared_next_ = std::move(track);
+            next_cond_var_.notify_all();
         }
+    }
 
-        pimpl_->state_ = PlayerState::Playing;
+    // [Prepare Thread] Opens, probes and pre-decodes the queued track at the output rate
+    bool MusicPlayer::Impl::prepare_next_track(PreparedTrack &track, int sample_rate, int channels) {
+        AudioDecoder &decoder = *track.decoder;
+        if (!open_track(decoder, track.music, sample_rate, channels)) {
+            logger_->warn("Failed to prepare next track: {}", track_name(track.music));
+            return false;
+        }
+        decoder.set_output_gain(replay_gain_for(track.music));
+        // Pre-decode the beginning so the splice doesn't depend on how quickly the first packets decode
+        const size_t capacity = static_cast<size_t>(sample_rate) * PREROLL_MS / 1000;
+        track.preroll.resize(capacity * channels);
+        while (track.preroll_frames < capacity) {
+            int frames = decoder.read(track.preroll.data() + track.preroll_frames * channels,
+                                      static_cast<int>(capacity - track.preroll_frames));
+            if (frames <= 0) {
+                break;
+            }
+            track.preroll_frames += static_cast<size_t>(frames);
+        }
+        logger_->info("Prepared next track: {}", track_name(track.music));
+        return true;
+    }
 
-        // 显式启动 miniaudio 设备，这将恢复调用我们的回调函数
-        if (ma_device_start(&pimpl_->audio_device_) != MA_SUCCESS) {
-            pimpl_->logger_->error("Failed to start audio device on resume. Playback may not continue.");
-            // 如果设备启动失败，最好还是停下来
-            stop();
+    // [Worker] Hands @p music to the prepare thread, replacing any track queued before it
+    void MusicPlayer::Impl::queue_next_track(Music music) {
+        std::unique_ptr<PreparedTrack> replaced;
+        {
+            std::lock_guard<std::mutex> lock(next_mutex_);
+            ++prepare_generation_;
+            replaced = std::move(prepared_next_);
+            // Decode the next track at the rate of the running output stream so it can be spliced into it
+            prepare_request_ = PrepareRequest{std::move(music), stream_format_.sample_rate, stream_format_.channels};
+            next_queued_ = true;
+        }
+        next_cond_var_.notify_all();
+        if (replaced) {
+            recycle_decoder(std::move(replaced->decoder));
+        }
+    }
+
+    // Closes @p decoder and keeps it for a later track, so its packet, frame and resampler are allocated only once
+    void MusicPlayer::Impl::recycle_decoder(std::unique_ptr<AudioDecoder> decoder) {
+        if (!decoder) {
             return;
         }
+        decoder->close();
+        std::lock_guard<std::mutex> lock(next_mutex_);
+        if (spare_decoders_.size() < MAX_SPARE_DECODERS) {
+            spare_decoders_.push_back(std::move(decoder));
+        }
+    }
+
+    // [Producer] Continues the output stream with the queued track. Returns false if there is none to splice.
+    bool MusicPlayer::Impl::splice_next_track() {
+        std::unique_ptr<PreparedTrack> next;
+        {
+            std::unique_lock<std::mutex> lock(next_mutex_);
+            // The ring still holds up to a second of the current track, so waiting for a slow open costs no audio yet
+            next_cond_var_.wait(lock, [this] { return prepared_next_ || !next_queued_ || stop_requested_; });
+            next = std::move(prepared_next_);
+            next_queued_ = false;
+        }
+        if (!next || !next->decoder) {
+            return false;
+        }
 
-        pimpl_->control_cond_var_.notify_one(); // 唤醒解码线程继续生产数据
-        pimpl_->logger_->info("Playback resumed");
+        // Report the previous splice first if the callback has already reached it (very short tracks)
+        notify_track_change();
+
+        // Everything written from here on belongs to the next track; decode_into_ring() writes the preroll first
+        track_boundary_.store(ring_buffer_.write_position(), std::memory_order_release);
+        decoder_.swap(next->decoder);
+        recycle_decoder(std::move(next->decoder));
+        scratch_buffer_.resize(static_cast<size_t>(decoder_->max_read_frames()) * ring_buffer_.channels());
+        pending_track_change_ = next->music;
+        pending_duration_secs_ = decoder_->duration();
+        track_frames_written_ = 0;
+        incoming_.decoder = decoder_.get();
+        incoming_.samples = std::move(next->preroll);
+        incoming_.frames = next->preroll_frames;
+
+        logger_->info("Gapless transition to: {}", track_name(next->music));
+        return true;
     }
 
-    PlayerState MusicPlayer::get_state() const { return pimpl_->state_; }
+    // ------------------- Crossfade -------------------
 
-    void MusicPlayer::Impl::cleanup() {
-        avcodec_free_context(&codec_ctx_);
-        avformat_close_input(&format_ctx_);
-        swr_free(&swr_ctx_);
-        audio_stream_index_ = -1;
+    namespace {
 
-        // 重置时长
-        total_duration_secs_ = 0.0;
+        // Gain of the incoming track at fade progress t in [0, 1]. The outgoing track gets the mirrored curve.
+        float fade_in_gain(CrossfadeCurve curve, double t) {
+            switch (curve) {
+                case CrossfadeCurve::Linear:
+                    return static_cast<float>(t);
+                case CrossfadeCurve::EqualPower:
+                    return static_cast<float>(std::sin(t * std::numbers::pi / 2.0));
+                case CrossfadeCurve::SCurve:
+                    return static_cast<float>(t * t * (3.0 - 2.0 * t));
+            }
+            return static_cast<float>(t);
+        }
+
+        float fade_out_gain(CrossfadeCurve curve, double t) {
+            if (curve == CrossfadeCurve::EqualPower) {
+                return static_cast<float>(std::cos(t * std::numbers::pi / 2.0));
+            }
+            return 1.0f - fade_in_gain(curve, t);
+        }
+
+    } // namespace
+
+    // [Producer] Starts mixing into the queued track once the current one is within the crossfade length of its
+    // end. Returns false if crossfading is off, it is too early, or the next track isn't prepared yet.
+    bool MusicPlayer::Impl::start_crossfade() {
+        const double fade_secs = crossfade_secs_;
+        const double duration = decoder_->duration();
+        // A preroll that is still being written belongs to the current track and must not be mixed away
+        if (fade_secs <= 0.0 || duration <= 0.0 || !next_queued_ || fade_out_decoder_ || incoming_.frames > 0) {
+            return false;
+        }
+
+        const double sample_rate = stream_format_.sample_rate;
+        const int64_t remaining = static_cast<int64_t>(duration * sample_rate) - track_frames_written_;
+        const int64_t fade_frames = static_cast<int64_t>(fade_secs * sample_rate);
+        if (remaining > fade_frames) {
+            return false;
+        }
+
+        // Never wait here: if the next track is still opening, the end of the track falls back to a splice
+        std::unique_ptr<PreparedTrack> next;
+        {
+            std::lock_guard<std::mutex> lock(next_mutex_);
+            if (!prepared_next_) {
+                return false;
+            }
+            next = std::move(prepared_next_);
+            next_queued_ = false;
+        }
+        if (!next->decoder) {
+            return false;
+        }
+
+        notify_track_change();
+
+        // The incoming track starts where the fade starts
+        track_boundary_.store(ring_buffer_.write_position(), std::memory_order_release);
+        fade_out_decoder_ = std::move(decoder_);
+        decoder_ = std::move(next->decoder);
+        scratch_buffer_.resize(static_cast<size_t>(decoder_->max_read_frames()) * ring_buffer_.channels());
+        pending_track_change_ = next->music;
+        pending_duration_secs_ = decoder_->duration();
+        track_frames_written_ = 0;
+
+        // Each side holds one block plus one resampler step; the incoming side starts with the preroll
+        const uint32_t channels = ring_buffer_.channels();
+        const size_t read_frames = static_cast<size_t>(std::max(fade_out_decoder_->max_read_frames(),
+                                                                 decoder_->max_read_frames()));
+        outgoing_.decoder = fade_out_decoder_.get();
+        outgoing_.samples.assign((FADE_BLOCK_FRAMES + read_frames) * channels, 0.0f);
+        outgoing_.frames = 0;
+        incoming_.decoder = decoder_.get();
+        incoming_.samples = std::move(next->preroll);
+        incoming_.frames = next->preroll_frames;
+        incoming_.samples.resize((std::max(incoming_.frames, FADE_BLOCK_FRAMES) + read_frames) * channels);
+
+        fade_length_ = std::clamp<int64_t>(remaining, 1, std::max<int64_t>(fade_frames, 1));
+        fade_position_ = 0;
+        fade_curve_ = crossfade_curve_;
+
+        logger_->info("Crossfading into {} over {:.2f}s ({} mix kernels)", track_name(next->music),
+                      static_cast<double>(fade_length_) / sample_rate, mix::instruction_set());
+        return true;
     }
 
+    // [Producer] Mixes the next block of a running crossfade straight into the ring.
+    // Returns the number of frames added, or 0 if the ring was full.
+    int MusicPlayer::Impl::crossfade_into_ring() {
+        size_t contiguous = 0;
+        float *region = ring_buffer_.write_region(contiguous);
+        const size_t frames = std::min(
+                {contiguous, fill_room(), FADE_BLOCK_FRAMES, static_cast<size_t>(fade_length_ - fade_position_)});
+        if (frames == 0) {
+            wait_for_room();
+            return 0;
+        }
 
-    // ------------------- Producer-Consumer Core Logic -------------------
+        const uint32_t channels = ring_buffer_.channels();
+        outgoing_.fill(frames, channels);
+        incoming_.fill(frames, channels);
+
+        // Evaluate the curve at both ends of the block and ramp linearly in between
+        const double t0 = static_cast<double>(fade_position_) / static_cast<double>(fade_length_);
+        const double t1 = static_cast<double>(fade_position_ + static_cast<int64_t>(frames)) /
+                          static_cast<double>(fade_length_);
+        const float out0 = fade_out_gain(fade_curve_, t0);
+        const float in0 = fade_in_gain(fade_curve_, t0);
+        const float inv_frames = 1.0f / static_cast<float>(frames);
+        const mix::GainRamp out_ramp{out0, (fade_out_gain(fade_curve_, t1) - out0) * inv_frames};
+        const mix::GainRamp in_ramp{in0, (fade_in_gain(fade_curve_, t1) - in0) * inv_frames};
+        mix::crossfade(region, outgoing_.samples.data(), incoming_.samples.data(), frames, channels, out_ramp, in_ramp);
+        ring_buffer_.commit(frames);
+
+        outgoing_.consume(frames, channels);
+        incoming_.consume(frames, channels);
+        fade_position_ += static_cast<int64_t>(frames);
+        track_frames_written_ += static_cast<int64_t>(frames);
+
+        if (fade_position_ >= fade_length_) {
+            // Whatever is left on the incoming side is written by decode_into_ring() at full gain
+            recycle_decoder(std::move(fade_out_decoder_));
+            outgoing_ = {};
+            logger_->info("Crossfade finished");
+        }
+        return static_cast<int>(frames);
+    }
+
+    // [Producer/Control] Drops any transition in progress, e.g. because a seek makes it meaningless
+    void MusicPlayer::Impl::reset_transition() {
+        recycle_decoder(std::move(fade_out_decoder_));
+        outgoing_ = {};
+        incoming_.frames = 0;
+        fade_position_ = fade_length_ = 0;
+    }
+
+    // [Producer] Publishes the new duration and invokes the callback once the spliced track is audible
+    void MusicPlayer::Impl::notify_track_change() {
+        if (!pending_track_change_ ||
+            boundary_reached_.load(std::memory_order_acquire) != track_boundary_.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        total_duration_secs_ = pending_duration_secs_;
+        Music music = std::move(*pending_track_change_);
+        pending_track_change_.reset();
+
+        logger_->info("Now playing: {}", track_name(music));
+        if (on_track_changed_callback_) {
+            on_track_changed_callback_(music);
+        }
+    }
 
-    // [Producer] Decoder Thread
-    void MusicPlayer::Impl::decoder_loop() {
-        AVPacket *packet = av_packet_alloc();
-        AVFrame *frame = av_frame_alloc();
+    // [Worker] Drops the queued track. A preparation still running is discarded when it finishes.
+    void MusicPlayer::Impl::cancel_next_track() {
+        std::unique_ptr<PreparedTrack> dropped;
+        {
+            std::lock_guard<std::mutex> lock(next_mutex_);
+            prepare_request_.reset();
+            ++prepare_generation_;
+            dropped = std::move(prepared_next_);
+            next_queued_ = false;
+        }
+        if (dropped) {
+            recycle_decoder(std::move(dropped->decoder));
+        }
+    }
 
+    // [Worker] Decodes the current track into the ring. Returns true once it has played to its end, false when a
+    // command has stopped it.
+    bool MusicPlayer::Impl::decoder_loop() {
         while (!stop_requested_) {
+            if (command_pending_ && !take_session_commands()) {
+                end_session();
+                return false;
+            }
+
             // 检查并处理 seek 请求
             double seek_pos = seek_request_secs_.exchange(-1.0);
             if (seek_pos >= 0.0) {
                 logger_->info("Seek command received, processing...");
-                // 计算FFmpeg时间戳
-                int64_t target_timestamp =
-                        av_rescale_q(static_cast<int64_t>(seek_pos * AV_TIME_BASE), {1, AV_TIME_BASE},
-                                     format_ctx_->streams[audio_stream_index_]->time_base);
-
-                // 执行 seek
-                if (av_seek_frame(format_ctx_, audio_stream_index_, target_timestamp, AVSEEK_FLAG_BACKWARD) < 0) {
-                    logger_->error("Failed to seek to position {}", seek_pos);
-                } else {
-                    // 清空解码器缓冲区
-                    avcodec_flush_buffers(codec_ctx_);
-
-                    // 清空我们的队列
-                    {
-                        std::lock_guard<std::mutex> lock(queue_mutex_);
-                        std::queue<std::shared_ptr<AudioFrame>> empty_queue;
-                        frame_queue_.swap(empty_queue);
-                    }
-
-                    // 更新播放样本计数器
-                    total_samples_played_ = static_cast<int64_t>(seek_pos * device_config_.sampleRate);
+                // Seeking lands in the current track, which is the incoming one during a transition
+                reset_transition();
+                end_of_stream_ = false;
+                const bool landed = decoder_->seek(seek_pos, seek_mode_ == SeekMode::Accurate);
+                if (landed) {
+                    // 让回调丢弃旧数据, 并在丢弃时更新播放样本计数器
+                    seek_target_samples_ = static_cast<int64_t>(seek_pos * stream_format_.sample_rate);
+                    track_frames_written_ = seek_target_samples_;
+                    ring_buffer_.request_flush();
 
                     logger_->info("Seek completed. Resuming decoding.");
                 }
+                finish_seek(landed);
             }
 
 
@@ -302,187 +1219,197 @@ namespace MusicEngine {
             {
                 std::unique_lock<std::mutex> lock(control_mutex_);
                 control_cond_var_.wait(lock, [this] {
-                    return state_ != PlayerState::Paused || stop_requested_ || seek_request_secs_ >= 0.0;
+                    return state_ != PlayerState::Paused || stop_requested_ || seek_request_secs_ >= 0.0 ||
+                           command_pending_;
                 });
             }
             if (stop_requested_)
                 break;
 
-            // Queue back-pressure control
-            {
-                std::unique_lock<std::mutex> lock(queue_mutex_);
-                queue_cond_var_.wait(lock, [this] {
-                    return frame_queue_.size() < MAX_QUEUE_SIZE || stop_requested_ || seek_request_secs_ >= 0.0;
-                });
-            }
-            if (stop_requested_)
-                break;
+            // 如果有新的 seek 请求或命令，回到循环顶部处理
+            if (seek_request_secs_ >= 0.0 || command_pending_)
+                continue;
+
+            notify_track_change();
+            adapt_buffering();
 
-            // 如果有新的 seek 请求，回到循环顶部处理
-            if (seek_request_secs_ >= 0.0)
+            // Crossfade: mix both tracks until the fade is over
+            if (fade_out_decoder_ || start_crossfade()) {
+                crossfade_into_ring();
                 continue;
+            }
 
-            // Read and decode frames
-            if (av_read_frame(format_ctx_, packet) >= 0) {
-                if (packet->stream_index == audio_stream_index_) {
-                    if (avcodec_send_packet(codec_ctx_, packet) == 0) {
-                        while (avcodec_receive_frame(codec_ctx_, frame) == 0) {
-                            auto audio_frame = std::make_shared<AudioFrame>();
-
-                            // Resample
-                            uint8_t **dst_data = nullptr;
-                            int dst_linesize;
-                            int dst_nb_samples =
-                                    av_rescale_rnd(swr_get_delay(swr_ctx_, codec_ctx_->sample_rate) + frame->nb_samples,
-                                                   codec_ctx_->sample_rate, codec_ctx_->sample_rate, AV_ROUND_UP);
-                            av_samples_alloc_array_and_samples(&dst_data, &dst_linesize,
-                                                               device_config_.playback.channels, dst_nb_samples,
-                                                               AV_SAMPLE_FMT_FLT, 0);
-
-                            int actual_dst_nb_samples = swr_convert(swr_ctx_, dst_data, dst_nb_samples,
-                                                                    (const uint8_t **) frame->data, frame->nb_samples);
-
-                            int data_size = actual_dst_nb_samples * device_config_.playback.channels *
-                                            av_get_bytes_per_sample(AV_SAMPLE_FMT_FLT);
-                            audio_frame->data.resize(data_size);
-                            memcpy(audio_frame->data.data(), dst_data[0], data_size);
-
-                            av_freep(&dst_data[0]);
-                            av_freep(&dst_data);
-
-                            // Push to queue
-                            {
-                                std::lock_guard<std::mutex> lock(queue_mutex_);
-                                frame_queue_.push(audio_frame);
-                            }
-                            queue_cond_var_.notify_one();
-                        }
-                    }
+            // Read, decode and convert into the ring buffer
+            if (decode_into_ring() < 0) {
+                // Gapless: the queued track continues in the same stream
+                if (splice_next_track()) {
+                    end_of_stream_ = false;
+                    continue;
                 }
-                av_packet_unref(packet);
-            } else {
-                // End of file
-                stop_requested_ = true;
-                logger_->info("Finished decoding file");
+                end_of_stream_ = true;
 
-                // 添加音乐播放完成的回调
-                state_ = PlayerState::Stopped;
-                // 调用回调通知上层应用
-                if (on_playback_finished_callback_) {
-                    logger_->info("Invoking on_playback_finished callback.");
-                    on_playback_finished_callback_();
+                // End of file: let the callback play out what is still buffered.
+                // A seek or a command during the drain sends us back to the top of the loop.
+                if (!wait_for_drain()) {
+                    continue;
                 }
-                break;
+                return true;
             }
         }
-
-        av_packet_free(&packet);
-        av_frame_free(&frame);
-        logger_->info("Decoder thread exited");
+        return false;
     }
 
     // [Consumer] Audio Callback Processing
-    void MusicPlayer::Impl::process_playback_frames(void *p_output, ma_uint32 frame_count) {
-        uint8_t *p_output_u8 = static_cast<uint8_t *>(p_output);
-        ma_uint32 frames_to_write = frame_count;
-        ma_uint32 total_frames_written = 0;
-        int bytes_per_frame = ma_get_bytes_per_frame(device_config_.playback.format, device_config_.playback.channels);
-
-        while (frames_to_write > 0) {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-
-            // Wait for data in the queue, with a short timeout to prevent deadlocks if the decoder stalls
-            if (queue_cond_var_.wait_for(lock, std::chrono::milliseconds(10),
-                                         [this] { return !frame_queue_.empty() || stop_requested_; })) {
-                if (stop_requested_) {
-                    break;
-                }
-
-                auto &audio_frame = frame_queue_.front();
-                size_t bytes_available = audio_frame->data.size() - audio_frame->consumed_bytes;
-                size_t bytes_to_copy = std::min((size_t) frames_to_write * bytes_per_frame, bytes_available);
-
-                memcpy(p_output_u8 + (total_frames_written * bytes_per_frame),
-                       audio_frame->data.data() + audio_frame->consumed_bytes, bytes_to_copy);
-
-                audio_frame->consumed_bytes += bytes_to_copy;
-                ma_uint32 frames_copied = bytes_to_copy / bytes_per_frame;
-                frames_to_write -= frames_copied;
-                total_frames_written += frames_copied;
-
-                if (audio_frame->consumed_bytes >= audio_frame->data.size()) {
-                    frame_queue_.pop();
-                    queue_cond_var_.notify_one();
-                }
-
+    // Called by the OutputMixer on miniaudio's real-time thread: no locks, no allocation, no waiting.
+    // Returns false if the block is all silence, so the mixer knows this voice isn't audible (for ducking).
+    bool MusicPlayer::Impl::process_playback_frames(float *p_output_f32, uint32_t frame_count) {
+        const uint32_t channels = static_cast<uint32_t>(stream_format_.channels);
+
+        // Instant seek requested by the control thread
+        if (const int64_t jump = jump_request_.exchange(-1, std::memory_order_acq_rel); jump >= 0) {
+            if (apply_jump(jump)) {
+                seek_landed_ = true;
             } else {
-                // Timeout, queue is empty, fill with silence
-                break;
+                // No longer buffered: let the decoder thread seek instead. It may be asleep in wait_for_room()
+                // for up to the profile's decoder wait, so wake it. Releasing the semaphore is an atomic add plus a
+                // futex wake; it never blocks, which keeps it safe on this thread
+                seek_request_secs_ = static_cast<double>(jump) / stream_format_.sample_rate;
+                wake_decoder();
             }
         }
 
-        // If there wasn't enough data, fill the rest with silence
+        uint32_t total_frames_written = 0;
+        bool flushed = false;
+        if (!stop_requested_) {
+            total_frames_written =
+                    static_cast<uint32_t>(ring_buffer_.read(p_output_f32, frame_count, flushed));
+        }
+
+        // Crossing into a track spliced by queue_next(): restart counting at its first sample
+        const uint64_t boundary = track_boundary_.load(std::memory_order_acquire);
+        const bool crossed = boundary != boundary_reached_.load(std::memory_order_relaxed) &&
+                             ring_buffer_.read_position() >= boundary;
+        if (crossed) {
+            boundary_reached_.store(boundary, std::memory_order_release);
+        }
+
+        // If there wasn't enough data, fill the rest with silence. Running dry mid-track is an underrun,
+        // which makes the decoder buffer further ahead.
         if (total_frames_written < frame_count) {
-            ma_uint32 frames_to_silence = frame_count - total_frames_written;
-            memset(p_output_u8 + (total_frames_written * bytes_per_frame), 0, frames_to_silence * bytes_per_frame);
+            uint32_t frames_to_silence = frame_count - total_frames_written;
+            if (!stop_requested_ && !end_of_stream_.load(std::memory_order_relaxed)) {
+                underruns_.fetch_add(1, std::memory_order_relaxed);
+                telemetry_->underruns.fetch_add(1, std::memory_order_relaxed);
+                telemetry_->underrun_frames.fetch_add(frames_to_silence, std::memory_order_relaxed);
+            }
+            std::memset(p_output_f32 + total_frames_written * channels, 0, frames_to_silence * channels * sizeof(float));
         }
 
-        // 累加实际写入的帧数到总播放样本数
-        total_samples_played_ += total_frames_written;
+        // Preamp, EQ and limiter; also runs over the silence so the limiter's look-ahead drains
+        dsp_chain_.process(p_output_f32, frame_count);
+        analysis_tap_->push(p_output_f32, frame_count);
+
+        if (flushed) {
+            // The old data up to the seek point has been dropped; continue counting from the seek target
+            const uint64_t flush_position = ring_buffer_.read_position() - total_frames_written;
+            total_samples_played_ = seek_target_samples_.load() + total_frames_written;
+            ring_origin_.store(static_cast<int64_t>(flush_position) - seek_target_samples_.load(),
+                               std::memory_order_relaxed);
+            window_start_.store(flush_position, std::memory_order_relaxed);
+        } else if (crossed) {
+            total_samples_played_ = static_cast<int64_t>(ring_buffer_.read_position() - boundary);
+            ring_origin_.store(static_cast<int64_t>(boundary), std::memory_order_relaxed);
+            window_start_.store(boundary, std::memory_order_relaxed);
+        } else {
+            // 累加实际写入的帧数到总播放样本数
+            total_samples_played_ += total_frames_written;
+        }
 
+        seek_landed_ = seek_landed_ || flushed;
+        if (total_frames_written > 0) {
+            if (first_audio_start_ns_.load(std::memory_order_relaxed) != 0) {
+                if (const int64_t start = first_audio_start_ns_.exchange(0, std::memory_order_relaxed); start != 0) {
+                    telemetry_->time_to_first_audio.record_since(start);
+                }
+            }
+            if (seek_landed_) {
+                seek_landed_ = false;
+                if (const int64_t start = seek_start_ns_.exchange(0, std::memory_order_relaxed); start != 0) {
+                    telemetry_->seek_latency.record_since(start);
+                }
+            }
+        }
+        return total_frames_written > 0;
+    }
 
-        // If there wasn`t enough data, fill the rest with silence
-        if (total_frames_written < frame_count) {
-            // 静音填充
+    // [Consumer] Timing of the whole callback, however many render() calls the mixer splits it into
+    void MusicPlayer::Impl::begin_block(uint32_t frames) {
+        callback_start_ns_ = TimingHistogram::now_ns();
+
+        // Time since the previous callback against that callback's length. Longer gaps (paused, detached, other
+        // players only) aren't jitter and are left out.
+        if (last_callback_frames_ > 0 && stream_format_.sample_rate > 0) {
+            const int64_t period = static_cast<int64_t>(last_callback_frames_) * 1'000'000'000 /
+                                   stream_format_.sample_rate;
+            const int64_t interval = callback_start_ns_ - last_callback_ns_;
+            if (interval < 4 * period) {
+                telemetry_->callback_jitter.record(std::abs(interval - period));
+            }
         }
+        last_callback_ns_ = callback_start_ns_;
+        last_callback_frames_ = frames;
     }
 
     double MusicPlayer::get_duration() const { return pimpl_->total_duration_secs_; }
 
     double MusicPlayer::get_current_position() const {
-        if (pimpl_->audio_device_.sampleRate > 0) {
-            return (double) pimpl_->total_samples_played_ / pimpl_->audio_device_.sampleRate;
+        if (const int sample_rate = pimpl_->stream_sample_rate_; sample_rate > 0) {
+            return (double) pimpl_->total_samples_played_ / sample_rate;
         }
         return 0.0;
     }
 
-    std::optional<double> MusicPlayer::seek(double position_secs) {
-        if (pimpl_->state_ == PlayerState::Stopped) {
+    std::future<bool> MusicPlayer::seek(double position_secs) {
+        // A track that is still being opened counts as playing
+        const bool opening = pimpl_->pending_plays_ > 0;
+        if (pimpl_->state_ == PlayerState::Stopped && !opening) {
             pimpl_->logger_->warn("Seek request ignored: player is stopped.");
-            return std::nullopt; // 请求被忽略
+            return Impl::rejected(); // 请求被忽略
         }
 
         // 注意：这里我们放宽了对 position_secs 的检查，因为 seek_percent 依赖它
         // 具体的钳位应该由业务逻辑决定，或者在这里也加上
         if (position_secs < 0)
             position_secs = 0.0;
-        if (position_secs > pimpl_->total_duration_secs_)
-            position_secs = pimpl_->total_duration_secs_;
-
-
-        pimpl_->logger_->info("Requesting seek to {} seconds", position_secs);
-        pimpl_->seek_request_secs_ = position_secs;
+        const double duration = pimpl_->total_duration_secs_;
+        if (!opening && position_secs > duration)
+            position_secs = duration;
 
-        // 唤醒解码线程
-        pimpl_->control_cond_var_.notify_one();
-        pimpl_->queue_cond_var_.notify_one();
-
-        return position_secs; // 返回实际请求的秒数
+        // Runs on the decoder thread, which also checks the duration of a track that is still opening
+        pimpl_->seek_start_ns_ = TimingHistogram::now_ns();
+        return pimpl_->post(Impl::Command::Type::Seek, nullptr, position_secs);
     }
 
     int MusicPlayer::get_current_position_percent() const {
-        if (pimpl_->total_duration_secs_ <= 0) {
+        const double duration = pimpl_->total_duration_secs_;
+        if (duration <= 0) {
             return 0;
         }
         double current_position = get_current_position();
-        double percentage = (current_position / pimpl_->total_duration_secs_) * 100.0;
+        double percentage = (current_position / duration) * 100.0;
         return static_cast<int>(std::round(percentage)); // 四舍五入取整
     }
 
-    std::optional<int> MusicPlayer::seek_percent(int percentage) {
+    std::future<bool> MusicPlayer::seek_percent(int percentage) {
         if (pimpl_->state_ == PlayerState::Stopped) {
             pimpl_->logger_->warn("Seek percentage request ignored: player is stopped.");
-            return std::nullopt; // 请求被忽略
+            return Impl::rejected(); // 请求被忽略
+        }
+        // A track that is still opening has no duration yet; a percentage of it would seek to the start
+        const double duration = pimpl_->total_duration_secs_;
+        if (duration <= 0.0) {
+            pimpl_->logger_->warn("Seek percentage request ignored: the track's duration isn't known yet.");
+            return Impl::rejected();
         }
 
         int clamped_percentage = std::max(0, std::min(100, percentage));
@@ -490,17 +1417,197 @@ namespace MusicEngine {
             pimpl_->logger_->warn("Seek percentage {} is out of range. Clamped to {}.", percentage, clamped_percentage);
         }
 
-        double target_secs = pimpl_->total_duration_secs_ * (static_cast<double>(clamped_percentage) / 100.0);
+        double target_secs = duration * (static_cast<double>(clamped_percentage) / 100.0);
 
         // 复用已有的 seek(double) 函数
-        seek(target_secs);
-
-        return clamped_percentage; // 返回钳位后的百分比
+        return seek(target_secs);
     }
 
     // 实现 set 函数
+    // The decoder thread may be invoking the old callback, so it swaps them itself
     void MusicPlayer::set_on_playback_finished_callback(const std::function<void()> &callback) {
-        pimpl_->on_playback_finished_callback_ = callback;
+        Impl::Command command;
+        command.type = Impl::Command::Type::SetFinishedCallback;
+        command.on_finished = callback;
+        pimpl_->post(std::move(command));
+    }
+
+    void MusicPlayer::set_seek_mode(SeekMode mode) { pimpl_->seek_mode_ = mode; }
+
+    void MusicPlayer::set_latency_profile(LatencyProfile profile) { pimpl_->latency_profile_ = profile; }
+
+    void MusicPlayer::set_buffer_window(double back_secs, double ahead_secs) {
+        pimpl_->window_back_secs_ = std::max(0.0, back_secs);
+        pimpl_->window_ahead_secs_ = std::max(0.0, ahead_secs);
+    }
+
+    // [Worker] Seeks the current track, through the buffer if the target is still in it, otherwise by the decoder.
+    // @p done is answered once playback continues from the target, or with false if the seek fails or is replaced.
+    void MusicPlayer::Impl::apply_seek(double position_secs, std::promise<bool> done) {
+        const double duration = total_duration_secs_;
+        if (duration > 0.0) {
+            position_secs = std::min(position_secs, duration);
+        }
+
+        // Inside the buffered window the callback only has to move its read position; FFmpeg isn't involved
+        if (request_instant_seek(position_secs)) {
+            // Should the play head have moved past it meanwhile, the callback hands it back as a decoder seek
+            logger_->debug("Seek to {} seconds served from the buffer", position_secs);
+            finish_seek(false); // A decoder seek still pending is replaced
+            done.set_value(true);
+            return;
+        }
+
+        logger_->info("Requesting seek to {} seconds", position_secs);
+        jump_request_ = -1; // Superseded
+        finish_seek(false);
+        seek_done_ = std::move(done);
+        seek_request_secs_ = position_secs;
+    }
+
+    // [Worker] Answers the seek() waiting for a decoder seek, if any
+    void MusicPlayer::Impl::finish_seek(bool landed) {
+        if (seek_done_) {
+            seek_done_->set_value(landed);
+            seek_done_.reset();
+        }
+    }
+
+    // [Worker] Hands a seek to the callback if the target is (very likely) still in the ring
+    bool MusicPlayer::Impl::request_instant_seek(double position_secs) {
+        if (seek_request_secs_ >= 0.0) {
+            return false; // A decoder seek is pending; the ring is about to be flushed
+        }
+        const int64_t target = static_cast<int64_t>(position_secs * stream_format_.sample_rate);
+        if (state_ == PlayerState::Paused) {
+            // The callback doesn't run while the device is stopped, so the jump can be applied right here
+            return apply_jump(target);
+        }
+
+        // Quick check against the current window. The callback re-validates when it applies the jump and falls
+        // back to a decoder seek if the play head has moved on in the meantime.
+        const int64_t ring_target = ring_origin_ + target;
+        const int64_t history = static_cast<int64_t>(ring_buffer_.capacity() - ring_buffer_.ahead_limit());
+        const int64_t oldest = std::max(static_cast<int64_t>(window_start_.load()),
+                                        static_cast<int64_t>(ring_buffer_.read_position()) - history);
+        if (ring_target < oldest || ring_target >= static_cast<int64_t>(ring_buffer_.write_position())) {
+            return false;
+        }
+        jump_request_.store(target, std::memory_order_release);
+        return true;
+    }
+
+    // [Consumer] Moves playback to a position of the current track that is still in the ring
+    bool MusicPlayer::Impl::apply_jump(int64_t target_samples) {
+        const int64_t target = ring_origin_.load(std::memory_order_relaxed) + target_samples;
+        if (target < static_cast<int64_t>(window_start_.load(std::memory_order_relaxed))) {
+            return false;
+        }
+        // Frames past a boundary the callback hasn't reached yet belong to the next track
+        const uint64_t boundary = track_boundary_.load(std::memory_order_acquire);
+        const uint64_t limit = boundary > ring_buffer_.read_position() ? boundary : UINT64_MAX;
+        if (!ring_buffer_.seek_read(static_cast<uint64_t>(target), limit)) {
+            return false;
+        }
+        total_samples_played_ = target_samples;
+        return true;
+    }
+
+    void MusicPlayer::set_crossfade(double duration_secs, CrossfadeCurve curve) {
+        pimpl_->crossfade_secs_ = std::max(0.0, duration_secs);
+        pimpl_->crossfade_curve_ = curve;
+    }
+
+    void MusicPlayer::set_replay_gain(ReplayGainMode mode, double preamp_db) {
+        pimpl_->replay_gain_preamp_db_ = preamp_db;
+        pimpl_->replay_gain_mode_ = mode;
+    }
+
+    void MusicPlayer::set_prefetch_size(size_t bytes) { pimpl_->prefetch_bytes_ = bytes; }
+
+    void MusicPlayer::set_decoder_threads(int threads) { pimpl_->decoder_threads_ = std::max(0, threads); }
+
+    void MusicPlayer::set_parallel_decoding(int workers, double min_duration_secs) {
+        pimpl_->segment_min_duration_secs_ = std::max(0.0, min_duration_secs);
+        pimpl_->segment_workers_ = std::max(0, workers);
+    }
+
+    void MusicPlayer::set_intro_cache(size_t budget_bytes, double intro_secs, bool compact) {
+        IntroCache::get_instance().configure(budget_bytes, intro_secs, compact);
+    }
+
+    void MusicPlayer::preload_intro(const MusicEngine::Music &music) {
+        IntroCache::get_instance().request(music);
+    }
+
+    void MusicPlayer::set_volume(double gain) { pimpl_->volume = static_cast<float>(std::max(0.0, gain)); }
+
+    void MusicPlayer::set_ducking(bool ducks_others, double depth_db) {
+        pimpl_->duck_gain = static_cast<float>(std::pow(10.0, std::min(depth_db, 0.0) / 20.0));
+        pimpl_->ducks_others = ducks_others;
+    }
+
+    void MusicPlayer::set_dsp_enabled(bool enabled) {
+        pimpl_->update_dsp([enabled](DspChain::Params &params) { params.enabled = enabled; });
+    }
+
+    void MusicPlayer::set_preamp(double gain_db) {
+        pimpl_->update_dsp([gain_db](DspChain::Params &params) { params.preamp_db = static_cast<float>(gain_db); });
+    }
+
+    void MusicPlayer::set_eq_bands(std::span<const EqBand> bands) {
+        if (bands.size() > DspChain::MAX_EQ_BANDS) {
+            pimpl_->logger_->warn("Only the first {} of {} EQ bands are used", DspChain::MAX_EQ_BANDS, bands.size());
+        }
+        pimpl_->update_dsp([bands](DspChain::Params &params) {
+            params.band_count = std::min(bands.size(), DspChain::MAX_EQ_BANDS);
+            std::copy_n(bands.begin(), params.band_count, params.bands.begin());
+        });
+    }
+
+    void MusicPlayer::set_limiter(bool enabled, double threshold_db, double release_ms) {
+        pimpl_->update_dsp([=](DspChain::Params &params) {
+            params.limiter_enabled = enabled;
+            params.limiter_threshold_db = static_cast<float>(std::min(threshold_db, 0.0));
+            params.limiter_release_ms = static_cast<float>(release_ms);
+        });
+    }
+
+    DspStats MusicPlayer::get_dsp_stats() const { return pimpl_->dsp_chain_.stats(); }
+
+    PlaybackStats MusicPlayer::get_playback_stats() const {
+        const int sample_rate = pimpl_->stream_sample_rate_;
+        PlaybackStats stats = pimpl_->telemetry_->snapshot(sample_rate);
+        if (sample_rate > 0 && pimpl_->state_ != PlayerState::Stopped) {
+            stats.buffered_secs = static_cast<double>(pimpl_->ring_buffer_.buffered_frames()) / sample_rate;
+        }
+        return stats;
+    }
+
+    std::string MusicPlayer::export_playback_stats(StatsFormat format, std::string_view player_label) const {
+        const PlaybackStats stats = get_playback_stats();
+        return format == StatsFormat::Json ? format_json(stats, player_label) : format_prometheus(stats, player_label);
+    }
+
+    void MusicPlayer::reset_playback_stats() { pimpl_->telemetry_->reset(); }
+
+    void MusicPlayer::set_analysis_enabled(bool enabled, const AnalysisSettings &settings) {
+        pimpl_->analysis_tap_->set_enabled(enabled, settings);
+    }
+
+    std::shared_ptr<const AudioAnalysis> MusicPlayer::get_latest_analysis() const {
+        return pimpl_->analysis_tap_->latest();
+    }
+
+    void MusicPlayer::set_on_analysis_callback(const std::function<void(const AudioAnalysis &)> &callback) {
+        pimpl_->analysis_tap_->set_callback(callback);
+    }
+
+    void MusicPlayer::set_on_track_changed_callback(const std::function<void(const MusicEngine::Music &)> &callback) {
+        Impl::Command command;
+        command.type = Impl::Command::Type::SetTrackChangedCallback;
+        command.on_track_changed = callback;
+        pimpl_->post(std::move(command));
     }
 
 } // namespace MusicEngine
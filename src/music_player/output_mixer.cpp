@@ -0,0 +1,297 @@
+#include "output_mixer.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "mix_kernels.hpp"
+#include "rt_safety.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/spdlog.h"
+
+#include "miniaudio.h"
+
+namespace MusicEngine {
+
+    namespace {
+
+        // Voices after the first are rendered into a scratch buffer of this many frames and summed in
+        constexpr uint32_t SCRATCH_FRAMES = 1024;
+        // Time constants of the ducking gain when a ducking voice becomes audible and when it falls silent
+        constexpr double DUCK_ATTACK_MS = 50.0;
+        constexpr double DUCK_RELEASE_MS = 400.0;
+
+        struct DeviceSettings {
+            ma_uint32 period_ms; // Device period; the output latency is roughly period_ms * periods
+            ma_uint32 periods;
+            ma_performance_profile performance;
+        };
+
+        constexpr DeviceSettings device_settings(LatencyProfile profile) {
+            switch (profile) {
+                case LatencyProfile::LowLatency:
+                    return {5, 2, ma_performance_profile_low_latency};
+                case LatencyProfile::PowerSaving:
+                    return {100, 3, ma_performance_profile_conservative};
+                case LatencyProfile::Balanced:
+                    break;
+            }
+            return {10, 3, ma_performance_profile_low_latency};
+        }
+
+    } // namespace
+
+    struct OutputMixer::Impl {
+        std::mutex mutex_; // Serializes open(), attach() and detach()
+        ma_device device_;
+        bool device_initialized_ = false;
+        bool device_started_ = false;
+        // Only set up for the null backend; otherwise miniaudio picks the system's backend itself
+        ma_context null_context_;
+        bool null_context_initialized_ = false;
+        std::atomic<bool> null_backend_{false};
+        // What the open device was asked for; a player asking for the same gets it without a reopen
+        int requested_sample_rate_ = 0;
+        int requested_channels_ = 0;
+        LatencyProfile requested_profile_ = LatencyProfile::Balanced;
+        bool requested_null_ = false;
+        Format format_;
+
+        // Slots are written under mutex_ and read by the audio thread
+        std::array<std::atomic<Voice *>, MAX_VOICES> voices_{};
+        size_t voice_count_ = 0;
+        // Incremented when the callback starts and when it ends, so it is odd while voices are being rendered.
+        // detach() stores a slot, then loads the epoch; mix() bumps the epoch, then loads the slots. Only seq_cst
+        // on both sides guarantees that one of them sees the other's write, so keep every access seq_cst.
+        std::atomic<uint64_t> render_epoch_{0};
+
+        // Audio thread only
+        std::vector<float> scratch_;
+        float duck_level_ = 1.0f;
+
+        std::shared_ptr<spdlog::logger> logger_;
+
+        Impl() {
+            logger_ = spdlog::stdout_color_mt("OutputMixer");
+            logger_->set_level(spdlog::level::info);
+        }
+
+        void close_device() {
+            if (device_initialized_) {
+                ma_device_uninit(&device_);
+                device_initialized_ = false;
+                device_started_ = false;
+            }
+            if (null_context_initialized_) {
+                ma_context_uninit(&null_context_);
+                null_context_initialized_ = false;
+            }
+        }
+
+        void mix(float *output, uint32_t frame_count);
+
+        static void audio_callback_wrapper(ma_device *p_device, void *p_output, const void *p_input,
+                                           ma_uint32 frame_count) {
+            MUSICENGINE_REALTIME_SCOPE("OutputMixer audio callback");
+            Impl *p_impl = static_cast<Impl *>(p_device->pUserData);
+            if (p_impl) {
+                p_impl->mix(static_cast<float *>(p_output), frame_count);
+            }
+        }
+    };
+
+    OutputMixer &OutputMixer::get_instance() {
+        static OutputMixer instance;
+        return instance;
+    }
+
+    OutputMixer::OutputMixer() : pimpl_(std::make_unique<Impl>()) {}
+
+    OutputMixer::~OutputMixer() { pimpl_->close_device(); }
+
+    std::optional<OutputMixer::Format> OutputMixer::current_format() const {
+        std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+        if (!pimpl_->device_initialized_) {
+            return std::nullopt;
+        }
+        return pimpl_->format_;
+    }
+
+    std::optional<OutputMixer::Format> OutputMixer::open(int sample_rate, int channels, LatencyProfile profile) {
+        std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+        const bool null_backend = pimpl_->null_backend_;
+        if (pimpl_->device_initialized_) {
+            if (pimpl_->requested_sample_rate_ == sample_rate && pimpl_->requested_channels_ == channels &&
+                pimpl_->requested_profile_ == profile && pimpl_->requested_null_ == null_backend) {
+                return pimpl_->format_;
+            }
+            if (pimpl_->voice_count_ > 0) {
+                pimpl_->logger_->info("Output device is in use, keeping {} Hz, {} channels",
+                                      pimpl_->format_.sample_rate, pimpl_->format_.channels);
+                return pimpl_->format_;
+            }
+            pimpl_->logger_->info("Output settings changed, reopening audio device");
+            pimpl_->close_device();
+        }
+
+        ma_device_config config = ma_device_config_init(ma_device_type_playback);
+        config.playback.format = ma_format_f32;
+        config.playback.channels = static_cast<ma_uint32>(channels);
+        config.sampleRate = static_cast<ma_uint32>(sample_rate);
+        config.dataCallback = Impl::audio_callback_wrapper;
+        config.pUserData = pimpl_.get();
+        const DeviceSettings settings = device_settings(profile);
+        config.periodSizeInMilliseconds = settings.period_ms;
+        config.periods = settings.periods;
+        config.performanceProfile = settings.performance;
+
+        if (null_backend) {
+            const ma_backend backends[] = {ma_backend_null};
+            if (ma_context_init(backends, 1, NULL, &pimpl_->null_context_) != MA_SUCCESS) {
+                pimpl_->logger_->error("Failed to initialize the null audio backend");
+                return std::nullopt;
+            }
+            pimpl_->null_context_initialized_ = true;
+        }
+        if (ma_device_init(null_backend ? &pimpl_->null_context_ : NULL, &config, &pimpl_->device_) != MA_SUCCESS) {
+            pimpl_->logger_->error("Failed to initialize audio device");
+            pimpl_->close_device();
+            return std::nullopt;
+        }
+        pimpl_->device_initialized_ = true;
+        pimpl_->requested_sample_rate_ = sample_rate;
+        pimpl_->requested_channels_ = channels;
+        pimpl_->requested_profile_ = profile;
+        pimpl_->requested_null_ = null_backend;
+        pimpl_->format_ = {static_cast<int>(pimpl_->device_.sampleRate),
+                           static_cast<int>(pimpl_->device_.playback.channels)};
+        pimpl_->scratch_.assign(static_cast<size_t>(SCRATCH_FRAMES) * pimpl_->device_.playback.channels, 0.0f);
+        pimpl_->logger_->info("Audio device opened: {} Hz, {} channels, {} x {} frame periods",
+                              pimpl_->device_.sampleRate, pimpl_->device_.playback.channels,
+                              pimpl_->device_.playback.internalPeriods,
+                              pimpl_->device_.playback.internalPeriodSizeInFrames);
+        return pimpl_->format_;
+    }
+
+    void OutputMixer::set_null_backend(bool enabled) { pimpl_->null_backend_ = enabled; }
+
+    bool OutputMixer::attach(Voice *voice, const Format &format) {
+        std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+        if (!pimpl_->device_initialized_ || pimpl_->format_ != format) {
+            pimpl_->logger_->error("Output device was reopened with another format");
+            return false;
+        }
+        auto free_slot = std::find_if(pimpl_->voices_.begin(), pimpl_->voices_.end(),
+                                      [](const std::atomic<Voice *> &slot) { return slot.load() == nullptr; });
+        if (free_slot == pimpl_->voices_.end()) {
+            pimpl_->logger_->error("Too many players are playing at once (at most {})", MAX_VOICES);
+            return false;
+        }
+
+        // Written before the slot is published, so the audio thread sees them with the pointer
+        voice->applied_gain_ = voice->volume.load();
+        voice->audible_ = false;
+        free_slot->store(voice);
+        ++pimpl_->voice_count_;
+
+        if (!pimpl_->device_started_) {
+            if (ma_device_start(&pimpl_->device_) != MA_SUCCESS) {
+                pimpl_->logger_->error("Failed to start audio device");
+                free_slot->store(nullptr);
+                --pimpl_->voice_count_;
+                return false;
+            }
+            pimpl_->device_started_ = true;
+        }
+        return true;
+    }
+
+    void OutputMixer::detach(Voice *voice) {
+        std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+        auto slot = std::find_if(pimpl_->voices_.begin(), pimpl_->voices_.end(),
+                                 [voice](const std::atomic<Voice *> &entry) { return entry.load() == voice; });
+        if (slot == pimpl_->voices_.end()) {
+            return;
+        }
+        slot->store(nullptr);
+        --pimpl_->voice_count_;
+
+        if (pimpl_->voice_count_ == 0) {
+            // ma_device_stop guarantees the callback is no longer running when it returns
+            if (ma_device_stop(&pimpl_->device_) != MA_SUCCESS) {
+                pimpl_->logger_->warn("Failed to stop audio device.");
+            }
+            pimpl_->device_started_ = false;
+            return;
+        }
+
+        // A callback that started before the slot was cleared may still be rendering the voice: wait for it to
+        // end. One that starts later can't see the voice any more.
+        const uint64_t epoch = pimpl_->render_epoch_.load();
+        if (epoch & 1) {
+            while (pimpl_->render_epoch_.load() == epoch) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // [Audio Thread] Renders every attached voice and sums them into the device buffer.
+    // The first voice renders straight into the output; the others go through the scratch buffer.
+    void OutputMixer::Impl::mix(float *output, uint32_t frame_count) {
+        render_epoch_.fetch_add(1);
+        const uint32_t channels = device_.playback.channels;
+
+        // Ducking follows whether a ducking voice was audible in the previous block, smoothed per block
+        float duck_target = 1.0f;
+        for (auto &slot: voices_) {
+            const Voice *voice = slot.load();
+            if (voice && voice->audible_ && voice->ducks_others.load(std::memory_order_relaxed)) {
+                duck_target = std::min(duck_target, voice->duck_gain.load(std::memory_order_relaxed));
+            }
+        }
+        const double time_constant_ms = duck_target < duck_level_ ? DUCK_ATTACK_MS : DUCK_RELEASE_MS;
+        const double block_ms = 1000.0 * frame_count / std::max<ma_uint32>(device_.sampleRate, 1);
+        duck_level_ += (duck_target - duck_level_) * static_cast<float>(1.0 - std::exp(-block_ms / time_constant_ms));
+
+        bool first = true;
+        for (auto &slot: voices_) {
+            Voice *voice = slot.load();
+            if (!voice) {
+                continue;
+            }
+            voice->begin_block(frame_count);
+            // Each voice glides from last block's gain to this block's over the whole block
+            const float start = voice->applied_gain_;
+            const float target = voice->volume.load(std::memory_order_relaxed) *
+                                 (voice->ducks_others.load(std::memory_order_relaxed) ? 1.0f : duck_level_);
+            const float step = (target - start) / static_cast<float>(frame_count);
+
+            bool audible = false;
+            if (first) {
+                audible = voice->render(output, frame_count);
+                if (start != 1.0f || target != 1.0f) {
+                    mix::apply_gain(output, frame_count, channels, {start, step});
+                }
+                first = false;
+            } else {
+                for (uint32_t offset = 0; offset < frame_count; offset += SCRATCH_FRAMES) {
+                    const uint32_t frames = std::min(frame_count - offset, SCRATCH_FRAMES);
+                    audible |= voice->render(scratch_.data(), frames);
+                    mix::mix_into(output + static_cast<size_t>(offset) * channels, scratch_.data(), frames, channels,
+                                  {start + step * static_cast<float>(offset), step});
+                }
+            }
+            voice->applied_gain_ = target;
+            voice->audible_ = audible;
+            voice->end_block();
+        }
+
+        if (first) {
+            std::memset(output, 0, static_cast<size_t>(frame_count) * channels * sizeof(float));
+        }
+        render_epoch_.fetch_add(1);
+    }
+
+} // namespace MusicEngine
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include "music_player.h"
+
+namespace MusicEngine {
+
+    /**
+     * @class OutputMixer
+     * @brief The one output device of the process, shared by every MusicPlayer.
+     *
+     * Each playing MusicPlayer is attached as a Voice. The device callback renders every attached voice (each
+     * one from its own ring buffer, through its own DSP chain) and sums them with vectorized gain ramps, so
+     * volume and ducking changes never click. The device runs while at least one voice is attached.
+     */
+    class OutputMixer {
+    public:
+        /**
+         * @class Voice
+         * @brief One source in the mix.
+         */
+        class Voice {
+        public:
+            virtual ~Voice() = default;
+
+            /**
+             * @brief [Audio Thread] Writes exactly @p frames frames in the device format to @p output.
+             * Must not lock, allocate or wait.
+             * @return false if the block is silence only (the voice had nothing to play).
+             */
+            virtual bool render(float *output, uint32_t frames) = 0;
+
+            /**
+             * @brief [Audio Thread] Called once per device callback, around all the render() calls for it: a voice
+             * mixed through the scratch buffer is rendered in several chunks.
+             */
+            virtual void begin_block(uint32_t frames) {}
+            virtual void end_block() {}
+
+            // Control side; read by the audio thread once per block
+            std::atomic<float> volume{1.0f};
+            std::atomic<bool> ducks_others{false};
+            std::atomic<float> duck_gain{0.25f}; // Gain of the other voices while this one is audible
+
+        private:
+            friend class OutputMixer;
+            // Audio thread only
+            float applied_gain_ = 1.0f;
+            bool audible_ = false;
+        };
+
+        struct Format {
+            int sample_rate = 0;
+            int channels = 0;
+            bool operator==(const Format &) const = default;
+        };
+
+        static OutputMixer &get_instance();
+
+        OutputMixer(const OutputMixer &) = delete;
+        OutputMixer &operator=(const OutputMixer &) = delete;
+
+        /**
+         * @brief Opens the device, or reopens it if the requested settings differ and no voice is attached.
+         *
+         * While voices are playing the running device is kept as it is, so a player asking for another format
+         * gets (and must convert to) the current one.
+         *
+         * @param sample_rate Requested rate, or 0 for the device's native rate.
+         * @return The format of the open device, or std::nullopt if it couldn't be opened.
+         */
+        std::optional<Format> open(int sample_rate, int channels, LatencyProfile profile);
+
+        /**
+         * @brief The format of the open device, or std::nullopt if it isn't open. Never opens it.
+         */
+        std::optional<Format> current_format() const;
+
+        /**
+         * @brief Uses miniaudio's null backend instead of the system's audio devices: the callback is driven by a
+         * timer thread at the device rate and the output is discarded. Applies the next time the device is
+         * (re)opened, under the same conditions as a changed format.
+         */
+        void set_null_backend(bool enabled);
+
+        /**
+         * @brief Adds @p voice to the mix and starts the device if needed.
+         * @return false if the device no longer has @p format (it was reopened in the meantime) or can't start.
+         */
+        bool attach(Voice *voice, const Format &format);
+
+        /**
+         * @brief Removes @p voice. On return the audio thread no longer renders it and won't again.
+         * The device is stopped once no voice is left.
+         */
+        void detach(Voice *voice);
+
+        static constexpr size_t MAX_VOICES = 16;
+
+    private:
+        OutputMixer();
+        ~OutputMixer();
+
+        struct Impl;
+        std::unique_ptr<Impl> pimpl_;
+    };
+
+} // namespace MusicEngine
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace MusicEngine {
+
+    /**
+     * @class PcmRingBuffer
+     * @brief Wait-free single-producer/single-consumer ring of interleaved float PCM, sized in frames.
+     *
+     * The producer (decoder thread) and the consumer (audio callback) each own one index; neither side ever
+     * locks, allocates or waits. Indices count frames monotonically and are only masked when addressing the
+     * storage, so `write - read` is always the number of buffered frames.
+     *
+     * Flushing (e.g. after a seek) is requested by the producer and carried out by the consumer on its next
+     * read, so the producer never touches the read index.
+     *
+     * The producer only fills up to a look-ahead limit; the rest of the storage keeps recently played frames,
+     * so the consumer can move its read position back (or forward) within the buffered window with seek_read().
+     */
+    class PcmRingBuffer {
+    public:
+        PcmRingBuffer() = default;
+        PcmRingBuffer(const PcmRingBuffer &) = delete;
+        PcmRingBuffer &operator=(const PcmRingBuffer &) = delete;
+
+        /**
+         * @brief (Re)allocates the storage and empties the buffer.
+         * Must not be called while a producer or consumer is active.
+         * @param ahead_frames How far the producer may fill ahead of the read position, in frames.
+         * @param channels Number of interleaved channels per frame.
+         * @param history_frames Minimum number of played frames kept behind the read position for seek_read().
+         * The capacity is ahead + history rounded up to a power of two; the surplus adds to the history.
+         */
+        void reset(size_t ahead_frames, uint32_t channels, size_t history_frames = 0) {
+            const size_t capacity = std::bit_ceil(std::max<size_t>(ahead_frames + history_frames, 2));
+            if (capacity != capacity_ || channels != channels_) {
+                storage_ = std::make_unique<float[]>(capacity * channels);
+            }
+            capacity_ = capacity;
+            ahead_limit_ = std::max<size_t>(ahead_frames, 1);
+            channels_ = channels;
+            read_high_ = 0;
+            write_index_.store(0, std::memory_order_relaxed);
+            read_index_.store(0, std::memory_order_relaxed);
+            flush_index_.store(0, std::memory_order_relaxed);
+        }
+
+        size_t capacity() const { return capacity_; }
+        size_t ahead_limit() const { return ahead_limit_; }
+        uint32_t channels() const { return channels_; }
+
+        // ------------------- Producer side -------------------
+
+        /**
+         * @brief Total number of frames ever written. Frame `n` of the stream lives at position `n`.
+         */
+        uint64_t write_position() const { return write_index_.load(std::memory_order_relaxed); }
+
+        size_t writable_frames() const {
+            const size_t buffered = buffered_frames();
+            // May exceed the limit right after the consumer has moved back into its history
+            return buffered >= ahead_limit_ ? 0 : ahead_limit_ - buffered;
+        }
+
+        /**
+         * @brief Frames written but not yet consumed.
+         */
+        size_t buffered_frames() const {
+            const uint64_t write = write_index_.load(std::memory_order_relaxed);
+            const uint64_t read = read_index_.load(std::memory_order_acquire);
+            return static_cast<size_t>(write - read);
+        }
+
+        /**
+         * @brief Copies up to @p frames frames into the buffer.
+         * @return The number of frames actually written (less than requested if the buffer is full).
+         */
+        size_t write(const float *src, size_t frames) {
+            const uint64_t write = write_index_.load(std::memory_order_relaxed);
+            frames = std::min(frames, writable_frames());
+            if (frames == 0) {
+                return 0;
+            }
+            const size_t offset = static_cast<size_t>(write & (capacity_ - 1));
+            const size_t first = std::min(frames, capacity_ - offset);
+            std::memcpy(storage_.get() + offset * channels_, src, first * channels_ * sizeof(float));
+            std::memcpy(storage_.get(), src + first * channels_, (frames - first) * channels_ * sizeof(float));
+            write_index_.store(write + frames, std::memory_order_release);
+            return frames;
+        }
+
+        /**
+         * @brief Returns the contiguous writable region starting at the write index.
+         * The producer fills it in place and publishes it with commit(); this avoids staging data elsewhere.
+         * @param frames Receives the number of frames available in the region (may be less than
+         * writable_frames() when the free space wraps around the end of the storage).
+         */
+        float *write_region(size_t &frames) {
+            const uint64_t write = write_index_.load(std::memory_order_relaxed);
+            const size_t offset = static_cast<size_t>(write & (capacity_ - 1));
+            frames = std::min(writable_frames(), capacity_ - offset);
+            return storage_.get() + offset * channels_;
+        }
+
+        /**
+         * @brief Publishes @p frames frames previously written into the region returned by write_region().
+         */
+        void commit(size_t frames) {
+            write_index_.store(write_index_.load(std::memory_order_relaxed) + frames, std::memory_order_release);
+        }
+
+        /**
+         * @brief Asks the consumer to drop everything written so far.
+         * Frames written after this call are kept. The consumer applies the flush on its next read().
+         */
+        void request_flush() {
+            flush_index_.store(write_index_.load(std::memory_order_relaxed), std::memory_order_release);
+        }
+
+        // ------------------- Consumer side -------------------
+
+        /**
+         * @brief Total number of frames consumed (or flushed) so far.
+         */
+        uint64_t read_position() const { return read_index_.load(std::memory_order_relaxed); }
+
+        size_t readable_frames() const {
+            const uint64_t read = read_index_.load(std::memory_order_relaxed);
+            const uint64_t write = write_index_.load(std::memory_order_acquire);
+            return static_cast<size_t>(write - read);
+        }
+
+        /**
+         * @brief Copies up to @p frames frames out of the buffer.
+         * @param flushed Set to true if a pending flush was applied before reading.
+         * @return The number of frames actually read.
+         */
+        size_t read(float *dst, size_t frames, bool &flushed) {
+            uint64_t read = read_index_.load(std::memory_order_relaxed);
+            const uint64_t flush = flush_index_.load(std::memory_order_acquire);
+            flushed = read < flush;
+            if (flushed) {
+                read = flush;
+            }
+
+            const uint64_t write = write_index_.load(std::memory_order_acquire);
+            frames = std::min(frames, static_cast<size_t>(write - read));
+            const size_t offset = static_cast<size_t>(read & (capacity_ - 1));
+            const size_t first = std::min(frames, capacity_ - offset);
+            std::memcpy(dst, storage_.get() + offset * channels_, first * channels_ * sizeof(float));
+            std::memcpy(dst + first * channels_, storage_.get(), (frames - first) * channels_ * sizeof(float));
+            read_index_.store(read + frames, std::memory_order_release);
+            read_high_ = std::max(read_high_, read + frames);
+            return frames;
+        }
+
+        /**
+         * @brief Moves the read position to @p position if the frame there is still in the buffer.
+         *
+         * Valid targets are frames not yet consumed and played frames that haven't been overwritten yet (at
+         * least history_frames of them). Fails while a flush is pending, since everything before it is stale.
+         *
+         * @param limit Exclusive upper bound for the target, e.g. where another track starts.
+         * @return true if the read position was moved.
+         */
+        bool seek_read(uint64_t position, uint64_t limit = UINT64_MAX) {
+            const uint64_t read = read_index_.load(std::memory_order_relaxed);
+            if (read < flush_index_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            // The producer never writes past (highest read position + ahead limit), so everything from there
+            // minus the capacity onwards is intact, even while a write is in progress
+            const uint64_t high = std::max(read_high_, read);
+            const uint64_t reach = high + ahead_limit_;
+            const uint64_t oldest = reach > capacity_ ? reach - capacity_ : 0;
+            const uint64_t end = std::min(write_index_.load(std::memory_order_acquire), limit);
+            if (position < oldest || position >= end) {
+                return false;
+            }
+            read_index_.store(position, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        std::unique_ptr<float[]> storage_;
+        size_t capacity_ = 0;
+        size_t ahead_limit_ = 0;
+        uint32_t channels_ = 0;
+        uint64_t read_high_ = 0; // Consumer only: the furthest the read position has ever been
+
+        // Each index lives on its own cache line so producer and consumer don't false-share
+        alignas(64) std::atomic<uint64_t> write_index_{0};
+        alignas(64) std::atomic<uint64_t> read_index_{0};
+        alignas(64) std::atomic<uint64_t> flush_index_{0};
+    };
+
+} // namespace MusicEngine
@@ -0,0 +1,221 @@
+#include "playback_telemetry.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <iterator>
+
+#include "spdlog/spdlog.h"
+
+namespace MusicEngine {
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "telemetry is recorded from the audio callback");
+
+    void TimingHistogram::record(int64_t duration_ns) {
+        const uint64_t ns = static_cast<uint64_t>(std::max<int64_t>(duration_ns, 0));
+        // Smallest bucket whose bound, 2^i µs, is at least the duration rounded up to whole microseconds
+        const uint64_t us = (ns + 999) / 1000;
+        const size_t bucket = std::min<size_t>(us <= 1 ? 0 : std::bit_width(us - 1), BUCKETS - 1);
+        buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+        total_ns_.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t max = max_ns_.load(std::memory_order_relaxed);
+        while (ns > max && !max_ns_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    void TimingHistogram::reset() {
+        for (auto &bucket : buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        total_ns_.store(0, std::memory_order_relaxed);
+        max_ns_.store(0, std::memory_order_relaxed);
+    }
+
+    TimingStats TimingHistogram::snapshot() const {
+        TimingStats stats;
+        stats.bucket_bounds_us.reserve(BUCKETS - 1);
+        stats.cumulative_counts.reserve(BUCKETS - 1);
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            cumulative += buckets_[i].load(std::memory_order_relaxed);
+            if (i + 1 < BUCKETS) { // The last bucket is the overflow, +Inf
+                stats.bucket_bounds_us.push_back(static_cast<double>(uint64_t{1} << i));
+                stats.cumulative_counts.push_back(cumulative);
+            }
+        }
+        stats.count = cumulative;
+        stats.total_us = static_cast<double>(total_ns_.load(std::memory_order_relaxed)) / 1000.0;
+        stats.max_us = static_cast<double>(max_ns_.load(std::memory_order_relaxed)) / 1000.0;
+        stats.mean_us = stats.count > 0 ? stats.total_us / static_cast<double>(stats.count) : 0.0;
+
+        const auto percentile = [&](double q) {
+            const double rank = q * static_cast<double>(stats.count);
+            for (size_t i = 0; i < stats.cumulative_counts.size(); ++i) {
+                if (static_cast<double>(stats.cumulative_counts[i]) >= rank) {
+                    return std::min(stats.bucket_bounds_us[i], stats.max_us);
+                }
+            }
+            return stats.max_us;
+        };
+        if (stats.count > 0) {
+            stats.p50_us = percentile(0.5);
+            stats.p99_us = percentile(0.99);
+        }
+        return stats;
+    }
+
+    void PlaybackTelemetry::reset() {
+        for (TimingHistogram *histogram : {&decoder.read, &decoder.decode, &decoder.resample, &enqueue, &callback,
+                                           &callback_jitter, &seek_latency, &time_to_first_audio}) {
+            histogram->reset();
+        }
+        underruns.store(0, std::memory_order_relaxed);
+        underrun_frames.store(0, std::memory_order_relaxed);
+    }
+
+    PlaybackStats PlaybackTelemetry::snapshot(int sample_rate) const {
+        const double rate = sample_rate > 0 ? static_cast<double>(sample_rate) : 1.0;
+        PlaybackStats stats;
+        stats.underruns = underruns.load(std::memory_order_relaxed);
+        stats.underrun_secs = static_cast<double>(underrun_frames.load(std::memory_order_relaxed)) / rate;
+        stats.buffer_target_secs = static_cast<double>(buffer_target_frames.load(std::memory_order_relaxed)) / rate;
+        stats.read = decoder.read.snapshot();
+        stats.decode = decoder.decode.snapshot();
+        stats.resample = decoder.resample.snapshot();
+        stats.enqueue = enqueue.snapshot();
+        stats.callback = callback.snapshot();
+        stats.callback_jitter = callback_jitter.snapshot();
+        stats.seek_latency = seek_latency.snapshot();
+        stats.time_to_first_audio = time_to_first_audio.snapshot();
+        return stats;
+    }
+
+    // ------------------- Export -------------------
+
+    namespace {
+
+        std::string escape(std::string_view value) {
+            std::string escaped;
+            escaped.reserve(value.size());
+            for (const char c : value) {
+                switch (c) {
+                    case '\\':
+                        escaped += "\\\\";
+                        break;
+                    case '"':
+                        escaped += "\\\"";
+                        break;
+                    case '\n':
+                        escaped += "\\n";
+                        break;
+                    default:
+                        // \u is JSON only; control characters aren't expected in a Prometheus label
+                        if (static_cast<unsigned char>(c) < 0x20) {
+                            fmt::format_to(std::back_inserter(escaped), "\\u{:04x}", static_cast<int>(c));
+                        } else {
+                            escaped += c;
+                        }
+                }
+            }
+            return escaped;
+        }
+
+        class PrometheusWriter {
+        public:
+            explicit PrometheusWriter(std::string_view player_label) :
+                player_(player_label.empty() ? std::string() : fmt::format("player=\"{}\"", escape(player_label))) {}
+
+            void header(std::string_view name, std::string_view type, std::string_view help) {
+                fmt::format_to(std::back_inserter(out_), "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+            }
+
+            void sample(std::string_view name, double value) {
+                fmt::format_to(std::back_inserter(out_), "{}{} {}\n", name, braces(player_), value);
+            }
+
+            // Buckets, sum and count of one histogram; durations in seconds, as Prometheus expects
+            void histogram(std::string_view name, const TimingStats &stats, std::string_view stage = {}) {
+                std::string labels = player_;
+                if (!stage.empty()) {
+                    labels += fmt::format("{}stage=\"{}\"", labels.empty() ? "" : ",", stage);
+                }
+                const std::string prefix = labels.empty() ? labels : labels + ",";
+                for (size_t i = 0; i < stats.bucket_bounds_us.size(); ++i) {
+                    fmt::format_to(std::back_inserter(out_), "{}_bucket{{{}le=\"{}\"}} {}\n", name, prefix,
+                                   stats.bucket_bounds_us[i] / 1e6, stats.cumulative_counts[i]);
+                }
+                fmt::format_to(std::back_inserter(out_), "{}_bucket{{{}le=\"+Inf\"}} {}\n", name, prefix, stats.count);
+                fmt::format_to(std::back_inserter(out_), "{}_sum{} {}\n", name, braces(labels), stats.total_us / 1e6);
+                fmt::format_to(std::back_inserter(out_), "{}_count{} {}\n", name, braces(labels), stats.count);
+            }
+
+            std::string take() { return std::move(out_); }
+
+        private:
+            static std::string braces(const std::string &labels) {
+                return labels.empty() ? labels : "{" + labels + "}";
+            }
+
+            std::string player_;
+            std::string out_;
+        };
+
+        void append_json(std::string &out, std::string_view key, const TimingStats &stats) {
+            fmt::format_to(std::back_inserter(out),
+                           ",\"{}\":{{\"count\":{},\"total_us\":{},\"mean_us\":{},\"max_us\":{},\"p50_us\":{},"
+                           "\"p99_us\":{},\"buckets\":[",
+                           key, stats.count, stats.total_us, stats.mean_us, stats.max_us, stats.p50_us, stats.p99_us);
+            for (size_t i = 0; i < stats.bucket_bounds_us.size(); ++i) {
+                fmt::format_to(std::back_inserter(out), "{}{{\"le_us\":{},\"count\":{}}}", i > 0 ? "," : "",
+                               stats.bucket_bounds_us[i], stats.cumulative_counts[i]);
+            }
+            out += "]}";
+        }
+
+    } // namespace
+
+    std::string format_prometheus(const PlaybackStats &stats, std::string_view player_label) {
+        PrometheusWriter writer(player_label);
+        writer.header("musicengine_underruns_total", "counter", "Callbacks that ran out of decoded audio mid-track.");
+        writer.sample("musicengine_underruns_total", static_cast<double>(stats.underruns));
+        writer.header("musicengine_underrun_seconds_total", "counter", "Silence output because of underruns.");
+        writer.sample("musicengine_underrun_seconds_total", stats.underrun_secs);
+        writer.header("musicengine_buffered_seconds", "gauge", "Decoded audio waiting in the playback buffer.");
+        writer.sample("musicengine_buffered_seconds", stats.buffered_secs);
+        writer.header("musicengine_buffer_target_seconds", "gauge", "How far ahead the decoder fills the buffer.");
+        writer.sample("musicengine_buffer_target_seconds", stats.buffer_target_secs);
+
+        writer.header("musicengine_stage_duration_seconds", "histogram", "Time spent in each decoding stage.");
+        writer.histogram("musicengine_stage_duration_seconds", stats.read, "read");
+        writer.histogram("musicengine_stage_duration_seconds", stats.decode, "decode");
+        writer.histogram("musicengine_stage_duration_seconds", stats.resample, "resample");
+        writer.histogram("musicengine_stage_duration_seconds", stats.enqueue, "enqueue");
+        writer.header("musicengine_callback_duration_seconds", "histogram", "Time spent in each audio callback.");
+        writer.histogram("musicengine_callback_duration_seconds", stats.callback);
+        writer.header("musicengine_callback_jitter_seconds", "histogram",
+                      "Deviation of the time between audio callbacks from the device period.");
+        writer.histogram("musicengine_callback_jitter_seconds", stats.callback_jitter);
+        writer.header("musicengine_seek_latency_seconds", "histogram", "Time from seek() to audio at the target.");
+        writer.histogram("musicengine_seek_latency_seconds", stats.seek_latency);
+        writer.header("musicengine_time_to_first_audio_seconds", "histogram", "Time from play() to the first audio.");
+        writer.histogram("musicengine_time_to_first_audio_seconds", stats.time_to_first_audio);
+        return writer.take();
+    }
+
+    std::string format_json(const PlaybackStats &stats, std::string_view player_label) {
+        std::string out = fmt::format("{{\"player\":\"{}\",\"underruns\":{},\"underrun_secs\":{},\"buffered_secs\":{},"
+                                      "\"buffer_target_secs\":{}",
+                                      escape(player_label), stats.underruns, stats.underrun_secs, stats.buffered_secs,
+                                      stats.buffer_target_secs);
+        append_json(out, "read", stats.read);
+        append_json(out, "decode", stats.decode);
+        append_json(out, "resample", stats.resample);
+        append_json(out, "enqueue", stats.enqueue);
+        append_json(out, "callback", stats.callback);
+        append_json(out, "callback_jitter", stats.callback_jitter);
+        append_json(out, "seek_latency", stats.seek_latency);
+        append_json(out, "time_to_first_audio", stats.time_to_first_audio);
+        out += "}";
+        return out;
+    }
+
+} // namespace MusicEngine
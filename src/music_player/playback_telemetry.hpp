@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "music_player.h"
+
+namespace MusicEngine {
+
+    /**
+     * @class TimingHistogram
+     * @brief Lock-free histogram of durations, with power-of-two microsecond buckets.
+     *
+     * record() is a few relaxed atomic operations and may be called from any number of threads at once,
+     * the audio callback included. snapshot() may run concurrently with it; every counter is read atomically,
+     * but not all of them at the same instant.
+     */
+    class TimingHistogram {
+    public:
+        static constexpr size_t BUCKETS = 24; // 1 µs up to 2^22 µs (about 4 s), then one overflow bucket
+
+        static int64_t now_ns() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+        }
+
+        void record(int64_t duration_ns);
+        void record_since(int64_t start_ns) { record(now_ns() - start_ns); }
+        void reset();
+        TimingStats snapshot() const;
+
+    private:
+        std::array<std::atomic<uint64_t>, BUCKETS> buckets_{};
+        std::atomic<uint64_t> total_ns_{0};
+        std::atomic<uint64_t> max_ns_{0};
+    };
+
+    /**
+     * @struct DecoderTimings
+     * @brief Stage timings an AudioDecoder records while it has been given them (see AudioDecoder::set_timings()).
+     */
+    struct DecoderTimings {
+        TimingHistogram read;
+        TimingHistogram decode;
+        TimingHistogram resample;
+
+        /**
+         * @brief Times one stage until it goes out of scope; does nothing if @p timings is nullptr.
+         */
+        class Scope {
+        public:
+            Scope(DecoderTimings *timings, TimingHistogram DecoderTimings::*stage) :
+                histogram_(timings ? &(timings->*stage) : nullptr),
+                start_ns_(histogram_ ? TimingHistogram::now_ns() : 0) {}
+            ~Scope() {
+                if (histogram_) {
+                    histogram_->record_since(start_ns_);
+                }
+            }
+
+            Scope(const Scope &) = delete;
+            Scope &operator=(const Scope &) = delete;
+
+        private:
+            TimingHistogram *histogram_;
+            int64_t start_ns_;
+        };
+    };
+
+    /**
+     * @struct PlaybackTelemetry
+     * @brief Everything a MusicPlayer measures about its pipeline; the raw form of PlaybackStats.
+     *
+     * Written by the decoder thread, segment workers, the prepare thread and the audio callback, all without locks.
+     */
+    struct PlaybackTelemetry {
+        DecoderTimings decoder;
+        TimingHistogram enqueue;
+        TimingHistogram callback;
+        TimingHistogram callback_jitter;
+        TimingHistogram seek_latency;
+        TimingHistogram time_to_first_audio;
+        std::atomic<uint64_t> underruns{0};
+        std::atomic<uint64_t> underrun_frames{0};
+        std::atomic<uint64_t> buffer_target_frames{0};
+
+        void reset();
+
+        /**
+         * @brief Fills in everything but the buffer level, which the player reads from its ring.
+         */
+        PlaybackStats snapshot(int sample_rate) const;
+    };
+
+    /**
+     * @brief Formats @p stats in the Prometheus text exposition format. A non-empty @p player_label is added to
+     * every sample as `player="..."`.
+     */
+    std::string format_prometheus(const PlaybackStats &stats, std::string_view player_label);
+
+    /**
+     * @brief Formats @p stats as one JSON object.
+     */
+    std::string format_json(const PlaybackStats &stats, std::string_view player_label);
+
+} // namespace MusicEngine
@@ -0,0 +1,208 @@
+#include "seek_index.hpp"
+#include "media_input.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/spdlog.h"
+
+namespace MusicEngine {
+
+    // ------------------- SeekIndex -------------------
+
+    std::shared_ptr<const SeekIndex> SeekIndex::build(const std::filesystem::path &file_path,
+                                                      const std::atomic<bool> &cancel) {
+        // Every packet is read once, front to back; the input outlives the format context
+        std::unique_ptr<MediaInput> input;
+        AVFormatContext *format_ctx = nullptr;
+        if (open_format_input(&format_ctx, file_path, MediaInput::Access::Playback, input) != 0) {
+            return nullptr;
+        }
+        // Same stream selection as AudioDecoder, so the stream index matches
+        if (avformat_find_stream_info(format_ctx, nullptr) < 0 ||
+            (format_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK)) {
+            avformat_close_input(&format_ctx);
+            return nullptr;
+        }
+        const int stream_index = av_find_best_stream(format_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+        if (stream_index < 0) {
+            avformat_close_input(&format_ctx);
+            return nullptr;
+        }
+
+        auto index = std::make_shared<SeekIndex>();
+        index->stream_index_ = stream_index;
+        const AVRational time_base = format_ctx->streams[stream_index]->time_base;
+        const int64_t interval = av_rescale_q(static_cast<int64_t>(INTERVAL_SECS * AV_TIME_BASE), {1, AV_TIME_BASE},
+                                              time_base);
+
+        AVPacket *packet = av_packet_alloc();
+        while (!cancel && av_read_frame(format_ctx, packet) >= 0) {
+            if (packet->stream_index == stream_index && packet->pos >= 0) {
+                const int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+                if (pts != AV_NOPTS_VALUE &&
+                    (index->entries_.empty() || pts - index->entries_.back().pts >= interval)) {
+                    index->entries_.push_back({pts, packet->pos});
+                }
+            }
+            av_packet_unref(packet);
+        }
+        av_packet_free(&packet);
+        avformat_close_input(&format_ctx);
+
+        if (cancel || index->entries_.empty()) {
+            return nullptr;
+        }
+        return index;
+    }
+
+    const SeekIndex::Entry *SeekIndex::find(int64_t pts) const {
+        auto it = std::upper_bound(entries_.begin(), entries_.end(), pts,
+                                   [](int64_t value, const Entry &entry) { return value < entry.pts; });
+        return it == entries_.begin() ? nullptr : &*(it - 1);
+    }
+
+    // ------------------- SeekIndexCache -------------------
+
+    struct SeekIndexCache::Impl {
+        struct CachedIndex {
+            std::shared_ptr<const SeekIndex> index;
+            std::filesystem::file_time_type modified;
+            uintmax_t size = 0;
+        };
+
+        std::mutex mutex_;
+        std::condition_variable cond_var_;
+        std::unordered_map<std::string, CachedIndex> cache_;
+        std::deque<std::string> insertion_order_; // Oldest first, for eviction
+        std::deque<std::filesystem::path> queue_;
+        std::string building_;
+        std::atomic<bool> stop_requested_{false};
+        std::thread worker_;
+        std::shared_ptr<spdlog::logger> logger_;
+
+        static constexpr size_t MAX_ENTRIES = 64;
+
+        Impl() {
+            logger_ = spdlog::stdout_color_mt("SeekIndex");
+            logger_->set_level(spdlog::level::info);
+        }
+
+        static bool stat_file(const std::filesystem::path &path, std::filesystem::file_time_type &modified,
+                              uintmax_t &size) {
+            std::error_code ec;
+            modified = std::filesystem::last_write_time(path, ec);
+            if (ec) {
+                return false;
+            }
+            size = std::filesystem::file_size(path, ec);
+            return !ec;
+        }
+
+        void worker_loop();
+    };
+
+    SeekIndexCache &SeekIndexCache::get_instance() {
+        static SeekIndexCache instance;
+        return instance;
+    }
+
+    SeekIndexCache::SeekIndexCache() : pimpl_(std::make_unique<Impl>()) {}
+
+    SeekIndexCache::~SeekIndexCache() {
+        pimpl_->stop_requested_ = true;
+        pimpl_->cond_var_.notify_all();
+        if (pimpl_->worker_.joinable()) {
+            pimpl_->worker_.join();
+        }
+    }
+
+    std::shared_ptr<const SeekIndex> SeekIndexCache::find(const std::filesystem::path &file_path) {
+        std::filesystem::file_time_type modified;
+        uintmax_t size = 0;
+        if (!Impl::stat_file(file_path, modified, size)) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+        auto it = pimpl_->cache_.find(file_path.string());
+        if (it == pimpl_->cache_.end() || it->second.modified != modified || it->second.size != size) {
+            return nullptr;
+        }
+        return it->second.index;
+    }
+
+    void SeekIndexCache::request(const std::filesystem::path &file_path) {
+        if (find(file_path)) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(pimpl_->mutex_);
+        const std::string key = file_path.string();
+        if (pimpl_->building_ == key ||
+            std::find(pimpl_->queue_.begin(), pimpl_->queue_.end(), file_path) != pimpl_->queue_.end()) {
+            return;
+        }
+        pimpl_->queue_.push_back(file_path);
+
+        // The worker is started on first use, so programs that never play anything don't get a thread
+        if (!pimpl_->worker_.joinable()) {
+            pimpl_->worker_ = std::thread(&Impl::worker_loop, pimpl_.get());
+        }
+        pimpl_->cond_var_.notify_one();
+    }
+
+    void SeekIndexCache::Impl::worker_loop() {
+        while (true) {
+            std::filesystem::path path;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_var_.wait(lock, [this] { return stop_requested_ || !queue_.empty(); });
+                if (stop_requested_) {
+                    return;
+                }
+                path = std::move(queue_.front());
+                queue_.pop_front();
+                building_ = path.string();
+            }
+
+            // Stat before scanning, so a file modified during the scan is rebuilt on the next request
+            std::filesystem::file_time_type modified;
+            uintmax_t size = 0;
+            std::shared_ptr<const SeekIndex> index;
+            if (stat_file(path, modified, size)) {
+                index = SeekIndex::build(path, stop_requested_);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            building_.clear();
+            if (!index) {
+                logger_->debug("No seek index for {}", path.string());
+                continue;
+            }
+            logger_->debug("Built seek index for {} ({} entries)", path.string(), index->size());
+
+            const std::string key = path.string();
+            if (cache_.find(key) == cache_.end()) {
+                insertion_order_.push_back(key);
+                if (insertion_order_.size() > MAX_ENTRIES) {
+                    cache_.erase(insertion_order_.front());
+                    insertion_order_.pop_front();
+                }
+            }
+            cache_[key] = {std::move(index), modified, size};
+        }
+    }
+
+} // namespace MusicEngine
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace MusicEngine {
+
+    /**
+     * @class SeekIndex
+     * @brief Maps timestamps of a file's audio stream to the byte offsets of the packets that carry them.
+     *
+     * Built by reading every packet once (without decoding), so it also covers containers whose own seeking is
+     * approximate or linear, such as VBR MP3 without a TOC, ADTS AAC or Ogg. Immutable once built.
+     */
+    class SeekIndex {
+    public:
+        struct Entry {
+            int64_t pts; // In the stream's time base
+            int64_t pos; // Byte offset of the packet in the file
+        };
+
+        /**
+         * @brief Scans @p file_path and records one entry per INTERVAL_SECS of audio.
+         * @param cancel Checked between packets; the build is abandoned when it becomes true.
+         * @return The index, or nullptr if the file couldn't be read or the scan was cancelled.
+         */
+        static std::shared_ptr<const SeekIndex> build(const std::filesystem::path &file_path,
+                                                      const std::atomic<bool> &cancel);
+
+        /**
+         * @brief Returns the last entry at or before @p pts, or nullptr if @p pts precedes the first entry.
+         */
+        const Entry *find(int64_t pts) const;
+
+        int stream_index() const { return stream_index_; }
+        size_t size() const { return entries_.size(); }
+
+        static constexpr double INTERVAL_SECS = 0.25;
+
+    private:
+        std::vector<Entry> entries_;
+        int stream_index_ = -1;
+    };
+
+    /**
+     * @class SeekIndexCache
+     * @brief Process-wide cache of seek indexes, built one at a time on a background thread.
+     */
+    class SeekIndexCache {
+    public:
+        static SeekIndexCache &get_instance();
+
+        SeekIndexCache(const SeekIndexCache &) = delete;
+        SeekIndexCache &operator=(const SeekIndexCache &) = delete;
+
+        /**
+         * @brief Returns the index of @p file_path if it has been built, or nullptr.
+         * An index whose file has been modified since is treated as missing.
+         */
+        std::shared_ptr<const SeekIndex> find(const std::filesystem::path &file_path);
+
+        /**
+         * @brief Queues a background build for @p file_path unless it is already cached or queued.
+         */
+        void request(const std::filesystem::path &file_path);
+
+    private:
+        SeekIndexCache();
+        ~SeekIndexCache();
+
+        struct Impl;
+        std::unique_ptr<Impl> pimpl_;
+    };
+
+} // namespace MusicEngine
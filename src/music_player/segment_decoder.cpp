@@ -0,0 +1,207 @@
+#include "segment_decoder.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "audio_decoder.hpp"
+#include "rt_safety.h"
+
+namespace MusicEngine {
+
+    SegmentDecoder::SegmentDecoder(std::shared_ptr<spdlog::logger> logger, Opener opener, int workers,
+                                   int sample_rate, int channels) :
+        logger_(std::move(logger)), opener_(std::move(opener)), sample_rate_(sample_rate), channels_(channels),
+        segment_frames_(static_cast<int64_t>(SEGMENT_SECS * sample_rate)),
+        max_segments_(static_cast<size_t>(workers) + 1) {
+        free_buffers_.reserve(max_segments_); // release_front() recycles buffers without growing the pool
+        workers_.reserve(static_cast<size_t>(workers));
+        for (int i = 0; i < workers; ++i) {
+            workers_.emplace_back(&SegmentDecoder::worker_loop, this);
+        }
+    }
+
+    SegmentDecoder::~SegmentDecoder() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+            ++generation_; // Makes workers abandon the segment they are decoding
+        }
+        worker_cond_var_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    void SegmentDecoder::start(double position_secs) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++generation_;
+            // Segments still being decoded are recycled by their workers once they notice
+            segments_.clear();
+            base_frame_ = std::llround(std::max(0.0, position_secs) * sample_rate_);
+            next_index_ = 0;
+            end_index_ = INT64_MAX;
+            read_offset_ = 0;
+            eof_ = false;
+        }
+        worker_cond_var_.notify_all();
+    }
+
+    // [Worker Thread] Claims segments in track order and decodes them with a decoder of its own
+    void SegmentDecoder::worker_loop() {
+        AudioDecoder decoder(logger_);
+        bool opened = false;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            worker_cond_var_.wait(lock, [this] {
+                return quit_ || (next_index_ < end_index_ && segments_.size() < max_segments_);
+            });
+            if (quit_) {
+                return;
+            }
+            auto segment = std::make_shared<Segment>();
+            segment->index = next_index_++;
+            if (!free_buffers_.empty()) {
+                segment->pcm = std::move(free_buffers_.back());
+                free_buffers_.pop_back();
+            }
+            segments_.push_back(segment);
+            const uint64_t generation = generation_;
+            const int64_t first_frame = base_frame_ + segment->index * segment_frames_;
+            lock.unlock();
+
+            if (!opened) {
+                opened = opener_(decoder);
+            }
+            if (opened) {
+                decode_segment(decoder, *segment, first_frame, generation);
+            } else {
+                lock.lock();
+                segment->done = true;
+                segment->failed = true;
+                lock.unlock();
+                reader_cond_var_.notify_one();
+            }
+
+            lock.lock();
+            if (generation_ != generation && free_buffers_.size() < max_segments_) {
+                free_buffers_.push_back(std::move(segment->pcm));
+            }
+        }
+    }
+
+    void SegmentDecoder::decode_segment(AudioDecoder &decoder, Segment &segment, int64_t first_frame,
+                                        uint64_t generation) {
+        const double start_secs = static_cast<double>(first_frame) / sample_rate_;
+
+        // Room for one read() past the end of the segment, so the last read never comes up short
+        const int64_t capacity = segment_frames_ + decoder.max_read_frames();
+        segment.pcm.resize(static_cast<size_t>(capacity) * channels_);
+        float *pcm = segment.pcm.data();
+
+        bool ok = decoder.seek_to_frame(first_frame);
+        bool past_end = false;
+        if (!ok && decoder.duration() > 0.0 && start_secs >= decoder.duration()) {
+            ok = true; // Starts past the end of the track: an empty last segment
+            past_end = true;
+        }
+
+        int64_t filled = 0;
+        const auto abandoned = [&] { return generation_.load(std::memory_order_relaxed) != generation; };
+        while (ok && !past_end && filled < segment_frames_ && !abandoned()) {
+            const int got = decoder.read(pcm + filled * channels_, static_cast<int>(capacity - filled));
+            if (got < 0) {
+                ok = false;
+                break;
+            }
+            if (got == 0) {
+                break; // End of the track
+            }
+            filled += got;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                segment.available = std::min(filled, segment_frames_);
+            }
+            reader_cond_var_.notify_one();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (generation_ != generation) {
+                return;
+            }
+            segment.available = std::min(filled, segment_frames_);
+            segment.done = true;
+            segment.failed = !ok;
+            if (ok && filled < segment_frames_) {
+                end_index_ = std::min(end_index_, segment.index + 1);
+            }
+        }
+        reader_cond_var_.notify_one();
+        if (!ok) {
+            logger_->error("Failed to decode segment {} at {:.1f}s", segment.index, start_secs);
+        }
+    }
+
+    int SegmentDecoder::read(float *dst, int max_frames) {
+        int produced = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (produced < max_frames && !eof_) {
+            const auto at_end = [this] {
+                return (segments_.empty() ? next_index_ : segments_.front()->index) >= end_index_;
+            };
+            const auto ready = [this] {
+                return !segments_.empty() &&
+                       (segments_.front()->available > read_offset_ || segments_.front()->done);
+            };
+            if (at_end()) {
+                eof_ = true;
+                break;
+            }
+            if (!ready()) {
+                if (produced > 0) {
+                    break; // Hand out what we have rather than wait
+                }
+                reader_cond_var_.wait(lock, [&] { return ready() || at_end(); });
+                continue;
+            }
+
+            Segment &front = *segments_.front();
+            if (front.available > read_offset_) {
+                // Workers only append behind `available`, so the copy doesn't need the lock
+                const int64_t count = std::min<int64_t>(max_frames - produced, front.available - read_offset_);
+                const float *src = front.pcm.data() + read_offset_ * channels_;
+                lock.unlock();
+                std::memcpy(dst + static_cast<size_t>(produced) * channels_, src,
+                            static_cast<size_t>(count) * channels_ * sizeof(float));
+                lock.lock();
+                read_offset_ += count;
+                produced += static_cast<int>(count);
+                continue;
+            }
+
+            if (front.failed) {
+                return produced > 0 ? produced : -1;
+            }
+            release_front();
+        }
+        return produced;
+    }
+
+    // Called with mutex_ held, once the front segment is done and fully read
+    void SegmentDecoder::release_front() {
+        if (free_buffers_.size() < max_segments_) {
+            free_buffers_.push_back(std::move(segments_.front()->pcm));
+        }
+        {
+            // The sample buffer is recycled above; what is freed here is the segment's bookkeeping
+            MUSICENGINE_REALTIME_EXEMPT("SegmentDecoder segment release");
+            segments_.pop_front();
+        }
+        read_offset_ = 0;
+        worker_cond_var_.notify_one();
+    }
+
+} // namespace MusicEngine
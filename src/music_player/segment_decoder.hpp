@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+namespace MusicEngine {
+
+    class AudioDecoder;
+
+    /**
+     * @class SegmentDecoder
+     * @brief Decodes one track on several threads at once by splitting it into consecutive segments.
+     *
+     * Each worker owns its own AudioDecoder on the same track, seeks it to the start of the next unclaimed
+     * segment with AudioDecoder::seek_to_frame() and decodes the segment into a buffer of its own. read() hands
+     * the segments out in order, each one as soon as its first samples are decoded, so starting playback is no
+     * slower than with a single decoder. At most one segment more than there are workers is held at a time.
+     *
+     * Used by AudioDecoder for long tracks (see AudioDecoder::set_parallel_segments()). read() and start() are
+     * called by one thread, the owning decoder's.
+     */
+    class SegmentDecoder {
+    public:
+        /**
+         * @brief Opens the track in a worker's decoder. Called once per worker, on the worker's thread.
+         */
+        using Opener = std::function<bool(AudioDecoder &)>;
+
+        SegmentDecoder(std::shared_ptr<spdlog::logger> logger, Opener opener, int workers, int sample_rate,
+                       int channels);
+        ~SegmentDecoder();
+
+        SegmentDecoder(const SegmentDecoder &) = delete;
+        SegmentDecoder &operator=(const SegmentDecoder &) = delete;
+
+        /**
+         * @brief Drops everything decoded so far and starts decoding at @p position_secs.
+         */
+        void start(double position_secs);
+
+        /**
+         * @brief Copies up to @p max_frames decoded frames into @p dst.
+         *
+         * Waits only if nothing at all is decoded yet at the read position.
+         * @return The number of frames written, 0 at the end of the track, or a negative value on an error.
+         */
+        int read(float *dst, int max_frames);
+
+        bool eof() const { return eof_; }
+
+        static constexpr double SEGMENT_SECS = 10.0;
+
+    private:
+        struct Segment {
+            int64_t index = 0;
+            std::vector<float> pcm;
+            int64_t available = 0; // Decoded frames at the front of pcm; guarded by mutex_
+            bool done = false;
+            bool failed = false;
+        };
+
+        void worker_loop();
+        // Decodes @p segment, whose first frame is @p first_frame, until it is full, the track ends or start()
+        // abandons it
+        void decode_segment(AudioDecoder &decoder, Segment &segment, int64_t first_frame, uint64_t generation);
+        void release_front();
+
+        std::shared_ptr<spdlog::logger> logger_;
+        Opener opener_;
+        const int sample_rate_;
+        const int channels_;
+        const int64_t segment_frames_;
+        const size_t max_segments_;
+
+        std::mutex mutex_;
+        std::condition_variable worker_cond_var_; // A segment can be claimed, or quit_
+        std::condition_variable reader_cond_var_; // The front segment made progress
+        std::deque<std::shared_ptr<Segment>> segments_; // In track order; the front one is being read
+        std::vector<std::vector<float>> free_buffers_;
+        std::atomic<uint64_t> generation_{0}; // Bumped by start(); workers drop segments of older generations
+        int64_t base_frame_ = 0;              // Output frame at which segment 0 starts
+        int64_t next_index_ = 0;              // Next segment to hand to a worker
+        int64_t end_index_ = INT64_MAX;       // One past the last segment, once a short one has been seen
+        bool quit_ = false;
+
+        // Reader side
+        int64_t read_offset_ = 0; // Frames of the front segment already read
+        bool eof_ = false;
+
+        std::vector<std::thread> workers_;
+    };
+
+} // namespace MusicEngine